@@ -2,6 +2,78 @@
 
 pub const MAX_SSL_BUF_SIZE: usize = 4096;
 
+/// Layout version of the maps pinned across agent restarts. Bump it whenever the key or
+/// value type of a pinned map changes, so that a new agent does not adopt old tables.
+pub const MAP_ABI_VERSION: u32 = 1;
+
+/// Upper bound of shards for high-volume rings (SSL, block I/O).
+pub const MAX_RING_SHARDS: u32 = 8;
+
+/// Shard of a ring that is sharded by connection rather than by CPU. Every event of a
+/// connection lands in the same shard, so the consumer sees them in order even though
+/// it drains the shards one after another.
+#[inline(always)]
+pub fn conn_shard(pid: u32, conn_id: u64, shards: u32) -> u32 {
+    if shards <= 1 {
+        return 0;
+    }
+    // `conn_id` is a heap address: mix the high bits in, the low ones are mostly alignment
+    let hash = (conn_id ^ ((pid as u64) << 32)).wrapping_mul(0x9E37_79B9_7F4A_7C15);
+    ((hash >> 32) as u32) % shards
+}
+
+/// Identifies each event ring for per-ring accounting (e.g. drop counters).
+#[repr(u32)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq, Hash)]
+pub enum RingId {
+    BlockIo = 0,
+    Network = 1,
+    GpuOpen = 2,
+    GpuClose = 3,
+    Ssl = 4,
+    Exec = 5,
+}
+
+pub const RING_COUNT: u32 = 6;
+
+/// Consumer wakeup policy of an event ring, stored in `RING_WAKEUP` at index `RingId`.
+/// A zero watermark wakes the consumer on every event.
+#[repr(C)]
+#[derive(Clone, Copy, Default)]
+pub struct RingWakeupConfig {
+    pub watermark_bytes: u64,
+    pub max_delay_ns: u64,
+}
+
+#[cfg(feature = "user")]
+unsafe impl aya::Pod for RingWakeupConfig {}
+
+impl RingId {
+    pub const ALL: [RingId; RING_COUNT as usize] = [
+        RingId::BlockIo,
+        RingId::Network,
+        RingId::GpuOpen,
+        RingId::GpuClose,
+        RingId::Ssl,
+        RingId::Exec,
+    ];
+
+    pub fn from_u32(value: u32) -> Option<Self> {
+        Self::ALL.get(value as usize).copied()
+    }
+
+    pub fn name(&self) -> &'static str {
+        match self {
+            RingId::BlockIo => "block_io",
+            RingId::Network => "network",
+            RingId::GpuOpen => "gpu_open",
+            RingId::GpuClose => "gpu_close",
+            RingId::Ssl => "ssl",
+            RingId::Exec => "exec",
+        }
+    }
+}
+
 #[repr(C)]
 #[derive(Clone, Copy, Default)]
 pub struct EventMetadata {
@@ -112,6 +184,8 @@ impl From<u8> for BlockIoEventType {
 pub struct BlockIoEvent {
     pub metadata: EventMetadata,
     pub dev: u32,
+    /// Keep-1-in-N rate of the ring when the event was kept: the requests it stands for
+    pub sample_rate: u32,
     pub sector: u64,
     pub nr_sector: u32,
     pub bytes: u32,
@@ -153,6 +227,10 @@ pub struct LlmEvent {
     pub buf_filled: u32,
     pub buf: [u8; MAX_SSL_BUF_SIZE],
     pub latency_ns: u64,
+    /// Address of the `SSL*` object, identifies the TLS connection within the process
+    pub conn_id: u64,
+    /// Per-connection sequence number, assigned before ring reservation so drops leave gaps
+    pub seq: u64,
     pub comm: [u8; 16],
 }
 
@@ -167,6 +245,8 @@ impl Default for LlmEvent {
             buf_filled: 0,
             buf: [0u8; MAX_SSL_BUF_SIZE],
             latency_ns: 0,
+            conn_id: 0,
+            seq: 0,
             comm: [0u8; 16],
         }
     }
@@ -175,6 +255,18 @@ impl Default for LlmEvent {
 #[cfg(feature = "user")]
 unsafe impl aya::Pod for LlmEvent {}
 
+/// Identifies a TLS connection: the `SSL*` address is only unique within a process.
+#[repr(C)]
+#[derive(Clone, Copy, Default, Debug, PartialEq, Eq, Hash)]
+pub struct ConnKey {
+    pub pid: u32,
+    pub _pad: u32,
+    pub conn_id: u64,
+}
+
+#[cfg(feature = "user")]
+unsafe impl aya::Pod for ConnKey {}
+
 /// Lightweight event emitted on sched_process_exec to trigger SSL re-discovery.
 #[repr(C)]
 #[derive(Clone, Copy, Default)]
@@ -1,29 +1,52 @@
 use aya_ebpf::{
     EbpfContext,
-    macros::{map, tracepoint},
-    maps::RingBuf,
-    programs::TracePointContext,
+    macros::{raw_tracepoint, tracepoint},
+    programs::{RawTracePointContext, TracePointContext},
 };
 use aya_log_ebpf::info;
-use honeybeepf_common::BlockIoEvent;
+use honeybeepf_common::{BlockIoEvent, RingId};
 
 use crate::probes::{HoneyBeeEvent, emit_event};
 
 const MAX_EVENT_SIZE: u32 = 1024 * 1024;
 
-#[map]
-pub static BLOCK_IO_EVENTS: RingBuf = RingBuf::with_byte_size(MAX_EVENT_SIZE, 0);
+crate::event_ring!(
+    BlockIoRing,
+    RingId::BlockIo,
+    MAX_EVENT_SIZE,
+    [
+        BLOCK_IO_EVENTS,
+        BLOCK_IO_EVENTS_1,
+        BLOCK_IO_EVENTS_2,
+        BLOCK_IO_EVENTS_3,
+        BLOCK_IO_EVENTS_4,
+        BLOCK_IO_EVENTS_5,
+        BLOCK_IO_EVENTS_6,
+        BLOCK_IO_EVENTS_7
+    ]
+);
 
 #[tracepoint]
 pub fn honeybeepf_block_io_start(ctx: TracePointContext) -> u32 {
-    info!(&ctx, "[eBPF] block_io_start tracepoint triggered");
-    emit_event::<TracePointContext, BlockIoStart>(&BLOCK_IO_EVENTS, &ctx)
+    block_io_start(&ctx)
+}
+
+/// `honeybeepf_block_io_start` as a raw tracepoint program, so it can be benchmarked with
+/// `BPF_PROG_TEST_RUN`. The test context is a `BlockIoTrace` record.
+#[raw_tracepoint(tracepoint = "block_io_start")]
+pub fn honeybeepf_block_io_start_raw(ctx: RawTracePointContext) -> u32 {
+    block_io_start(&TracePointContext::new(ctx.as_ptr()))
+}
+
+fn block_io_start(ctx: &TracePointContext) -> u32 {
+    info!(ctx, "[eBPF] block_io_start tracepoint triggered");
+    emit_event::<TracePointContext, BlockIoStart, BlockIoRing>(ctx)
 }
 
 #[tracepoint]
 pub fn honeybeepf_block_io_done(ctx: TracePointContext) -> u32 {
     info!(&ctx, "[eBPF] block_io_done tracepoint triggered");
-    emit_event::<TracePointContext, BlockIoDone>(&BLOCK_IO_EVENTS, &ctx)
+    emit_event::<TracePointContext, BlockIoDone, BlockIoRing>(&ctx)
 }
 
 #[tracepoint]
@@ -32,7 +55,7 @@ pub fn honeybeepf_block_rq_issue(ctx: TracePointContext) -> u32 {
         &ctx,
         "[eBPF] block_rq_issue tracepoint triggered (fallback)"
     );
-    emit_event::<TracePointContext, BlockIoStart>(&BLOCK_IO_EVENTS, &ctx)
+    emit_event::<TracePointContext, BlockIoStart, BlockIoRing>(&ctx)
 }
 
 #[tracepoint]
@@ -41,7 +64,7 @@ pub fn honeybeepf_block_rq_complete(ctx: TracePointContext) -> u32 {
         &ctx,
         "[eBPF] block_rq_complete tracepoint triggered (fallback)"
     );
-    emit_event::<TracePointContext, BlockIoDone>(&BLOCK_IO_EVENTS, &ctx)
+    emit_event::<TracePointContext, BlockIoDone, BlockIoRing>(&ctx)
 }
 
 #[repr(C)]
@@ -69,6 +92,10 @@ impl HoneyBeeEvent<TracePointContext> for BlockIoStart {
         self.0.metadata()
     }
 
+    fn set_sample_rate(&mut self, rate: u32) {
+        self.0.set_sample_rate(rate);
+    }
+
     fn fill(&mut self, ctx: &TracePointContext) -> Result<(), u32> {
         self.0.fill(ctx)?;
         self.0.event_type = BlockIoEventType::Start as u8;
@@ -88,6 +115,10 @@ impl HoneyBeeEvent<TracePointContext> for BlockIoDone {
         self.0.metadata()
     }
 
+    fn set_sample_rate(&mut self, rate: u32) {
+        self.0.set_sample_rate(rate);
+    }
+
     fn fill(&mut self, ctx: &TracePointContext) -> Result<(), u32> {
         self.0.fill(ctx)?;
         self.0.event_type = BlockIoEventType::Done as u8;
@@ -104,6 +135,10 @@ impl HoneyBeeEvent<TracePointContext> for BlockIoEvent {
         &mut self.metadata
     }
 
+    fn set_sample_rate(&mut self, rate: u32) {
+        self.sample_rate = rate;
+    }
+
     fn fill(&mut self, ctx: &TracePointContext) -> Result<(), u32> {
         self.init_base();
 
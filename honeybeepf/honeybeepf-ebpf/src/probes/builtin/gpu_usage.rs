@@ -1,17 +1,19 @@
 use aya_ebpf::{
     EbpfContext,
     helpers::{bpf_get_current_comm, bpf_probe_read_user_str_bytes},
-    macros::{map, tracepoint},
-    maps::{HashMap, RingBuf},
-    programs::TracePointContext,
+    macros::{map, raw_tracepoint, tracepoint},
+    maps::HashMap,
+    programs::{RawTracePointContext, TracePointContext},
+};
+use honeybeepf_common::{
+    EventMetadata, GpuCloseEvent, GpuFdInfo, GpuOpenEvent, PendingGpuOpen, RingId,
 };
-use honeybeepf_common::{EventMetadata, GpuCloseEvent, GpuFdInfo, GpuOpenEvent, PendingGpuOpen};
 
 use super::{
     gpu_utils::get_gpu_index,
     syscall_types::{SysEnterClose, SysEnterOpenat, SysExitOpenat},
 };
-use crate::probes::HoneyBeeEvent;
+use crate::probes::{HoneyBeeEvent, ring::EventRing};
 
 const MAX_EVENT_SIZE: u32 = 1024 * 1024;
 const MAX_PENDING_OPENS: u32 = 10240;
@@ -24,20 +26,29 @@ pub enum EmitGpuStatus {
     NotGpuDevice = 2,
 }
 
-#[map]
-pub static GPU_OPEN_EVENTS: RingBuf = RingBuf::with_byte_size(MAX_EVENT_SIZE, 0);
-
-#[map]
-pub static GPU_CLOSE_EVENTS: RingBuf = RingBuf::with_byte_size(MAX_EVENT_SIZE, 0);
-
-/// Map to store pending GPU opens (key: tid, value: PendingGpuOpen)
+crate::event_ring!(
+    GpuOpenRing,
+    RingId::GpuOpen,
+    MAX_EVENT_SIZE,
+    [GPU_OPEN_EVENTS]
+);
+
+crate::event_ring!(
+    GpuCloseRing,
+    RingId::GpuClose,
+    MAX_EVENT_SIZE,
+    [GPU_CLOSE_EVENTS]
+);
+
+/// Map to store pending GPU opens (key: tid, value: PendingGpuOpen).
+/// Pinned, like `GPU_FD_MAP`, so that opens and closes pair up across agent upgrades.
 #[map]
 pub static PENDING_GPU_OPENS: HashMap<u64, PendingGpuOpen> =
-    HashMap::with_max_entries(MAX_PENDING_OPENS, 0);
+    HashMap::pinned(MAX_PENDING_OPENS, 0);
 
 /// Map to track GPU file descriptors (key: pid << 32 | fd, value: GpuFdInfo)
 #[map]
-pub static GPU_FD_MAP: HashMap<u64, GpuFdInfo> = HashMap::with_max_entries(MAX_GPU_FDS, 0);
+pub static GPU_FD_MAP: HashMap<u64, GpuFdInfo> = HashMap::pinned(MAX_GPU_FDS, 0);
 
 impl HoneyBeeEvent<TracePointContext> for GpuOpenEvent {
     fn metadata(&mut self) -> &mut EventMetadata {
@@ -64,7 +75,18 @@ impl HoneyBeeEvent<TracePointContext> for GpuCloseEvent {
 /// sys_enter_openat: Check if GPU device and store pending info
 #[tracepoint]
 pub fn honeybeepf_gpu_open_enter(ctx: TracePointContext) -> u32 {
-    match try_gpu_open_enter(&ctx) {
+    gpu_open_enter(&ctx)
+}
+
+/// `honeybeepf_gpu_open_enter` as a raw tracepoint program, so it can be benchmarked with
+/// `BPF_PROG_TEST_RUN` (unsupported for tracepoints). The test context is a `SysEnterOpenat`.
+#[raw_tracepoint(tracepoint = "sys_enter")]
+pub fn honeybeepf_gpu_open_enter_raw(ctx: RawTracePointContext) -> u32 {
+    gpu_open_enter(&TracePointContext::new(ctx.as_ptr()))
+}
+
+fn gpu_open_enter(ctx: &TracePointContext) -> u32 {
+    match try_gpu_open_enter(ctx) {
         Ok(_) => EmitGpuStatus::Success as u32,
         Err(e) => e,
     }
@@ -162,11 +184,11 @@ fn try_gpu_open_exit(ctx: &TracePointContext) -> Result<(), u32> {
     let _ = GPU_FD_MAP.insert(&fd_key, &fd_info, 0);
 
     // Emit GPU open event
-    if let Some(mut slot) = GPU_OPEN_EVENTS.reserve::<GpuOpenEvent>(0) {
+    if let Some(mut slot) = GpuOpenRing::reserve::<GpuOpenEvent>() {
         let event = unsafe { &mut *slot.as_mut_ptr() };
 
         if event.fill(ctx).is_err() {
-            slot.discard(0);
+            GpuOpenRing::discard(slot);
             return Err(EmitGpuStatus::Failure as u32);
         }
 
@@ -176,7 +198,7 @@ fn try_gpu_open_exit(ctx: &TracePointContext) -> Result<(), u32> {
         event.comm = bpf_get_current_comm().unwrap_or([0u8; 16]);
         event.filename = pending.filename;
 
-        slot.submit(0);
+        GpuOpenRing::submit(slot);
     }
 
     Ok(())
@@ -185,7 +207,17 @@ fn try_gpu_open_exit(ctx: &TracePointContext) -> Result<(), u32> {
 /// sys_enter_close: Check if GPU fd and emit close event
 #[tracepoint]
 pub fn honeybeepf_gpu_close(ctx: TracePointContext) -> u32 {
-    match try_gpu_close(&ctx) {
+    gpu_close(&ctx)
+}
+
+/// `honeybeepf_gpu_close` for `BPF_PROG_TEST_RUN`. The test context is a `SysEnterClose`.
+#[raw_tracepoint(tracepoint = "sys_enter")]
+pub fn honeybeepf_gpu_close_raw(ctx: RawTracePointContext) -> u32 {
+    gpu_close(&TracePointContext::new(ctx.as_ptr()))
+}
+
+fn gpu_close(ctx: &TracePointContext) -> u32 {
+    match try_gpu_close(ctx) {
         Ok(_) => EmitGpuStatus::Success as u32,
         Err(_) => EmitGpuStatus::Success as u32, // Silent fail for non-GPU fds
     }
@@ -220,11 +252,11 @@ fn try_gpu_close(ctx: &TracePointContext) -> Result<(), u32> {
     let _ = GPU_FD_MAP.remove(&fd_key);
 
     // Emit GPU close event
-    if let Some(mut slot) = GPU_CLOSE_EVENTS.reserve::<GpuCloseEvent>(0) {
+    if let Some(mut slot) = GpuCloseRing::reserve::<GpuCloseEvent>() {
         let event = unsafe { &mut *slot.as_mut_ptr() };
 
         if event.fill(ctx).is_err() {
-            slot.discard(0);
+            GpuCloseRing::discard(slot);
             return Err(EmitGpuStatus::Failure as u32);
         }
 
@@ -232,7 +264,7 @@ fn try_gpu_close(ctx: &TracePointContext) -> Result<(), u32> {
         event.fd = fd as i32;
         event.comm = bpf_get_current_comm().unwrap_or([0u8; 16]);
 
-        slot.submit(0);
+        GpuCloseRing::submit(slot);
     }
 
     Ok(())
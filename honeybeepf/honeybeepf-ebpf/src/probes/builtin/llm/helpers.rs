@@ -5,9 +5,11 @@ use aya_ebpf::{
     },
     programs::RetProbeContext,
 };
-use honeybeepf_common::{LlmEvent, MAX_SSL_BUF_SIZE};
+use honeybeepf_common::{ConnKey, LlmEvent, MAX_SSL_BUF_SIZE};
 
-use crate::probes::builtin::llm::maps::{BUFS, READBYTES_PTRS, START_NS};
+use crate::probes::builtin::llm::maps::{
+    BUFS, CONN_SEQ, CONN_VERDICT, READBYTES_PTRS, SSL_CONNS, START_NS,
+};
 
 #[inline(always)]
 pub fn get_current_tid() -> u32 {
@@ -18,9 +20,10 @@ pub struct Session;
 
 impl Session {
     #[inline(always)]
-    pub fn start(tid: u32, buf_addr: u64, len_ptr: Option<u64>) {
+    pub fn start(tid: u32, ssl: u64, buf_addr: u64, len_ptr: Option<u64>) {
         let ts = unsafe { bpf_ktime_get_ns() };
         let _ = START_NS.insert(&tid, &ts, 0);
+        let _ = SSL_CONNS.insert(&tid, &ssl, 0);
         let _ = BUFS.insert(&tid, &buf_addr, 0);
         if let Some(lp) = len_ptr {
             let _ = READBYTES_PTRS.insert(&tid, &lp, 0);
@@ -37,14 +40,66 @@ impl Session {
         }
     }
 
+    /// Connection (`SSL*`) of the thread's in-flight call, 0 if unknown.
+    #[inline(always)]
+    pub fn conn_id(tid: u32) -> u64 {
+        unsafe { SSL_CONNS.get(&tid).copied().unwrap_or(0) }
+    }
+
     #[inline(always)]
     pub fn clear(tid: u32) {
         let _ = START_NS.remove(&tid);
+        let _ = SSL_CONNS.remove(&tid);
         let _ = BUFS.remove(&tid);
         let _ = READBYTES_PTRS.remove(&tid);
     }
 }
 
+/// Hand out the next sequence number of a connection. OpenSSL forbids concurrent use
+/// of one `SSL*`, so updates for a connection are already serialized.
+#[inline(always)]
+pub fn next_seq(pid: u32, conn_id: u64) -> u64 {
+    let key = ConnKey {
+        pid,
+        _pad: 0,
+        conn_id,
+    };
+    if let Some(seq) = CONN_SEQ.get_ptr_mut(&key) {
+        unsafe {
+            *seq += 1;
+            *seq
+        }
+    } else {
+        let _ = CONN_SEQ.insert(&key, &1, 0);
+        1
+    }
+}
+
+/// Whether userspace rejected the connection and the verdict has not expired yet.
+#[inline(always)]
+pub fn is_rejected(pid: u32, conn_id: u64) -> bool {
+    let key = ConnKey {
+        pid,
+        _pad: 0,
+        conn_id,
+    };
+    match unsafe { CONN_VERDICT.get(&key) } {
+        Some(&until) => until > unsafe { bpf_ktime_get_ns() },
+        None => false,
+    }
+}
+
+/// A handshake starts a new TLS session, which may carry another protocol.
+#[inline(always)]
+pub fn clear_verdict(pid: u32, conn_id: u64) {
+    let key = ConnKey {
+        pid,
+        _pad: 0,
+        conn_id,
+    };
+    let _ = CONN_VERDICT.remove(&key);
+}
+
 pub trait LlmEventExt {
     fn capture_data(
         &mut self,
@@ -69,7 +124,7 @@ impl LlmEventExt for LlmEvent {
         // rather than the HoneyBeeEvent trait (which uses TracePointContext/ProbeContext).
         let pid_tgid = bpf_get_current_pid_tgid();
         self.metadata.pid = (pid_tgid >> 32) as u32;
-        // Store tid in _pad for userspace per-thread stream correlation. EventMetadata is shared
+        // Store tid in _pad (streams are keyed by conn_id, the tid is informational). EventMetadata is shared
         // across all event types, so we reuse the padding field rather than adding a new field.
         self.metadata._pad = pid_tgid as u32;
         self.metadata.timestamp = unsafe { bpf_ktime_get_ns() };
@@ -1,20 +1,53 @@
 use aya_ebpf::{
     macros::map,
-    maps::{HashMap, RingBuf},
+    maps::{HashMap, LruHashMap},
 };
+use honeybeepf_common::{ConnKey, RingId};
 
+// Compile-time defaults; userspace resizes these at load time (see probes/loader.rs).
+// Per-thread and per-connection state is pinned, so SSL calls and connection sequence
+// numbers in flight carry over to the next agent on upgrades.
 pub const MAX_ENTRIES: u32 = 10240;
 pub const SSL_RINGBUF_SIZE: u32 = 8 * 1024 * 1024; // 8MB
 pub const EXEC_RINGBUF_SIZE: u32 = 64 * 1024; // 64KB
 
+crate::event_ring!(
+    SslRing,
+    RingId::Ssl,
+    SSL_RINGBUF_SIZE,
+    [
+        SSL_EVENTS,
+        SSL_EVENTS_1,
+        SSL_EVENTS_2,
+        SSL_EVENTS_3,
+        SSL_EVENTS_4,
+        SSL_EVENTS_5,
+        SSL_EVENTS_6,
+        SSL_EVENTS_7
+    ]
+);
+
+#[map]
+pub static START_NS: HashMap<u32, u64> = HashMap::pinned(MAX_ENTRIES, 0);
+
+#[map]
+pub static BUFS: HashMap<u32, u64> = HashMap::pinned(MAX_ENTRIES, 0);
+
 #[map]
-pub static SSL_EVENTS: RingBuf = RingBuf::with_byte_size(SSL_RINGBUF_SIZE, 0);
+pub static READBYTES_PTRS: HashMap<u32, u64> = HashMap::pinned(MAX_ENTRIES, 0);
 
+/// `SSL*` argument of the in-flight SSL call, per thread.
 #[map]
-pub static START_NS: HashMap<u32, u64> = HashMap::with_max_entries(MAX_ENTRIES, 0);
+pub static SSL_CONNS: HashMap<u32, u64> = HashMap::pinned(MAX_ENTRIES, 0);
 
+/// Last sequence number handed out per connection. LRU so closed connections age out;
+/// an evicted connection restarts at 1, which userspace treats as a new stream.
 #[map]
-pub static BUFS: HashMap<u32, u64> = HashMap::with_max_entries(MAX_ENTRIES, 0);
+pub static CONN_SEQ: LruHashMap<ConnKey, u64> = LruHashMap::pinned(MAX_ENTRIES, 0);
 
+/// Connections userspace classified as something other than HTTP (see the first-bytes
+/// classifier in the agent), with the `bpf_ktime_get_ns` time until which their data is
+/// not captured. Verdicts expire so that a reused `SSL*` address gets classified again.
+/// Not pinned: a new agent simply classifies again.
 #[map]
-pub static READBYTES_PTRS: HashMap<u32, u64> = HashMap::with_max_entries(MAX_ENTRIES, 0);
+pub static CONN_VERDICT: LruHashMap<ConnKey, u64> = LruHashMap::with_max_entries(MAX_ENTRIES, 0);
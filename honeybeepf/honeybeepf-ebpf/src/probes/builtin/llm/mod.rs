@@ -11,8 +11,12 @@
 //! - `probe_ssl_read_ex_exit` → Return from `SSL_read_ex`
 //! - `probe_ssl_write_ex_exit` → Return from `SSL_write_ex`
 //! - `probe_ssl_do_handshake_enter/exit` → `SSL_do_handshake` for latency measurement
+//!
+//! Connections that userspace classified as not HTTP are listed in `CONN_VERDICT`, and
+//! their reads and writes are not captured until the verdict expires or a new handshake.
 
 use aya_ebpf::{
+    helpers::bpf_get_current_pid_tgid,
     macros::{uprobe, uretprobe},
     programs::{ProbeContext, RetProbeContext},
 };
@@ -21,15 +25,17 @@ use honeybeepf_common::{LlmDirection, LlmEvent};
 mod helpers;
 pub mod maps;
 
-use helpers::{LlmEventExt, Session, get_current_tid};
-use maps::*;
+use helpers::{LlmEventExt, Session, clear_verdict, get_current_tid, is_rejected, next_seq};
+use maps::SslRing;
+
+use crate::probes::ring::{EventRing, connection_shard};
 
-/// Entry probe for SSL_read/SSL_write. Captures buffer pointer from arg1.
+/// Entry probe for SSL_read/SSL_write. Captures the connection from arg0 and buffer pointer from arg1.
 /// Session::start overwrites any existing entry, so no clear() needed.
 #[uprobe]
 pub fn probe_ssl_rw_enter(ctx: ProbeContext) -> u32 {
     let tid = get_current_tid();
-    Session::start(tid, ctx.arg(1).unwrap_or(0), None);
+    Session::start(tid, ctx.arg(0).unwrap_or(0), ctx.arg(1).unwrap_or(0), None);
     0
 }
 
@@ -50,7 +56,12 @@ pub fn probe_ssl_write_exit(ctx: RetProbeContext) -> u32 {
 #[uprobe]
 pub fn probe_ssl_rw_ex_enter(ctx: ProbeContext) -> u32 {
     let tid = get_current_tid();
-    Session::start(tid, ctx.arg(1).unwrap_or(0), Some(ctx.arg(3).unwrap_or(0)));
+    Session::start(
+        tid,
+        ctx.arg(0).unwrap_or(0),
+        ctx.arg(1).unwrap_or(0),
+        Some(ctx.arg(3).unwrap_or(0)),
+    );
     0
 }
 
@@ -68,9 +79,9 @@ pub fn probe_ssl_write_ex_exit(ctx: RetProbeContext) -> u32 {
 
 /// Entry probe for SSL_do_handshake - captures start time for latency.
 #[uprobe]
-pub fn probe_ssl_do_handshake_enter(_ctx: ProbeContext) -> u32 {
+pub fn probe_ssl_do_handshake_enter(ctx: ProbeContext) -> u32 {
     let tid = get_current_tid();
-    Session::start(tid, 0, None);
+    Session::start(tid, ctx.arg(0).unwrap_or(0), 0, None);
     0
 }
 
@@ -84,12 +95,29 @@ pub fn probe_ssl_do_handshake_exit(ctx: RetProbeContext) -> u32 {
 #[inline(always)]
 fn emit_llm_event(ctx: &RetProbeContext, rw: u8, is_handshake: bool) -> u32 {
     let tid = get_current_tid();
-    if let Some(mut slot) = SSL_EVENTS.reserve::<LlmEvent>(0) {
-        let event = unsafe { &mut *slot.as_mut_ptr() };
-        if event.capture_data(ctx, rw, is_handshake).is_ok() {
-            slot.submit(0);
-        } else {
-            slot.discard(0);
+    // Calls that transferred nothing are never emitted and must not consume a sequence number
+    let ret: i64 = ctx.ret().unwrap_or(0);
+    let pid = (bpf_get_current_pid_tgid() >> 32) as u32;
+    let conn_id = Session::conn_id(tid);
+    if ret > 0 && is_handshake {
+        clear_verdict(pid, conn_id);
+    }
+    // Rejected connections (not HTTP) skip the copy and the ring entirely, without taking
+    // a sequence number
+    if ret > 0 && !is_rejected(pid, conn_id) {
+        // Taken before reserving so that an event dropped on a full ring shows up as a gap
+        let seq = next_seq(pid, conn_id);
+        // One shard per connection: the consumer relies on seeing its events in order
+        let shard = connection_shard(pid, conn_id);
+        if let Some(mut slot) = SslRing::reserve_on::<LlmEvent>(shard) {
+            let event = unsafe { &mut *slot.as_mut_ptr() };
+            event.conn_id = conn_id;
+            event.seq = seq;
+            if event.capture_data(ctx, rw, is_handshake).is_ok() {
+                SslRing::submit_on(shard, slot);
+            } else {
+                SslRing::discard(slot);
+            }
         }
     }
     // Always clear session state - handles success, failure, and reserve failure cases
@@ -1,10 +1,5 @@
-use aya_ebpf::{
-    helpers::bpf_probe_read_user,
-    macros::{map, tracepoint},
-    maps::RingBuf,
-    programs::TracePointContext,
-};
-use honeybeepf_common::ConnectionEvent;
+use aya_ebpf::{helpers::bpf_probe_read_user, macros::tracepoint, programs::TracePointContext};
+use honeybeepf_common::{ConnectionEvent, RingId};
 
 const AF_INET: u16 = 2;
 const MAX_EVENT_SIZE: u32 = 1024 * 1024;
@@ -19,12 +14,16 @@ struct SockaddrIn {
 
 use crate::probes::{HoneyBeeEvent, emit_event};
 
-#[map]
-static NETWORK_EVENTS: RingBuf = RingBuf::with_byte_size(MAX_EVENT_SIZE, 0);
+crate::event_ring!(
+    NetworkRing,
+    RingId::Network,
+    MAX_EVENT_SIZE,
+    [NETWORK_EVENTS]
+);
 
 #[tracepoint]
 pub fn honeybeepf(ctx: TracePointContext) -> u32 {
-    emit_event::<TracePointContext, ConnectionEvent>(&NETWORK_EVENTS, &ctx)
+    emit_event::<TracePointContext, ConnectionEvent, NetworkRing>(&ctx)
 }
 
 use honeybeepf_common::EventMetadata;
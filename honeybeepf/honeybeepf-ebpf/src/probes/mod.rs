@@ -1,12 +1,11 @@
-use aya_ebpf::{
-    helpers::{bpf_get_current_cgroup_id, bpf_get_current_pid_tgid, bpf_ktime_get_ns},
-    maps::RingBuf,
-};
+use aya_ebpf::helpers::{bpf_get_current_cgroup_id, bpf_get_current_pid_tgid, bpf_ktime_get_ns};
 
 pub mod builtin;
 pub mod custom;
+pub mod ring;
 
 use honeybeepf_common::EventMetadata;
+use ring::EventRing;
 
 /// Trait defining the lifecycle of an eBPF event
 pub trait HoneyBeeEvent<C> {
@@ -16,6 +15,10 @@ pub trait HoneyBeeEvent<C> {
     // Accessor for common metadata
     fn metadata(&mut self) -> &mut EventMetadata;
 
+    /// Record the keep-1-in-N rate of the ring the event was reserved on. Only events whose
+    /// consumers weight what they count keep it.
+    fn set_sample_rate(&mut self, _rate: u32) {}
+
     /// Common logic to populate base metadata
     fn init_base(&mut self) {
         unsafe {
@@ -34,18 +37,19 @@ pub enum EmitStatus {
 }
 
 /// A generic reporter function to reduce boilerplate
-pub fn emit_event<C, T: HoneyBeeEvent<C> + 'static>(ringbuf: &RingBuf, ctx: &C) -> u32 {
-    if let Some(mut slot) = ringbuf.reserve::<T>(0) {
+pub fn emit_event<C, T: HoneyBeeEvent<C> + 'static, R: EventRing>(ctx: &C) -> u32 {
+    if let Some((mut slot, rate)) = R::reserve_sampled::<T>() {
         let event = unsafe { &mut *slot.as_mut_ptr() };
 
         // Populate event data
         match event.fill(ctx) {
             Ok(_) => {
-                slot.submit(0);
+                event.set_sample_rate(rate);
+                R::submit(slot);
                 EmitStatus::Success as u32
             }
             Err(e) => {
-                slot.discard(0);
+                R::discard(slot);
                 e
             }
         }
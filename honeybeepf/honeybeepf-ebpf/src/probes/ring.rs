@@ -0,0 +1,226 @@
+//! Event ring helpers shared by all probes.
+//!
+//! High-volume rings can be split into up to `MAX_RING_SHARDS` ring buffers so that
+//! producers on different CPUs do not contend on the same ring spinlock. Each shard is
+//! its own map (aya-ebpf has no array-of-maps), the active shard count is patched by
+//! userspace at load time, and programs pick a shard from the current CPU id. Rings whose
+//! consumer relies on per-connection order (SSL) pick it from the connection instead, as
+//! the consumer drains the shards one after another.
+//!
+//! Submissions do not wake the consumer by default. A wakeup is forced only when the
+//! ring's unconsumed data crosses the configured watermark or the per-CPU time budget
+//! since the last forced wakeup expires, which avoids wakeup storms at high event rates.
+//!
+//! Rings can also be sampled: userspace (the CPU governor) sets a keep-1-in-N rate per ring
+//! in `RING_SAMPLE`, and events sampled out are never reserved. Kept events can carry the
+//! rate they were sampled at, so that consumers weight them correctly across rate changes.
+
+use aya_ebpf::{
+    helpers::{bpf_get_prandom_u32, bpf_get_smp_processor_id, bpf_ktime_get_ns},
+    macros::map,
+    maps::{Array, PerCpuArray, RingBuf, ring_buf::RingBufEntry},
+};
+use honeybeepf_common::{RING_COUNT, RingId, RingWakeupConfig, conn_shard};
+
+const BPF_RB_NO_WAKEUP: u64 = 1;
+const BPF_RB_FORCE_WAKEUP: u64 = 2;
+const BPF_RB_AVAIL_DATA: u64 = 0;
+
+/// Number of active ring shards, set by userspace via `EbpfLoader::set_global`.
+#[unsafe(no_mangle)]
+static RING_SHARDS: u32 = 1;
+
+/// Per-CPU count of events dropped because a ring was full, indexed by `RingId`.
+/// Pinned, so the totals keep counting across agent upgrades.
+#[map]
+pub static RINGBUF_DROPS: PerCpuArray<u64> = PerCpuArray::pinned(RING_COUNT, 0);
+
+/// Wakeup policy per ring, written by userspace after load.
+#[map]
+pub static RING_WAKEUP: Array<RingWakeupConfig> = Array::with_max_entries(RING_COUNT, 0);
+
+/// Keep 1 in N events per ring (0 or 1 keeps everything), updated by userspace at runtime.
+#[map]
+pub static RING_SAMPLE: Array<u32> = Array::with_max_entries(RING_COUNT, 0);
+
+/// Per-CPU timestamp of the last forced wakeup, indexed by `RingId`.
+#[map]
+pub static RING_LAST_WAKEUP: PerCpuArray<u64> = PerCpuArray::with_max_entries(RING_COUNT, 0);
+
+#[inline(always)]
+fn active_shards() -> u32 {
+    unsafe { core::ptr::read_volatile(&RING_SHARDS) }
+}
+
+#[inline(always)]
+pub fn current_shard() -> u32 {
+    let shards = active_shards();
+    if shards <= 1 {
+        return 0;
+    }
+    unsafe { bpf_get_smp_processor_id() % shards }
+}
+
+/// Shard for the events of one connection, the same on every CPU.
+#[inline(always)]
+pub fn connection_shard(pid: u32, conn_id: u64) -> u32 {
+    conn_shard(pid, conn_id, active_shards())
+}
+
+#[inline(always)]
+pub fn record_drop(id: RingId) {
+    if let Some(count) = RINGBUF_DROPS.get_ptr_mut(id as u32) {
+        unsafe { *count += 1 };
+    }
+}
+
+/// Keep-1-in-N rate of a ring, 1 when it is not sampled
+#[inline(always)]
+fn sample_rate(id: RingId) -> u32 {
+    match RING_SAMPLE.get(id as u32) {
+        Some(&keep_one_in) if keep_one_in > 1 => keep_one_in,
+        _ => 1,
+    }
+}
+
+/// Pick submit flags for `ring`: no wakeup unless the watermark or time budget is hit.
+#[inline(always)]
+fn wakeup_flags(id: RingId, ring: &RingBuf) -> u64 {
+    let Some(config) = RING_WAKEUP.get(id as u32) else {
+        return 0;
+    };
+    if config.watermark_bytes == 0 {
+        return 0;
+    }
+
+    let Some(last) = RING_LAST_WAKEUP.get_ptr_mut(id as u32) else {
+        return 0;
+    };
+    let now = unsafe { bpf_ktime_get_ns() };
+    if ring.query(BPF_RB_AVAIL_DATA) >= config.watermark_bytes
+        || now.wrapping_sub(unsafe { *last }) >= config.max_delay_ns
+    {
+        unsafe { *last = now };
+        return BPF_RB_FORCE_WAKEUP;
+    }
+    BPF_RB_NO_WAKEUP
+}
+
+/// A (possibly sharded) event ring declared with `event_ring!`.
+pub trait EventRing {
+    const ID: RingId;
+
+    /// Run `f` against ring shard `shard` (shard 0 when it is out of range).
+    fn with_shard<R>(shard: u32, f: impl FnOnce(&'static RingBuf) -> R) -> R;
+
+    /// Reserve an event slot, counting a drop when the ring is full.
+    /// Returns `None` without a drop for events removed by sampling.
+    #[inline(always)]
+    fn reserve<T: 'static>() -> Option<RingBufEntry<T>> {
+        Self::reserve_on::<T>(current_shard())
+    }
+
+    /// `reserve` in a given shard, e.g. the `connection_shard` of the event.
+    #[inline(always)]
+    fn reserve_on<T: 'static>(shard: u32) -> Option<RingBufEntry<T>> {
+        Self::reserve_sampled_on::<T>(shard).map(|(entry, _)| entry)
+    }
+
+    /// `reserve`, also returning the rate the event was sampled at: the number of events
+    /// it stands for.
+    #[inline(always)]
+    fn reserve_sampled<T: 'static>() -> Option<(RingBufEntry<T>, u32)> {
+        Self::reserve_sampled_on::<T>(current_shard())
+    }
+
+    /// `reserve_sampled` in a given shard.
+    #[inline(always)]
+    fn reserve_sampled_on<T: 'static>(shard: u32) -> Option<(RingBufEntry<T>, u32)> {
+        let rate = sample_rate(Self::ID);
+        if rate > 1 && unsafe { bpf_get_prandom_u32() } % rate != 0 {
+            return None;
+        }
+        let entry = Self::with_shard(shard, |ring| ring.reserve::<T>(0));
+        if entry.is_none() {
+            record_drop(Self::ID);
+        }
+        Some((entry?, rate))
+    }
+
+    /// Commit an event, waking the consumer only when the wakeup policy says so.
+    /// Must run on the CPU that reserved the entry (BPF programs are not migrated).
+    #[inline(always)]
+    fn submit<T: 'static>(entry: RingBufEntry<T>) {
+        Self::submit_on(current_shard(), entry);
+    }
+
+    /// `submit` of an entry reserved with `reserve_on(shard)`.
+    #[inline(always)]
+    fn submit_on<T: 'static>(shard: u32, entry: RingBufEntry<T>) {
+        let flags = Self::with_shard(shard, |ring| wakeup_flags(Self::ID, ring));
+        entry.submit(flags);
+    }
+
+    /// Drop a reserved event without waking the consumer.
+    #[inline(always)]
+    fn discard<T: 'static>(entry: RingBufEntry<T>) {
+        entry.discard(BPF_RB_NO_WAKEUP);
+    }
+}
+
+/// Declare an event ring type. With extra map names the ring is sharded;
+/// every shard is a separate map named `<FIRST>`, `<FIRST>_1`, ... so userspace can find them.
+/// Each branch references its map directly, as BPF cannot index a table of map pointers.
+#[macro_export]
+macro_rules! event_ring {
+    ($ty:ident, $id:expr, $size:expr, [$first:ident]) => {
+        #[aya_ebpf::macros::map]
+        pub static $first: aya_ebpf::maps::RingBuf =
+            aya_ebpf::maps::RingBuf::with_byte_size($size, 0);
+
+        pub struct $ty;
+
+        impl $crate::probes::ring::EventRing for $ty {
+            const ID: honeybeepf_common::RingId = $id;
+
+            #[inline(always)]
+            fn with_shard<R>(
+                _shard: u32,
+                f: impl FnOnce(&'static aya_ebpf::maps::RingBuf) -> R,
+            ) -> R {
+                f(&$first)
+            }
+        }
+    };
+    ($ty:ident, $id:expr, $size:expr, [$first:ident, $($shard:ident),+]) => {
+        #[aya_ebpf::macros::map]
+        pub static $first: aya_ebpf::maps::RingBuf =
+            aya_ebpf::maps::RingBuf::with_byte_size($size, 0);
+        $(
+            #[aya_ebpf::macros::map]
+            pub static $shard: aya_ebpf::maps::RingBuf =
+                aya_ebpf::maps::RingBuf::with_byte_size($size, 0);
+        )+
+
+        pub struct $ty;
+
+        impl $crate::probes::ring::EventRing for $ty {
+            const ID: honeybeepf_common::RingId = $id;
+
+            #[inline(always)]
+            fn with_shard<R>(
+                shard: u32,
+                f: impl FnOnce(&'static aya_ebpf::maps::RingBuf) -> R,
+            ) -> R {
+                let mut _index = 1u32;
+                $(
+                    if shard == _index {
+                        return f(&$shard);
+                    }
+                    _index += 1;
+                )+
+                f(&$first)
+            }
+        }
+    };
+}
@@ -0,0 +1,85 @@
+//! Time to the first SSL probe: full process scan versus the discovery cache.
+//!
+//! `full_scan` is what a start without a cache does before attaching anything:
+//! `ldconfig -p` plus the maps of every process. `cache_validate` is what a restart with a
+//! warm cache does instead: one `stat` per cached library, after which attaching starts.
+//! `symbol_offsets` compares resolving the SSL symbols of one library from its ELF with a
+//! cache hit.
+//!
+//! Run with `cargo bench -p honeybeepf --bench discovery` on a busy node (as root, so every
+//! process's maps are readable). The process count is printed first; the gap grows with it.
+
+mod harness;
+
+use std::{hint::black_box, time::Duration};
+
+use honeybeepf::probes::builtin::llm::discovery::{self, cache};
+
+use harness::Harness;
+
+const SSL_SYMBOLS: [&str; 5] = [
+    "SSL_read",
+    "SSL_write",
+    "SSL_do_handshake",
+    "SSL_read_ex",
+    "SSL_write_ex",
+];
+
+fn bench_discovery(h: &mut Harness) {
+    let processes = procfs::process::all_processes()
+        .map(|procs| procs.count())
+        .unwrap_or(0);
+    let targets = discovery::find_all_targets().unwrap_or_default();
+    println!(
+        "{} processes, {} SSL libraries found\n",
+        processes,
+        targets.len()
+    );
+
+    // Warm the cache the way a previous run leaves it
+    let dir = std::env::temp_dir().join(format!("honeybeepf-bench-{}", std::process::id()));
+    let cache_file = dir.join("discovery.json");
+    cache::init(cache_file.to_str());
+    for path in targets.iter().filter(|path| !path.contains("libcrypto")) {
+        cache::symbol_offsets(path, &SSL_SYMBOLS);
+        cache::mark_attached(path);
+    }
+    cache::save();
+    cache::init(cache_file.to_str());
+
+    let mut group = h.benchmark_group("discovery");
+    group
+        .sample_size(10)
+        .measurement_time(Duration::from_secs(10));
+    group.bench_function("full_scan", |b| {
+        b.iter(|| black_box(discovery::find_all_targets()))
+    });
+    group.bench_function("cache_validate", |b| {
+        b.iter(|| black_box(cache::attached_targets()))
+    });
+    group.finish();
+
+    let Some(library) = targets.iter().find(|path| !path.contains("libcrypto")) else {
+        let _ = std::fs::remove_dir_all(&dir);
+        return;
+    };
+    let mut group = h.benchmark_group("symbol_offsets");
+    group.bench_function("cache_hit", |b| {
+        b.iter(|| black_box(cache::symbol_offsets(library, &SSL_SYMBOLS)))
+    });
+    group.bench_function("elf_parse", |b| {
+        b.iter(|| {
+            // A fresh in-memory cache misses every time
+            cache::init(None);
+            black_box(cache::symbol_offsets(library, &SSL_SYMBOLS))
+        })
+    });
+    group.finish();
+    let _ = std::fs::remove_dir_all(&dir);
+}
+
+fn main() {
+    let mut harness = Harness::default().configure_from_args();
+    bench_discovery(&mut harness);
+    harness.final_summary();
+}
@@ -0,0 +1,153 @@
+//! Per-event output cost: an `info!` line per event versus the structured event sink.
+//!
+//! The log baseline replays the block I/O handler's former `info!` line through the same
+//! `tracing_subscriber` formatter the agent installs, writing to `/dev/null`. The sink runs
+//! write JSON lines and binary records to `/dev/null`, flushing the per-thread batch every
+//! `EVENTS_PER_WAKEUP` events like a ring consumer does after each drain pass.
+//!
+//! Run with `cargo bench -p honeybeepf --bench event_sink`. Before the timed runs, a table of
+//! process CPU time per event is printed. It includes the sink's writer thread, which the
+//! harness timings (consumer thread only) do not.
+
+mod harness;
+
+use std::{fs::File, hint::black_box, sync::Mutex, time::Duration};
+
+use honeybeepf::{settings::SinkSettings, sink};
+use honeybeepf_common::{BlockIoEvent, BlockIoEventType, RingId};
+
+use harness::{Harness, Throughput};
+
+const EVENTS: u64 = 200_000;
+const EVENTS_PER_WAKEUP: u64 = 64;
+
+fn sample_event(i: u64) -> BlockIoEvent {
+    let mut event: BlockIoEvent = unsafe { std::mem::zeroed() };
+    event.metadata.pid = 4242;
+    event.metadata.cgroup_id = 0x1234_5678;
+    event.metadata.timestamp = 1_000_000 + i;
+    event.dev = (259 << 20) | 1;
+    event.sector = 2048 + i * 8;
+    event.nr_sector = 8;
+    event.bytes = 4096;
+    event.rwbs[..2].copy_from_slice(b"WS");
+    event.comm[..8].copy_from_slice(b"postgres");
+    event.event_type = BlockIoEventType::Done as u8;
+    event
+}
+
+/// The block I/O handler's per-event line before the sink replaced it
+fn log_event(event: &BlockIoEvent) {
+    let rwbs = std::str::from_utf8(&event.rwbs)
+        .unwrap_or("<invalid>")
+        .trim_matches(char::from(0));
+    let comm = std::str::from_utf8(&event.comm)
+        .unwrap_or("<invalid>")
+        .trim_matches(char::from(0));
+    let device = format!("{}:{}", event.dev >> 20, event.dev & 0xFFFFF);
+    log::info!(
+        "BlockIO DONE pid={} dev={} sector={} nr_sector={} bytes={} rwbs={} comm={}",
+        event.metadata.pid,
+        device,
+        event.sector,
+        event.nr_sector,
+        event.bytes,
+        rwbs,
+        comm
+    );
+}
+
+fn sink_event(i: u64, event: &BlockIoEvent) {
+    sink::record(RingId::BlockIo, event.metadata.timestamp, event);
+    if i % EVENTS_PER_WAKEUP == 0 {
+        sink::flush();
+    }
+}
+
+fn start_sink(format: &str) {
+    sink::init(&SinkSettings {
+        format: Some(format.to_string()),
+        path: Some("/dev/null".to_string()),
+        // Deep enough that the consumer never drops batches while the writer catches up
+        queue_capacity: Some(4096),
+        ..Default::default()
+    })
+    .expect("Failed to start event sink");
+}
+
+/// Process CPU time (all threads) in nanoseconds
+fn process_cpu_ns() -> u64 {
+    let mut ts = libc::timespec {
+        tv_sec: 0,
+        tv_nsec: 0,
+    };
+    unsafe { libc::clock_gettime(libc::CLOCK_PROCESS_CPUTIME_ID, &mut ts) };
+    ts.tv_sec as u64 * 1_000_000_000 + ts.tv_nsec as u64
+}
+
+fn report_cpu() {
+    let events: Vec<BlockIoEvent> = (0..EVENTS).map(sample_event).collect();
+
+    let start = process_cpu_ns();
+    for event in &events {
+        log_event(black_box(event));
+    }
+    let log_ns = (process_cpu_ns() - start) as f64 / EVENTS as f64;
+
+    println!("{:<14} {:>14} {:>10}", "output", "cpu ns/event", "vs log");
+    println!("{:<14} {:>14.0} {:>10}", "info! log", log_ns, "1.0x");
+    for format in ["json", "binary"] {
+        let start = process_cpu_ns();
+        start_sink(format);
+        for (i, event) in events.iter().enumerate() {
+            sink_event(i as u64, black_box(event));
+        }
+        // Waits for the writer to format and write every batch
+        sink::shutdown();
+        let ns = (process_cpu_ns() - start) as f64 / EVENTS as f64;
+        println!(
+            "{:<14} {:>14.0} {:>9.1}x",
+            format!("sink {}", format),
+            ns,
+            log_ns / ns
+        );
+    }
+    println!();
+}
+
+fn bench_output(h: &mut Harness) {
+    let event = sample_event(0);
+    let mut group = h.benchmark_group("event_output");
+    group
+        .throughput(Throughput::Elements(1))
+        .measurement_time(Duration::from_secs(2));
+
+    group.bench_function("info_log", |b| b.iter(|| log_event(black_box(&event))));
+    for format in ["json", "binary"] {
+        start_sink(format);
+        let mut i = 0u64;
+        group.bench_function(format!("sink_{}", format), |b| {
+            b.iter(|| {
+                i += 1;
+                sink_event(i, black_box(&event))
+            })
+        });
+        sink::shutdown();
+    }
+    group.finish();
+}
+
+fn main() {
+    // Same formatter as the agent, at the chart's default level
+    let devnull = File::create("/dev/null").expect("Failed to open /dev/null");
+    tracing_subscriber::fmt()
+        .with_max_level(tracing::Level::INFO)
+        .with_writer(Mutex::new(devnull))
+        .init();
+
+    report_cpu();
+
+    let mut harness = Harness::default().configure_from_args();
+    bench_output(&mut harness);
+    harness.final_summary();
+}
@@ -0,0 +1,214 @@
+//! Minimal benchmark harness shared by the `harness = false` benches.
+//!
+//! Groups of benchmarks share a sample count, a measurement time and a throughput, and
+//! each benchmark times a `Bencher::iter` routine. Each benchmark is warmed up, then timed
+//! in `sample_size` samples of a fixed iteration count sized to fill the measurement time.
+//! The median time per iteration is reported, with the fastest and slowest samples around
+//! it. There is no statistical analysis and no comparison with earlier runs.
+//!
+//! `cargo bench -p honeybeepf --bench <name> -- <filter>` runs the benchmarks whose
+//! `group/name` id contains the filter.
+
+#![allow(dead_code)]
+
+use std::{
+    fmt,
+    hint::black_box,
+    time::{Duration, Instant},
+};
+
+const DEFAULT_SAMPLE_SIZE: usize = 100;
+const DEFAULT_MEASUREMENT_TIME: Duration = Duration::from_secs(5);
+const WARM_UP_TIME: Duration = Duration::from_millis(500);
+
+#[derive(Clone, Copy)]
+pub enum Throughput {
+    Bytes(u64),
+    Elements(u64),
+}
+
+pub struct BenchmarkId(String);
+
+impl BenchmarkId {
+    pub fn from_parameter<P: fmt::Display>(parameter: P) -> Self {
+        Self(parameter.to_string())
+    }
+}
+
+impl From<&str> for BenchmarkId {
+    fn from(name: &str) -> Self {
+        Self(name.to_string())
+    }
+}
+
+impl From<String> for BenchmarkId {
+    fn from(name: String) -> Self {
+        Self(name)
+    }
+}
+
+#[derive(Default)]
+pub struct Harness {
+    filter: Option<String>,
+    benchmarks: usize,
+}
+
+impl Harness {
+    /// Take the name filter from the command line, skipping the flags cargo passes.
+    pub fn configure_from_args(mut self) -> Self {
+        self.filter = std::env::args().skip(1).find(|arg| !arg.starts_with('-'));
+        self
+    }
+
+    pub fn benchmark_group<S: Into<String>>(&mut self, name: S) -> Group<'_> {
+        Group {
+            harness: self,
+            name: name.into(),
+            sample_size: DEFAULT_SAMPLE_SIZE,
+            measurement_time: DEFAULT_MEASUREMENT_TIME,
+            throughput: None,
+        }
+    }
+
+    pub fn final_summary(&mut self) {
+        println!("{} benchmark(s) run", self.benchmarks);
+    }
+}
+
+pub struct Group<'a> {
+    harness: &'a mut Harness,
+    name: String,
+    sample_size: usize,
+    measurement_time: Duration,
+    throughput: Option<Throughput>,
+}
+
+impl Group<'_> {
+    pub fn sample_size(&mut self, samples: usize) -> &mut Self {
+        self.sample_size = samples.max(2);
+        self
+    }
+
+    pub fn measurement_time(&mut self, time: Duration) -> &mut Self {
+        self.measurement_time = time;
+        self
+    }
+
+    pub fn throughput(&mut self, throughput: Throughput) -> &mut Self {
+        self.throughput = Some(throughput);
+        self
+    }
+
+    pub fn bench_function<I, F>(&mut self, id: I, mut f: F) -> &mut Self
+    where
+        I: Into<BenchmarkId>,
+        F: FnMut(&mut Bencher),
+    {
+        self.run(id.into(), |b| f(b));
+        self
+    }
+
+    pub fn bench_with_input<T: ?Sized, F>(
+        &mut self,
+        id: BenchmarkId,
+        input: &T,
+        mut f: F,
+    ) -> &mut Self
+    where
+        F: FnMut(&mut Bencher, &T),
+    {
+        self.run(id, |b| f(b, input));
+        self
+    }
+
+    pub fn finish(self) {}
+
+    fn run(&mut self, id: BenchmarkId, mut f: impl FnMut(&mut Bencher)) {
+        let id = format!("{}/{}", self.name, id.0);
+        if self
+            .harness
+            .filter
+            .as_ref()
+            .is_some_and(|filter| !id.contains(filter.as_str()))
+        {
+            return;
+        }
+        self.harness.benchmarks += 1;
+
+        // Warm up, doubling the iterations until the warm-up time is spent
+        let mut bencher = Bencher {
+            iters: 1,
+            elapsed: Duration::ZERO,
+        };
+        let start = Instant::now();
+        let mut warm_up_iters = 0;
+        while start.elapsed() < WARM_UP_TIME {
+            f(&mut bencher);
+            warm_up_iters += bencher.iters;
+            bencher.iters *= 2;
+        }
+        let per_iter = start.elapsed().as_secs_f64() / warm_up_iters as f64;
+
+        let sample_time = self.measurement_time.as_secs_f64() / self.sample_size as f64;
+        bencher.iters = ((sample_time / per_iter) as u64).max(1);
+        let mut samples: Vec<f64> = (0..self.sample_size)
+            .map(|_| {
+                f(&mut bencher);
+                bencher.elapsed.as_secs_f64() / bencher.iters as f64
+            })
+            .collect();
+        samples.sort_by(f64::total_cmp);
+        let median = samples[samples.len() / 2];
+
+        let throughput = match self.throughput {
+            Some(Throughput::Bytes(bytes)) => {
+                format!(
+                    "  thrpt: {:.1} MiB/s",
+                    bytes as f64 / median / (1024.0 * 1024.0)
+                )
+            }
+            Some(Throughput::Elements(elements)) => {
+                format!("  thrpt: {:.0} elem/s", elements as f64 / median)
+            }
+            None => String::new(),
+        };
+        println!(
+            "{:<48} time: [{} {} {}]{}",
+            id,
+            Seconds(samples[0]),
+            Seconds(median),
+            Seconds(samples[samples.len() - 1]),
+            throughput
+        );
+    }
+}
+
+pub struct Bencher {
+    iters: u64,
+    elapsed: Duration,
+}
+
+impl Bencher {
+    pub fn iter<O, R: FnMut() -> O>(&mut self, mut routine: R) {
+        let start = Instant::now();
+        for _ in 0..self.iters {
+            black_box(routine());
+        }
+        self.elapsed = start.elapsed();
+    }
+}
+
+/// A duration in the unit that suits it
+struct Seconds(f64);
+
+impl fmt::Display for Seconds {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        let (value, unit) = match self.0 {
+            s if s < 1e-6 => (s * 1e9, "ns"),
+            s if s < 1e-3 => (s * 1e6, "µs"),
+            s if s < 1.0 => (s * 1e3, "ms"),
+            s => (s, "s"),
+        };
+        write!(f, "{:.2} {}", value, unit)
+    }
+}
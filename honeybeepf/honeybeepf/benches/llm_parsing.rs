@@ -0,0 +1,430 @@
+//! Benchmarks for the LLM HTTP parsing stack (`StreamProcessor::handle_event` and below).
+//!
+//! Each scenario replays one request/response exchange, captured as SSL events, through a
+//! fresh `StreamProcessor`. The text corpora live in `benches/fixtures/` (OpenAI, Anthropic and
+//! Gemini request, response and SSE stream bodies). The wire encodings (HTTP/1.1 with
+//! Content-Length, chunked, gzip, SSE, and HTTP/2 frames) are built from them at startup.
+//! Wire bytes are split into events with deterministic size distributions that mimic TLS
+//! record sizes, capped at `MAX_SSL_BUF_SIZE` like the eBPF capture.
+//!
+//! Run with `cargo bench -p honeybeepf --bench llm_parsing`. Before the timed runs, a table
+//! of allocations per event for every scenario is printed.
+
+mod harness;
+
+use std::{
+    alloc::{GlobalAlloc, Layout, System},
+    hint::black_box,
+    io::Write,
+    sync::atomic::{AtomicBool, AtomicU64, Ordering},
+    time::Duration,
+};
+
+use flate2::{Compression, write::GzEncoder};
+use honeybeepf::probes::builtin::llm::{processor::StreamProcessor, types::LlmDirection};
+use honeybeepf_common::MAX_SSL_BUF_SIZE;
+
+use harness::{BenchmarkId, Harness, Throughput};
+
+// --- Allocation counting ---
+
+struct CountingAlloc;
+
+static COUNTING: AtomicBool = AtomicBool::new(false);
+static ALLOCS: AtomicU64 = AtomicU64::new(0);
+static ALLOC_BYTES: AtomicU64 = AtomicU64::new(0);
+
+unsafe impl GlobalAlloc for CountingAlloc {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        if COUNTING.load(Ordering::Relaxed) {
+            ALLOCS.fetch_add(1, Ordering::Relaxed);
+            ALLOC_BYTES.fetch_add(layout.size() as u64, Ordering::Relaxed);
+        }
+        unsafe { System.alloc(layout) }
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        unsafe { System.dealloc(ptr, layout) }
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        if COUNTING.load(Ordering::Relaxed) {
+            ALLOCS.fetch_add(1, Ordering::Relaxed);
+            ALLOC_BYTES.fetch_add(new_size as u64, Ordering::Relaxed);
+        }
+        unsafe { System.realloc(ptr, layout, new_size) }
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAlloc = CountingAlloc;
+
+// --- Corpora ---
+
+struct Provider {
+    name: &'static str,
+    host: &'static str,
+    path: &'static str,
+    stream_path: &'static str,
+    request: &'static [u8],
+    response: &'static [u8],
+    stream: &'static [u8],
+}
+
+const PROVIDERS: &[Provider] = &[
+    Provider {
+        name: "openai",
+        host: "api.openai.com",
+        path: "/v1/chat/completions",
+        stream_path: "/v1/chat/completions",
+        request: include_bytes!("fixtures/openai_request.json"),
+        response: include_bytes!("fixtures/openai_response.json"),
+        stream: include_bytes!("fixtures/openai_stream.sse"),
+    },
+    Provider {
+        name: "anthropic",
+        host: "api.anthropic.com",
+        path: "/v1/messages",
+        stream_path: "/v1/messages",
+        request: include_bytes!("fixtures/anthropic_request.json"),
+        response: include_bytes!("fixtures/anthropic_response.json"),
+        stream: include_bytes!("fixtures/anthropic_stream.sse"),
+    },
+    Provider {
+        name: "gemini",
+        host: "generativelanguage.googleapis.com",
+        path: "/v1beta/models/gemini-1.5-pro:generateContent",
+        stream_path: "/v1beta/models/gemini-1.5-pro:streamGenerateContent?alt=sse",
+        request: include_bytes!("fixtures/gemini_request.json"),
+        response: include_bytes!("fixtures/gemini_response.json"),
+        stream: include_bytes!("fixtures/gemini_stream.sse"),
+    },
+];
+
+#[derive(Clone, Copy)]
+enum Encoding {
+    Json,
+    Chunked,
+    Gzip,
+    Sse,
+    Http2,
+}
+
+const ENCODINGS: &[(Encoding, &str)] = &[
+    (Encoding::Json, "h1_json"),
+    (Encoding::Chunked, "h1_chunked"),
+    (Encoding::Gzip, "h1_gzip"),
+    (Encoding::Sse, "h1_sse"),
+    (Encoding::Http2, "h2"),
+];
+
+fn http1_request(p: &Provider, path: &str) -> Vec<u8> {
+    let mut out = format!(
+        "POST {} HTTP/1.1\r\nHost: {}\r\nUser-Agent: bench/1.0\r\nAuthorization: Bearer sk-bench\r\n\
+         Content-Type: application/json\r\nContent-Length: {}\r\n\r\n",
+        path,
+        p.host,
+        p.request.len()
+    )
+    .into_bytes();
+    out.extend_from_slice(p.request);
+    out
+}
+
+fn chunked(body: &[u8], chunk_size: usize) -> Vec<u8> {
+    let mut out = Vec::with_capacity(body.len() + body.len() / chunk_size * 8 + 8);
+    for chunk in body.chunks(chunk_size) {
+        write!(out, "{:x}\r\n", chunk.len()).unwrap();
+        out.extend_from_slice(chunk);
+        out.extend_from_slice(b"\r\n");
+    }
+    out.extend_from_slice(b"0\r\n\r\n");
+    out
+}
+
+/// SSE streams are sent as one chunk per event, the way servers flush them.
+fn chunked_sse(stream: &[u8]) -> Vec<u8> {
+    let text = std::str::from_utf8(stream).unwrap();
+    let mut out = Vec::with_capacity(stream.len() * 2);
+    for event in text.split_inclusive("\n\n") {
+        write!(out, "{:x}\r\n{}\r\n", event.len(), event).unwrap();
+    }
+    out.extend_from_slice(b"0\r\n\r\n");
+    out
+}
+
+fn gzip(body: &[u8]) -> Vec<u8> {
+    let mut encoder = GzEncoder::new(Vec::new(), Compression::default());
+    encoder.write_all(body).unwrap();
+    encoder.finish().unwrap()
+}
+
+const H2_DATA: u8 = 0x0;
+const H2_HEADERS: u8 = 0x1;
+const H2_SETTINGS: u8 = 0x4;
+const H2_END_STREAM: u8 = 0x1;
+const H2_END_HEADERS: u8 = 0x4;
+const H2_MAX_FRAME: usize = 16 * 1024;
+
+fn h2_frame(out: &mut Vec<u8>, kind: u8, flags: u8, stream_id: u32, payload: &[u8]) {
+    let len = payload.len() as u32;
+    out.extend_from_slice(&len.to_be_bytes()[1..]);
+    out.push(kind);
+    out.push(flags);
+    out.extend_from_slice(&stream_id.to_be_bytes());
+    out.extend_from_slice(payload);
+}
+
+fn h2_data(out: &mut Vec<u8>, body: &[u8]) {
+    let frames: Vec<&[u8]> = body.chunks(H2_MAX_FRAME).collect();
+    for (i, chunk) in frames.iter().enumerate() {
+        let flags = if i + 1 == frames.len() {
+            H2_END_STREAM
+        } else {
+            0
+        };
+        h2_frame(out, H2_DATA, flags, 1, chunk);
+    }
+}
+
+/// HPACK-encoded header block stand-in: mostly indexed fields plus Huffman literals.
+fn h2_header_block(len: usize) -> Vec<u8> {
+    (0..len).map(|i| 0x80 | (i as u8 % 61 + 1)).collect()
+}
+
+fn h2_request(p: &Provider) -> Vec<u8> {
+    let mut out = b"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n".to_vec();
+    h2_frame(&mut out, H2_SETTINGS, 0, 0, &[0, 3, 0, 0, 0, 100]);
+    h2_frame(
+        &mut out,
+        H2_HEADERS,
+        H2_END_HEADERS,
+        1,
+        &h2_header_block(96),
+    );
+    h2_data(&mut out, p.request);
+    out
+}
+
+fn h2_response(body: &[u8]) -> Vec<u8> {
+    let mut out = Vec::with_capacity(body.len() + 128);
+    h2_frame(
+        &mut out,
+        H2_HEADERS,
+        H2_END_HEADERS,
+        1,
+        &h2_header_block(48),
+    );
+    h2_data(&mut out, body);
+    out
+}
+
+fn http1_response(headers: &str, body: &[u8]) -> Vec<u8> {
+    let mut out = format!(
+        "HTTP/1.1 200 OK\r\nDate: Fri, 18 Oct 2024 09:00:00 GMT\r\n{}\r\n",
+        headers
+    )
+    .into_bytes();
+    out.extend_from_slice(body);
+    out
+}
+
+/// Wire bytes of one exchange: (request, response).
+fn exchange(p: &Provider, encoding: Encoding) -> (Vec<u8>, Vec<u8>) {
+    match encoding {
+        Encoding::Json => (
+            http1_request(p, p.path),
+            http1_response(
+                &format!(
+                    "Content-Type: application/json\r\nContent-Length: {}\r\n",
+                    p.response.len()
+                ),
+                p.response,
+            ),
+        ),
+        Encoding::Chunked => (
+            http1_request(p, p.path),
+            http1_response(
+                "Content-Type: application/json\r\nTransfer-Encoding: chunked\r\n",
+                &chunked(p.response, 1024),
+            ),
+        ),
+        Encoding::Gzip => (
+            http1_request(p, p.path),
+            http1_response(
+                "Content-Type: application/json\r\nContent-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n",
+                &chunked(&gzip(p.response), 1024),
+            ),
+        ),
+        Encoding::Sse => (
+            http1_request(p, p.stream_path),
+            http1_response(
+                "Content-Type: text/event-stream\r\nCache-Control: no-cache\r\nTransfer-Encoding: chunked\r\n",
+                &chunked_sse(p.stream),
+            ),
+        ),
+        Encoding::Http2 => (h2_request(p), h2_response(p.response)),
+    }
+}
+
+// --- Event size distributions ---
+
+#[derive(Clone, Copy)]
+enum SizeDist {
+    /// Full TLS records, truncated to the capture size
+    Records,
+    /// Small writes/reads as produced by token streaming (64..512 bytes)
+    Small,
+    /// 80% small, 20% full records
+    Mixed,
+}
+
+const DISTS: &[(SizeDist, &str)] = &[
+    (SizeDist::Records, "records"),
+    (SizeDist::Small, "small"),
+    (SizeDist::Mixed, "mixed"),
+];
+
+/// xorshift64*, deterministic so every run replays identical events.
+struct Rng(u64);
+
+impl Rng {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545_F491_4F6C_DD1D)
+    }
+
+    fn range(&mut self, lo: usize, hi: usize) -> usize {
+        lo + (self.next() % (hi - lo + 1) as u64) as usize
+    }
+}
+
+fn split(bytes: &[u8], dist: SizeDist, rng: &mut Rng) -> Vec<Vec<u8>> {
+    let mut events = Vec::new();
+    let mut pos = 0;
+    while pos < bytes.len() {
+        let size = match dist {
+            SizeDist::Records => MAX_SSL_BUF_SIZE,
+            SizeDist::Small => rng.range(64, 512),
+            SizeDist::Mixed if rng.next() % 5 == 0 => MAX_SSL_BUF_SIZE,
+            SizeDist::Mixed => rng.range(64, 512),
+        };
+        let end = (pos + size).min(bytes.len());
+        events.push(bytes[pos..end].to_vec());
+        pos = end;
+    }
+    events
+}
+
+struct Scenario {
+    id: String,
+    events: Vec<(LlmDirection, Vec<u8>)>,
+    bytes: u64,
+}
+
+fn scenarios() -> Vec<Scenario> {
+    let mut out = Vec::new();
+    for p in PROVIDERS {
+        for &(encoding, encoding_name) in ENCODINGS {
+            let (request, response) = exchange(p, encoding);
+            for &(dist, dist_name) in DISTS {
+                let mut rng = Rng(0x9E37_79B9_7F4A_7C15);
+                let mut events: Vec<(LlmDirection, Vec<u8>)> = split(&request, dist, &mut rng)
+                    .into_iter()
+                    .map(|e| (LlmDirection::Write, e))
+                    .collect();
+                events.extend(
+                    split(&response, dist, &mut rng)
+                        .into_iter()
+                        .map(|e| (LlmDirection::Read, e)),
+                );
+                out.push(Scenario {
+                    id: format!("{}/{}/{}", p.name, encoding_name, dist_name),
+                    bytes: (request.len() + response.len()) as u64,
+                    events,
+                });
+            }
+        }
+    }
+    out
+}
+
+/// Replay one exchange. Returns whether the processor completed it.
+fn replay(scenario: &Scenario) -> bool {
+    let mut processor = StreamProcessor::new();
+    for (direction, data) in &scenario.events {
+        processor.handle_event(*direction, black_box(data), 0, Duration::ZERO, 1);
+    }
+    !processor.is_llm()
+}
+
+fn report_allocations(scenarios: &[Scenario]) {
+    println!(
+        "\n{:<32} {:>7} {:>9} {:>8} {:>12} {:>14}",
+        "scenario", "events", "bytes", "parsed", "allocs/event", "alloc B/event"
+    );
+    for scenario in scenarios {
+        // Warm up lazily initialized provider tables outside the counted run
+        replay(scenario);
+
+        ALLOCS.store(0, Ordering::Relaxed);
+        ALLOC_BYTES.store(0, Ordering::Relaxed);
+        COUNTING.store(true, Ordering::Relaxed);
+        let parsed = replay(scenario);
+        COUNTING.store(false, Ordering::Relaxed);
+
+        let events = scenario.events.len() as f64;
+        println!(
+            "{:<32} {:>7} {:>9} {:>8} {:>12.2} {:>14.0}",
+            scenario.id,
+            scenario.events.len(),
+            scenario.bytes,
+            if parsed { "yes" } else { "no" },
+            ALLOCS.load(Ordering::Relaxed) as f64 / events,
+            ALLOC_BYTES.load(Ordering::Relaxed) as f64 / events
+        );
+    }
+    println!();
+}
+
+fn bench_handle_event(h: &mut Harness, scenarios: &[Scenario]) {
+    // Bytes/s and events/s need separate groups, the harness reports one throughput per group
+    let mut bytes = h.benchmark_group("handle_event_bytes");
+    bytes
+        .sample_size(20)
+        .measurement_time(Duration::from_secs(2));
+    for scenario in scenarios {
+        bytes.throughput(Throughput::Bytes(scenario.bytes));
+        bytes.bench_with_input(
+            BenchmarkId::from_parameter(&scenario.id),
+            scenario,
+            |b, s| b.iter(|| replay(s)),
+        );
+    }
+    bytes.finish();
+
+    let mut events = h.benchmark_group("handle_event_events");
+    events
+        .sample_size(20)
+        .measurement_time(Duration::from_secs(2));
+    for scenario in scenarios {
+        events.throughput(Throughput::Elements(scenario.events.len() as u64));
+        events.bench_with_input(
+            BenchmarkId::from_parameter(&scenario.id),
+            scenario,
+            |b, s| b.iter(|| replay(s)),
+        );
+    }
+    events.finish();
+}
+
+fn main() {
+    let scenarios = scenarios();
+    report_allocations(&scenarios);
+
+    let mut harness = Harness::default().configure_from_args();
+    bench_handle_event(&mut harness, &scenarios);
+    harness.final_summary();
+}
@@ -0,0 +1,71 @@
+//! Token estimator throughput: tiktoken-compatible BPE over the request and response
+//! fixtures in `benches/fixtures/`, reported in tokens per second.
+//!
+//! `pieces` measures pre-tokenization alone, `count` the full count with merges. The
+//! vocabularies are not vendored: point `HONEYBEEPF_TOKENIZER_DIR` (or `LLM__TOKENIZER_DIR`)
+//! at a directory holding `cl100k_base.tiktoken` and/or `o200k_base.tiktoken`, then run
+//! `cargo bench -p honeybeepf --bench tokenizer`.
+
+mod harness;
+
+use std::{hint::black_box, path::PathBuf};
+
+use honeybeepf::probes::builtin::llm::tokenizer::{Tokenizer, Vocab, pieces};
+
+use harness::{Harness, Throughput};
+
+const FIXTURES: [&str; 9] = [
+    include_str!("fixtures/openai_request.json"),
+    include_str!("fixtures/openai_response.json"),
+    include_str!("fixtures/openai_stream.sse"),
+    include_str!("fixtures/anthropic_request.json"),
+    include_str!("fixtures/anthropic_response.json"),
+    include_str!("fixtures/anthropic_stream.sse"),
+    include_str!("fixtures/gemini_request.json"),
+    include_str!("fixtures/gemini_response.json"),
+    include_str!("fixtures/gemini_stream.sse"),
+];
+
+fn bench_tokenizer(h: &mut Harness) {
+    let Some(dir) = std::env::var_os("HONEYBEEPF_TOKENIZER_DIR")
+        .or_else(|| std::env::var_os("LLM__TOKENIZER_DIR"))
+        .map(PathBuf::from)
+    else {
+        println!("HONEYBEEPF_TOKENIZER_DIR is not set, skipping tokenizer benchmarks");
+        return;
+    };
+
+    let text = FIXTURES.concat();
+
+    for vocab in Vocab::ALL {
+        let path = dir.join(vocab.file_name());
+        let tokenizer = match Tokenizer::load(vocab, &path) {
+            Ok(tokenizer) => tokenizer,
+            Err(e) => {
+                println!("{:?}: {:#}, skipping", vocab, e);
+                continue;
+            }
+        };
+        let tokens = tokenizer.count(&text) as u64;
+        println!(
+            "{:?}: {} bytes of fixtures, {} tokens",
+            vocab,
+            text.len(),
+            tokens
+        );
+
+        let mut group = h.benchmark_group(format!("tokenizer/{:?}", vocab));
+        group.throughput(Throughput::Elements(tokens));
+        group.bench_function("pieces", |b| {
+            b.iter(|| pieces(black_box(&text), vocab).count())
+        });
+        group.bench_function("count", |b| b.iter(|| tokenizer.count(black_box(&text))));
+        group.finish();
+    }
+}
+
+fn main() {
+    let mut harness = Harness::default().configure_from_args();
+    bench_tokenizer(&mut harness);
+    harness.final_summary();
+}
@@ -0,0 +1,469 @@
+//! Local control socket.
+//!
+//! A line protocol on a Unix socket (`CONTROL__SOCKET`, mode 0600): one command per line,
+//! answered with one `ok ...` or `error ...` line. For example with
+//! `socat - UNIX-CONNECT:/run/honeybeepf/control.sock`:
+//!
+//! ```text
+//! status
+//! attach <probe>            block_io, network_latency, gpu_usage or llm
+//! detach <probe>            also frees the probe's maps and links
+//! sample <n>                event sink keeps 1 in n events per probe
+//! filter <cgroup_id>...     only handle events of these cgroups
+//! filter off
+//! capture <secs> <path> [pid <pid> | cgroup <cgroup_id>]
+//! dump [<cgroup_id>]        flight recorder dump
+//! handoff                   detach every probe for a new agent (see `request_handoff`)
+//! ```
+//!
+//! `status`, `attach`, `detach` and `handoff` need the eBPF objects owned by
+//! `HoneyBeeEngine` and are forwarded to its main loop; the other commands are handled here.
+//!
+//! After `handoff`, the connection is kept for the new agent to send `ready` once its own
+//! probes are attached. Without it in time, or if the connection drops, the old agent
+//! re-attaches its probes.
+
+use std::{
+    collections::HashSet,
+    io::Write,
+    os::unix::fs::{FileTypeExt, PermissionsExt},
+    path::{Path, PathBuf},
+    time::Duration,
+};
+
+use anyhow::{Context, Result, anyhow, bail};
+use log::{info, warn};
+use tokio::{
+    io::{AsyncBufReadExt, AsyncWriteExt, BufReader, Lines},
+    net::{UnixListener, UnixStream, unix::OwnedReadHalf},
+    sync::{mpsc, oneshot},
+};
+
+use crate::{
+    probes::{
+        self,
+        capture::{self, CaptureScope},
+        loader::ProbeKind,
+    },
+    recorder,
+    settings::ControlSettings,
+    sink,
+};
+
+/// Longest capture session a command may start
+const MAX_CAPTURE_SECS: u64 = 3600;
+const ENGINE_QUEUE_CAPACITY: usize = 16;
+/// Longest a client waits for a reply (detaching the LLM probe drains its rings)
+const REPLY_TIMEOUT: Duration = Duration::from_secs(30);
+/// Longest an agent that handed off its probes waits for the new agent to attach
+const HANDOFF_READY_TIMEOUT: Duration = Duration::from_secs(60);
+
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum Command {
+    Status,
+    Attach(ProbeKind),
+    Detach(ProbeKind),
+    Sample(u32),
+    /// `None` removes the filter
+    Filter(Option<HashSet<u64>>),
+    Capture {
+        duration: Duration,
+        path: PathBuf,
+        scope: CaptureScope,
+    },
+    Dump(Option<u64>),
+    Handoff,
+    /// Re-attach the probes detached by `Handoff`. Sent by `serve` when the new agent does
+    /// not become ready; there is no command line for it.
+    Resume,
+}
+
+/// A command for the engine's main loop and where to send its reply line.
+pub struct EngineRequest {
+    pub command: Command,
+    pub reply: oneshot::Sender<Result<String>>,
+}
+
+fn parse_probe(arg: Option<&str>) -> Result<ProbeKind> {
+    let name = arg.context("Missing probe name")?;
+    ProbeKind::from_name(name).with_context(|| format!("Unknown probe '{}'", name))
+}
+
+fn parse_number<T: std::str::FromStr>(arg: Option<&str>, what: &str) -> Result<T> {
+    let arg = arg.with_context(|| format!("Missing {}", what))?;
+    arg.parse()
+        .map_err(|_| anyhow!("Invalid {} '{}'", what, arg))
+}
+
+pub fn parse(line: &str) -> Result<Command> {
+    let mut args = line.split_whitespace();
+    let command = match args.next().context("Empty command")? {
+        "status" => Command::Status,
+        "handoff" => Command::Handoff,
+        "attach" => Command::Attach(parse_probe(args.next())?),
+        "detach" => Command::Detach(parse_probe(args.next())?),
+        "sample" => {
+            let rate: u32 = parse_number(args.next(), "sample rate")?;
+            if rate == 0 {
+                bail!("Sample rate must be at least 1");
+            }
+            Command::Sample(rate)
+        }
+        "filter" => {
+            let ids: Vec<&str> = args.by_ref().collect();
+            match ids.as_slice() {
+                [] => bail!("Missing cgroup ids (or 'off')"),
+                ["off"] => Command::Filter(None),
+                ids => Command::Filter(Some(
+                    ids.iter()
+                        .map(|id| parse_number(Some(id), "cgroup id"))
+                        .collect::<Result<_>>()?,
+                )),
+            }
+        }
+        "capture" => {
+            let secs: u64 = parse_number(args.next(), "duration")?;
+            if secs == 0 || secs > MAX_CAPTURE_SECS {
+                bail!(
+                    "Duration must be between 1 and {} seconds",
+                    MAX_CAPTURE_SECS
+                );
+            }
+            let path = PathBuf::from(args.next().context("Missing capture path")?);
+            let scope = match args.next() {
+                None => CaptureScope::All,
+                Some("pid") => CaptureScope::Pid(parse_number(args.next(), "pid")?),
+                Some("cgroup") => CaptureScope::Cgroup(parse_number(args.next(), "cgroup id")?),
+                Some(other) => bail!("Unknown capture scope '{}' (expected pid or cgroup)", other),
+            };
+            Command::Capture {
+                duration: Duration::from_secs(secs),
+                path,
+                scope,
+            }
+        }
+        "dump" => Command::Dump(match args.next() {
+            Some(id) => Some(parse_number(Some(id), "cgroup id")?),
+            None => None,
+        }),
+        other => bail!("Unknown command '{}'", other),
+    };
+    if let Some(extra) = args.next() {
+        bail!("Unexpected argument '{}'", extra);
+    }
+    Ok(command)
+}
+
+/// Listen on `CONTROL__SOCKET`, if set. Returns the queue of requests for the engine.
+/// Takes the socket over from a previous agent. Must be called from within the tokio runtime.
+pub fn spawn(settings: &ControlSettings) -> Result<Option<mpsc::Receiver<EngineRequest>>> {
+    let Some(path) = settings.socket.as_deref() else {
+        return Ok(None);
+    };
+    let path = Path::new(path);
+    // A socket left behind by a previous run blocks the bind
+    if std::fs::symlink_metadata(path).is_ok_and(|m| m.file_type().is_socket()) {
+        std::fs::remove_file(path)
+            .with_context(|| format!("Failed to remove stale socket {}", path.display()))?;
+    }
+    if let Some(parent) = path.parent() {
+        std::fs::create_dir_all(parent)
+            .with_context(|| format!("Failed to create {}", parent.display()))?;
+    }
+    let listener = UnixListener::bind(path)
+        .with_context(|| format!("Failed to bind control socket {}", path.display()))?;
+    std::fs::set_permissions(path, std::fs::Permissions::from_mode(0o600))?;
+
+    let (tx, rx) = mpsc::channel(ENGINE_QUEUE_CAPACITY);
+    tokio::spawn(async move {
+        loop {
+            match listener.accept().await {
+                Ok((stream, _)) => {
+                    tokio::spawn(serve(stream, tx.clone()));
+                }
+                Err(e) => {
+                    warn!("Control socket accept failed: {}", e);
+                    tokio::time::sleep(Duration::from_secs(1)).await;
+                }
+            }
+        }
+    });
+    info!("Control socket listening on {}", path.display());
+    Ok(Some(rx))
+}
+
+async fn serve(stream: UnixStream, engine: mpsc::Sender<EngineRequest>) {
+    let (read, mut write) = stream.into_split();
+    let mut lines = BufReader::new(read).lines();
+    while let Ok(Some(line)) = lines.next_line().await {
+        if line.trim().is_empty() {
+            continue;
+        }
+        let result = execute(&line, &engine).await;
+        let handed_off = result.is_ok() && matches!(parse(&line), Ok(Command::Handoff));
+        let reply = match result {
+            Ok(message) if message.is_empty() => "ok\n".to_string(),
+            Ok(message) => format!("ok {}\n", message),
+            Err(e) => format!("error {:#}\n", e),
+        };
+        let sent = write.write_all(reply.as_bytes()).await.is_ok();
+        if handed_off {
+            if sent && await_ready(&mut lines).await {
+                info!("New agent is ready, waiting to be stopped");
+                let _ = write.write_all(b"ok\n").await;
+            } else {
+                match forward(Command::Resume, &engine).await {
+                    Ok(message) => info!("Handoff abandoned, {}", message),
+                    Err(e) => warn!("Handoff abandoned, failed to re-attach probes: {:#}", e),
+                }
+            }
+            break;
+        }
+        if !sent {
+            break;
+        }
+    }
+}
+
+/// Wait for the agent that took a handoff to report `ready` on the same connection.
+async fn await_ready(lines: &mut Lines<BufReader<OwnedReadHalf>>) -> bool {
+    match tokio::time::timeout(HANDOFF_READY_TIMEOUT, lines.next_line()).await {
+        Ok(Ok(Some(line))) if line.trim() == "ready" => true,
+        Ok(Ok(Some(line))) => {
+            warn!("Expected 'ready' after handoff, got '{}'", line.trim());
+            false
+        }
+        Ok(_) => {
+            warn!("New agent disconnected before it was ready");
+            false
+        }
+        Err(_) => {
+            warn!(
+                "New agent not ready after {}s",
+                HANDOFF_READY_TIMEOUT.as_secs()
+            );
+            false
+        }
+    }
+}
+
+async fn execute(line: &str, engine: &mpsc::Sender<EngineRequest>) -> Result<String> {
+    let command = parse(line)?;
+    info!("Control command: {}", line.trim());
+    match command {
+        Command::Sample(rate) => {
+            if !sink::enabled() {
+                bail!("Event sink is not enabled");
+            }
+            sink::set_sample_rate(rate);
+            Ok(format!("keeping 1 in {} events", rate))
+        }
+        Command::Filter(cgroups) => {
+            let message = match &cgroups {
+                Some(cgroups) => format!("{} cgroup(s)", cgroups.len()),
+                None => "off".to_string(),
+            };
+            probes::set_cgroup_filter(cgroups);
+            Ok(message)
+        }
+        Command::Capture {
+            duration,
+            path,
+            scope,
+        } => {
+            let session = capture::start_capture_session(&path, scope)?;
+            tokio::spawn(async move {
+                tokio::time::sleep(duration).await;
+                capture::stop_capture_session(session);
+            });
+            Ok(format!(
+                "capturing {:?} to {} for {}s",
+                scope,
+                path.display(),
+                duration.as_secs()
+            ))
+        }
+        Command::Dump(cgroup) => {
+            if !recorder::enabled() {
+                bail!("Flight recorder is not enabled");
+            }
+            if !recorder::trigger(recorder::Trigger::Command(cgroup)) {
+                bail!("Too many dumps pending");
+            }
+            Ok("dump queued".to_string())
+        }
+        command => forward(command, engine).await,
+    }
+}
+
+/// Run `command` on the engine's main loop and wait for its reply.
+async fn forward(command: Command, engine: &mpsc::Sender<EngineRequest>) -> Result<String> {
+    let (reply, response) = oneshot::channel();
+    engine
+        .send(EngineRequest { command, reply })
+        .await
+        .map_err(|_| anyhow!("Agent is shutting down"))?;
+    response
+        .await
+        .map_err(|_| anyhow!("Agent is shutting down"))?
+}
+
+/// A handoff in progress: the previous agent has detached its probes and waits on this
+/// connection for `ready`. Dropping it without calling `ready` makes that agent re-attach
+/// them.
+pub struct Handoff {
+    stream: std::os::unix::net::UnixStream,
+    /// Reply of the previous agent to `handoff`
+    pub reply: String,
+}
+
+impl Handoff {
+    /// Tell the previous agent that this agent's probes are attached.
+    pub fn ready(self) -> Result<()> {
+        let reply = exchange(&self.stream, "ready")?;
+        if !reply.starts_with("ok") {
+            bail!("Previous agent answered '{}'", reply);
+        }
+        Ok(())
+    }
+}
+
+/// Ask the agent currently listening on `CONTROL__SOCKET` (the one being upgraded) to
+/// detach its probes, right before this agent attaches its own. The tables they share are
+/// pinned, so only events in between are missed. `None` when no agent answers.
+pub async fn request_handoff(settings: &ControlSettings) -> Option<Handoff> {
+    let path = PathBuf::from(settings.socket.as_deref()?);
+    if !std::fs::symlink_metadata(&path).is_ok_and(|m| m.file_type().is_socket()) {
+        return None;
+    }
+    let handoff = tokio::task::spawn_blocking(move || {
+        let stream = connect(&path)?;
+        let reply = exchange(&stream, "handoff")?;
+        Ok::<_, anyhow::Error>(Handoff { stream, reply })
+    });
+    match handoff.await {
+        Ok(Ok(handoff)) if handoff.reply.starts_with("ok") => Some(handoff),
+        Ok(Ok(handoff)) => {
+            warn!("Previous agent refused the handoff: {}", handoff.reply);
+            None
+        }
+        // Nobody listening: the socket was left behind by an agent that exited
+        Ok(Err(_)) | Err(_) => None,
+    }
+}
+
+/// Client side: send one command line and return the reply line.
+pub fn send_command(socket: &Path, command: &str) -> Result<String> {
+    exchange(&connect(socket)?, command)
+}
+
+fn connect(socket: &Path) -> Result<std::os::unix::net::UnixStream> {
+    let stream = std::os::unix::net::UnixStream::connect(socket)
+        .with_context(|| format!("Failed to connect to {}", socket.display()))?;
+    stream.set_read_timeout(Some(REPLY_TIMEOUT))?;
+    Ok(stream)
+}
+
+/// Send one command line on `stream` and read the reply line. The agent replies to one
+/// line at a time, so nothing past the reply is buffered away.
+fn exchange(mut stream: &std::os::unix::net::UnixStream, command: &str) -> Result<String> {
+    writeln!(stream, "{}", command)?;
+    let mut reply = String::new();
+    std::io::BufRead::read_line(&mut std::io::BufReader::new(stream), &mut reply)?;
+    if reply.is_empty() {
+        bail!("Agent closed the connection");
+    }
+    Ok(reply.trim_end().to_string())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_parse() {
+        assert_eq!(
+            parse("attach block_io").unwrap(),
+            Command::Attach(ProbeKind::BlockIo)
+        );
+        assert_eq!(
+            parse(" detach  llm ").unwrap(),
+            Command::Detach(ProbeKind::Llm)
+        );
+        assert_eq!(
+            parse("filter 7 9").unwrap(),
+            Command::Filter(Some(HashSet::from([7, 9])))
+        );
+        assert_eq!(parse("filter off").unwrap(), Command::Filter(None));
+        assert_eq!(
+            parse("capture 30 /tmp/x.hbcap cgroup 42").unwrap(),
+            Command::Capture {
+                duration: Duration::from_secs(30),
+                path: PathBuf::from("/tmp/x.hbcap"),
+                scope: CaptureScope::Cgroup(42),
+            }
+        );
+        assert_eq!(parse("dump").unwrap(), Command::Dump(None));
+        assert_eq!(parse("handoff").unwrap(), Command::Handoff);
+
+        assert!(parse("attach kprobe").is_err());
+        assert!(parse("sample 0").is_err());
+        assert!(parse("capture 0 /tmp/x.hbcap").is_err());
+        assert!(parse("capture 10 /tmp/x.hbcap pid").is_err());
+        assert!(parse("status now").is_err());
+        assert!(parse("filter 7 x").is_err());
+    }
+
+    /// Serve one connection against an engine that records the commands it runs
+    fn serve_pair() -> (UnixStream, mpsc::UnboundedReceiver<Command>) {
+        let (client, server) = UnixStream::pair().unwrap();
+        let (engine, mut requests) = mpsc::channel::<EngineRequest>(ENGINE_QUEUE_CAPACITY);
+        let (seen, commands) = mpsc::unbounded_channel();
+        tokio::spawn(async move {
+            while let Some(request) = requests.recv().await {
+                let _ = request.reply.send(Ok(format!("{:?}", request.command)));
+                let _ = seen.send(request.command);
+            }
+        });
+        tokio::spawn(serve(server, engine));
+        (client, commands)
+    }
+
+    async fn exchange_async(client: &mut UnixStream, command: &str) -> String {
+        client
+            .write_all(format!("{}\n", command).as_bytes())
+            .await
+            .unwrap();
+        let mut reply = Vec::new();
+        let mut byte = [0u8; 1];
+        while tokio::io::AsyncReadExt::read(client, &mut byte)
+            .await
+            .unwrap()
+            == 1
+        {
+            if byte[0] == b'\n' {
+                break;
+            }
+            reply.push(byte[0]);
+        }
+        String::from_utf8(reply).unwrap()
+    }
+
+    #[tokio::test]
+    async fn test_handoff_waits_for_ready() {
+        let (mut client, mut commands) = serve_pair();
+        assert_eq!(exchange_async(&mut client, "handoff").await, "ok Handoff");
+        assert_eq!(exchange_async(&mut client, "ready").await, "ok");
+        drop(client);
+        assert_eq!(commands.recv().await, Some(Command::Handoff));
+        // The engine channel closes with the connection, without a resume
+        assert_eq!(commands.recv().await, None);
+
+        // The new agent went away before it was ready
+        let (mut client, mut commands) = serve_pair();
+        assert_eq!(exchange_async(&mut client, "handoff").await, "ok Handoff");
+        drop(client);
+        assert_eq!(commands.recv().await, Some(Command::Handoff));
+        assert_eq!(commands.recv().await, Some(Command::Resume));
+    }
+}
@@ -0,0 +1,201 @@
+//! Agent CPU budget governor.
+//!
+//! Every interval the governor compares the agent's own CPU time (`/proc/self/stat`) with
+//! its budget, `GOVERNOR__CPU_MILLICORES` or else the cgroup CPU limit, and checks the
+//! per-ring drop counters. Over budget, or dropping events, it doubles the in-kernel
+//! sampling rate (keep 1 in N) of the high-volume rings; well under budget without drops
+//! it halves the rate again. The engine writes the rates into each probe's `RING_SAMPLE`
+//! map.
+//!
+//! Only rings whose events stand alone are sampled. SSL chunks, exec notifications and GPU
+//! open/close pairs must arrive complete. The current rates are exported as the
+//! `ring_sample_rate` gauge. Events carry the rate they were sampled at, and handlers
+//! weight what they count by it, so totals stay unbiased across rate changes.
+
+use std::{
+    sync::atomic::{AtomicU32, AtomicU64, Ordering},
+    time::{Duration, Instant},
+};
+
+use honeybeepf_common::{RING_COUNT, RingId};
+use log::{info, warn};
+
+use crate::{probes::ring_drops_total, settings::GovernorSettings};
+
+/// Rings the governor may sample
+pub const SAMPLED_RINGS: [RingId; 2] = [RingId::BlockIo, RingId::Network];
+
+const DEFAULT_INTERVAL_SECS: u64 = 10;
+const DEFAULT_MAX_SAMPLE_RATE: u32 = 1024;
+/// Tighten above this share of the budget
+const HIGH_WATERMARK: f64 = 0.9;
+/// Relax below this share of the budget
+const LOW_WATERMARK: f64 = 0.6;
+
+static SAMPLE_RATES: [AtomicU32; RING_COUNT as usize] =
+    [const { AtomicU32::new(1) }; RING_COUNT as usize];
+static CPU_MILLICORES: AtomicU64 = AtomicU64::new(0);
+
+/// Current keep-1-in-N rate of `ring`: the number of events each received event stands for.
+#[inline]
+pub fn sample_rate(ring: RingId) -> u32 {
+    SAMPLE_RATES[ring as usize].load(Ordering::Relaxed)
+}
+
+/// Agent CPU usage over the last interval, 0 while the governor is off
+pub fn cpu_millicores() -> u64 {
+    CPU_MILLICORES.load(Ordering::Relaxed)
+}
+
+pub struct Governor {
+    pub interval: Duration,
+    budget_cores: f64,
+    max_rate: u32,
+    last_cpu_secs: f64,
+    last_at: Instant,
+    last_drops: [u64; SAMPLED_RINGS.len()],
+}
+
+impl Governor {
+    /// `None` when disabled or when no budget is configured or detectable.
+    pub fn new(settings: &GovernorSettings) -> Option<Self> {
+        if !settings.enabled.unwrap_or(true) {
+            return None;
+        }
+        let budget_cores = match settings.cpu_millicores {
+            Some(0) => return None,
+            Some(millicores) => millicores as f64 / 1000.0,
+            None => cgroup_cpu_limit()?,
+        };
+        let interval = Duration::from_secs(
+            settings
+                .interval_secs
+                .unwrap_or(DEFAULT_INTERVAL_SECS)
+                .max(1),
+        );
+        info!(
+            "CPU governor active: budget {:.0}m, checked every {}s",
+            budget_cores * 1000.0,
+            interval.as_secs()
+        );
+        Some(Self {
+            interval,
+            budget_cores,
+            max_rate: settings
+                .max_sample_rate
+                .unwrap_or(DEFAULT_MAX_SAMPLE_RATE)
+                .max(1),
+            last_cpu_secs: process_cpu_secs().unwrap_or(0.0),
+            last_at: Instant::now(),
+            last_drops: SAMPLED_RINGS.map(ring_drops_total),
+        })
+    }
+
+    /// Measure the last interval and return the rings whose rate should change.
+    pub fn tick(&mut self) -> Vec<(RingId, u32)> {
+        let Some(cpu_secs) = process_cpu_secs() else {
+            return Vec::new();
+        };
+        let elapsed = self.last_at.elapsed().as_secs_f64();
+        let cores = (cpu_secs - self.last_cpu_secs) / elapsed.max(1e-3);
+        self.last_cpu_secs = cpu_secs;
+        self.last_at = Instant::now();
+        CPU_MILLICORES.store((cores * 1000.0) as u64, Ordering::Relaxed);
+        let load = cores / self.budget_cores;
+
+        let mut changes = Vec::new();
+        for (i, ring) in SAMPLED_RINGS.into_iter().enumerate() {
+            let drops = ring_drops_total(ring);
+            let dropped = drops > self.last_drops[i];
+            self.last_drops[i] = drops;
+
+            let rate = sample_rate(ring);
+            let next = next_rate(rate, load, dropped, self.max_rate);
+            if next != rate {
+                if next > rate {
+                    warn!(
+                        "CPU governor: {} ring now keeps 1 in {} events (cpu {:.0}% of budget{})",
+                        ring.name(),
+                        next,
+                        load * 100.0,
+                        if dropped { ", ring dropping" } else { "" }
+                    );
+                } else {
+                    info!(
+                        "CPU governor: {} ring now keeps 1 in {} events",
+                        ring.name(),
+                        next
+                    );
+                }
+                changes.push((ring, next));
+            }
+        }
+        changes
+    }
+}
+
+/// Record a rate once it is in effect in the kernel.
+pub fn set_sample_rate(ring: RingId, rate: u32) {
+    SAMPLE_RATES[ring as usize].store(rate.max(1), Ordering::Relaxed);
+}
+
+fn next_rate(rate: u32, load: f64, dropped: bool, max_rate: u32) -> u32 {
+    if load > HIGH_WATERMARK || dropped {
+        rate.saturating_mul(2).min(max_rate)
+    } else if load < LOW_WATERMARK {
+        (rate / 2).max(1)
+    } else {
+        rate
+    }
+}
+
+/// User plus system CPU time of this process, in seconds
+fn process_cpu_secs() -> Option<f64> {
+    let stat = std::fs::read_to_string("/proc/self/stat").ok()?;
+    // Fields after the parenthesized command name, which may contain spaces
+    let mut fields = stat.get(stat.rfind(')')? + 2..)?.split_whitespace();
+    // utime and stime are fields 14 and 15; the first field here is field 3 (state)
+    let utime: u64 = fields.nth(11)?.parse().ok()?;
+    let stime: u64 = fields.next()?.parse().ok()?;
+    let ticks = unsafe { libc::sysconf(libc::_SC_CLK_TCK) };
+    (ticks > 0).then(|| (utime + stime) as f64 / ticks as f64)
+}
+
+/// CPU limit of the agent's cgroup in cores (`cpu.max`, or the v1 CFS quota)
+fn cgroup_cpu_limit() -> Option<f64> {
+    let (quota, period) = match std::fs::read_to_string("/sys/fs/cgroup/cpu.max") {
+        Ok(max) => {
+            let mut fields = max.split_whitespace();
+            let quota = fields.next()?.parse::<f64>().ok()?;
+            (quota, fields.next()?.parse::<f64>().ok()?)
+        }
+        Err(_) => {
+            let read = |name: &str| {
+                std::fs::read_to_string(format!("/sys/fs/cgroup/cpu/{}", name))
+                    .ok()?
+                    .trim()
+                    .parse::<f64>()
+                    .ok()
+            };
+            (read("cpu.cfs_quota_us")?, read("cpu.cfs_period_us")?)
+        }
+    };
+    // "max" does not parse and -1 means unlimited
+    (quota > 0.0 && period > 0.0).then(|| quota / period)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_next_rate() {
+        assert_eq!(next_rate(1, 1.2, false, 1024), 2);
+        assert_eq!(next_rate(4, 0.5, true, 1024), 8);
+        assert_eq!(next_rate(1024, 2.0, true, 1024), 1024);
+        // Hysteresis between the watermarks
+        assert_eq!(next_rate(8, 0.75, false, 1024), 8);
+        assert_eq!(next_rate(8, 0.3, false, 1024), 4);
+        assert_eq!(next_rate(1, 0.1, false, 1024), 1);
+    }
+}
@@ -1,96 +1,289 @@
+pub mod control;
+pub mod governor;
+pub mod recorder;
 pub mod settings;
+pub mod sink;
+pub mod store;
 pub mod telemetry;
 
-use std::{collections::HashSet, sync::atomic::Ordering, time::Duration};
+use std::{
+    collections::{HashMap, HashSet},
+    path::Path,
+    sync::atomic::Ordering,
+    time::{Duration, Instant},
+};
 
-use anyhow::Result;
+use anyhow::{Context, Result, bail};
 use aya::Ebpf;
-use aya_log::EbpfLogger;
+use honeybeepf_common::RingId;
 use log::{info, warn};
-use tokio::signal;
+use tokio::{
+    signal::{
+        self,
+        unix::{Signal, SignalKind, signal as unix_signal},
+    },
+    sync::mpsc,
+};
 
-use crate::settings::Settings;
+use crate::{
+    control::{Command, EngineRequest},
+    governor::Governor,
+    settings::Settings,
+};
 
 pub mod probes;
 use crate::probes::{
     Probe,
     builtin::{
-        block_io::BlockIoProbe,
-        gpu_usage::GpuUsageProbe,
+        block_io::{self, BlockIoProbe},
+        gpu_usage::{self, GpuUsageProbe},
         llm::{
-            ExecNotify, ExecPidQueue, LlmProbe, attach_new_targets_for_pids, discovery,
-            setup_exec_watch,
+            ExecNotify, ExecPidQueue, LlmProbe, attach_new_targets, attach_new_targets_for_pids,
+            discover_targets, discovery, estimator, pipeline::SslPipeline, setup_exec_watch,
+            ssl_event_handler,
         },
-        network::NetworkLatencyProbe,
+        network::{self, NetworkLatencyProbe},
     },
-    request_shutdown, shutdown_flag,
+    capture::{self, CaptureFile, ReplaySpeed, ReplayStats, Replayer},
+    loader::{
+        MapLimits, ProbeKind, configure_wakeup, load_probe_object, load_programs, owner_of_ring,
+        set_ring_sampling,
+    },
+    request_shutdown, shutdown_flag, spawn_drop_monitor, stop_probe_tasks,
 };
 
+/// Present once every enabled probe is attached (the chart's readiness probe)
+const READY_FILE: &str = "/tmp/honeybeepf.ready";
+
 pub struct HoneyBeeEngine {
     pub settings: Settings,
-    bpf: Ebpf,
+    bytecode: &'static [u8],
+    limits: MapLimits,
+    /// One independently loaded eBPF object per attached builtin probe
+    objects: HashMap<ProbeKind, Ebpf>,
+    /// Exec notifications for SSL re-discovery, while the LLM probe is attached
+    exec_watch: Option<(ExecPidQueue, ExecNotify)>,
+    /// SSL libraries the LLM probe is attached to
+    known_targets: HashSet<String>,
+    /// Background full scan after the LLM probe attached from the discovery cache
+    full_scan: Option<std::sync::mpsc::Receiver<HashSet<String>>>,
+    /// SSL libraries discovered during startup, for the first attach of the LLM probe
+    startup_targets: Option<(Instant, Result<(HashSet<String>, bool)>)>,
+    /// Probes detached by a handoff, re-attached if the new agent never becomes ready
+    handed_off: Vec<ProbeKind>,
+}
+
+/// Load the probe's own eBPF object and configure its rings. Dropping the object later
+/// releases every map and link that belongs to the probe, except pinned tables.
+fn load_probe(
+    settings: &Settings,
+    bytecode: &[u8],
+    limits: &MapLimits,
+    kind: ProbeKind,
+) -> Result<Ebpf> {
+    let pin_root = settings.maps.pin_dir.as_deref().map(Path::new);
+    let mut bpf = load_probe_object(bytecode, kind, limits, pin_root)?;
+    if let Err(e) = configure_wakeup(&mut bpf, kind, limits, &settings.wakeup) {
+        warn!(
+            "Wakeup batching unavailable for {}, waking on every event: {}",
+            kind.name(),
+            e
+        );
+    }
+    for ring in governor::SAMPLED_RINGS {
+        let rate = governor::sample_rate(ring);
+        if rate > 1
+            && owner_of_ring(ring) == Some(kind)
+            && let Err(e) = set_ring_sampling(&mut bpf, ring, rate)
+        {
+            warn!("Failed to set sampling of {} ring: {}", ring.name(), e);
+        }
+    }
+    Ok(bpf)
 }
 
 impl HoneyBeeEngine {
-    pub fn new(settings: Settings, bytecode: &[u8]) -> Result<Self> {
+    pub fn new(settings: Settings, bytecode: &'static [u8]) -> Result<Self> {
         bump_memlock_rlimit()?;
-        let mut bpf = Ebpf::load(bytecode)?;
-        if let Err(e) = EbpfLogger::init(&mut bpf) {
-            warn!("Failed to initialize eBPF logger: {}", e);
-        }
-        Ok(Self { settings, bpf })
+        let limits = MapLimits::detect(&settings.maps);
+        Ok(Self {
+            settings,
+            bytecode,
+            limits,
+            objects: HashMap::new(),
+            exec_watch: None,
+            known_targets: HashSet::new(),
+            full_scan: None,
+            startup_targets: None,
+            handed_off: Vec::new(),
+        })
     }
 
+    /// Start up, then serve until Ctrl-C or SIGTERM.
+    ///
+    /// Startup is a small DAG. The OTLP exporter, LLM library discovery and the load and
+    /// verification of every enabled probe (one thread each) run concurrently. The handoff
+    /// and the attaches wait for all of them, so counters are live before the first event.
+    /// Phase durations are logged and exported as `startup_phase_ms`.
     pub async fn run(mut self) -> Result<()> {
-        if let Err(e) = telemetry::init_metrics() {
-            warn!(
+        let started = Instant::now();
+        let mut phases: Vec<(String, Duration)> = Vec::new();
+
+        discovery::cache::init(self.settings.llm.discovery_cache.as_deref());
+        let exporter = tokio::task::spawn_blocking(|| {
+            let started = Instant::now();
+            (telemetry::init_metrics(), started.elapsed())
+        });
+        let llm_discovery = self.settings.builtin_probes.llm.unwrap_or(false).then(|| {
+            tokio::task::spawn_blocking(|| {
+                let started = Instant::now();
+                (started, discover_targets(), started.elapsed())
+            })
+        });
+
+        let outputs_started = Instant::now();
+        if let Err(e) = sink::init(&self.settings.sink) {
+            warn!("Event sink disabled: {:#}", e);
+        }
+        if let Err(e) = store::init(&self.settings.store) {
+            warn!("Local store disabled: {:#}", e);
+        }
+        if let Err(e) = estimator::init(&self.settings.llm) {
+            warn!("LLM token estimates disabled: {:#}", e);
+        }
+        match recorder::init(&self.settings.recorder) {
+            Ok(()) if recorder::enabled() => spawn_dump_on_sigusr1(),
+            Ok(()) => {}
+            Err(e) => warn!("Flight recorder disabled: {:#}", e),
+        }
+        phases.push(("outputs".to_string(), outputs_started.elapsed()));
+
+        // Load (the slow, verifier-bound part) before asking a previous agent to step
+        // down, so that probes are off only while this agent attaches
+        let load_started = Instant::now();
+        let (settings, bytecode, limits) = (self.settings.clone(), self.bytecode, self.limits);
+        let loaded = tokio::task::spawn_blocking(move || {
+            Self::load_enabled_probes(&settings, bytecode, &limits)
+        })
+        .await
+        .unwrap_or_else(|panic| std::panic::resume_unwind(panic.into_panic()))?;
+        phases.push(("load".to_string(), load_started.elapsed()));
+        for (kind, _, took) in &loaded {
+            phases.push((format!("load_{}", kind.name()), *took));
+        }
+
+        match exporter.await {
+            Ok((Ok(()), took)) => phases.push(("exporter".to_string(), took)),
+            Ok((Err(e), _)) => warn!(
                 "Failed to initialize OpenTelemetry metrics: {}. Metrics will not be exported.",
                 e
-            );
+            ),
+            Err(e) => warn!("OpenTelemetry metrics initialization panicked: {}", e),
+        }
+        if let Some(llm_discovery) = llm_discovery {
+            match llm_discovery.await {
+                Ok((discovery_started, targets, took)) => {
+                    phases.push(("discovery".to_string(), took));
+                    self.startup_targets = Some((discovery_started, targets));
+                }
+                Err(e) => warn!("SSL library discovery panicked: {}", e),
+            }
         }
 
-        self.attach_probes()?;
+        let handoff_started = Instant::now();
+        let handoff = control::request_handoff(&self.settings.control).await;
+        phases.push(("handoff".to_string(), handoff_started.elapsed()));
+        let handed_off_at = Instant::now();
+        let control = control::spawn(&self.settings.control).unwrap_or_else(|e| {
+            warn!("Control socket disabled: {:#}", e);
+            None
+        });
 
-        // Start LLM dynamic discovery if enabled
-        if self.settings.builtin_probes.llm.unwrap_or(false) {
-            let (queue, notify) = setup_exec_watch(&mut self.bpf)?;
-            self.run_llm_discovery(queue, notify).await?;
-        } else {
-            info!("Monitoring active. Press Ctrl-C to exit.");
-            signal::ctrl_c().await?;
+        for (kind, bpf, _) in loaded {
+            self.attach_loaded(kind, bpf)?;
+        }
+        phases.push(("attach".to_string(), handed_off_at.elapsed()));
+        if let Some(handoff) = handoff {
+            let gap = handed_off_at.elapsed();
+            info!(
+                "Took over from the previous agent ({}); probes were detached for {}ms",
+                handoff.reply,
+                gap.as_millis()
+            );
+            telemetry::record_handoff_gap(gap);
+            match tokio::task::spawn_blocking(move || handoff.ready()).await {
+                Ok(Ok(())) => {}
+                Ok(Err(e)) => warn!("Failed to tell the previous agent we are ready: {:#}", e),
+                Err(e) => warn!("Handoff confirmation panicked: {}", e),
+            }
         }
+        if let Err(e) = std::fs::write(READY_FILE, b"") {
+            warn!("Failed to create {}: {}", READY_FILE, e);
+        }
+        phases.push(("ready".to_string(), started.elapsed()));
+        info!(
+            "Ready in {}ms ({})",
+            started.elapsed().as_millis(),
+            phases
+                .iter()
+                .map(|(phase, took)| format!("{} {}ms", phase, took.as_millis()))
+                .collect::<Vec<_>>()
+                .join(", ")
+        );
+        for (phase, took) in &phases {
+            telemetry::record_startup_phase(phase, *took);
+        }
+
+        self.run_main_loop(control).await;
 
+        let _ = std::fs::remove_file(READY_FILE);
         request_shutdown();
+        capture::stop_capture();
+        sink::shutdown();
+        estimator::shutdown();
+        store::shutdown();
+        recorder::shutdown();
         info!("Exiting...");
         Ok(())
     }
 
-    /// Run the LLM discovery loop that monitors for new processes and attaches SSL probes.
-    async fn run_llm_discovery(&mut self, queue: ExecPidQueue, notify: ExecNotify) -> Result<()> {
+    /// Wait for Ctrl-C or SIGTERM while serving control socket commands, running the CPU governor and,
+    /// with the LLM probe attached, probing the SSL libraries of newly exec'd processes.
+    async fn run_main_loop(&mut self, mut control: Option<mpsc::Receiver<EngineRequest>>) {
         const BATCH_WAIT_MS: u64 = 50;
 
-        // Seed with initial targets to avoid duplicate attachments
-        let mut known_targets: HashSet<String> = discovery::find_all_targets().unwrap_or_default();
         let shutdown = shutdown_flag();
-
-        info!("LLM discovery active. Press Ctrl-C to exit.");
+        let mut governor = Governor::new(&self.settings.governor);
+        let mut governor_ticks = governor.as_ref().map(|g| {
+            let mut ticks = tokio::time::interval(g.interval);
+            ticks.set_missed_tick_behavior(tokio::time::MissedTickBehavior::Delay);
+            ticks
+        });
+        let mut sigterm = unix_signal(SignalKind::terminate())
+            .inspect_err(|e| warn!("Cannot install SIGTERM handler: {}", e))
+            .ok();
+        info!("Monitoring active. Press Ctrl-C to exit.");
 
         loop {
+            let exec_notify = self.exec_watch.as_ref().map(|(_, notify)| notify.clone());
             tokio::select! {
                 _ = signal::ctrl_c() => break,
-                _ = notify.notified() => {
+                _ = terminated(&mut sigterm) => break,
+                Some(request) = next_request(&mut control) => {
+                    let reply = self.handle_command(request.command).await;
+                    let _ = request.reply.send(reply);
+                }
+                _ = notified(exec_notify) => {
                     // Brief delay to batch rapid exec events
                     tokio::time::sleep(Duration::from_millis(BATCH_WAIT_MS)).await;
-
-                    let pids: Vec<u32> = {
-                        let mut q = queue.lock().unwrap_or_else(|e| e.into_inner());
-                        q.drain(..).collect()
-                    };
-
-                    if !pids.is_empty()
-                        && let Err(e) = attach_new_targets_for_pids(&mut self.bpf, &mut known_targets, &pids) {
-                            warn!("LLM re-discovery error: {}", e);
+                    self.rediscover_ssl_targets();
+                }
+                _ = next_tick(&mut governor_ticks) => {
+                    if let Some(governor) = governor.as_mut() {
+                        for (ring, rate) in governor.tick() {
+                            self.apply_ring_sampling(ring, rate);
                         }
+                    }
                 }
             }
 
@@ -100,41 +293,352 @@ impl HoneyBeeEngine {
         }
 
         telemetry::shutdown_metrics();
+    }
 
+    /// Watch execs so that SSL libraries of new processes get probed too. `known` are the
+    /// libraries found at attach time; with `scan_pending` they came from the discovery
+    /// cache, and libraries loaded while no agent ran are picked up by a background scan.
+    fn start_llm_discovery(&mut self, known: HashSet<String>, scan_pending: bool) -> Result<()> {
+        let Some(bpf) = self.objects.get_mut(&ProbeKind::Llm) else {
+            return Ok(());
+        };
+        let (queue, notify) = setup_exec_watch(bpf)?;
+        self.known_targets = known;
+        if scan_pending {
+            let (tx, rx) = std::sync::mpsc::channel();
+            let wake = notify.clone();
+            std::thread::spawn(move || {
+                if let Ok(targets) = discovery::find_all_targets() {
+                    let _ = tx.send(targets);
+                    wake.notify_one();
+                }
+            });
+            self.full_scan = Some(rx);
+        }
+        self.exec_watch = Some((queue, notify));
+        info!("LLM discovery active.");
         Ok(())
     }
 
-    fn attach_probes(&mut self) -> Result<()> {
-        if self
-            .settings
-            .builtin_probes
-            .network_latency
-            .unwrap_or(false)
+    fn rediscover_ssl_targets(&mut self) {
+        let Some((queue, _)) = &self.exec_watch else {
+            return;
+        };
+        let pids: Vec<u32> = {
+            let mut q = queue.lock().unwrap_or_else(|e| e.into_inner());
+            q.drain(..).collect()
+        };
+
+        if !pids.is_empty()
+            && let Some(bpf) = self.objects.get_mut(&ProbeKind::Llm)
+            && let Err(e) = attach_new_targets_for_pids(bpf, &mut self.known_targets, &pids)
         {
-            NetworkLatencyProbe.attach(&mut self.bpf)?;
+            warn!("LLM re-discovery error: {}", e);
+        }
+
+        if let Some(targets) = self.full_scan.as_ref().and_then(|rx| rx.try_recv().ok()) {
+            self.full_scan = None;
+            if let Some(bpf) = self.objects.get_mut(&ProbeKind::Llm) {
+                attach_new_targets(bpf, &mut self.known_targets, targets);
+            }
+        }
+    }
+
+    /// Run a control socket command that needs the eBPF objects.
+    async fn handle_command(&mut self, command: Command) -> Result<String> {
+        match command {
+            Command::Status => Ok(self.status()),
+            Command::Attach(kind) => {
+                if self.objects.contains_key(&kind) {
+                    bail!("{} is already attached", kind.name());
+                }
+                if let Err(e) = self.attach_builtin(kind) {
+                    // Consumers spawned before the failure still hold maps of the dropped object
+                    stop_probe_tasks(kind).await;
+                    return Err(e);
+                }
+                Ok(format!("{} attached", kind.name()))
+            }
+            Command::Detach(kind) => {
+                self.detach_probe(kind).await?;
+                Ok(format!("{} detached", kind.name()))
+            }
+            Command::Handoff => {
+                let attached: Vec<ProbeKind> = ProbeKind::ALL
+                    .into_iter()
+                    .filter(|kind| self.objects.contains_key(kind))
+                    .collect();
+                for kind in &attached {
+                    self.detach_probe(*kind).await?;
+                    self.handed_off.push(*kind);
+                }
+                info!("Handed off to a new agent, waiting for it to be ready");
+                let names: Vec<&str> = attached.iter().map(|kind| kind.name()).collect();
+                Ok(format!("detached {}", names.join(",")))
+            }
+            Command::Resume => {
+                let mut attached = Vec::new();
+                for kind in std::mem::take(&mut self.handed_off) {
+                    if self.objects.contains_key(&kind) {
+                        continue;
+                    }
+                    match self.attach_builtin(kind) {
+                        Ok(()) => attached.push(kind.name()),
+                        Err(e) => {
+                            stop_probe_tasks(kind).await;
+                            warn!("Failed to re-attach {}: {:#}", kind.name(), e);
+                        }
+                    }
+                }
+                Ok(format!("re-attached {}", attached.join(",")))
+            }
+            other => bail!("Not an engine command: {:?}", other),
+        }
+    }
+
+    fn status(&self) -> String {
+        let probes: Vec<&str> = ProbeKind::ALL
+            .iter()
+            .filter(|kind| self.objects.contains_key(*kind))
+            .map(|kind| kind.name())
+            .collect();
+        let sample = if sink::enabled() {
+            format!("1/{}", sink::sample_rate())
+        } else {
+            "off".to_string()
+        };
+        let filter = match probes::cgroup_filter() {
+            Some(cgroups) => cgroups
+                .iter()
+                .map(|id| id.to_string())
+                .collect::<Vec<_>>()
+                .join(","),
+            None => "off".to_string(),
+        };
+        let rings: Vec<String> = governor::SAMPLED_RINGS
+            .iter()
+            .map(|ring| format!("{}:1/{}", ring.name(), governor::sample_rate(*ring)))
+            .collect();
+        format!(
+            "probes={} sample={} filter={} capture={} recorder={} rings={}",
+            probes.join(","),
+            sample,
+            filter,
+            capture::capture_active(),
+            recorder::enabled(),
+            rings.join(",")
+        )
+    }
+
+    /// Set the in-kernel sampling of `ring`. The rate is recorded even while the owning
+    /// probe is detached, and applied when it is attached again.
+    fn apply_ring_sampling(&mut self, ring: RingId, rate: u32) {
+        if let Some(bpf) = owner_of_ring(ring).and_then(|kind| self.objects.get_mut(&kind))
+            && let Err(e) = set_ring_sampling(bpf, ring, rate)
+        {
+            warn!("Failed to set sampling of {} ring: {}", ring.name(), e);
+            return;
+        }
+        governor::set_sample_rate(ring, rate);
+    }
+
+    /// Load the objects of the probes enabled in the settings and verify their programs,
+    /// without attaching them. Each probe loads on its own thread; returns how long each took.
+    /// Blocks until all are loaded.
+    fn load_enabled_probes(
+        settings: &Settings,
+        bytecode: &[u8],
+        limits: &MapLimits,
+    ) -> Result<Vec<(ProbeKind, Ebpf, Duration)>> {
+        let builtin = &settings.builtin_probes;
+        let enabled = [
+            (ProbeKind::NetworkLatency, builtin.network_latency),
+            (ProbeKind::BlockIo, builtin.block_io),
+            (ProbeKind::GpuUsage, builtin.gpu_usage),
+            (ProbeKind::Llm, builtin.llm),
+        ];
+        let runtime = tokio::runtime::Handle::current();
+        std::thread::scope(|scope| {
+            let loads: Vec<_> = enabled
+                .into_iter()
+                .filter(|(_, enabled)| enabled.unwrap_or(false))
+                .map(|(kind, _)| {
+                    let runtime = runtime.clone();
+                    let load = scope.spawn(move || {
+                        // The eBPF logger spawns its reader task on the runtime
+                        let _runtime = runtime.enter();
+                        let started = Instant::now();
+                        let mut bpf = load_probe(settings, bytecode, limits, kind)?;
+                        let programs = load_programs(&mut bpf, kind);
+                        info!(
+                            "Loaded {} probe ({} programs verified) in {}ms",
+                            kind.name(),
+                            programs,
+                            started.elapsed().as_millis()
+                        );
+                        Ok::<_, anyhow::Error>((bpf, started.elapsed()))
+                    });
+                    (kind, load)
+                })
+                .collect();
+            loads
+                .into_iter()
+                .map(|(kind, load)| {
+                    let (bpf, took) = load
+                        .join()
+                        .unwrap_or_else(|panic| std::panic::resume_unwind(panic))?;
+                    Ok((kind, bpf, took))
+                })
+                .collect()
+        })
+    }
+
+    fn attach_builtin(&mut self, kind: ProbeKind) -> Result<()> {
+        let bpf = load_probe(&self.settings, self.bytecode, &self.limits, kind)?;
+        self.attach_loaded(kind, bpf)
+    }
+
+    fn attach_loaded(&mut self, kind: ProbeKind, bpf: Ebpf) -> Result<()> {
+        match kind {
             // Note: network_latency probe currently logs connection events only,
             // latency measurement not yet implemented
+            ProbeKind::NetworkLatency => self.attach_probe(kind, bpf, &NetworkLatencyProbe)?,
+            ProbeKind::BlockIo => self.attach_probe(kind, bpf, &BlockIoProbe)?,
+            ProbeKind::GpuUsage => self.attach_probe(kind, bpf, &GpuUsageProbe)?,
+            ProbeKind::Llm => {
+                let mut probe = LlmProbe::new(&self.settings.llm);
+                if let Some((started, targets)) = self.startup_targets.take() {
+                    probe = probe.with_targets(started, targets);
+                }
+                self.attach_probe(kind, bpf, &probe)?;
+                let (known, scan_pending) = probe.take_targets();
+                self.start_llm_discovery(known, scan_pending)?;
+            }
+        }
+        if kind != ProbeKind::NetworkLatency {
+            telemetry::record_active_probe(kind.name(), 1);
         }
+        Ok(())
+    }
 
-        if self.settings.builtin_probes.block_io.unwrap_or(false) {
-            BlockIoProbe.attach(&mut self.bpf)?;
-            telemetry::record_active_probe("block_io", 1);
+    /// Stop the probe's ring consumers, then drop its eBPF object, which detaches its
+    /// programs and frees the remaining maps.
+    async fn detach_probe(&mut self, kind: ProbeKind) -> Result<()> {
+        if !self.objects.contains_key(&kind) {
+            bail!("{} is not attached", kind.name());
+        }
+        stop_probe_tasks(kind).await;
+        self.objects.remove(&kind);
+        if kind == ProbeKind::Llm {
+            self.exec_watch = None;
+            self.known_targets.clear();
+            self.full_scan = None;
         }
+        if kind != ProbeKind::NetworkLatency {
+            telemetry::record_active_probe(kind.name(), 0);
+        }
+        info!("Detached {} probe", kind.name());
+        Ok(())
+    }
 
-        if self.settings.builtin_probes.gpu_usage.unwrap_or(false) {
-            GpuUsageProbe.attach(&mut self.bpf)?;
-            telemetry::record_active_probe("gpu_usage", 1);
+    fn attach_probe(&mut self, kind: ProbeKind, mut bpf: Ebpf, probe: &dyn Probe) -> Result<()> {
+        probe
+            .attach(&mut bpf)
+            .with_context(|| format!("Failed to attach {} probe", kind.name()))?;
+        if let Err(e) = spawn_drop_monitor(&mut bpf, kind.name()) {
+            warn!(
+                "Ring drop accounting unavailable for {}: {}",
+                kind.name(),
+                e
+            );
+        }
+        self.objects.insert(kind, bpf);
+        Ok(())
+    }
+}
+
+/// Feed a capture file through the builtin probe handlers. Needs neither root nor eBPF.
+/// Exec notifications are skipped, as they only drive live SSL library discovery.
+pub fn replay_capture(settings: &Settings, path: &Path, speed: ReplaySpeed) -> Result<ReplayStats> {
+    let capture = CaptureFile::open(path)?;
+    sink::init(&settings.sink)?;
+    store::init(&settings.store)?;
+    estimator::init(&settings.llm)?;
+    recorder::init(&settings.recorder)?;
+    let pipeline =
+        SslPipeline::spawn(settings.llm.workers, settings.llm.queue_capacity, None)?.lossless();
+
+    let mut replayer = Replayer::new();
+    replayer
+        .on(RingId::BlockIo, block_io::handle_event)
+        .on(RingId::Network, network::handle_event)
+        .on(RingId::GpuOpen, gpu_usage::handle_open_event)
+        .on(RingId::GpuClose, gpu_usage::handle_close_event)
+        .on(RingId::Ssl, ssl_event_handler(pipeline));
+    let stats = replayer.run(&capture, speed);
+    sink::shutdown();
+
+    // Waits for the LLM parser workers to drain their queues
+    drop(replayer);
+    estimator::shutdown();
+    store::shutdown();
+    recorder::shutdown();
+    Ok(stats)
+}
+
+async fn next_request(
+    control: &mut Option<mpsc::Receiver<EngineRequest>>,
+) -> Option<EngineRequest> {
+    match control {
+        Some(rx) => rx.recv().await,
+        None => std::future::pending().await,
+    }
+}
+
+async fn next_tick(ticks: &mut Option<tokio::time::Interval>) {
+    match ticks {
+        Some(ticks) => {
+            ticks.tick().await;
         }
+        None => std::future::pending().await,
+    }
+}
 
-        if self.settings.builtin_probes.llm.unwrap_or(false) {
-            LlmProbe.attach(&mut self.bpf)?;
-            telemetry::record_active_probe("llm", 1);
+async fn terminated(sigterm: &mut Option<Signal>) {
+    match sigterm {
+        Some(sigterm) => {
+            sigterm.recv().await;
         }
+        None => std::future::pending().await,
+    }
+}
 
-        Ok(())
+async fn notified(notify: Option<ExecNotify>) {
+    match notify {
+        Some(notify) => notify.notified().await,
+        None => std::future::pending().await,
     }
 }
 
+/// Dump every flight recorder buffer on SIGUSR1. Only installed while the recorder runs,
+/// as the default action of SIGUSR1 is to terminate.
+fn spawn_dump_on_sigusr1() {
+    let mut usr1 = match unix_signal(SignalKind::user_defined1()) {
+        Ok(usr1) => usr1,
+        Err(e) => {
+            warn!("Cannot install SIGUSR1 handler for flight recorder: {}", e);
+            return;
+        }
+    };
+    tokio::spawn(async move {
+        while usr1.recv().await.is_some() {
+            if !recorder::trigger(recorder::Trigger::Signal) {
+                warn!("Flight recorder dump already pending, SIGUSR1 ignored");
+            }
+        }
+    });
+}
+
 fn bump_memlock_rlimit() -> Result<()> {
     let rlim = libc::rlimit {
         rlim_cur: libc::RLIM_INFINITY,
@@ -1,6 +1,9 @@
+use std::path::PathBuf;
+
 use anyhow::{Context, Result};
 use aya::include_bytes_aligned;
-use clap::Parser;
+use clap::{Parser, Subcommand};
+use honeybeepf::probes::capture::{self, ReplaySpeed};
 use tracing_subscriber::{self, EnvFilter};
 
 #[derive(Debug, Parser)]
@@ -8,6 +11,36 @@ struct Opt {
     /// Enable verbose output (sets log level to INFO)
     #[clap(short, long)]
     verbose: bool,
+
+    /// Write every raw ring buffer record to this capture file
+    #[clap(long, value_name = "PATH")]
+    capture: Option<PathBuf>,
+
+    #[clap(subcommand)]
+    command: Option<Command>,
+}
+
+#[derive(Debug, Subcommand)]
+enum Command {
+    /// Replay a capture file through the probe handlers (no root or eBPF required)
+    Replay {
+        file: PathBuf,
+
+        /// Keep the original timing between records instead of replaying as fast as possible
+        #[clap(long)]
+        realtime: bool,
+    },
+    /// Send a command to the control socket of a running agent (see CONTROL__SOCKET)
+    Ctl {
+        /// e.g. `status`, `attach llm`, `capture 30 /tmp/x.hbcap cgroup 1234`
+        #[clap(required = true)]
+        command: Vec<String>,
+    },
+    /// Summarize the local Parquet store: tokens per model, usage per cgroup
+    Summarize {
+        /// Store directory (defaults to STORE__DIR)
+        dir: Option<PathBuf>,
+    },
 }
 
 #[tokio::main]
@@ -28,6 +61,57 @@ async fn main() -> Result<()> {
     // Load agent settings from environment variables or a .env file.
     let settings = honeybeepf::settings::Settings::new().context("Failed to load settings")?;
 
+    if let Some(Command::Ctl { command }) = &opt.command {
+        let socket = settings
+            .control
+            .socket
+            .as_deref()
+            .context("CONTROL__SOCKET is not set")?;
+        let reply = honeybeepf::control::send_command(socket.as_ref(), &command.join(" "))?;
+        println!("{}", reply);
+        if reply.starts_with("error") {
+            std::process::exit(1);
+        }
+        return Ok(());
+    }
+
+    if let Some(Command::Summarize { dir }) = &opt.command {
+        let dir = dir
+            .clone()
+            .or_else(|| settings.store.dir.clone().map(PathBuf::from))
+            .context("No store directory given and STORE__DIR is not set")?;
+        print!("{}", honeybeepf::store::summary::summarize(&dir)?);
+        return Ok(());
+    }
+
+    if let Some(Command::Replay { file, realtime }) = opt.command {
+        let speed = if realtime {
+            ReplaySpeed::Original
+        } else {
+            ReplaySpeed::Max
+        };
+        if let Err(e) = honeybeepf::telemetry::init_metrics() {
+            log::warn!("Failed to initialize OpenTelemetry metrics: {}", e);
+        }
+        let stats = tokio::task::spawn_blocking(move || {
+            honeybeepf::replay_capture(&settings, &file, speed)
+        })
+        .await??;
+        println!(
+            "Replayed {} records ({} bytes) in {:.3}s, {} skipped",
+            stats.records,
+            stats.bytes,
+            stats.elapsed.as_secs_f64(),
+            stats.skipped
+        );
+        honeybeepf::telemetry::shutdown_metrics();
+        return Ok(());
+    }
+
+    if let Some(path) = &opt.capture {
+        capture::start_capture(path)?;
+    }
+
     // Load the eBPF bytecode and initialize the HoneyBee engine.
     // include_bytes_aligned ensures the bytecode is correctly aligned in memory for Aya.
     let engine = honeybeepf::HoneyBeeEngine::new(
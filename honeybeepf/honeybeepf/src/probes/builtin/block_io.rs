@@ -1,10 +1,10 @@
 use anyhow::Result;
 use aya::Ebpf;
-use honeybeepf_common::{BlockIoEvent, BlockIoEventType};
-use log::info;
+use honeybeepf_common::{BlockIoEvent, BlockIoEventType, RingId};
+use log::{Level, info, log_enabled, trace};
 
 use crate::probes::{Probe, TracepointConfig, attach_tracepoint, spawn_ringbuf_handler};
-use crate::telemetry;
+use crate::{recorder, sink, store, telemetry};
 
 pub struct BlockIoProbe;
 
@@ -29,42 +29,58 @@ impl Probe for BlockIoProbe {
             },
         )?;
 
-        spawn_ringbuf_handler(bpf, "BLOCK_IO_EVENTS", |event: BlockIoEvent| {
-            let rwbs = std::str::from_utf8(&event.rwbs)
-                .unwrap_or("<invalid>")
-                .trim_matches(char::from(0));
-            let comm = std::str::from_utf8(&event.comm)
-                .unwrap_or("<invalid>")
-                .trim_matches(char::from(0));
+        spawn_ringbuf_handler(bpf, "BLOCK_IO_EVENTS", handle_event)?;
+        Ok(())
+    }
+}
 
-            let type_str = match BlockIoEventType::from(event.event_type) {
-                BlockIoEventType::Start => "START",
-                BlockIoEventType::Done => "DONE",
-                BlockIoEventType::Unknown => "UNKNOWN",
-            };
+/// Handle one `BLOCK_IO_EVENTS` record.
+pub fn handle_event(event: BlockIoEvent) {
+    sink::record(RingId::BlockIo, event.metadata.timestamp, &event);
+    // The rate the event was sampled at, which the governor may have changed since
+    let weight = event.sample_rate.max(1) as u64;
+    store::record_block_io(&event, weight);
+    recorder::record(
+        RingId::BlockIo,
+        event.metadata.timestamp,
+        event.metadata.cgroup_id,
+        &event,
+    );
 
-            // Create device name (major:minor)
-            let device = format!("{}:{}", event.dev >> 20, event.dev & 0xFFFFF);
+    let type_str = match BlockIoEventType::from(event.event_type) {
+        BlockIoEventType::Start => "START",
+        BlockIoEventType::Done => "DONE",
+        BlockIoEventType::Unknown => "UNKNOWN",
+    };
 
-            info!(
-                "BlockIO {} pid={} dev={} sector={} nr_sector={} bytes={} rwbs={} comm={}",
-                type_str,
-                event.metadata.pid,
-                device,
-                event.sector,
-                event.nr_sector,
-                event.bytes,
-                rwbs,
-                comm
-            );
+    // Create device name (major:minor)
+    let device = format!("{}:{}", event.dev >> 20, event.dev & 0xFFFFF);
 
-            telemetry::record_block_io_event(
-                type_str,
-                event.bytes as u64,
-                None, // Latency requires separate calculation
-                &device,
-            );
-        })?;
-        Ok(())
+    if log_enabled!(Level::Trace) {
+        let rwbs = std::str::from_utf8(&event.rwbs)
+            .unwrap_or("<invalid>")
+            .trim_matches(char::from(0));
+        let comm = std::str::from_utf8(&event.comm)
+            .unwrap_or("<invalid>")
+            .trim_matches(char::from(0));
+        trace!(
+            "BlockIO {} pid={} dev={} sector={} nr_sector={} bytes={} rwbs={} comm={}",
+            type_str,
+            event.metadata.pid,
+            device,
+            event.sector,
+            event.nr_sector,
+            event.bytes,
+            rwbs,
+            comm
+        );
     }
+
+    telemetry::record_block_io_event(
+        type_str,
+        event.bytes as u64,
+        None, // Latency requires separate calculation
+        &device,
+        weight,
+    );
 }
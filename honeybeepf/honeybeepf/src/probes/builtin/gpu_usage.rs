@@ -1,9 +1,12 @@
 use anyhow::Result;
 use aya::Ebpf;
-use honeybeepf_common::{GpuCloseEvent, GpuOpenEvent};
-use log::info;
+use honeybeepf_common::{GpuCloseEvent, GpuOpenEvent, RingId};
+use log::{info, trace};
 
-use crate::probes::{Probe, TracepointConfig, attach_tracepoint, spawn_ringbuf_handler};
+use crate::{
+    probes::{Probe, TracepointConfig, attach_tracepoint, spawn_ringbuf_handler},
+    recorder, sink, store,
+};
 
 fn get_gpu_type(filename: &str) -> &'static str {
     if filename.starts_with("/dev/nvidia") {
@@ -52,39 +55,63 @@ impl Probe for GpuUsageProbe {
         )?;
 
         // Handle GPU open events
-        spawn_ringbuf_handler(bpf, "GPU_OPEN_EVENTS", |event: GpuOpenEvent| {
-            let comm = std::str::from_utf8(&event.comm)
-                .unwrap_or("<invalid>")
-                .trim_matches(char::from(0));
-            let filename = std::str::from_utf8(&event.filename)
-                .unwrap_or("<invalid>")
-                .trim_matches(char::from(0));
-            let gpu_type = get_gpu_type(filename);
-
-            info!(
-                "GPU_OPEN pid={} comm={} gpu_index={} fd={} type={} file={} cgroup_id={}",
-                event.metadata.pid,
-                comm,
-                event.gpu_index,
-                event.fd,
-                gpu_type,
-                filename,
-                event.metadata.cgroup_id,
-            );
-        })?;
+        spawn_ringbuf_handler(bpf, "GPU_OPEN_EVENTS", handle_open_event)?;
 
         // Handle GPU close events
-        spawn_ringbuf_handler(bpf, "GPU_CLOSE_EVENTS", |event: GpuCloseEvent| {
-            let comm = std::str::from_utf8(&event.comm)
-                .unwrap_or("<invalid>")
-                .trim_matches(char::from(0));
-
-            info!(
-                "GPU_CLOSE pid={} comm={} gpu_index={} fd={} cgroup_id={}",
-                event.metadata.pid, comm, event.gpu_index, event.fd, event.metadata.cgroup_id,
-            );
-        })?;
+        spawn_ringbuf_handler(bpf, "GPU_CLOSE_EVENTS", handle_close_event)?;
 
         Ok(())
     }
 }
+
+/// Handle one `GPU_OPEN_EVENTS` record.
+pub fn handle_open_event(event: GpuOpenEvent) {
+    sink::record(RingId::GpuOpen, event.metadata.timestamp, &event);
+    store::record_gpu_open(&event);
+    recorder::record(
+        RingId::GpuOpen,
+        event.metadata.timestamp,
+        event.metadata.cgroup_id,
+        &event,
+    );
+
+    let comm = std::str::from_utf8(&event.comm)
+        .unwrap_or("<invalid>")
+        .trim_matches(char::from(0));
+    let filename = std::str::from_utf8(&event.filename)
+        .unwrap_or("<invalid>")
+        .trim_matches(char::from(0));
+    let gpu_type = get_gpu_type(filename);
+
+    trace!(
+        "GPU_OPEN pid={} comm={} gpu_index={} fd={} type={} file={} cgroup_id={}",
+        event.metadata.pid,
+        comm,
+        event.gpu_index,
+        event.fd,
+        gpu_type,
+        filename,
+        event.metadata.cgroup_id,
+    );
+}
+
+/// Handle one `GPU_CLOSE_EVENTS` record.
+pub fn handle_close_event(event: GpuCloseEvent) {
+    sink::record(RingId::GpuClose, event.metadata.timestamp, &event);
+    store::record_gpu_close(&event);
+    recorder::record(
+        RingId::GpuClose,
+        event.metadata.timestamp,
+        event.metadata.cgroup_id,
+        &event,
+    );
+
+    let comm = std::str::from_utf8(&event.comm)
+        .unwrap_or("<invalid>")
+        .trim_matches(char::from(0));
+
+    trace!(
+        "GPU_CLOSE pid={} comm={} gpu_index={} fd={} cgroup_id={}",
+        event.metadata.pid, comm, event.gpu_index, event.fd, event.metadata.cgroup_id,
+    );
+}
@@ -0,0 +1,273 @@
+//! Discovery cache: SSL library identity → uprobe symbol offsets, and the attached set.
+//!
+//! A library is identified by `(dev, ino, mtime, size)`, checked with one `stat`, and by
+//! its GNU build id. Symbol offsets are read from the ELF symbol tables once per build and
+//! then reused for every uprobe of the library and for other paths of the same build (the
+//! same libssl in several container images), instead of aya parsing the file per uprobe.
+//!
+//! With `LLM__DISCOVERY_CACHE` set the cache is saved to disk, keyed by the kernel boot id.
+//! A restarted agent attaches to the libraries it was attached to before, once their
+//! identity still matches, and leaves the full process scan for later.
+
+use std::{
+    collections::{HashMap, HashSet},
+    os::unix::fs::MetadataExt,
+    path::{Path, PathBuf},
+    sync::Mutex,
+};
+
+use anyhow::{Context, Result};
+use log::{debug, info, warn};
+use object::{Object, ObjectSection, ObjectSymbol};
+use serde::{Deserialize, Serialize};
+
+const BOOT_ID_PATH: &str = "/proc/sys/kernel/random/boot_id";
+
+/// Identity of a file on disk; any rewrite or replacement changes it.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize)]
+pub struct FileId {
+    pub dev: u64,
+    pub ino: u64,
+    pub mtime_ns: i64,
+    pub size: u64,
+}
+
+impl FileId {
+    pub fn of(path: &Path) -> Option<Self> {
+        let meta = std::fs::metadata(path).ok()?;
+        Some(Self {
+            dev: meta.dev(),
+            ino: meta.ino(),
+            mtime_ns: meta.mtime() * 1_000_000_000 + meta.mtime_nsec(),
+            size: meta.size(),
+        })
+    }
+}
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+struct Library {
+    id: FileId,
+    build_id: Option<String>,
+    /// File offset of each resolved symbol
+    symbols: HashMap<String, u64>,
+    attached: bool,
+}
+
+#[derive(Default, Serialize, Deserialize)]
+struct CacheFile {
+    boot_id: String,
+    libraries: HashMap<String, Library>,
+}
+
+#[derive(Default)]
+struct Cache {
+    path: Option<PathBuf>,
+    contents: CacheFile,
+    dirty: bool,
+}
+
+static CACHE: Mutex<Option<Cache>> = Mutex::new(None);
+
+fn with_cache<R>(f: impl FnOnce(&mut Cache) -> R) -> R {
+    let mut cache = CACHE.lock().unwrap_or_else(|e| e.into_inner());
+    f(cache.get_or_insert_with(Cache::default))
+}
+
+fn boot_id() -> String {
+    std::fs::read_to_string(BOOT_ID_PATH)
+        .map(|id| id.trim().to_string())
+        .unwrap_or_default()
+}
+
+/// Load the cache saved at `path`, if any. A cache from another boot is discarded.
+pub fn init(path: Option<&str>) {
+    let boot_id = boot_id();
+    let contents = path
+        .and_then(|path| std::fs::read(path).ok())
+        .and_then(|data| serde_json::from_slice::<CacheFile>(&data).ok())
+        .filter(|cache| !boot_id.is_empty() && cache.boot_id == boot_id)
+        .unwrap_or_else(|| CacheFile {
+            boot_id,
+            libraries: HashMap::new(),
+        });
+    if !contents.libraries.is_empty() {
+        info!(
+            "Discovery cache: {} libraries from a previous run",
+            contents.libraries.len()
+        );
+    }
+    *CACHE.lock().unwrap_or_else(|e| e.into_inner()) = Some(Cache {
+        path: path.map(PathBuf::from),
+        contents,
+        dirty: false,
+    });
+}
+
+/// Libraries attached by a previous run that are still the same files.
+pub fn attached_targets() -> HashSet<String> {
+    with_cache(|cache| {
+        let before = cache.contents.libraries.len();
+        cache
+            .contents
+            .libraries
+            .retain(|path, library| FileId::of(Path::new(path)) == Some(library.id));
+        cache.dirty |= cache.contents.libraries.len() != before;
+        cache
+            .contents
+            .libraries
+            .iter()
+            .filter(|(_, library)| library.attached)
+            .map(|(path, _)| path.clone())
+            .collect()
+    })
+}
+
+pub fn mark_attached(path: &str) {
+    with_cache(|cache| {
+        if let Some(library) = cache.contents.libraries.get_mut(path)
+            && !library.attached
+        {
+            library.attached = true;
+            cache.dirty = true;
+        }
+    });
+}
+
+/// File offsets of `names` in the library at `path`. Symbols that cannot be found are
+/// left out, so the caller can fall back to aya's own lookup.
+pub fn symbol_offsets(path: &str, names: &[&str]) -> HashMap<String, u64> {
+    let Some(id) = FileId::of(Path::new(path)) else {
+        return HashMap::new();
+    };
+    if let Some(symbols) = with_cache(|cache| {
+        let library = cache.contents.libraries.get(path)?;
+        (library.id == id).then(|| library.symbols.clone())
+    }) {
+        return symbols;
+    }
+
+    let resolved = std::fs::read(path)
+        .context("read")
+        .and_then(|data| resolve_symbols(&data, names));
+    let (build_id, symbols) = match resolved {
+        Ok(resolved) => resolved,
+        Err(e) => {
+            debug!("Cannot resolve SSL symbols of {}: {:#}", path, e);
+            return HashMap::new();
+        }
+    };
+    with_cache(|cache| {
+        // Keep what an earlier path of the same build resolved (it may have had debug symbols)
+        let symbols = build_id
+            .as_ref()
+            .and_then(|build_id| {
+                cache.contents.libraries.values().find(|library| {
+                    library.build_id.as_ref() == Some(build_id)
+                        && library.symbols.len() > symbols.len()
+                })
+            })
+            .map(|library| library.symbols.clone())
+            .unwrap_or(symbols);
+        let attached = cache
+            .contents
+            .libraries
+            .get(path)
+            .is_some_and(|library| library.id == id && library.attached);
+        cache.contents.libraries.insert(
+            path.to_string(),
+            Library {
+                id,
+                build_id,
+                symbols: symbols.clone(),
+                attached,
+            },
+        );
+        cache.dirty = true;
+        symbols
+    })
+}
+
+/// Build id and symbol file offsets, computed like aya does for uprobes:
+/// `sym.address - section.address + section.file_offset`.
+fn resolve_symbols(data: &[u8], names: &[&str]) -> Result<(Option<String>, HashMap<String, u64>)> {
+    let file = object::File::parse(data)?;
+    let build_id = file
+        .build_id()
+        .ok()
+        .flatten()
+        .map(|id| id.iter().map(|b| format!("{:02x}", b)).collect());
+
+    let mut offsets = HashMap::new();
+    for symbol in file.dynamic_symbols().chain(file.symbols()) {
+        let Ok(name) = symbol.name() else {
+            continue;
+        };
+        if symbol.address() == 0 || !names.contains(&name) || offsets.contains_key(name) {
+            continue;
+        }
+        let Some(section) = symbol
+            .section_index()
+            .and_then(|index| file.section_by_index(index).ok())
+        else {
+            continue;
+        };
+        if let Some((file_offset, _)) = section.file_range() {
+            offsets.insert(
+                name.to_string(),
+                symbol.address() - section.address() + file_offset,
+            );
+        }
+    }
+    Ok((build_id, offsets))
+}
+
+/// Write the cache back if anything changed.
+pub fn save() {
+    let (path, data) = {
+        let mut cache = CACHE.lock().unwrap_or_else(|e| e.into_inner());
+        let Some(cache) = cache.as_mut().filter(|cache| cache.dirty) else {
+            return;
+        };
+        let Some(path) = cache.path.clone() else {
+            return;
+        };
+        cache.dirty = false;
+        match serde_json::to_vec(&cache.contents) {
+            Ok(data) => (path, data),
+            Err(e) => {
+                warn!("Failed to serialize discovery cache: {}", e);
+                return;
+            }
+        }
+    };
+    // Replace atomically, a crash mid-write must not leave a truncated cache
+    let tmp = path.with_extension("tmp");
+    let written = path
+        .parent()
+        .map_or(Ok(()), std::fs::create_dir_all)
+        .and_then(|_| std::fs::write(&tmp, data))
+        .and_then(|_| std::fs::rename(&tmp, &path));
+    if let Err(e) = written {
+        warn!("Failed to save discovery cache {}: {}", path.display(), e);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_resolve_symbols() {
+        let exe = std::env::current_exe().unwrap();
+        let data = std::fs::read(&exe).unwrap();
+        let (_, offsets) = resolve_symbols(&data, &["main", "no_such_symbol"]).unwrap();
+
+        assert!(offsets["main"] < data.len() as u64);
+        assert!(!offsets.contains_key("no_such_symbol"));
+        assert_eq!(
+            FileId::of(&exe).unwrap().size,
+            data.len() as u64,
+            "stat identity matches the file read"
+        );
+    }
+}
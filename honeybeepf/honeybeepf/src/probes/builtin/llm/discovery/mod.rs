@@ -1,4 +1,5 @@
 pub mod binary;
+pub mod cache;
 pub mod dynamic;
 
 use std::collections::HashSet;
@@ -0,0 +1,357 @@
+//! Token estimates for exchanges whose responses carried no usage: streams without
+//! `stream_options.include_usage`, aborted requests, self-hosted servers.
+//!
+//! Parser workers extract the prompt and generated text of such exchanges and hand the
+//! text over through a queue bounded in jobs and in bytes, so that queued jobs never hold
+//! response buffers. A single `llm-tokenizer` thread loads the tiktoken vocabularies
+//! found in `LLM__TOKENIZER_DIR` and counts the text with the local tokenizer. Results
+//! are recorded like parsed usage, with `UsageInfo::estimated` set. Without the setting
+//! (or without any vocabulary file) exchanges without usage are dropped as before.
+//!
+//! Only the start of a request body is kept (`RequestInfo::prompt_sample`), so the prompt
+//! count is scaled from the sample to the whole body, at most `MAX_PROMPT_SCALE` times:
+//! the rest of a large body is often images or files, not text.
+//!
+//! Without the tokenizer (or when its queue is full), streamed responses are still
+//! estimated from their deltas (see `http::deltas`): completion tokens only, from the
+//! length of the generated text.
+
+use std::{
+    path::PathBuf,
+    sync::{
+        Mutex,
+        atomic::{AtomicBool, AtomicUsize, Ordering},
+        mpsc::{Receiver, SyncSender, TrySendError, sync_channel},
+    },
+    thread::JoinHandle,
+    time::Duration,
+};
+
+use anyhow::{Context, Result};
+use log::{info, warn};
+
+use crate::{
+    probes::builtin::llm::{
+        http::DeltaScanner,
+        pipeline,
+        tokenizer::{Tokenizer, Vocab},
+        types::{LlmCompletion, RequestInfo, UnmeteredExchange, UsageInfo},
+    },
+    settings::LlmSettings,
+    telemetry,
+};
+
+/// Exchanges waiting for the tokenizer thread
+const QUEUE_CAPACITY: usize = 1024;
+/// Text waiting for the tokenizer thread, across all queued exchanges
+const QUEUE_MAX_BYTES: usize = 32 * 1024 * 1024;
+/// Largest factor a prompt count is scaled by from its sample to the whole body
+const MAX_PROMPT_SCALE: u64 = 16;
+
+/// An exchange reduced to its text, as queued for the tokenizer thread
+struct Job {
+    pid: u32,
+    cgroup_id: u64,
+    /// Without its prompt sample, which is replaced by `prompt_text`
+    request: RequestInfo,
+    prompt_text: String,
+    sample_bytes: u64,
+    generated: String,
+    latency: Duration,
+    deltas: DeltaScanner,
+}
+
+impl Job {
+    fn new(pid: u32, cgroup_id: u64, exchange: UnmeteredExchange) -> Self {
+        let UnmeteredExchange {
+            mut request,
+            response,
+            latency,
+            parser,
+            deltas,
+        } = exchange;
+        let sample = std::mem::take(&mut request.prompt_sample);
+        Self {
+            pid,
+            cgroup_id,
+            prompt_text: parser.extract_request_text(&sample),
+            sample_bytes: sample.len() as u64,
+            generated: parser.extract_response_text(&response),
+            request,
+            latency,
+            deltas,
+        }
+    }
+
+    /// Bytes held by the job while queued
+    fn bytes(&self) -> usize {
+        self.prompt_text.len() + self.generated.len()
+    }
+}
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static QUEUED_BYTES: AtomicUsize = AtomicUsize::new(0);
+static SENDER: Mutex<Option<SyncSender<Job>>> = Mutex::new(None);
+static WORKER: Mutex<Option<JoinHandle<()>>> = Mutex::new(None);
+
+/// Start the tokenizer thread. Does nothing unless `LLM__TOKENIZER_DIR` is set.
+pub fn init(settings: &LlmSettings) -> Result<()> {
+    let Some(dir) = settings.tokenizer_dir.as_ref() else {
+        return Ok(());
+    };
+    let dir = PathBuf::from(dir);
+    let (tx, rx) = sync_channel(QUEUE_CAPACITY);
+    let handle = std::thread::Builder::new()
+        .name("llm-tokenizer".to_string())
+        .spawn(move || run(dir, rx))
+        .context("Failed to spawn LLM tokenizer thread")?;
+    *SENDER.lock().unwrap_or_else(|e| e.into_inner()) = Some(tx);
+    *WORKER.lock().unwrap_or_else(|e| e.into_inner()) = Some(handle);
+    ENABLED.store(true, Ordering::Relaxed);
+    Ok(())
+}
+
+/// Whether exchanges without usage should be submitted
+pub fn enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Estimate what is already queued and stop the tokenizer thread.
+pub fn shutdown() {
+    ENABLED.store(false, Ordering::Relaxed);
+    drop(SENDER.lock().unwrap_or_else(|e| e.into_inner()).take());
+    if let Some(handle) = WORKER.lock().unwrap_or_else(|e| e.into_inner()).take() {
+        let _ = handle.join();
+    }
+}
+
+pub fn submit(pid: u32, cgroup_id: u64, exchange: UnmeteredExchange) {
+    let (request, latency, deltas) = match SENDER.lock().unwrap_or_else(|e| e.into_inner()).as_ref()
+    {
+        Some(tx) if !exchange.response.is_empty() => {
+            let job = Job::new(pid, cgroup_id, exchange);
+            if job.generated.is_empty() {
+                // An error page, or cut before the first token
+                return;
+            }
+            let bytes = job.bytes();
+            let sent = if QUEUED_BYTES.fetch_add(bytes, Ordering::Relaxed) + bytes > QUEUE_MAX_BYTES
+            {
+                Err(TrySendError::Full(job))
+            } else {
+                tx.try_send(job)
+            };
+            match sent {
+                Ok(()) => return,
+                Err(TrySendError::Full(job)) => {
+                    QUEUED_BYTES.fetch_sub(bytes, Ordering::Relaxed);
+                    telemetry::record_llm_estimate_drop();
+                    (job.request, job.latency, job.deltas)
+                }
+                Err(TrySendError::Disconnected(job)) => {
+                    QUEUED_BYTES.fetch_sub(bytes, Ordering::Relaxed);
+                    (job.request, job.latency, job.deltas)
+                }
+            }
+        }
+        _ => (exchange.request, exchange.latency, exchange.deltas),
+    };
+    if let Some(completion) = from_deltas(request, latency, deltas) {
+        record(pid, cgroup_id, &completion);
+    }
+}
+
+fn run(dir: PathBuf, rx: Receiver<Job>) {
+    let mut tokenizers = Vec::new();
+    for vocab in Vocab::ALL {
+        let path = dir.join(vocab.file_name());
+        if !path.exists() {
+            continue;
+        }
+        match Tokenizer::load(vocab, &path) {
+            Ok(tokenizer) => tokenizers.push(tokenizer),
+            Err(e) => warn!("LLM token estimates: {:#}", e),
+        }
+    }
+    if tokenizers.is_empty() {
+        warn!(
+            "No tokenizer vocabulary in {}, LLM token estimates disabled",
+            dir.display()
+        );
+        ENABLED.store(false, Ordering::Relaxed);
+        return;
+    }
+    info!(
+        "LLM token estimates: {} vocabularies loaded from {}",
+        tokenizers.len(),
+        dir.display()
+    );
+
+    for job in rx {
+        QUEUED_BYTES.fetch_sub(job.bytes(), Ordering::Relaxed);
+        let (pid, cgroup_id) = (job.pid, job.cgroup_id);
+        if let Some(completion) = estimate(&tokenizers, job) {
+            record(pid, cgroup_id, &completion);
+        }
+    }
+}
+
+fn record(pid: u32, cgroup_id: u64, completion: &LlmCompletion) {
+    let usage = &completion.usage;
+    let rate_str = completion
+        .generation
+        .map(|g| {
+            format!(
+                " | ~{:.1} tok/s",
+                usage.completion_tokens as f64 / g.as_secs_f64()
+            )
+        })
+        .unwrap_or_default();
+    info!(
+        "LLM ESTIMATED | PID: {} | Provider: {} | Model: {} | Latency: {:.2}s | Tokens: ~{} (Prompt: ~{}, Compl: ~{}){}",
+        pid,
+        completion.request.provider.as_deref().unwrap_or("unknown"),
+        usage.model.as_deref().unwrap_or("unknown"),
+        completion.latency.as_secs_f64(),
+        usage.prompt_tokens + usage.completion_tokens,
+        usage.prompt_tokens,
+        usage.completion_tokens,
+        rate_str
+    );
+    telemetry::record_llm_usage_estimated();
+    pipeline::record_completion(pid, cgroup_id, completion);
+}
+
+/// Completion tokens from the streamed deltas alone. Returns `None` when none were seen.
+fn from_deltas(
+    request: RequestInfo,
+    latency: Duration,
+    deltas: DeltaScanner,
+) -> Option<LlmCompletion> {
+    let completion_tokens = deltas.tokens();
+    if completion_tokens == 0 {
+        return None;
+    }
+    Some(LlmCompletion {
+        usage: UsageInfo {
+            prompt_tokens: 0,
+            completion_tokens,
+            thoughts_tokens: None,
+            cache_read_tokens: None,
+            cache_write_tokens: None,
+            model: request.model.clone(),
+            estimated: true,
+        },
+        request,
+        latency,
+        generation: deltas.generation(),
+    })
+}
+
+/// Count the tokens of an exchange with the vocabulary of its model. Returns `None` when
+/// the response has no generated text (an error page, or cut before the first token).
+fn estimate(tokenizers: &[Tokenizer], job: Job) -> Option<LlmCompletion> {
+    let Job {
+        request,
+        prompt_text,
+        sample_bytes,
+        generated,
+        latency,
+        deltas,
+        ..
+    } = job;
+    if generated.is_empty() {
+        return None;
+    }
+    let vocab = Vocab::for_model(request.model.as_deref().unwrap_or_default());
+    let tokenizer = tokenizers
+        .iter()
+        .find(|tokenizer| tokenizer.vocab() == vocab)
+        .or(tokenizers.first())?;
+
+    let sampled = tokenizer.count(&prompt_text) as u64;
+    let prompt_tokens = if request.body_bytes > sample_bytes && sample_bytes > 0 {
+        sampled * request.body_bytes.min(sample_bytes * MAX_PROMPT_SCALE) / sample_bytes
+    } else {
+        sampled
+    };
+
+    let usage = UsageInfo {
+        prompt_tokens,
+        completion_tokens: tokenizer.count(&generated) as u64,
+        thoughts_tokens: None,
+        cache_read_tokens: None,
+        cache_write_tokens: None,
+        model: request.model.clone(),
+        estimated: true,
+    };
+    Some(LlmCompletion {
+        request,
+        usage,
+        latency,
+        generation: deltas.generation(),
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::probes::builtin::llm::http::Http11Parser;
+
+    #[test]
+    fn test_estimate_counts_prompt_and_completion() {
+        // Single bytes only, so one token per byte
+        let alphabet = b"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        let ranks: String = (0..=255u8)
+            .map(|b| {
+                format!(
+                    "{}{}== {}\n",
+                    alphabet[(b >> 2) as usize] as char,
+                    alphabet[((b & 3) << 4) as usize] as char,
+                    b
+                )
+            })
+            .collect();
+        let tokenizers = [Tokenizer::from_ranks(Vocab::Cl100k, ranks.as_bytes()).unwrap()];
+
+        let body = br#"{"model":"llama3","messages":[{"role":"user","content":"hello"}]}"#;
+        let exchange = |response: &[u8], body_bytes: u64| {
+            let exchange = UnmeteredExchange {
+                request: RequestInfo {
+                    model: Some("llama3".to_string()),
+                    body_bytes,
+                    prompt_sample: body.to_vec(),
+                    ..Default::default()
+                },
+                response: response.to_vec(),
+                latency: Duration::from_millis(10),
+                parser: Box::new(Http11Parser),
+                deltas: DeltaScanner::new(),
+            };
+            Job::new(1, 0, exchange)
+        };
+        let response = b"HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n\r\n{\"choices\":[{\"message\":{\"content\":\"hi there\"}}]}";
+
+        let completion = estimate(&tokenizers, exchange(response, body.len() as u64)).unwrap();
+        assert!(completion.usage.estimated);
+        assert_eq!(completion.usage.model.as_deref(), Some("llama3"));
+        assert_eq!(completion.usage.prompt_tokens, 5);
+        assert_eq!(completion.usage.completion_tokens, 8);
+
+        // A truncated sample scales to the whole body
+        let completion = estimate(&tokenizers, exchange(response, 4 * body.len() as u64)).unwrap();
+        assert_eq!(completion.usage.prompt_tokens, 20);
+        // but only so far: the rest of a large body is likely not text
+        let completion =
+            estimate(&tokenizers, exchange(response, 1000 * body.len() as u64)).unwrap();
+        assert_eq!(completion.usage.prompt_tokens, 5 * MAX_PROMPT_SCALE);
+
+        // Queued jobs hold the text, not the response
+        let job = exchange(response, body.len() as u64);
+        assert_eq!(job.bytes(), "hello".len() + "hi there".len());
+
+        // Nothing generated, nothing to estimate
+        let error = b"HTTP/1.1 502 Bad Gateway\r\nContent-Length: 0\r\n\r\n";
+        assert!(estimate(&tokenizers, exchange(error, body.len() as u64)).is_none());
+    }
+}
@@ -0,0 +1,124 @@
+//! First-bytes protocol classifier.
+//!
+//! Settles what a TLS stream carries from the first bytes the client writes, before any
+//! HTTP parsing: an HTTP/1.x request line, the HTTP/2 connection preface, or something
+//! else. Only a fixed prefix (at most the 24-byte preface) is looked at. Common binary
+//! protocols are recognized by their first message so that rejections can be told apart
+//! in logs and metrics.
+
+/// Client connection preface of HTTP/2 (RFC 9113, section 3.4)
+pub const H2_PREFACE: &[u8] = b"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+/// Request line prefixes of HTTP/1.x
+const HTTP_METHODS: [&[u8]; 9] = [
+    b"GET ",
+    b"POST ",
+    b"PUT ",
+    b"DELETE ",
+    b"PATCH ",
+    b"HEAD ",
+    b"OPTIONS ",
+    b"CONNECT ",
+    b"TRACE ",
+];
+
+/// Postgres protocol 3.0, as sent in the StartupMessage
+const POSTGRES_PROTOCOL: [u8; 4] = [0x00, 0x03, 0x00, 0x00];
+/// MongoDB wire protocol opcodes: OP_MSG and the legacy OP_QUERY
+const MONGODB_OPCODES: [u32; 2] = [2013, 2004];
+/// Highest Kafka API key plausibly seen in a request header
+const KAFKA_MAX_API_KEY: u16 = 100;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Protocol {
+    Http1,
+    Http2,
+    /// Anything else, named for diagnostics (`postgres`, `redis`, ..., or `unknown`)
+    Other(&'static str),
+}
+
+/// Classify a stream from the start of its first write. `None` while `data` is too short
+/// to tell (a prefix of a method token or of the preface).
+pub fn classify(data: &[u8]) -> Option<Protocol> {
+    if data.starts_with(H2_PREFACE) {
+        return Some(Protocol::Http2);
+    }
+    if HTTP_METHODS.iter().any(|method| data.starts_with(method)) {
+        return Some(Protocol::Http1);
+    }
+    if data.is_empty()
+        || H2_PREFACE.starts_with(data)
+        || HTTP_METHODS.iter().any(|method| method.starts_with(data))
+    {
+        return None;
+    }
+    Some(Protocol::Other(binary_protocol(data)))
+}
+
+fn binary_protocol(data: &[u8]) -> &'static str {
+    let be_u32 = |at: usize| {
+        data.get(at..at + 4)
+            .map(|b| u32::from_be_bytes([b[0], b[1], b[2], b[3]]))
+    };
+    let le_u32 = |at: usize| {
+        data.get(at..at + 4)
+            .map(|b| u32::from_le_bytes([b[0], b[1], b[2], b[3]]))
+    };
+
+    // Length-prefixed StartupMessage: int32 length, int32 protocol version
+    if data.get(4..8) == Some(&POSTGRES_PROTOCOL[..]) {
+        return "postgres";
+    }
+    // RESP arrays: "*<count>\r\n"
+    if data[0] == b'*' && data.get(1).is_some_and(u8::is_ascii_digit) {
+        return "redis";
+    }
+    // Little-endian header: length, request id, response to, opcode
+    if le_u32(12).is_some_and(|opcode| MONGODB_OPCODES.contains(&opcode)) {
+        return "mongodb";
+    }
+    // Big-endian header: length, api key, api version, correlation id
+    if let (Some(length), Some(api)) = (be_u32(0), be_u32(4)) {
+        let api_key = (api >> 16) as u16;
+        let api_version = api as u16;
+        if length >= 8 && api_key <= KAFKA_MAX_API_KEY && api_version < 32 {
+            return "kafka";
+        }
+    }
+    "unknown"
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_classify() {
+        assert_eq!(
+            classify(b"POST /v1/chat/completions HTTP/1.1\r\n"),
+            Some(Protocol::Http1)
+        );
+        assert_eq!(classify(H2_PREFACE), Some(Protocol::Http2));
+        // Too short to tell: "P" could still become POST, PUT, PATCH or the preface
+        assert_eq!(classify(b"P"), None);
+        assert_eq!(classify(b"PRI * HTTP/2"), None);
+        assert_eq!(classify(b""), None);
+
+        let postgres = [0, 0, 0, 41, 0, 3, 0, 0, b'u', b's', b'e', b'r'];
+        assert_eq!(classify(&postgres), Some(Protocol::Other("postgres")));
+        assert_eq!(
+            classify(b"*2\r\n$3\r\nGET\r\n$3\r\nkey\r\n"),
+            Some(Protocol::Other("redis"))
+        );
+        let mut mongodb = [0u8; 21];
+        mongodb[12..16].copy_from_slice(&2013u32.to_le_bytes());
+        assert_eq!(classify(&mongodb), Some(Protocol::Other("mongodb")));
+        // Metadata v9 request
+        let kafka = [0, 0, 0, 30, 0, 3, 0, 9, 0, 0, 0, 1];
+        assert_eq!(classify(&kafka), Some(Protocol::Other("kafka")));
+        assert_eq!(
+            classify(b"post /lowercase"),
+            Some(Protocol::Other("unknown"))
+        );
+    }
+}
@@ -0,0 +1,164 @@
+//! Incremental scanner of the generated text in responses.
+//!
+//! Streamed responses carry their text as deltas: `choices[].delta.content` (OpenAI),
+//! `delta.text` of `content_block_delta` events (Anthropic), `parts[].text` (Gemini). When
+//! a provider leaves out the final usage chunk, they are all there is to count.
+//! `DeltaScanner` reads the string values of `content` and `text` keys byte by byte as
+//! reads arrive and keeps their total length, their number and when they arrived. Nothing
+//! of the response itself is retained.
+//!
+//! The scanner is fed the de-framed body (see `ResponseFraming::feed_body`), and times
+//! are the kernel timestamps of the reads, not when a worker got to them.
+
+use std::time::Duration;
+
+const KEYS: [&[u8]; 2] = [br#""content":"#, br#""text":"#];
+/// Bytes of generated text per token, about right for English prose and code under the
+/// GPT tokenizers
+const BYTES_PER_TOKEN: u64 = 4;
+
+#[derive(Default)]
+pub struct DeltaScanner {
+    /// Bytes of each of `KEYS` matched so far
+    matched: [usize; 2],
+    /// After a key, up to its value
+    after_key: bool,
+    in_value: bool,
+    escape: bool,
+    /// Decoded bytes of the value being read
+    value_bytes: u64,
+    /// Decoded bytes of all non-empty values
+    text_bytes: u64,
+    deltas: u64,
+    /// Kernel timestamps of the reads with the first and the last delta
+    first_delta: Option<Duration>,
+    last_delta: Option<Duration>,
+}
+
+impl DeltaScanner {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// Scan the next body bytes, read at kernel time `at`.
+    pub fn feed(&mut self, data: &[u8], at: Duration) {
+        let deltas = self.deltas;
+        for &byte in data {
+            self.scan(byte);
+        }
+        if self.deltas > deltas {
+            self.first_delta.get_or_insert(at);
+            self.last_delta = Some(at);
+        }
+    }
+
+    /// Bytes the kernel did not capture: whatever was being read is lost.
+    pub fn skip(&mut self) {
+        self.matched = [0; 2];
+        self.after_key = false;
+        self.in_value = false;
+        self.escape = false;
+    }
+
+    /// Estimated tokens of the generated text: one per delta at least, as streams send
+    /// tokens as soon as they are sampled.
+    pub fn tokens(&self) -> u64 {
+        self.deltas.max(self.text_bytes.div_ceil(BYTES_PER_TOKEN))
+    }
+
+    /// Time from the first delta to the last, for streams of more than one.
+    pub fn generation(&self) -> Option<Duration> {
+        let (first, last) = (self.first_delta?, self.last_delta?);
+        (self.deltas > 1 && last > first).then(|| last - first)
+    }
+
+    fn scan(&mut self, byte: u8) {
+        if self.in_value {
+            if self.escape {
+                self.escape = false;
+                self.value_bytes += 1;
+            } else if byte == b'\\' {
+                self.escape = true;
+            } else if byte == b'"' {
+                self.in_value = false;
+                if self.value_bytes > 0 {
+                    self.text_bytes += self.value_bytes;
+                    self.deltas += 1;
+                }
+            } else {
+                self.value_bytes += 1;
+            }
+            return;
+        }
+
+        if self.after_key {
+            match byte {
+                b' ' | b'\t' | b'\r' | b'\n' => return,
+                b'"' => {
+                    self.after_key = false;
+                    self.in_value = true;
+                    self.value_bytes = 0;
+                    return;
+                }
+                // Not a string (`"content":[...]`): look for keys inside
+                _ => self.after_key = false,
+            }
+        }
+
+        for (key, matched) in KEYS.iter().zip(&mut self.matched) {
+            if key[*matched] == byte {
+                *matched += 1;
+            } else {
+                *matched = usize::from(byte == b'"');
+            }
+        }
+        if KEYS
+            .iter()
+            .zip(&self.matched)
+            .any(|(key, &n)| n == key.len())
+        {
+            self.matched = [0; 2];
+            self.after_key = true;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn scan(chunks: &[&[u8]]) -> DeltaScanner {
+        let mut scanner = DeltaScanner::new();
+        for (i, chunk) in chunks.iter().enumerate() {
+            scanner.feed(chunk, Duration::from_millis(i as u64 * 20));
+        }
+        scanner
+    }
+
+    #[test]
+    fn test_deltas_of_each_provider() {
+        let openai =
+            b"data: {\"choices\":[{\"delta\":{\"role\":\"assistant\",\"content\":\"\"}}]}\n\n\
+            data: {\"choices\":[{\"delta\":{\"content\":\"Hello\"}}]}\n\n\
+            data: {\"choices\":[{\"delta\":{\"content\":\" wor\\\"ld\"}}]}\n\n\
+            data: [DONE]\n\n";
+        // Split anywhere, including inside keys and escapes
+        for split in [10, 60, 105, 118, 130] {
+            let scanner = scan(&[&openai[..split], &openai[split..]]);
+            assert_eq!(scanner.deltas, 2, "split at {}", split);
+            assert_eq!(scanner.text_bytes, 12);
+        }
+
+        let anthropic = b"event: message_start\ndata: {\"type\":\"message_start\",\"message\":{\"content\":[]}}\n\n\
+            event: content_block_delta\ndata: {\"type\":\"content_block_delta\",\"delta\":{\"type\":\"text_delta\",\"text\":\"Hi there, how can I help?\"}}\n\n";
+        let scanner = scan(&[anthropic]);
+        assert_eq!(scanner.deltas, 1);
+        assert_eq!(scanner.tokens(), 7);
+
+        let gemini = b"[{\n  \"candidates\": [{\"content\": {\"parts\": [{\"text\": \"Sure\"}], \"role\": \"model\"}}]\n}";
+        let scanner = scan(&[gemini]);
+        assert_eq!(scanner.deltas, 1);
+        assert_eq!(scanner.text_bytes, 4);
+        assert_eq!(scanner.generation(), None);
+    }
+}
@@ -0,0 +1,490 @@
+//! Response framing.
+//!
+//! Tells when a response is complete from its framing alone: the `Content-Length` byte
+//! count or the terminal chunk of HTTP/1.1, and `END_STREAM` of HTTP/2. The body is then
+//! parsed once, instead of on every read. Bytes are walked once as they arrive. Bytes the
+//! kernel did not capture (reads longer than the event buffer) still count towards
+//! lengths; only a gap inside a chunk-size line or frame header loses the framing.
+//!
+//! The walk also hands out the body bytes of each read (`feed_body`), without the head,
+//! chunk-size lines, chunk CRLFs or frame headers, and of HTTP/2 only the DATA payloads.
+
+/// Longest response head buffered before giving up on the framing
+const MAX_HEAD_SIZE: usize = 64 * 1024;
+/// Longest chunk-size or trailer line
+const MAX_LINE_SIZE: usize = 1024;
+/// HTTP/2 frame header: 24-bit length, type, flags, 31-bit stream id
+const H2_FRAME_HEADER_SIZE: usize = 9;
+const H2_FRAME_DATA: u8 = 0x0;
+const H2_FRAME_HEADERS: u8 = 0x1;
+/// Highest frame type of RFC 9113 (CONTINUATION)
+const H2_MAX_FRAME_TYPE: u8 = 0x9;
+const H2_FLAG_END_STREAM: u8 = 0x1;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Progress {
+    /// More bytes are needed
+    Pending,
+    /// The response is complete
+    Complete,
+    /// An HTTP/2 stream ended; others may follow on the same connection
+    StreamEnded,
+    /// No framing to go by (a close-delimited body, or bytes that are not frames)
+    Unframed,
+}
+
+enum State {
+    /// HTTP/1.1 status line and headers, buffered in `pending`
+    Head,
+    /// HTTP/1.1 body bytes left
+    Body(u64),
+    /// HTTP/1.1 chunk-size line, buffered in `pending`
+    ChunkSize,
+    /// Chunk bytes left, including the CRLF after them
+    ChunkData(u64),
+    /// Trailer lines after the last chunk, until an empty one
+    Trailers,
+    /// HTTP/2 frame header, buffered in `pending`
+    FrameHeader,
+    /// HTTP/2 frame payload bytes left, whether the frame carries body bytes (DATA) and
+    /// whether it ends its stream
+    FramePayload {
+        left: u64,
+        data: bool,
+        end_stream: bool,
+    },
+    Complete,
+    Unframed,
+}
+
+pub struct ResponseFraming {
+    state: State,
+    pending: Vec<u8>,
+    /// Captured bytes of the last read past the end of the response
+    leftover: usize,
+    /// The response answers a HEAD request
+    head_request: bool,
+}
+
+impl ResponseFraming {
+    pub fn http1() -> Self {
+        Self {
+            state: State::Head,
+            pending: Vec::new(),
+            leftover: 0,
+            head_request: false,
+        }
+    }
+
+    pub fn http2() -> Self {
+        Self {
+            state: State::FrameHeader,
+            pending: Vec::new(),
+            leftover: 0,
+            head_request: false,
+        }
+    }
+
+    /// The response answers a HEAD request: an HTTP/1.1 response then ends with its head,
+    /// whatever its `Content-Length` or `Transfer-Encoding` say. (HTTP/2 ends the stream.)
+    pub fn head_request(mut self) -> Self {
+        self.head_request = true;
+        self
+    }
+
+    /// Walk one read: its captured bytes, then `missing` bytes the kernel left out.
+    pub fn feed(&mut self, data: &[u8], missing: usize) -> Progress {
+        self.feed_body(data, missing, &mut Vec::new())
+    }
+
+    /// `feed`, appending the body bytes of `data` to `body`. Without framing to go by,
+    /// everything after the head counts as body.
+    pub fn feed_body<'a>(
+        &mut self,
+        data: &'a [u8],
+        missing: usize,
+        body: &mut Vec<&'a [u8]>,
+    ) -> Progress {
+        self.leftover = 0;
+        let mut stream_ended = self.advance(data, body);
+        if missing > 0 {
+            stream_ended |= self.skip(missing as u64);
+        }
+        match self.state {
+            State::Complete => Progress::Complete,
+            State::Unframed => Progress::Unframed,
+            _ if stream_ended => Progress::StreamEnded,
+            _ => Progress::Pending,
+        }
+    }
+
+    /// Captured bytes at the end of the last read that follow the complete response.
+    pub fn leftover(&self) -> usize {
+        self.leftover
+    }
+
+    /// Whether the response turned out to have no framing to go by.
+    pub fn is_unframed(&self) -> bool {
+        matches!(self.state, State::Unframed)
+    }
+
+    /// Returns whether an HTTP/2 stream ended.
+    fn advance<'a>(&mut self, mut data: &'a [u8], body: &mut Vec<&'a [u8]>) -> bool {
+        let mut stream_ended = false;
+        while !data.is_empty() {
+            let used = match self.state {
+                State::Complete => {
+                    // The start of a pipelined response
+                    self.leftover = data.len();
+                    return stream_ended;
+                }
+                State::Unframed => {
+                    body.push(data);
+                    return stream_ended;
+                }
+                State::Head => self.head(data),
+                State::ChunkSize | State::Trailers => self.line(data),
+                State::FrameHeader => self.frame_header(data),
+                State::Body(_) | State::ChunkData(_) | State::FramePayload { .. } => {
+                    let content = self.content_left().min(data.len() as u64) as usize;
+                    if content > 0 {
+                        body.push(&data[..content]);
+                    }
+                    let (used, ended) = self.payload(data.len() as u64);
+                    stream_ended |= ended;
+                    used as usize
+                }
+            };
+            data = &data[used..];
+        }
+        // A frame with an empty payload ends as soon as its header is complete
+        if let State::FramePayload { left: 0, .. } = self.state {
+            stream_ended |= self.payload(0).1;
+        }
+        stream_ended
+    }
+
+    /// Body bytes left in the current body, chunk or frame payload: not the CRLF closing a
+    /// chunk, nothing of frames other than DATA.
+    fn content_left(&self) -> u64 {
+        match self.state {
+            State::Body(left) => left,
+            State::ChunkData(left) => left.saturating_sub(2),
+            State::FramePayload {
+                left, data: true, ..
+            } => left,
+            _ => 0,
+        }
+    }
+
+    /// Account for bytes that were not captured.
+    fn skip(&mut self, missing: u64) -> bool {
+        match self.state {
+            State::Body(_) | State::ChunkData(_) | State::FramePayload { .. } => {
+                let (used, stream_ended) = self.payload(missing);
+                if used < missing {
+                    // The gap runs into a chunk-size line or frame header
+                    self.state = State::Unframed;
+                }
+                stream_ended
+            }
+            State::Complete | State::Unframed => false,
+            _ => {
+                self.state = State::Unframed;
+                false
+            }
+        }
+    }
+
+    fn head(&mut self, data: &[u8]) -> usize {
+        let buffered = self.pending.len();
+        self.pending.extend_from_slice(data);
+        let mut headers = [httparse::EMPTY_HEADER; 64];
+        let mut resp = httparse::Response::new(&mut headers);
+        let head_len = match resp.parse(&self.pending) {
+            Ok(httparse::Status::Complete(n)) => n,
+            Ok(httparse::Status::Partial) if self.pending.len() <= MAX_HEAD_SIZE => {
+                return data.len();
+            }
+            _ => {
+                self.state = State::Unframed;
+                return data.len();
+            }
+        };
+
+        let header = |name: &str| {
+            resp.headers
+                .iter()
+                .find(|h| h.name.eq_ignore_ascii_case(name))
+                .map(|h| String::from_utf8_lossy(h.value))
+        };
+        let code = resp.code.unwrap_or_default();
+        self.state = if (100..200).contains(&code) {
+            // Interim response (100 Continue), the final one follows
+            State::Head
+        } else if code == 204 || code == 304 || self.head_request {
+            // No body, whatever the headers say
+            State::Complete
+        } else if header("Transfer-Encoding")
+            .is_some_and(|te| te.to_ascii_lowercase().contains("chunked"))
+        {
+            State::ChunkSize
+        } else if let Some(len) = header("Content-Length").and_then(|len| len.trim().parse().ok()) {
+            if len == 0 {
+                State::Complete
+            } else {
+                State::Body(len)
+            }
+        } else {
+            State::Unframed
+        };
+        self.pending.clear();
+        // Bytes of this read past the head belong to the body
+        head_len - buffered
+    }
+
+    fn line(&mut self, data: &[u8]) -> usize {
+        let Some(newline) = data.iter().position(|&b| b == b'\n') else {
+            self.pending.extend_from_slice(data);
+            if self.pending.len() > MAX_LINE_SIZE {
+                self.state = State::Unframed;
+            }
+            return data.len();
+        };
+        self.pending.extend_from_slice(&data[..newline]);
+        let line = String::from_utf8_lossy(&self.pending);
+        let line = line.trim();
+        self.state = match self.state {
+            State::ChunkSize => {
+                // Chunk extensions follow a ';'
+                let size = line.split(';').next().unwrap_or_default().trim();
+                match u64::from_str_radix(size, 16) {
+                    Ok(0) => State::Trailers,
+                    Ok(size) => State::ChunkData(size + 2),
+                    Err(_) => State::Unframed,
+                }
+            }
+            _ if line.is_empty() => State::Complete,
+            _ => State::Trailers,
+        };
+        self.pending.clear();
+        newline + 1
+    }
+
+    fn frame_header(&mut self, data: &[u8]) -> usize {
+        let used = (H2_FRAME_HEADER_SIZE - self.pending.len()).min(data.len());
+        self.pending.extend_from_slice(&data[..used]);
+        if self.pending.len() < H2_FRAME_HEADER_SIZE {
+            return used;
+        }
+        let header = &self.pending;
+        let len = u32::from_be_bytes([0, header[0], header[1], header[2]]);
+        let kind = header[3];
+        let flags = header[4];
+        let stream = u32::from_be_bytes([header[5], header[6], header[7], header[8]]) & 0x7fff_ffff;
+        self.state = if kind > H2_MAX_FRAME_TYPE {
+            // Not at a frame boundary (the buffer started mid-frame)
+            State::Unframed
+        } else {
+            State::FramePayload {
+                left: len as u64,
+                data: kind == H2_FRAME_DATA,
+                end_stream: stream != 0
+                    && matches!(kind, H2_FRAME_DATA | H2_FRAME_HEADERS)
+                    && flags & H2_FLAG_END_STREAM != 0,
+            }
+        };
+        self.pending.clear();
+        used
+    }
+
+    /// Consume up to `available` bytes of a body, chunk or frame payload. Returns the bytes
+    /// used and whether an HTTP/2 stream ended.
+    fn payload(&mut self, available: u64) -> (u64, bool) {
+        let (left, used) = match self.state {
+            State::Body(left) | State::ChunkData(left) | State::FramePayload { left, .. } => {
+                let used = left.min(available);
+                (left - used, used)
+            }
+            _ => return (0, false),
+        };
+        let mut stream_ended = false;
+        self.state = match self.state {
+            State::Body(_) if left == 0 => State::Complete,
+            State::Body(_) => State::Body(left),
+            State::ChunkData(_) if left == 0 => State::ChunkSize,
+            State::ChunkData(_) => State::ChunkData(left),
+            State::FramePayload { end_stream, .. } if left == 0 => {
+                stream_ended = end_stream;
+                State::FrameHeader
+            }
+            State::FramePayload {
+                data, end_stream, ..
+            } => State::FramePayload {
+                left,
+                data,
+                end_stream,
+            },
+            _ => unreachable!(),
+        };
+        (used, stream_ended)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn feed_bytewise(framing: &mut ResponseFraming, data: &[u8]) -> Vec<Progress> {
+        data.chunks(1).map(|byte| framing.feed(byte, 0)).collect()
+    }
+
+    #[test]
+    fn test_http1_framing() {
+        // Content-Length, with the body split across reads and a gap the kernel left out
+        let mut framing = ResponseFraming::http1();
+        assert_eq!(
+            framing.feed(
+                b"HTTP/1.1 200 OK\r\nContent-Length: 10000\r\n\r\n{\"a\":{}}",
+                0
+            ),
+            Progress::Pending
+        );
+        assert_eq!(framing.feed(&[b' '; 4000], 5000), Progress::Pending);
+        assert_eq!(framing.feed(b"  }", 989), Progress::Complete);
+        assert_eq!(framing.leftover(), 0);
+
+        // Two pipelined responses in one read
+        let mut framing = ResponseFraming::http1();
+        let second = b"HTTP/1.1 204 No Content\r\n\r\n";
+        let mut reads = b"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n{}".to_vec();
+        reads.extend_from_slice(second);
+        assert_eq!(framing.feed(&reads, 0), Progress::Complete);
+        assert_eq!(framing.leftover(), second.len());
+
+        // Chunked: a chunk ending in '}' is not the end, the terminal chunk is
+        let response = b"HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n8\r\n{\"a\":{}}\r\n3;ext=1\r\n, }\r\n0\r\nX-Trailer: 1\r\n\r\n";
+        let progress = feed_bytewise(&mut ResponseFraming::http1(), response);
+        assert_eq!(progress.last(), Some(&Progress::Complete));
+        assert!(
+            progress[..progress.len() - 1]
+                .iter()
+                .all(|p| *p == Progress::Pending)
+        );
+
+        // Only the chunk contents are body
+        let mut framing = ResponseFraming::http1();
+        let mut body = Vec::new();
+        framing.feed_body(&response[25..], 0, &mut body);
+        assert_eq!(body.concat(), b"{\"a\":{}}, }");
+
+        // Neither length nor chunks: only the connection close would tell
+        let mut framing = ResponseFraming::http1();
+        assert_eq!(
+            framing.feed(b"HTTP/1.1 200 OK\r\nConnection: close\r\n\r\n{}", 0),
+            Progress::Unframed
+        );
+        // A gap in a chunk-size line loses the framing
+        let mut framing = ResponseFraming::http1();
+        framing.feed(b"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n", 0);
+        assert_eq!(framing.feed(b"1", 100), Progress::Unframed);
+    }
+
+    #[test]
+    fn test_bodiless_responses() {
+        let framing = |head_request: bool| {
+            let framing = ResponseFraming::http1();
+            if head_request {
+                framing.head_request()
+            } else {
+                framing
+            }
+        };
+        let next = b"HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n{}";
+        let bodiless: [(bool, &[u8]); 4] = [
+            (true, b"HTTP/1.1 200 OK\r\nContent-Length: 1234\r\n\r\n"),
+            (
+                true,
+                b"HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n",
+            ),
+            (
+                false,
+                b"HTTP/1.1 204 No Content\r\nContent-Length: 10\r\n\r\n",
+            ),
+            (
+                false,
+                b"HTTP/1.1 304 Not Modified\r\nTransfer-Encoding: chunked\r\n\r\n",
+            ),
+        ];
+        for (head_request, head) in bodiless {
+            // Complete at the end of the head, even when it arrives bytewise
+            let progress = feed_bytewise(&mut framing(head_request), head);
+            assert_eq!(progress.last(), Some(&Progress::Complete));
+            assert!(
+                progress[..progress.len() - 1]
+                    .iter()
+                    .all(|p| *p == Progress::Pending)
+            );
+
+            // The next response in the same read is left over, and nothing is body
+            let mut reads = head.to_vec();
+            reads.extend_from_slice(next);
+            let mut body = Vec::new();
+            let mut framing = framing(head_request);
+            assert_eq!(framing.feed_body(&reads, 0, &mut body), Progress::Complete);
+            assert_eq!(framing.leftover(), next.len());
+            assert!(body.is_empty());
+        }
+
+        // Interim responses, to HEAD requests too, are followed by the final one
+        for head_request in [false, true] {
+            let mut framing = framing(head_request);
+            assert_eq!(
+                framing.feed(b"HTTP/1.1 103 Early Hints\r\nLink: </a>\r\n\r\n", 0),
+                Progress::Pending
+            );
+            assert_eq!(
+                framing.feed(b"HTTP/1.1 100 Continue\r\n\r\n", 0),
+                Progress::Pending
+            );
+            assert_eq!(framing.feed(next, 0), Progress::Complete);
+            assert_eq!(framing.leftover(), if head_request { 2 } else { 0 });
+        }
+    }
+
+    #[test]
+    fn test_http2_framing() {
+        let frame = |kind: u8, flags: u8, stream: u32, payload: &[u8]| {
+            let mut frame = (payload.len() as u32).to_be_bytes()[1..].to_vec();
+            frame.extend_from_slice(&[kind, flags]);
+            frame.extend_from_slice(&stream.to_be_bytes());
+            frame.extend_from_slice(payload);
+            frame
+        };
+        let mut response = frame(0x4, 0, 0, &[0; 6]); // SETTINGS
+        response.extend(frame(H2_FRAME_HEADERS, 0x4, 1, &[0x88]));
+        response.extend(frame(H2_FRAME_DATA, 0, 1, b"{\"usage\":"));
+        response.extend(frame(H2_FRAME_DATA, H2_FLAG_END_STREAM, 1, b"{}}"));
+
+        // Only DATA payloads are body, not frame headers or the HPACK block
+        let mut body = Vec::new();
+        ResponseFraming::http2().feed_body(&response, 0, &mut body);
+        assert_eq!(body.concat(), b"{\"usage\":{}}");
+
+        let progress = feed_bytewise(&mut ResponseFraming::http2(), &response);
+        assert_eq!(progress.last(), Some(&Progress::StreamEnded));
+        assert_eq!(
+            progress
+                .iter()
+                .filter(|p| **p == Progress::StreamEnded)
+                .count(),
+            1
+        );
+
+        // A buffer that starts mid-frame
+        assert_eq!(
+            ResponseFraming::http2().feed(b"\"usage\": {}}\r\n", 0),
+            Progress::Unframed
+        );
+    }
+}
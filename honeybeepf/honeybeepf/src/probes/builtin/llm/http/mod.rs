@@ -3,10 +3,19 @@
 //! This module handles HTTP/1.1 and HTTP/2 parsing to extract
 //! LLM request/response data.
 
+pub mod classify;
+pub mod deltas;
+pub mod framing;
 pub mod protocol;
 pub mod providers;
+pub mod ratelimit;
+pub mod scanner;
 pub mod utils;
 
 // Re-export main types
+pub use classify::{Protocol, classify};
+pub use deltas::DeltaScanner;
+pub use framing::{Progress, ResponseFraming};
 pub use protocol::{Http2Parser, Http11Parser, ProtocolParser};
 pub use providers::{ConfigurableProvider, ProviderRegistry};
+pub use scanner::RequestScanner;
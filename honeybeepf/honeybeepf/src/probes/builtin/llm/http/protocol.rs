@@ -1,14 +1,18 @@
-use std::io::Read;
+use std::{borrow::Cow, io::Read};
 
 use flate2::read::GzDecoder;
 use once_cell::sync::Lazy;
 use serde_json::Value;
 
 use super::{
+    classify::H2_PREFACE,
+    framing::ResponseFraming,
     providers::{ConfigurableProvider, ProviderRegistry},
+    ratelimit,
+    scanner::RequestScanner,
     utils as byte_utils,
 };
-use crate::probes::builtin::llm::types::{SseChunkDelta, UsageInfo};
+use crate::probes::builtin::llm::types::{RequestInfo, ResponseHead, SseChunkDelta, UsageInfo};
 
 /// Cached providers - built once at initialization
 static CACHED_PROVIDERS: Lazy<Vec<ConfigurableProvider>> = Lazy::new(|| {
@@ -61,10 +65,26 @@ pub trait ProtocolParser: Send + Sync {
     /// Uses the global PROVIDER_REGISTRY for host/path matching.
     fn detect_request(&self, buffer: &[u8]) -> Option<String>;
 
+    /// Routing facts from the head of a detected request, and the offset of its body in
+    /// `buffer`. `None` while the head is incomplete.
+    fn request_head(&self, buffer: &[u8]) -> Option<(RequestInfo, usize)>;
+
+    /// Scanner of the request body that follows the head
+    fn request_scanner(&self, info: RequestInfo) -> RequestScanner;
+
     /// Extract request text for token estimation
     fn extract_request_text(&self, buffer: &[u8]) -> String;
 
-    /// Parse response buffer. Returns UsageInfo if complete.
+    /// Extract the generated text of a response for token estimation
+    fn extract_response_text(&self, buffer: &[u8]) -> String;
+
+    /// Tracker of the response framing, which tells when to call `parse_response`
+    fn response_framing(&self) -> ResponseFraming;
+
+    /// Status and rate-limit headers of a response. `None` while its head is incomplete.
+    fn response_head(&self, buffer: &[u8]) -> Option<ResponseHead>;
+
+    /// Parse a complete response buffer. Returns UsageInfo if it carries any.
     fn parse_response(&self, buffer: &[u8]) -> Option<UsageInfo>;
 }
 
@@ -98,6 +118,37 @@ impl ProtocolParser for Http11Parser {
         None
     }
 
+    fn request_head(&self, buffer: &[u8]) -> Option<(RequestInfo, usize)> {
+        let mut headers = [httparse::EMPTY_HEADER; 64];
+        let mut req = httparse::Request::new(&mut headers);
+        let Ok(httparse::Status::Complete(body_offset)) = req.parse(buffer) else {
+            return None;
+        };
+        let header = |name: &str| {
+            req.headers
+                .iter()
+                .find(|h| h.name.eq_ignore_ascii_case(name))
+                .map(|h| String::from_utf8_lossy(h.value))
+        };
+        let path = req.path.unwrap_or_default();
+        let host = header("Host").unwrap_or_default();
+        let info = RequestInfo {
+            provider: PROVIDER_REGISTRY
+                .find_provider(&host, path)
+                .map(|provider| provider.name.clone()),
+            model: model_from_path(path),
+            content_length: header("Content-Length").and_then(|len| len.trim().parse().ok()),
+            head_request: req.method == Some("HEAD"),
+            api_key: ratelimit::api_key_hash(req.headers, path),
+            ..Default::default()
+        };
+        Some((info, body_offset))
+    }
+
+    fn request_scanner(&self, info: RequestInfo) -> RequestScanner {
+        RequestScanner::new(info)
+    }
+
     fn extract_request_text(&self, buffer: &[u8]) -> String {
         let body_start = byte_utils::find_pattern(buffer, b"\r\n\r\n")
             .map(|i| i + 4)
@@ -107,6 +158,25 @@ impl ProtocolParser for Http11Parser {
         extract_text_from_json(&json_body)
     }
 
+    fn extract_response_text(&self, buffer: &[u8]) -> String {
+        let mut headers = [httparse::EMPTY_HEADER; 64];
+        let mut resp = httparse::Response::new(&mut headers);
+        let Ok(httparse::Status::Complete(body_offset)) = resp.parse(buffer) else {
+            return String::new();
+        };
+        decode_body(resp.headers, &buffer[body_offset..])
+            .map(|body| extract_string_fields(&String::from_utf8_lossy(&body), 0).concat())
+            .unwrap_or_default()
+    }
+
+    fn response_framing(&self) -> ResponseFraming {
+        ResponseFraming::http1()
+    }
+
+    fn response_head(&self, buffer: &[u8]) -> Option<ResponseHead> {
+        ratelimit::http1_head(buffer)
+    }
+
     fn parse_response(&self, buffer: &[u8]) -> Option<UsageInfo> {
         let mut headers = [httparse::EMPTY_HEADER; 64];
         let mut resp = httparse::Response::new(&mut headers);
@@ -120,14 +190,6 @@ impl ProtocolParser for Http11Parser {
             h.name.eq_ignore_ascii_case("Content-Type")
                 && String::from_utf8_lossy(h.value).contains("text/event-stream")
         });
-        let is_chunked = resp.headers.iter().any(|h| {
-            h.name.eq_ignore_ascii_case("Transfer-Encoding")
-                && String::from_utf8_lossy(h.value).contains("chunked")
-        });
-        let is_gzip = resp.headers.iter().any(|h| {
-            h.name.eq_ignore_ascii_case("Content-Encoding")
-                && String::from_utf8_lossy(h.value).contains("gzip")
-        });
 
         let body = &buffer[body_offset..];
 
@@ -135,30 +197,8 @@ impl ProtocolParser for Http11Parser {
             return parse_sse_body(body);
         }
 
-        // Decode chunked transfer encoding first
-        let dechunked = if is_chunked {
-            byte_utils::decode_chunked_body(body)
-        } else {
-            std::borrow::Cow::Borrowed(body)
-        };
-
-        // Then decompress gzip if needed
-        let decompressed: std::borrow::Cow<'_, [u8]> = if is_gzip {
-            match decompress_gzip(&dechunked) {
-                Ok(data) => std::borrow::Cow::Owned(data),
-                Err(_) => return None,
-            }
-        } else {
-            dechunked
-        };
-
-        let trimmed = byte_utils::trim_trailing_whitespace(&decompressed);
-
-        if !trimmed.ends_with(b"}") {
-            return None;
-        }
-
-        let s = String::from_utf8_lossy(trimmed);
+        let decompressed = decode_body(resp.headers, body)?;
+        let s = String::from_utf8_lossy(&decompressed);
         let start = s.find('{')?;
         let json_body = &s[start..];
 
@@ -201,6 +241,21 @@ impl ProtocolParser for Http2Parser {
         None
     }
 
+    fn request_head(&self, buffer: &[u8]) -> Option<(RequestInfo, usize)> {
+        // Headers are HPACK-compressed; the frames after the connection preface are walked
+        // for the body
+        let body_offset = if buffer.starts_with(H2_PREFACE) {
+            H2_PREFACE.len()
+        } else {
+            0
+        };
+        Some((RequestInfo::default(), body_offset))
+    }
+
+    fn request_scanner(&self, info: RequestInfo) -> RequestScanner {
+        RequestScanner::new(info).with_frames()
+    }
+
     fn extract_request_text(&self, buffer: &[u8]) -> String {
         let json_objects = byte_utils::extract_h2_json_all(buffer);
         for payload in &json_objects {
@@ -215,6 +270,19 @@ impl ProtocolParser for Http2Parser {
         extract_text_from_json(&text)
     }
 
+    fn extract_response_text(&self, buffer: &[u8]) -> String {
+        extract_string_fields(&String::from_utf8_lossy(buffer), 0).concat()
+    }
+
+    fn response_framing(&self) -> ResponseFraming {
+        ResponseFraming::http2()
+    }
+
+    /// `:status` only: the other headers need the connection's HPACK dynamic table
+    fn response_head(&self, buffer: &[u8]) -> Option<ResponseHead> {
+        ratelimit::http2_head(buffer)
+    }
+
     fn parse_response(&self, buffer: &[u8]) -> Option<UsageInfo> {
         let json_objects = byte_utils::extract_h2_json_all(buffer);
         if json_objects.is_empty() {
@@ -294,7 +362,10 @@ fn parse_response_json_value(val: &Value) -> Option<UsageInfo> {
             prompt_tokens: 0,
             completion_tokens: 0,
             thoughts_tokens: None,
+            cache_read_tokens: None,
+            cache_write_tokens: None,
             model: None,
+            estimated: false,
         });
     }
 
@@ -308,6 +379,29 @@ fn parse_response_json_value(val: &Value) -> Option<UsageInfo> {
 
 // --- Helpers ---
 
+/// Body of an HTTP/1.1 response without its chunked transfer and gzip content encodings
+fn decode_body<'a>(headers: &[httparse::Header<'_>], body: &'a [u8]) -> Option<Cow<'a, [u8]>> {
+    let has = |name: &str, value: &str| {
+        headers.iter().any(|h| {
+            h.name.eq_ignore_ascii_case(name) && String::from_utf8_lossy(h.value).contains(value)
+        })
+    };
+
+    // Decode chunked transfer encoding first
+    let dechunked = if has("Transfer-Encoding", "chunked") {
+        byte_utils::decode_chunked_body(body)
+    } else {
+        Cow::Borrowed(body)
+    };
+
+    // Then decompress gzip if needed
+    if has("Content-Encoding", "gzip") {
+        decompress_gzip(&dechunked).ok().map(Cow::Owned)
+    } else {
+        Some(dechunked)
+    }
+}
+
 /// Decompress gzip data
 fn decompress_gzip(data: &[u8]) -> Result<Vec<u8>, std::io::Error> {
     let mut decoder = GzDecoder::new(data);
@@ -316,6 +410,19 @@ fn decompress_gzip(data: &[u8]) -> Result<Vec<u8>, std::io::Error> {
     Ok(decompressed)
 }
 
+/// Model named in the path, as in Gemini's `/v1beta/models/<model>:generateContent` or
+/// Bedrock's `/model/<model>/invoke`
+fn model_from_path(path: &str) -> Option<String> {
+    let start = ["/models/", "/model/"]
+        .iter()
+        .find_map(|prefix| path.find(prefix).map(|i| i + prefix.len()))?;
+    let model = path[start..]
+        .split([':', '/', '?'])
+        .next()
+        .filter(|model| !model.is_empty())?;
+    Some(model.to_string())
+}
+
 fn is_llm_path(path: &str) -> bool {
     PROVIDER_REGISTRY
         .providers
@@ -352,6 +459,12 @@ fn extract_text_from_json(json: &str) -> String {
 /// Extract text from incomplete JSON by finding "text" or "content" field values.
 /// Used when the request buffer was truncated and full JSON parsing fails.
 fn extract_text_from_incomplete_json(json: &str) -> String {
+    extract_string_fields(json, 10).join(" ")
+}
+
+/// Values of the "text" and "content" string fields in `json` longer than `min_len`,
+/// wherever they are (complete or not, one object or a stream of deltas).
+fn extract_string_fields(json: &str, min_len: usize) -> Vec<String> {
     let mut texts = Vec::new();
 
     for pattern in [r#""text":"#, r#""content":"#] {
@@ -362,7 +475,7 @@ fn extract_text_from_incomplete_json(json: &str) -> String {
 
             if rest.starts_with('"')
                 && let Some(text) = extract_json_string(&rest[1..])
-                && text.len() > 10
+                && text.len() > min_len
             {
                 texts.push(text);
             }
@@ -370,7 +483,7 @@ fn extract_text_from_incomplete_json(json: &str) -> String {
         }
     }
 
-    texts.join(" ")
+    texts
 }
 
 /// Extract a JSON string value, handling basic escape sequences.
@@ -33,6 +33,17 @@ pub struct ResponseConfig {
     /// Optional: field name for thinking/reasoning tokens
     pub thoughts_tokens: Option<String>,
 
+    /// Optional: field name for prompt tokens read from the prompt cache
+    pub cached_read_tokens: Option<String>,
+
+    /// Optional: field name for prompt tokens written to the prompt cache
+    pub cached_write_tokens: Option<String>,
+
+    /// Whether `prompt_tokens` already counts the cached tokens (OpenAI, Gemini). When not
+    /// (Anthropic), they are added to it, so that prompt tokens are all input tokens.
+    #[serde(default = "default_prompt_includes_cached")]
+    pub prompt_includes_cached: bool,
+
     /// JSON path to model name (from root, e.g., "model" or "modelVersion")
     #[serde(default = "default_model_path")]
     pub model_path: String,
@@ -50,6 +61,9 @@ fn default_completion_tokens() -> String {
 fn default_model_path() -> String {
     "model".to_string()
 }
+fn default_prompt_includes_cached() -> bool {
+    true
+}
 
 impl Default for ResponseConfig {
     fn default() -> Self {
@@ -58,6 +72,9 @@ impl Default for ResponseConfig {
             prompt_tokens: default_prompt_tokens(),
             completion_tokens: default_completion_tokens(),
             thoughts_tokens: None,
+            cached_read_tokens: None,
+            cached_write_tokens: None,
+            prompt_includes_cached: default_prompt_includes_cached(),
             model_path: default_model_path(),
         }
     }
@@ -116,6 +133,9 @@ impl ProviderRegistry {
                         thoughts_tokens: Some(
                             "completion_tokens_details.reasoning_tokens".to_string(),
                         ),
+                        cached_read_tokens: Some("prompt_tokens_details.cached_tokens".to_string()),
+                        cached_write_tokens: None,
+                        prompt_includes_cached: true,
                         model_path: "model".to_string(),
                     },
                     request_extractor: RequestExtractorType::Messages,
@@ -129,6 +149,9 @@ impl ProviderRegistry {
                         prompt_tokens: "input_tokens".to_string(),
                         completion_tokens: "output_tokens".to_string(),
                         thoughts_tokens: None,
+                        cached_read_tokens: Some("cache_read_input_tokens".to_string()),
+                        cached_write_tokens: Some("cache_creation_input_tokens".to_string()),
+                        prompt_includes_cached: false,
                         model_path: "model".to_string(),
                     },
                     request_extractor: RequestExtractorType::Messages,
@@ -142,6 +165,9 @@ impl ProviderRegistry {
                         prompt_tokens: "promptTokenCount".to_string(),
                         completion_tokens: "candidatesTokenCount".to_string(),
                         thoughts_tokens: Some("thoughtsTokenCount".to_string()),
+                        cached_read_tokens: Some("cachedContentTokenCount".to_string()),
+                        cached_write_tokens: None,
+                        prompt_includes_cached: true,
                         model_path: "modelVersion".to_string(),
                     },
                     request_extractor: RequestExtractorType::Contents,
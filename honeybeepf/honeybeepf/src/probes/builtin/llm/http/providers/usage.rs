@@ -56,12 +56,22 @@ impl ConfigurableProvider {
         let completion =
             get_nested_value(usage, &response_config.completion_tokens).and_then(|v| v.as_u64())?;
 
-        // Optional: thoughts/reasoning tokens
-        let thoughts = response_config
-            .thoughts_tokens
-            .as_ref()
-            .and_then(|path| get_nested_value(usage, path))
-            .and_then(|v| v.as_u64());
+        // Optional: thoughts/reasoning and prompt cache tokens
+        let optional = |path: &Option<String>| {
+            path.as_ref()
+                .and_then(|path| get_nested_value(usage, path))
+                .and_then(|v| v.as_u64())
+        };
+        let thoughts = optional(&response_config.thoughts_tokens);
+        // A configured cache field left out means nothing was cached (Gemini omits it)
+        let cached = |path: &Option<String>| path.as_ref().map(|_| optional(path).unwrap_or(0));
+        let cache_read = cached(&response_config.cached_read_tokens);
+        let cache_write = cached(&response_config.cached_write_tokens);
+        let prompt = if response_config.prompt_includes_cached {
+            prompt
+        } else {
+            prompt + cache_read.unwrap_or(0) + cache_write.unwrap_or(0)
+        };
 
         // Model name from root
         let model = get_nested_value(json, &response_config.model_path)
@@ -72,7 +82,10 @@ impl ConfigurableProvider {
             prompt_tokens: prompt,
             completion_tokens: completion,
             thoughts_tokens: thoughts,
+            cache_read_tokens: cache_read,
+            cache_write_tokens: cache_write,
             model,
+            estimated: false,
         })
     }
 }
@@ -91,7 +104,7 @@ mod tests {
     use serde_json::json;
 
     use super::{
-        super::config::{ProviderConfig, RequestExtractorType, ResponseConfig},
+        super::config::{ProviderConfig, ProviderRegistry, RequestExtractorType, ResponseConfig},
         *,
     };
 
@@ -105,6 +118,9 @@ mod tests {
                 prompt_tokens: "prompt_tokens".to_string(),
                 completion_tokens: "completion_tokens".to_string(),
                 thoughts_tokens: None,
+                cached_read_tokens: Some("prompt_tokens_details.cached_tokens".to_string()),
+                cached_write_tokens: None,
+                prompt_includes_cached: true,
                 model_path: "model".to_string(),
             },
             request_extractor: RequestExtractorType::Messages,
@@ -121,6 +137,9 @@ mod tests {
                 prompt_tokens: "promptTokenCount".to_string(),
                 completion_tokens: "candidatesTokenCount".to_string(),
                 thoughts_tokens: Some("thoughtsTokenCount".to_string()),
+                cached_read_tokens: Some("cachedContentTokenCount".to_string()),
+                cached_write_tokens: None,
+                prompt_includes_cached: true,
                 model_path: "modelVersion".to_string(),
             },
             request_extractor: RequestExtractorType::Contents,
@@ -170,9 +189,48 @@ mod tests {
         assert_eq!(usage.prompt_tokens, 15);
         assert_eq!(usage.completion_tokens, 25);
         assert_eq!(usage.thoughts_tokens, Some(100));
+        assert_eq!(usage.cache_read_tokens, Some(0));
         assert_eq!(usage.model, Some("gemini-1.5-pro".to_string()));
     }
 
+    #[test]
+    fn test_prompt_cache_tokens() {
+        let provider = ConfigurableProvider::new(openai_config());
+        let response = json!({
+            "model": "gpt-4o",
+            "usage": {
+                "prompt_tokens": 2006,
+                "completion_tokens": 300,
+                "prompt_tokens_details": {"cached_tokens": 1920}
+            }
+        });
+        let usage = provider.parse_usage(&response).unwrap();
+        assert_eq!(usage.prompt_tokens, 2006);
+        assert_eq!(usage.cache_read_tokens, Some(1920));
+        assert_eq!(usage.cache_write_tokens, None);
+
+        // Anthropic's input_tokens leaves out the cached part
+        let anthropic = ProviderRegistry::with_defaults()
+            .providers
+            .into_iter()
+            .find(|p| p.name == "anthropic")
+            .unwrap();
+        let provider = ConfigurableProvider::new(anthropic);
+        let response = json!({
+            "model": "claude-sonnet-4",
+            "usage": {
+                "input_tokens": 50,
+                "cache_read_input_tokens": 10000,
+                "cache_creation_input_tokens": 2000,
+                "output_tokens": 400
+            }
+        });
+        let usage = provider.parse_usage(&response).unwrap();
+        assert_eq!(usage.prompt_tokens, 12050);
+        assert_eq!(usage.cache_read_tokens, Some(10000));
+        assert_eq!(usage.cache_write_tokens, Some(2000));
+    }
+
     #[test]
     fn test_extract_request_text() {
         let provider = ConfigurableProvider::new(openai_config());
@@ -0,0 +1,307 @@
+//! Response status and rate-limit headers, and the API key of requests.
+//!
+//! Providers report their rate-limit window in response headers: `x-ratelimit-remaining-*`
+//! (OpenAI, Azure OpenAI), `anthropic-ratelimit-*-remaining` (Anthropic) and `retry-after`
+//! on 429s. HTTP/1.1 heads are read in full. HTTP/2 headers are HPACK-compressed against
+//! a dynamic table that lives as long as the connection, which is not tracked; only
+//! `:status`, sent first and almost always from the static table, is decoded there.
+//!
+//! The API key is never kept: requests are told apart by a short hash of it.
+
+use std::time::Duration;
+
+use crate::probes::builtin::llm::types::ResponseHead;
+
+/// Request headers carrying the API key, in order of precedence
+const API_KEY_HEADERS: [&str; 4] = ["Authorization", "x-api-key", "api-key", "x-goog-api-key"];
+/// HTTP/2 frame header: 24-bit length, type, flags, 31-bit stream id
+const FRAME_HEADER_LEN: usize = 9;
+const FRAME_HEADERS: u8 = 0x1;
+const FLAG_PADDED: u8 = 0x8;
+const FLAG_PRIORITY: u8 = 0x20;
+/// `:status` values of the HPACK static table, entries 8 to 14 (RFC 7541 Appendix A)
+const STATIC_STATUS: [u16; 7] = [200, 204, 206, 304, 400, 404, 500];
+
+/// Hash of the API key in the request headers (`Bearer` tokens included), as 8 hex
+/// digits. FNV-1a, so that it is the same on every node and across restarts.
+pub fn api_key_hash(headers: &[httparse::Header<'_>], path: &str) -> Option<String> {
+    let key = API_KEY_HEADERS
+        .iter()
+        .find_map(|name| {
+            headers
+                .iter()
+                .find(|h| h.name.eq_ignore_ascii_case(name))
+                .map(|h| h.value)
+        })
+        .or_else(|| {
+            // Gemini also takes the key as a query parameter
+            let query = path.split_once('?')?.1;
+            query
+                .split('&')
+                .find_map(|param| param.strip_prefix("key="))
+                .map(str::as_bytes)
+        })?;
+    let key = key.trim_ascii();
+    let key = key
+        .strip_prefix(b"Bearer ")
+        .or_else(|| key.strip_prefix(b"bearer "))
+        .unwrap_or(key)
+        .trim_ascii();
+    if key.is_empty() {
+        return None;
+    }
+    let hash = key.iter().fold(0xcbf2_9ce4_8422_2325u64, |hash, &b| {
+        (hash ^ b as u64).wrapping_mul(0x0100_0000_01b3)
+    });
+    Some(format!("{:08x}", hash >> 32))
+}
+
+/// Status and rate-limit headers of the final HTTP/1.1 response in `buffer`, past any
+/// interim (1xx) responses. `None` while the head is incomplete.
+pub fn http1_head(mut buffer: &[u8]) -> Option<ResponseHead> {
+    loop {
+        let mut headers = [httparse::EMPTY_HEADER; 64];
+        let mut resp = httparse::Response::new(&mut headers);
+        let Ok(httparse::Status::Complete(head_len)) = resp.parse(buffer) else {
+            return None;
+        };
+        let status = resp.code?;
+        if (100..200).contains(&status) && status != 101 {
+            buffer = &buffer[head_len..];
+            continue;
+        }
+
+        let mut head = ResponseHead {
+            status,
+            ..Default::default()
+        };
+        let mut retry_after_ms = None;
+        for header in resp.headers.iter() {
+            let value = String::from_utf8_lossy(header.value);
+            let value = value.trim();
+            match header.name.to_ascii_lowercase().as_str() {
+                "x-ratelimit-remaining-requests" | "anthropic-ratelimit-requests-remaining" => {
+                    head.remaining_requests = value.parse().ok();
+                }
+                "x-ratelimit-remaining-tokens" | "anthropic-ratelimit-tokens-remaining" => {
+                    head.remaining_tokens = value.parse().ok();
+                }
+                // Seconds; the HTTP-date form is not used by LLM APIs
+                "retry-after" => head.retry_after = value.parse().ok().map(Duration::from_secs),
+                "retry-after-ms" => {
+                    retry_after_ms = value
+                        .parse::<f64>()
+                        .ok()
+                        .and_then(|ms| Duration::try_from_secs_f64(ms / 1e3).ok());
+                }
+                _ => {}
+            }
+        }
+        // The finer of the two when both are sent
+        head.retry_after = retry_after_ms.or(head.retry_after);
+        return Some(head);
+    }
+}
+
+/// `:status` of the first HTTP/2 HEADERS frame in `buffer`. `None` until one arrives, and
+/// when the status is not encoded in a way that can be read without the dynamic table.
+pub fn http2_head(buffer: &[u8]) -> Option<ResponseHead> {
+    let mut rest = buffer;
+    while rest.len() >= FRAME_HEADER_LEN {
+        let len = u32::from_be_bytes([0, rest[0], rest[1], rest[2]]) as usize;
+        let (kind, flags) = (rest[3], rest[4]);
+        // Not at a frame boundary (the buffer started mid-frame)
+        if kind > 0x9 {
+            return None;
+        }
+        let payload = &rest[FRAME_HEADER_LEN..rest.len().min(FRAME_HEADER_LEN + len)];
+        if kind == FRAME_HEADERS {
+            let mut block = payload;
+            if flags & FLAG_PADDED != 0 {
+                block = block.get(1..)?;
+            }
+            if flags & FLAG_PRIORITY != 0 {
+                block = block.get(5..)?;
+            }
+            return hpack_status(block).map(|status| ResponseHead {
+                status,
+                ..Default::default()
+            });
+        }
+        rest = rest.get(FRAME_HEADER_LEN + len..)?;
+    }
+    None
+}
+
+/// `:status` from the first field of an HPACK header block, when it is a static table
+/// entry or a literal with a static table name.
+fn hpack_status(block: &[u8]) -> Option<u16> {
+    let mut pos = 0;
+    // Dynamic table size updates come before any field
+    while block.get(pos)? & 0xe0 == 0x20 {
+        pos = integer(block, pos, 5)?.1;
+    }
+    let first = block[pos];
+    if first & 0x80 != 0 {
+        let (index, _) = integer(block, pos, 7)?;
+        return STATIC_STATUS.get(index.checked_sub(8)?).copied();
+    }
+
+    // Literal, with incremental indexing (6-bit name index) or without (4-bit)
+    let prefix = if first & 0x40 != 0 { 6 } else { 4 };
+    let (name, pos) = integer(block, pos, prefix)?;
+    if !(8..=14).contains(&name) {
+        return None;
+    }
+    let huffman = block.get(pos)? & 0x80 != 0;
+    let (len, pos) = integer(block, pos, 7)?;
+    let value = block.get(pos..pos + len)?;
+    let digits = if huffman {
+        huffman_digits(value)?
+    } else {
+        value.try_into().ok()?
+    };
+    std::str::from_utf8(&digits).ok()?.parse().ok()
+}
+
+/// HPACK integer with a `prefix`-bit prefix at `pos`. Returns it and the position after it.
+fn integer(block: &[u8], pos: usize, prefix: u32) -> Option<(usize, usize)> {
+    let max = (1usize << prefix) - 1;
+    let mut value = (*block.get(pos)? as usize) & max;
+    let mut pos = pos + 1;
+    if value < max {
+        return Some((value, pos));
+    }
+    let mut shift = 0;
+    loop {
+        let byte = *block.get(pos)?;
+        pos += 1;
+        value = value.checked_add(((byte & 0x7f) as usize).checked_shl(shift)?)?;
+        if byte & 0x80 == 0 {
+            return Some((value, pos));
+        }
+        shift += 7;
+    }
+}
+
+/// Three Huffman-coded digits. '0' to '2' have 5-bit codes, '3' to '9' 6-bit codes
+/// (RFC 7541 Appendix B).
+fn huffman_digits(value: &[u8]) -> Option<[u8; 3]> {
+    if value.len() > 8 {
+        return None;
+    }
+    let mut bits = value.iter().fold(0u64, |bits, &b| bits << 8 | b as u64);
+    let mut left = value.len() as u32 * 8;
+    let mut take = |n: u32| {
+        left = left.checked_sub(n)?;
+        let code = (bits >> left) & ((1 << n) - 1);
+        bits &= (1 << left) - 1;
+        Some(code as u8)
+    };
+    let mut digits = [0; 3];
+    for digit in &mut digits {
+        let code = take(5)?;
+        *digit = match code {
+            0..=2 => b'0' + code,
+            12..=15 => match code << 1 | take(1)? {
+                code @ 0x19..=0x1f => b'3' + code - 0x19,
+                _ => return None,
+            },
+            _ => return None,
+        };
+    }
+    Some(digits)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_http1_rate_limit_headers() {
+        let response = b"HTTP/1.1 100 Continue\r\n\r\n\
+            HTTP/1.1 429 Too Many Requests\r\n\
+            Content-Type: application/json\r\n\
+            x-ratelimit-remaining-requests: 0\r\n\
+            x-ratelimit-remaining-tokens: 1520\r\n\
+            retry-after: 2\r\n\
+            retry-after-ms: 1250\r\n\r\n{\"error\":{}}";
+        let head = http1_head(response).unwrap();
+        assert_eq!(head.status, 429);
+        assert_eq!(head.remaining_requests, Some(0));
+        assert_eq!(head.remaining_tokens, Some(1520));
+        assert_eq!(head.retry_after, Some(Duration::from_millis(1250)));
+
+        let response = b"HTTP/1.1 200 OK\r\nanthropic-ratelimit-tokens-remaining: 79000\r\n\r\n";
+        let head = http1_head(response).unwrap();
+        assert_eq!(head.status, 200);
+        assert_eq!(head.remaining_tokens, Some(79000));
+        assert_eq!(head.remaining_requests, None);
+
+        assert_eq!(
+            http1_head(b"HTTP/1.1 503 Service Unavailable\r\nretry-after"),
+            None
+        );
+    }
+
+    #[test]
+    fn test_http2_status() {
+        let frame = |kind: u8, flags: u8, payload: &[u8]| {
+            let mut frame = (payload.len() as u32).to_be_bytes()[1..].to_vec();
+            frame.extend_from_slice(&[kind, flags, 0, 0, 0, 1]);
+            frame.extend_from_slice(payload);
+            frame
+        };
+        let mut buffer = frame(0x4, 0, &[0; 6]); // SETTINGS
+        // Indexed: static entry 8 is `:status: 200`
+        buffer.extend(frame(FRAME_HEADERS, 0x4, &[0x88]));
+        assert_eq!(http2_head(&buffer).unwrap().status, 200);
+
+        // Literal with indexed name, plain and Huffman-coded ("429" is 011010 00010 011111)
+        let plain = frame(FRAME_HEADERS, 0x4, &[0x48, 0x03, b'4', b'2', b'9']);
+        assert_eq!(http2_head(&plain).unwrap().status, 429);
+        let huffman = frame(FRAME_HEADERS, 0x4, &[0x48, 0x83, 0x68, 0x4f, 0xff]);
+        assert_eq!(http2_head(&huffman).unwrap().status, 429);
+        // Padded, after a dynamic table size update, never indexed
+        let padded = frame(
+            FRAME_HEADERS,
+            0x8 | 0x4,
+            &[1, 0x3f, 0xe1, 0x1f, 0x18, 0x03, b'5', b'0', b'3', 0],
+        );
+        assert_eq!(http2_head(&padded).unwrap().status, 503);
+
+        // Dynamic table entry: unknown without the connection's table
+        assert_eq!(http2_head(&frame(FRAME_HEADERS, 0x4, &[0xbe])), None);
+        assert_eq!(http2_head(&buffer[..12]), None);
+    }
+
+    #[test]
+    fn test_api_key_hash() {
+        let headers = [
+            httparse::Header {
+                name: "Host",
+                value: b"api.openai.com",
+            },
+            httparse::Header {
+                name: "authorization",
+                value: b"Bearer sk-proj-abc123",
+            },
+        ];
+        let hash = api_key_hash(&headers, "/v1/chat/completions").unwrap();
+        assert_eq!(hash.len(), 8);
+        assert!(!hash.contains("abc"));
+
+        let anthropic = [httparse::Header {
+            name: "x-api-key",
+            value: b"sk-proj-abc123",
+        }];
+        assert_eq!(api_key_hash(&anthropic, "/v1/messages").unwrap(), hash);
+
+        let gemini = api_key_hash(
+            &[],
+            "/v1beta/models/gemini-pro:generateContent?key=sk-proj-abc123&alt=sse",
+        );
+        assert_eq!(gemini.unwrap(), hash);
+        assert_eq!(api_key_hash(&headers[..1], "/v1/chat/completions"), None);
+    }
+}
@@ -0,0 +1,441 @@
+//! Incremental request body scanner.
+//!
+//! Request bodies can be megabytes (images, long contexts), but only a few routing facts
+//! are needed from them: the top-level `model` and `stream` fields. `RequestScanner` reads
+//! them byte by byte as chunks arrive, keeping only a short prefix of the body as a prompt
+//! sample, and stops scanning once both are found. The body itself is never retained.
+//!
+//! HTTP/2 bodies are read from frames: only the payloads of the request's DATA frames are
+//! scanned, so that bytes of HPACK-coded headers are never taken for JSON.
+
+use crate::probes::builtin::llm::types::RequestInfo;
+
+/// Body bytes kept for prompt text extraction
+pub const PROMPT_SAMPLE_BYTES: usize = 4096;
+/// Longest top-level key or `model` value captured; longer strings are skipped
+const MAX_TOKEN_LEN: usize = 256;
+/// HTTP/2 frame header: 24-bit length, type, flags, 31-bit stream id
+const H2_FRAME_HEADER_SIZE: usize = 9;
+const H2_FRAME_DATA: u8 = 0x0;
+const H2_FRAME_HEADERS: u8 = 0x1;
+/// Highest frame type of RFC 9113 (CONTINUATION)
+const H2_MAX_FRAME_TYPE: u8 = 0x9;
+const H2_FLAG_PADDED: u8 = 0x8;
+
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum Field {
+    Model,
+    Stream,
+    Other,
+}
+
+pub struct RequestScanner {
+    info: RequestInfo,
+    /// Nesting depth, 1 inside the top-level object
+    depth: u32,
+    in_string: bool,
+    escape: bool,
+    /// Between a top-level `:` and the next `,`
+    in_value: bool,
+    /// Key of the top-level value being read
+    field: Field,
+    /// Bytes of the top-level key or `model` value being read, `None` when not captured
+    token: Option<Vec<u8>>,
+    /// The top-level object has been closed, or everything wanted was found
+    done: bool,
+    /// HTTP/2 frames the body is read from
+    frames: Option<DataFrames>,
+}
+
+impl RequestScanner {
+    /// Continue from the facts found in the request head.
+    pub fn new(info: RequestInfo) -> Self {
+        let done = info.model.is_some() && info.stream.is_some();
+        Self {
+            info,
+            depth: 0,
+            in_string: false,
+            escape: false,
+            in_value: false,
+            field: Field::Other,
+            token: None,
+            done,
+            frames: None,
+        }
+    }
+
+    /// Read the body from the DATA frames of an HTTP/2 request.
+    pub fn with_frames(mut self) -> Self {
+        self.frames = Some(DataFrames::new());
+        self
+    }
+
+    /// Scan the next body bytes. Returns how many belong to this request: all of them,
+    /// unless `Content-Length` ends it sooner and a pipelined request follows.
+    pub fn feed(&mut self, data: &[u8]) -> usize {
+        let Some(frames) = &mut self.frames else {
+            return self.feed_body(data);
+        };
+        let mut body = Vec::new();
+        frames.walk(data, &mut body);
+        for payload in body {
+            self.feed_body(payload);
+        }
+        data.len()
+    }
+
+    /// Count body bytes that were not captured.
+    pub fn skip(&mut self, missing: usize) {
+        let missing = match &mut self.frames {
+            Some(frames) => frames.skip(missing as u64),
+            None => missing as u64,
+        };
+        self.info.body_bytes += self.remaining().min(missing);
+    }
+
+    fn feed_body(&mut self, body: &[u8]) -> usize {
+        let body = &body[..(self.remaining().min(body.len() as u64) as usize)];
+        self.info.body_bytes += body.len() as u64;
+        let room = PROMPT_SAMPLE_BYTES.saturating_sub(self.info.prompt_sample.len());
+        self.info
+            .prompt_sample
+            .extend_from_slice(&body[..room.min(body.len())]);
+        if !self.done {
+            for &byte in body {
+                self.scan(byte);
+                if self.done {
+                    break;
+                }
+            }
+        }
+        body.len()
+    }
+
+    /// Whether the body has reached its `Content-Length`. Without one, only the response
+    /// starting tells that the request is over.
+    pub fn is_complete(&self) -> bool {
+        self.remaining() == 0
+    }
+
+    pub fn finish(self) -> RequestInfo {
+        self.info
+    }
+
+    fn remaining(&self) -> u64 {
+        self.info
+            .content_length
+            .map_or(u64::MAX, |len| len.saturating_sub(self.info.body_bytes))
+    }
+
+    fn scan(&mut self, byte: u8) {
+        if self.in_string {
+            if self.escape {
+                self.escape = false;
+            } else if byte == b'\\' {
+                self.escape = true;
+            } else if byte == b'"' {
+                self.in_string = false;
+                if let Some(token) = self.token.take() {
+                    self.end_token(token);
+                }
+                return;
+            }
+            if let Some(token) = &mut self.token {
+                if token.len() < MAX_TOKEN_LEN {
+                    token.push(byte);
+                } else {
+                    self.token = None;
+                }
+            }
+            return;
+        }
+
+        match byte {
+            // Anything before the top-level object is skipped
+            b'{' if self.depth == 0 => self.depth = 1,
+            _ if self.depth == 0 => {}
+            b'"' => {
+                self.in_string = true;
+                // Capture top-level keys, and the value of `model`
+                let capture = self.depth == 1 && (!self.in_value || self.field == Field::Model);
+                self.token = capture.then(Vec::new);
+            }
+            b'{' | b'[' => self.depth += 1,
+            b'}' | b']' => {
+                self.depth = self.depth.saturating_sub(1);
+                if self.depth == 0 {
+                    self.done = true;
+                }
+            }
+            _ if self.depth != 1 => {}
+            b':' => self.in_value = true,
+            b',' => {
+                self.in_value = false;
+                self.field = Field::Other;
+            }
+            b't' | b'f' if self.in_value && self.field == Field::Stream => {
+                self.info.stream = Some(byte == b't');
+                self.field = Field::Other;
+                self.check_done();
+            }
+            _ => {}
+        }
+    }
+
+    fn end_token(&mut self, token: Vec<u8>) {
+        if !self.in_value {
+            self.field = match token.as_slice() {
+                b"model" => Field::Model,
+                b"stream" => Field::Stream,
+                _ => Field::Other,
+            };
+        } else if self.field == Field::Model {
+            self.info.model = Some(String::from_utf8_lossy(&token).into_owned());
+            self.field = Field::Other;
+            self.check_done();
+        }
+    }
+
+    fn check_done(&mut self) {
+        self.done = self.info.model.is_some() && self.info.stream.is_some();
+    }
+}
+
+enum FrameState {
+    /// Frame header, buffered in `DataFrames::header`
+    Header,
+    /// Pad length, the first byte of a padded DATA frame of `left` bytes
+    PadLength { left: u64 },
+    /// DATA payload bytes left, then padding
+    Data { left: u64, padding: u64 },
+    /// Bytes of another frame, or padding, left
+    Skip(u64),
+    /// Not at a frame boundary: all bytes are taken as body
+    Lost,
+}
+
+/// Walks the HTTP/2 frames of a request and passes on the payload of its DATA frames. The
+/// request's stream is the one of the first HEADERS or DATA frame.
+struct DataFrames {
+    state: FrameState,
+    header: Vec<u8>,
+    stream: Option<u32>,
+}
+
+impl DataFrames {
+    fn new() -> Self {
+        Self {
+            state: FrameState::Header,
+            header: Vec::with_capacity(H2_FRAME_HEADER_SIZE),
+            stream: None,
+        }
+    }
+
+    /// Append the DATA payload parts of `data` to `body`.
+    fn walk<'a>(&mut self, mut data: &'a [u8], body: &mut Vec<&'a [u8]>) {
+        while !data.is_empty() {
+            let used = match self.state {
+                FrameState::Header => self.frame_header(data),
+                FrameState::PadLength { left } => {
+                    let left = left - 1;
+                    let padding = (data[0] as u64).min(left);
+                    self.state = data_state(left - padding, padding);
+                    1
+                }
+                _ => {
+                    let (used, is_body) = self.payload(data.len() as u64);
+                    if is_body {
+                        body.push(&data[..used as usize]);
+                    }
+                    used as usize
+                }
+            };
+            data = &data[used..];
+        }
+    }
+
+    /// Account for `missing` bytes that were not captured. Returns how many of them were
+    /// body.
+    fn skip(&mut self, mut missing: u64) -> u64 {
+        let mut body = 0;
+        while missing > 0 {
+            if matches!(
+                self.state,
+                FrameState::Header | FrameState::PadLength { .. }
+            ) {
+                // The gap runs into a frame header
+                self.state = FrameState::Lost;
+            }
+            let (used, is_body) = self.payload(missing);
+            if is_body {
+                body += used;
+            }
+            missing -= used;
+        }
+        body
+    }
+
+    fn frame_header(&mut self, data: &[u8]) -> usize {
+        let used = (H2_FRAME_HEADER_SIZE - self.header.len()).min(data.len());
+        self.header.extend_from_slice(&data[..used]);
+        if self.header.len() < H2_FRAME_HEADER_SIZE {
+            return used;
+        }
+        let header = &self.header;
+        let len = u32::from_be_bytes([0, header[0], header[1], header[2]]) as u64;
+        let (kind, flags) = (header[3], header[4]);
+        let stream = u32::from_be_bytes([header[5], header[6], header[7], header[8]]) & 0x7fff_ffff;
+        self.header.clear();
+        if kind > H2_MAX_FRAME_TYPE {
+            // Not at a frame boundary (the request was joined mid-frame)
+            self.state = FrameState::Lost;
+            return used;
+        }
+        if stream != 0 && matches!(kind, H2_FRAME_DATA | H2_FRAME_HEADERS) {
+            self.stream.get_or_insert(stream);
+        }
+        self.state = match kind {
+            H2_FRAME_DATA if self.stream == Some(stream) => {
+                if flags & H2_FLAG_PADDED != 0 && len > 0 {
+                    FrameState::PadLength { left: len }
+                } else {
+                    data_state(len, 0)
+                }
+            }
+            _ => skip_state(len),
+        };
+        used
+    }
+
+    /// Consume up to `available` bytes of a payload. Returns the bytes used and whether
+    /// they are body.
+    fn payload(&mut self, available: u64) -> (u64, bool) {
+        match self.state {
+            FrameState::Data { left, padding } => {
+                let used = left.min(available);
+                self.state = match left - used {
+                    0 => skip_state(padding),
+                    left => FrameState::Data { left, padding },
+                };
+                (used, true)
+            }
+            FrameState::Skip(left) => {
+                let used = left.min(available);
+                self.state = skip_state(left - used);
+                (used, false)
+            }
+            FrameState::Lost => (available, true),
+            FrameState::Header | FrameState::PadLength { .. } => (0, false),
+        }
+    }
+}
+
+fn data_state(len: u64, padding: u64) -> FrameState {
+    if len > 0 {
+        FrameState::Data { left: len, padding }
+    } else {
+        skip_state(padding)
+    }
+}
+
+fn skip_state(len: u64) -> FrameState {
+    if len > 0 {
+        FrameState::Skip(len)
+    } else {
+        FrameState::Header
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn scan(chunks: &[&[u8]]) -> RequestInfo {
+        let mut scanner = RequestScanner::new(RequestInfo::default());
+        for chunk in chunks {
+            scanner.feed(chunk);
+        }
+        scanner.finish()
+    }
+
+    #[test]
+    fn test_scanner_finds_top_level_fields() {
+        // Split anywhere, nested "model" keys and escaped quotes do not count
+        let body = br#"{"messages":[{"role":"user","content":"say \"model\": x","model":"no"}],"metadata":{"stream":true},"model":"gpt-4o","stream":false}"#;
+        for split in [1, 7, 40, body.len() - 3] {
+            let info = scan(&[&body[..split], &body[split..]]);
+            assert_eq!(info.model.as_deref(), Some("gpt-4o"), "split at {}", split);
+            assert_eq!(info.stream, Some(false));
+            assert_eq!(info.body_bytes, body.len() as u64);
+        }
+    }
+
+    #[test]
+    fn test_scanner_keeps_only_a_sample() {
+        let image = vec![b'A'; 2 * 1024 * 1024];
+        let info = scan(&[
+            br#"{"messages":[{"content":[{"type":"image","data":""#,
+            &image,
+            br#""}]}],"stream":true,"model":"claude-sonnet"}"#,
+        ]);
+        assert_eq!(info.model.as_deref(), Some("claude-sonnet"));
+        assert_eq!(info.stream, Some(true));
+        assert_eq!(info.prompt_sample.len(), PROMPT_SAMPLE_BYTES);
+        assert!(info.body_bytes > image.len() as u64);
+    }
+
+    #[test]
+    fn test_scanner_reads_http2_data_frames() {
+        let frame = |kind: u8, flags: u8, stream: u8, payload: &[u8]| {
+            let mut frame = (payload.len() as u32).to_be_bytes()[1..].to_vec();
+            frame.extend_from_slice(&[kind, flags, 0, 0, 0, stream]);
+            frame.extend_from_slice(payload);
+            frame
+        };
+        let body = br#"{"model":"gpt-4o","stream":true}"#;
+        let mut request = frame(0x4, 0, 0, &[0; 6]); // SETTINGS
+        // HPACK bytes that look like JSON
+        request.extend(frame(H2_FRAME_HEADERS, 0x4, 1, br#"{"model":"hpack"}"#));
+        request.extend(frame(H2_FRAME_DATA, 0, 3, br#"{"model":"other stream"}"#));
+        request.extend(frame(H2_FRAME_DATA, 0, 1, &body[..10]));
+        // Padded: pad length, data, padding
+        let mut padded = vec![4];
+        padded.extend_from_slice(&body[10..]);
+        padded.extend_from_slice(&[0; 4]);
+        request.extend(frame(H2_FRAME_DATA, H2_FLAG_PADDED | 0x1, 1, &padded));
+
+        for split in [1, 9, 20, 40, request.len() - 5] {
+            let mut scanner = RequestScanner::new(RequestInfo::default()).with_frames();
+            assert_eq!(scanner.feed(&request[..split]), split);
+            scanner.feed(&request[split..]);
+            let info = scanner.finish();
+            assert_eq!(info.model.as_deref(), Some("gpt-4o"), "split at {}", split);
+            assert_eq!(info.stream, Some(true));
+            assert_eq!(info.body_bytes, body.len() as u64);
+            assert_eq!(info.prompt_sample, body);
+        }
+
+        // Uncaptured DATA bytes count, the padding after them does not
+        let mut scanner = RequestScanner::new(RequestInfo::default()).with_frames();
+        let end = request.len() - padded.len() + 3;
+        scanner.feed(&request[..end]);
+        scanner.skip(request.len() - end);
+        assert_eq!(scanner.finish().body_bytes, body.len() as u64);
+    }
+
+    #[test]
+    fn test_scanner_stops_at_content_length() {
+        let body = br#"{"model":"a"}"#;
+        let mut scanner = RequestScanner::new(RequestInfo {
+            content_length: Some(body.len() as u64 + 100),
+            ..Default::default()
+        });
+        assert_eq!(scanner.feed(body), body.len());
+        scanner.skip(90);
+        assert!(!scanner.is_complete());
+        // The rest of the write is the next request
+        assert_eq!(scanner.feed(b"0123456789POST /v1"), 10);
+        assert!(scanner.is_complete());
+        assert_eq!(scanner.finish().body_bytes, body.len() as u64 + 100);
+    }
+}
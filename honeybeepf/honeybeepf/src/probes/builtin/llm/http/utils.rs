@@ -10,15 +10,6 @@ pub fn contains_pattern(haystack: &[u8], needle: &[u8]) -> bool {
     find_pattern(haystack, needle).is_some()
 }
 
-/// Trim trailing ASCII whitespace
-pub fn trim_trailing_whitespace(buf: &[u8]) -> &[u8] {
-    let mut end = buf.len();
-    while end > 0 && buf[end - 1].is_ascii_whitespace() {
-        end -= 1;
-    }
-    &buf[..end]
-}
-
 /// Decode HTTP Chunked Encoding
 pub fn decode_chunked_body(buffer: &[u8]) -> Cow<'_, [u8]> {
     if !contains_pattern(buffer, b"\r\n") {
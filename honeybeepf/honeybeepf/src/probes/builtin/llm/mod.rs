@@ -1,12 +1,18 @@
 pub mod discovery;
+pub mod estimator;
 pub mod http;
+pub mod pipeline;
 pub mod processor;
+pub mod tokenizer;
 pub mod types;
 
 use std::{
     collections::{HashMap, HashSet, VecDeque},
-    sync::{Arc, Mutex},
-    time::Duration,
+    sync::{
+        Arc, Mutex,
+        atomic::{AtomicBool, Ordering},
+    },
+    time::Instant,
 };
 
 use anyhow::{Context, Result};
@@ -16,43 +22,49 @@ use aya::{
 };
 use honeybeepf_common::{ExecEvent, LlmEvent};
 use log::{info, warn};
-use processor::StreamProcessor;
+use pipeline::{ConnVerdicts, SslChunk, SslPipeline};
 use tokio::sync::Notify;
-use types::LlmDirection;
 
-use crate::probes::{Probe, spawn_ringbuf_handler};
+use crate::{
+    probes::{Probe, builtin::llm::discovery::cache, spawn_ringbuf_handler},
+    recorder,
+    settings::LlmSettings,
+};
 
-// Queue and timing constants
+// Queue constants
 const MAX_EXEC_QUEUE_SIZE: usize = 1024; // Max pending exec PIDs
-const CLEANUP_INTERVAL_SECS: u64 = 30; // How often to run cleanup
-const CONNECTION_RETENTION_SECS: u64 = 300; // Keep idle connections for 5 minutes
+
+/// Functions the SSL uprobes attach to
+const SSL_SYMBOLS: [&str; 5] = [
+    "SSL_read",
+    "SSL_write",
+    "SSL_do_handshake",
+    "SSL_read_ex",
+    "SSL_write_ex",
+];
 
 pub fn attach_probes_to_path(bpf: &mut Ebpf, libssl_path: &str) -> Result<()> {
+    // Resolved once per library (and cached) rather than by aya for every uprobe
+    let offsets = cache::symbol_offsets(libssl_path, &SSL_SYMBOLS);
+    let mut attach = |prog_name: &str, func_name: &str| {
+        attach_uprobe(bpf, prog_name, func_name, libssl_path, &offsets)
+    };
+
     // SSL_read/SSL_write need BOTH entry (to save buf ptr) and exit (to read data + emit event)
-    attach_uprobe(bpf, "probe_ssl_rw_enter", "SSL_read", libssl_path)?;
-    attach_uprobe(bpf, "probe_ssl_read_exit", "SSL_read", libssl_path)?;
-    attach_uprobe(bpf, "probe_ssl_rw_enter", "SSL_write", libssl_path)?;
-    attach_uprobe(bpf, "probe_ssl_write_exit", "SSL_write", libssl_path)?;
+    attach("probe_ssl_rw_enter", "SSL_read")?;
+    attach("probe_ssl_read_exit", "SSL_read")?;
+    attach("probe_ssl_rw_enter", "SSL_write")?;
+    attach("probe_ssl_write_exit", "SSL_write")?;
 
     // Handshake
-    attach_uprobe(
-        bpf,
-        "probe_ssl_do_handshake_enter",
-        "SSL_do_handshake",
-        libssl_path,
-    )?;
-    attach_uprobe(
-        bpf,
-        "probe_ssl_do_handshake_exit",
-        "SSL_do_handshake",
-        libssl_path,
-    )?;
+    attach("probe_ssl_do_handshake_enter", "SSL_do_handshake")?;
+    attach("probe_ssl_do_handshake_exit", "SSL_do_handshake")?;
 
     // Extended variants (optional — not all OpenSSL builds export these)
-    let _ = attach_uprobe(bpf, "probe_ssl_rw_ex_enter", "SSL_write_ex", libssl_path);
-    let _ = attach_uprobe(bpf, "probe_ssl_write_ex_exit", "SSL_write_ex", libssl_path);
-    let _ = attach_uprobe(bpf, "probe_ssl_rw_ex_enter", "SSL_read_ex", libssl_path);
-    let _ = attach_uprobe(bpf, "probe_ssl_read_ex_exit", "SSL_read_ex", libssl_path);
+    let _ = attach("probe_ssl_rw_ex_enter", "SSL_write_ex");
+    let _ = attach("probe_ssl_write_ex_exit", "SSL_write_ex");
+    let _ = attach("probe_ssl_rw_ex_enter", "SSL_read_ex");
+    let _ = attach("probe_ssl_read_ex_exit", "SSL_read_ex");
 
     Ok(())
 }
@@ -64,7 +76,12 @@ pub fn attach_new_targets_for_pids(
     pids: &[u32],
 ) -> Result<()> {
     let targets = discovery::find_targets_for_pids(pids)?;
+    attach_new_targets(bpf, known, targets);
+    Ok(())
+}
 
+/// Attach probes to the libraries in `targets` that are not yet in `known`.
+pub fn attach_new_targets(bpf: &mut Ebpf, known: &mut HashSet<String>, targets: HashSet<String>) {
     for path in targets {
         if path.contains("libcrypto") {
             continue;
@@ -76,6 +93,7 @@ pub fn attach_new_targets_for_pids(
         info!("[Re-discovery] New SSL library found: {}", path);
         match attach_probes_to_path(bpf, &path) {
             Ok(()) => {
+                cache::mark_attached(&path);
                 known.insert(path);
             }
             Err(e) => {
@@ -83,8 +101,7 @@ pub fn attach_new_targets_for_pids(
             }
         }
     }
-
-    Ok(())
+    cache::save();
 }
 
 /// Shared queue of PIDs from exec events.
@@ -101,7 +118,9 @@ pub fn setup_exec_watch(bpf: &mut Ebpf) -> Result<(ExecPidQueue, ExecNotify)> {
         .program_mut("probe_exec")
         .context("Failed to find probe_exec program")?
         .try_into()?;
-    program.load()?;
+    if program.fd().is_err() {
+        program.load()?;
+    }
     program.attach("sched", "sched_process_exec")?;
 
     let queue: ExecPidQueue = Arc::new(Mutex::new(VecDeque::new()));
@@ -123,20 +142,83 @@ pub fn setup_exec_watch(bpf: &mut Ebpf) -> Result<(ExecPidQueue, ExecNotify)> {
     Ok((queue, notify))
 }
 
-pub struct LlmProbe;
+/// SSL libraries to probe, and whether they came from the discovery cache (a full scan is
+/// then still due). Also resolves their symbol offsets, so that attaching only hits the
+/// cache. The engine runs this at startup while the eBPF objects load.
+pub fn discover_targets() -> Result<(HashSet<String>, bool)> {
+    let cached = cache::attached_targets();
+    let from_cache = !cached.is_empty();
+    let targets = if from_cache {
+        cached
+    } else {
+        discovery::find_all_targets()?
+    };
+    for path in targets.iter().filter(|path| !path.contains("libcrypto")) {
+        cache::symbol_offsets(path, &SSL_SYMBOLS);
+    }
+    Ok((targets, from_cache))
+}
+
+type Discovered = (Instant, Result<(HashSet<String>, bool)>);
+
+/// SSL/TLS capture probe. Payloads are parsed by a sharded worker pool (see `pipeline`).
+pub struct LlmProbe {
+    pub workers: Option<usize>,
+    pub queue_capacity: Option<usize>,
+    /// Libraries found at attach time
+    targets: Mutex<HashSet<String>>,
+    /// Attached from the discovery cache; a full scan is still due
+    scan_pending: AtomicBool,
+    /// Result of `discover_targets` run ahead of `attach`, and when it started
+    discovered: Mutex<Option<Discovered>>,
+}
 
-// Shared state
-type StreamMap = Arc<Mutex<HashMap<(u32, u32), StreamProcessor>>>;
+impl LlmProbe {
+    pub fn new(settings: &LlmSettings) -> Self {
+        Self {
+            workers: settings.workers,
+            queue_capacity: settings.queue_capacity,
+            targets: Mutex::new(HashSet::new()),
+            scan_pending: AtomicBool::new(false),
+            discovered: Mutex::new(None),
+        }
+    }
+
+    /// Attach to libraries found by a `discover_targets` call started at `started`,
+    /// instead of discovering them in `attach`.
+    pub fn with_targets(
+        self,
+        started: Instant,
+        discovered: Result<(HashSet<String>, bool)>,
+    ) -> Self {
+        *self.discovered.lock().unwrap_or_else(|e| e.into_inner()) = Some((started, discovered));
+        self
+    }
+
+    /// Libraries handled by `attach`, and whether they came from the cache only.
+    pub fn take_targets(&self) -> (HashSet<String>, bool) {
+        let targets = std::mem::take(&mut *self.targets.lock().unwrap_or_else(|e| e.into_inner()));
+        (targets, self.scan_pending.load(Ordering::Relaxed))
+    }
+}
 
 impl Probe for LlmProbe {
     fn attach(&self, bpf: &mut Ebpf) -> Result<()> {
-        let targets = discovery::find_all_targets()?;
+        let discovered = self
+            .discovered
+            .lock()
+            .unwrap_or_else(|e| e.into_inner())
+            .take();
+        let (started, discovered) =
+            discovered.unwrap_or_else(|| (Instant::now(), discover_targets()));
+        let (targets, from_cache) = discovered?;
 
         if targets.is_empty() {
             warn!("No targets found. LLM probing disabled.");
             return Ok(());
         }
 
+        let mut attached = 0;
         for path in &targets {
             // Skip libcrypto for SSL_* probes as they usually don't contain them
             if path.contains("libcrypto") {
@@ -145,53 +227,60 @@ impl Probe for LlmProbe {
             }
 
             info!("Attaching LLM (SSL) probes to detected library: {}", path);
-            if let Err(e) = attach_probes_to_path(bpf, path) {
-                warn!("Failed to attach to {}: {}", path, e);
+            match attach_probes_to_path(bpf, path) {
+                Ok(()) => {
+                    if attached == 0 {
+                        info!(
+                            "First SSL library probed {}ms after discovery started",
+                            started.elapsed().as_millis()
+                        );
+                    }
+                    attached += 1;
+                    cache::mark_attached(path);
+                }
+                Err(e) => warn!("Failed to attach to {}: {}", path, e),
             }
         }
-
-        let state: StreamMap = Arc::new(Mutex::new(HashMap::new()));
-        let handler_state = state.clone();
-
-        spawn_ringbuf_handler(bpf, "SSL_EVENTS", move |event: LlmEvent| {
-            let direction = LlmDirection::from(event.rw);
-            if event.is_handshake == 1 {
-                return;
-            }
-            if event.buf_filled == 0 || event.len == 0 {
-                return;
+        cache::save();
+        info!(
+            "SSL probes attached to {} libraries in {}ms ({})",
+            attached,
+            started.elapsed().as_millis(),
+            if from_cache {
+                "discovery cache, full scan follows in the background"
+            } else {
+                "full scan"
             }
+        );
+        *self.targets.lock().unwrap_or_else(|e| e.into_inner()) = targets;
+        self.scan_pending.store(from_cache, Ordering::Relaxed);
 
-            let key = (event.metadata.pid, event.metadata._pad);
-            let mut map = handler_state.lock().unwrap_or_else(|e| e.into_inner());
-            let processor = map.entry(key).or_default();
-
-            let data_len = std::cmp::min(event.len as usize, honeybeepf_common::MAX_SSL_BUF_SIZE);
-            processor.handle_event(direction, &event.buf[..data_len], event.metadata.pid);
-        })?;
-
-        start_cleanup_task(state);
+        let verdicts = ConnVerdicts::take(bpf)
+            .inspect_err(|e| warn!("Non-HTTP connections stay captured: {:#}", e))
+            .ok();
+        let pipeline = SslPipeline::spawn(self.workers, self.queue_capacity, verdicts)?;
+        spawn_ringbuf_handler(bpf, "SSL_EVENTS", ssl_event_handler(pipeline))?;
 
         Ok(())
     }
 }
 
-fn start_cleanup_task(state: StreamMap) {
-    let shutdown = crate::probes::shutdown_flag();
-    std::thread::spawn(move || {
-        while !shutdown.load(std::sync::atomic::Ordering::Relaxed) {
-            std::thread::sleep(Duration::from_secs(CLEANUP_INTERVAL_SECS));
-            let mut map = state.lock().unwrap_or_else(|e| e.into_inner());
-            let now = std::time::Instant::now();
-
-            map.retain(|_, v| {
-                now.duration_since(v.last_activity()).as_secs() < CONNECTION_RETENTION_SECS
-            });
-        }
-    });
+/// Handler for `SSL_EVENTS` records. The ring consumer only decodes the header and
+/// hands the payload to a parser worker.
+pub fn ssl_event_handler(pipeline: SslPipeline) -> impl Fn(LlmEvent) {
+    move |event| {
+        recorder::record_ssl(&event);
+        pipeline.dispatch(SslChunk::from_event(&event))
+    }
 }
 
-fn attach_uprobe(bpf: &mut Ebpf, prog_name: &str, func_name: &str, path: &str) -> Result<()> {
+fn attach_uprobe(
+    bpf: &mut Ebpf,
+    prog_name: &str,
+    func_name: &str,
+    path: &str,
+    offsets: &HashMap<String, u64>,
+) -> Result<()> {
     let program: &mut UProbe = bpf
         .program_mut(prog_name)
         .with_context(|| format!("Failed to find program {}", prog_name))?
@@ -202,9 +291,12 @@ fn attach_uprobe(bpf: &mut Ebpf, prog_name: &str, func_name: &str, path: &str) -
         program.load()?;
     }
 
-    program
-        .attach(Some(func_name), 0, path, None)
-        .with_context(|| format!("Failed to attach {} to {}", prog_name, func_name))?;
+    // Without a resolved offset aya looks the symbol up itself (e.g. via debuglink)
+    match offsets.get(func_name) {
+        Some(&offset) => program.attach(None, offset, path, None),
+        None => program.attach(Some(func_name), 0, path, None),
+    }
+    .with_context(|| format!("Failed to attach {} to {}", prog_name, func_name))?;
 
     Ok(())
 }
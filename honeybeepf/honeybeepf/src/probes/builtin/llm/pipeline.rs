@@ -0,0 +1,514 @@
+//! Sharded SSL parsing pipeline.
+//!
+//! The ring-draining thread only decodes event headers and copies the payload out;
+//! parsing (httparse, gzip, serde_json) runs on a fixed set of worker threads. Events
+//! are sharded by stream key, so each connection is handled by exactly one worker in
+//! ring order, and every worker owns its `StreamProcessor`s without any locking.
+//!
+//! Connections a processor rejects as not HTTP are written to the kernel's `CONN_VERDICT`
+//! map, after which their data is no longer captured at all.
+//!
+//! A chunk dropped on a full worker queue is remembered per stream, so that the worker
+//! closes the exchange it belonged to as truncated when it reaches the gap, instead of
+//! counting it as events lost in the kernel.
+
+use std::{
+    collections::{HashMap, VecDeque},
+    sync::{
+        Arc, Mutex,
+        atomic::{AtomicUsize, Ordering},
+        mpsc::{Receiver, RecvTimeoutError, SyncSender, TrySendError, sync_channel},
+    },
+    thread::JoinHandle,
+    time::{Duration, Instant},
+};
+
+use anyhow::{Context, Result};
+use aya::{
+    Ebpf,
+    maps::{LruHashMap, MapData},
+};
+use honeybeepf_common::{ConnKey, LlmEvent, MAX_SSL_BUF_SIZE};
+use log::{debug, info, warn};
+
+use super::{
+    estimator,
+    processor::{StreamProcessor, VERDICT_TTL},
+    types::{LlmCompletion, LlmDirection},
+};
+use crate::{probes::shutdown_flag, recorder, store, telemetry};
+
+const DEFAULT_WORKERS: usize = 2;
+const DEFAULT_QUEUE_CAPACITY: usize = 1024; // Chunks per worker (up to 4KB each)
+const CLEANUP_INTERVAL_SECS: u64 = 30; // How often to run cleanup
+const CONNECTION_RETENTION_SECS: u64 = 300; // Keep idle connections for 5 minutes
+const RECV_TIMEOUT_MS: u64 = 500; // Bounds shutdown and cleanup latency of idle workers
+
+/// Streams are keyed by (pid, conn_id).
+pub type StreamKey = (u32, u64);
+
+/// Decoded header of an SSL event plus a copy of its payload.
+pub struct SslChunk {
+    pub key: StreamKey,
+    pub cgroup_id: u64,
+    pub seq: u64,
+    /// Kernel time of the SSL call's return (`bpf_ktime_get_ns`)
+    pub timestamp: Duration,
+    pub direction: LlmDirection,
+    pub is_handshake: bool,
+    pub data: Vec<u8>,
+    /// Bytes of the SSL call past the captured `data`
+    pub missing: usize,
+}
+
+impl SslChunk {
+    pub fn from_event(event: &LlmEvent) -> Self {
+        let is_handshake = event.is_handshake == 1;
+        let data = if is_handshake || event.buf_filled == 0 {
+            Vec::new()
+        } else {
+            let len = std::cmp::min(event.len as usize, MAX_SSL_BUF_SIZE);
+            event.buf[..len].to_vec()
+        };
+        Self {
+            missing: (event.len as usize).saturating_sub(data.len()),
+            key: (event.metadata.pid, event.conn_id),
+            cgroup_id: event.metadata.cgroup_id,
+            seq: event.seq,
+            timestamp: Duration::from_nanos(event.metadata.timestamp),
+            direction: LlmDirection::from(event.rw),
+            is_handshake,
+            data,
+        }
+    }
+}
+
+/// The kernel's `CONN_VERDICT` map: connections whose SSL data is not captured.
+pub struct ConnVerdicts(Mutex<LruHashMap<MapData, ConnKey, u64>>);
+
+impl ConnVerdicts {
+    pub fn take(bpf: &mut Ebpf) -> Result<Self> {
+        let map = bpf
+            .take_map("CONN_VERDICT")
+            .context("Failed to find CONN_VERDICT map")?;
+        Ok(Self(Mutex::new(LruHashMap::try_from(map)?)))
+    }
+
+    fn reject(&self, (pid, conn_id): StreamKey) -> Result<()> {
+        // bpf_ktime_get_ns() is CLOCK_MONOTONIC
+        let mut now = libc::timespec {
+            tv_sec: 0,
+            tv_nsec: 0,
+        };
+        unsafe { libc::clock_gettime(libc::CLOCK_MONOTONIC, &mut now) };
+        let until =
+            now.tv_sec as u64 * 1_000_000_000 + now.tv_nsec as u64 + VERDICT_TTL.as_nanos() as u64;
+        let key = ConnKey {
+            pid,
+            _pad: 0,
+            conn_id,
+        };
+        self.0
+            .lock()
+            .unwrap_or_else(|e| e.into_inner())
+            .insert(key, until, 0)?;
+        Ok(())
+    }
+}
+
+struct WorkerQueue {
+    tx: SyncSender<SslChunk>,
+    depth: Arc<AtomicUsize>,
+    dropped: Arc<DroppedChunks>,
+}
+
+/// Sequence numbers of the chunks a full queue dropped, per stream, until the worker
+/// reaches the gap they left.
+#[derive(Default)]
+struct DroppedChunks(Mutex<HashMap<StreamKey, VecDeque<u64>>>);
+
+impl DroppedChunks {
+    fn add(&self, key: StreamKey, seq: u64) {
+        let mut dropped = self.0.lock().unwrap_or_else(|e| e.into_inner());
+        dropped.entry(key).or_default().push_back(seq);
+    }
+
+    /// Forget the dropped chunks of `key` that came before `seq`, returning how many.
+    fn take_before(&self, key: StreamKey, seq: u64) -> u64 {
+        let mut dropped = self.0.lock().unwrap_or_else(|e| e.into_inner());
+        let Some(seqs) = dropped.get_mut(&key) else {
+            return 0;
+        };
+        let before = seqs.iter().take_while(|&&dropped| dropped < seq).count();
+        seqs.drain(..before);
+        if seqs.is_empty() {
+            dropped.remove(&key);
+        }
+        before as u64
+    }
+
+    /// Streams with dropped chunks the worker has not reached yet.
+    fn streams(&self) -> Vec<StreamKey> {
+        let dropped = self.0.lock().unwrap_or_else(|e| e.into_inner());
+        dropped.keys().copied().collect()
+    }
+
+    fn retain(&self, mut keep: impl FnMut(&StreamKey) -> bool) {
+        let mut dropped = self.0.lock().unwrap_or_else(|e| e.into_inner());
+        dropped.retain(|key, _| keep(key));
+    }
+}
+
+pub struct SslPipeline {
+    queues: Vec<WorkerQueue>,
+    workers: Vec<JoinHandle<()>>,
+    /// Block on full queues instead of dropping (replay)
+    lossless: bool,
+}
+
+impl SslPipeline {
+    /// Start `workers` parser threads, each behind a bounded queue of `queue_capacity` chunks.
+    /// Rejected connections are written to `verdicts`, if given.
+    pub fn spawn(
+        workers: Option<usize>,
+        queue_capacity: Option<usize>,
+        verdicts: Option<ConnVerdicts>,
+    ) -> Result<Self> {
+        let workers = workers.unwrap_or(DEFAULT_WORKERS).max(1);
+        let capacity = queue_capacity.unwrap_or(DEFAULT_QUEUE_CAPACITY).max(1);
+
+        let verdicts = verdicts.map(Arc::new);
+        let mut queues = Vec::with_capacity(workers);
+        let mut handles = Vec::with_capacity(workers);
+        for index in 0..workers {
+            let (tx, rx) = sync_channel(capacity);
+            let depth = Arc::new(AtomicUsize::new(0));
+            let dropped = Arc::new(DroppedChunks::default());
+            let worker_depth = depth.clone();
+            let worker_dropped = dropped.clone();
+            let worker_verdicts = verdicts.clone();
+            let handle = std::thread::Builder::new()
+                .name(format!("llm-parser-{}", index))
+                .spawn(move || run_worker(rx, worker_depth, worker_dropped, worker_verdicts))
+                .context("Failed to spawn LLM parser thread")?;
+            queues.push(WorkerQueue { tx, depth, dropped });
+            handles.push(handle);
+        }
+
+        telemetry::register_llm_queue_depths(queues.iter().map(|q| q.depth.clone()).collect());
+        info!(
+            "LLM parsing pipeline: {} worker(s), queue capacity {}",
+            workers, capacity
+        );
+        Ok(Self {
+            queues,
+            workers: handles,
+            lossless: false,
+        })
+    }
+
+    /// Apply backpressure instead of dropping chunks, so that a replayed capture is
+    /// parsed exactly like the original event sequence.
+    pub fn lossless(mut self) -> Self {
+        self.lossless = true;
+        self
+    }
+
+    /// Hand a chunk to the worker owning its stream. Unless lossless, never blocks the
+    /// ring consumer: when the worker is saturated the chunk is dropped, and the worker
+    /// closes the exchange it belonged to as truncated.
+    pub fn dispatch(&self, chunk: SslChunk) {
+        let queue = &self.queues[shard_of(chunk.key, self.queues.len())];
+        queue.depth.fetch_add(1, Ordering::Relaxed);
+        if self.lossless {
+            if queue.tx.send(chunk).is_err() {
+                queue.depth.fetch_sub(1, Ordering::Relaxed);
+            }
+            return;
+        }
+        match queue.tx.try_send(chunk) {
+            Ok(()) => {}
+            Err(TrySendError::Full(chunk)) => {
+                queue.depth.fetch_sub(1, Ordering::Relaxed);
+                queue.dropped.add(chunk.key, chunk.seq);
+                telemetry::record_llm_queue_drop();
+            }
+            Err(TrySendError::Disconnected(_)) => {
+                queue.depth.fetch_sub(1, Ordering::Relaxed);
+            }
+        }
+    }
+}
+
+impl Drop for SslPipeline {
+    /// Close the queues and wait for the workers to finish what is already queued.
+    fn drop(&mut self) {
+        self.queues.clear();
+        for handle in self.workers.drain(..) {
+            let _ = handle.join();
+        }
+    }
+}
+
+fn shard_of(key: StreamKey, shards: usize) -> usize {
+    // Fibonacci hashing: SSL* addresses share low bits from allocator alignment
+    let hash = (key.1 ^ key.0 as u64).wrapping_mul(0x9E37_79B9_7F4A_7C15);
+    ((hash >> 32) % shards as u64) as usize
+}
+
+fn run_worker(
+    rx: Receiver<SslChunk>,
+    depth: Arc<AtomicUsize>,
+    dropped: Arc<DroppedChunks>,
+    verdicts: Option<Arc<ConnVerdicts>>,
+) {
+    let mut streams: HashMap<StreamKey, Stream> = HashMap::new();
+    let mut last_cleanup = Instant::now();
+    let shutdown = shutdown_flag();
+
+    while !shutdown.load(Ordering::Relaxed) {
+        match rx.recv_timeout(Duration::from_millis(RECV_TIMEOUT_MS)) {
+            Ok(chunk) => {
+                depth.fetch_sub(1, Ordering::Relaxed);
+                process_chunk(&mut streams, chunk, &dropped, verdicts.as_deref());
+            }
+            Err(RecvTimeoutError::Timeout) => {}
+            Err(RecvTimeoutError::Disconnected) => break,
+        }
+
+        if last_cleanup.elapsed() >= Duration::from_secs(CLEANUP_INTERVAL_SECS) {
+            // With nothing queued, no chunk follows the dropped ones: their exchanges are over
+            if depth.load(Ordering::Relaxed) == 0 {
+                for key in dropped.streams() {
+                    if let Some(stream) = streams.get_mut(&key) {
+                        stream.processor.truncate();
+                        stream.submit_unmetered(key.0);
+                    }
+                }
+            }
+            let now = Instant::now();
+            streams.retain(|&(pid, _), stream| {
+                let idle = now
+                    .duration_since(stream.processor.last_activity())
+                    .as_secs()
+                    >= CONNECTION_RETENTION_SECS;
+                if idle {
+                    stream.processor.abandon();
+                    stream.submit_unmetered(pid);
+                }
+                !idle
+            });
+            dropped.retain(|key| streams.contains_key(key));
+            last_cleanup = now;
+        }
+    }
+
+    // Detached (the queue closed) or shutting down: responses in flight end here, with
+    // what was read of them. A new agent taking over joins these connections mid-stream.
+    for (&(pid, _), stream) in streams.iter_mut() {
+        stream.processor.abandon();
+        stream.submit_unmetered(pid);
+    }
+}
+
+/// A connection owned by a worker
+struct Stream {
+    processor: StreamProcessor,
+    cgroup_id: u64,
+}
+
+impl Stream {
+    /// Hand the exchanges that ended without usage to the token estimator.
+    fn submit_unmetered(&mut self, pid: u32) {
+        for exchange in self.processor.take_unmetered() {
+            estimator::submit(pid, self.cgroup_id, exchange);
+        }
+    }
+}
+
+fn process_chunk(
+    streams: &mut HashMap<StreamKey, Stream>,
+    chunk: SslChunk,
+    dropped: &DroppedChunks,
+    verdicts: Option<&ConnVerdicts>,
+) {
+    let (pid, conn_id) = chunk.key;
+    let stream = streams.entry(chunk.key).or_insert_with(|| Stream {
+        processor: StreamProcessor::new(),
+        cgroup_id: chunk.cgroup_id,
+    });
+    let processor = &mut stream.processor;
+
+    // Chunks the worker never got: the exchange they belonged to is cut short. The gap
+    // they leave is no loss in the kernel.
+    let queue_lost = dropped.take_before(chunk.key, chunk.seq);
+    if queue_lost > 0 {
+        debug!(
+            "SSL stream truncated: {} chunks dropped on a full queue (PID: {}, conn: {:#x})",
+            queue_lost, pid, conn_id
+        );
+        processor.truncate();
+        stream.submit_unmetered(pid);
+    }
+    let processor = &mut stream.processor;
+
+    // Every emitted event carries the connection's sequence number, handshakes included
+    if let Some(lost) = processor.observe_seq(chunk.seq)
+        && lost > queue_lost
+    {
+        let lost = lost - queue_lost;
+        debug!(
+            "SSL stream gap: {} events lost (PID: {}, conn: {:#x})",
+            lost, pid, conn_id
+        );
+        telemetry::record_llm_stream_gap(lost);
+    }
+
+    if chunk.is_handshake {
+        processor.handshake();
+        return;
+    }
+    // Uncaptured bytes still count towards response lengths
+    if chunk.data.is_empty() && chunk.missing == 0 {
+        return;
+    }
+    let completions = processor.handle_event(
+        chunk.direction,
+        &chunk.data,
+        chunk.missing,
+        chunk.timestamp,
+        pid,
+    );
+    for response in processor.take_responses() {
+        telemetry::record_llm_response(&response);
+    }
+    for completion in completions {
+        record_completion(pid, chunk.cgroup_id, &completion);
+    }
+    stream.submit_unmetered(pid);
+    let processor = &mut stream.processor;
+    if let Some(protocol) = processor.take_verdict() {
+        telemetry::record_llm_stream_rejected(protocol);
+        if let Some(verdicts) = verdicts
+            && let Err(e) = verdicts.reject(chunk.key)
+        {
+            warn!(
+                "Failed to store verdict of PID {} conn {:#x}: {}",
+                pid, conn_id, e
+            );
+        }
+    }
+}
+
+/// Hand a parsed (or estimated) exchange to the outputs.
+pub fn record_completion(pid: u32, cgroup_id: u64, completion: &LlmCompletion) {
+    store::record_llm(pid, cgroup_id, completion);
+    recorder::observe_llm(cgroup_id, completion.latency);
+    let provider = completion.request.provider.as_deref().unwrap_or("unknown");
+    telemetry::record_llm_usage(provider, &completion.usage);
+    if let Some(generation) = completion.generation {
+        telemetry::record_llm_output_rate(
+            provider,
+            completion.usage.estimated,
+            completion.usage.completion_tokens as f64 / generation.as_secs_f64(),
+        );
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_chunk_and_shard() {
+        let mut event = LlmEvent::default();
+        event.metadata.pid = 42;
+        event.conn_id = 0x7f00_dead_b000;
+        event.seq = 7;
+        event.metadata.timestamp = 1_500_000_000;
+        event.rw = LlmDirection::Write as u8;
+        event.len = 5;
+        event.buf_filled = 1;
+        event.buf[..5].copy_from_slice(b"POST ");
+
+        let chunk = SslChunk::from_event(&event);
+        assert_eq!(chunk.key, (42, 0x7f00_dead_b000));
+        assert_eq!(chunk.data, b"POST ");
+        assert_eq!(chunk.missing, 0);
+        assert_eq!(chunk.timestamp, Duration::from_millis(1500));
+
+        // Only the start of a long call is captured
+        event.len = 10_000;
+        let chunk = SslChunk::from_event(&event);
+        assert_eq!(chunk.data.len(), MAX_SSL_BUF_SIZE);
+        assert_eq!(chunk.missing, 10_000 - MAX_SSL_BUF_SIZE);
+
+        event.is_handshake = 1;
+        assert!(SslChunk::from_event(&event).data.is_empty());
+
+        // A stream always maps to the same worker, and aligned addresses still spread
+        assert_eq!(shard_of(chunk.key, 4), shard_of(chunk.key, 4));
+        let used: std::collections::HashSet<usize> = (0..64u64)
+            .map(|i| shard_of((42, 0x7f00_0000_0000 + i * 0x1000), 4))
+            .collect();
+        assert_eq!(used.len(), 4);
+    }
+
+    #[test]
+    fn test_queue_drop_truncates_stream() {
+        let key = (42, 0x7f00_dead_b000);
+        let chunk = |seq: u64, direction, data: &[u8]| SslChunk {
+            key,
+            cgroup_id: 0,
+            seq,
+            timestamp: Duration::from_millis(seq),
+            direction,
+            is_handshake: false,
+            data: data.to_vec(),
+            missing: 0,
+        };
+        let request = b"POST /v1/chat/completions HTTP/1.1\r\nHost: api.openai.com\r\n\r\n{}";
+        let head = b"HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n{";
+        let dropped = DroppedChunks::default();
+        let mut streams = HashMap::new();
+
+        process_chunk(
+            &mut streams,
+            chunk(1, LlmDirection::Write, request),
+            &dropped,
+            None,
+        );
+        process_chunk(
+            &mut streams,
+            chunk(2, LlmDirection::Read, head),
+            &dropped,
+            None,
+        );
+        assert!(streams[&key].processor.is_llm());
+
+        // Seq 3 and 4 are dropped on a full queue, while 2 may still be queued
+        dropped.add(key, 3);
+        dropped.add(key, 4);
+        assert_eq!(dropped.take_before(key, 2), 0);
+        assert_eq!(dropped.streams(), vec![key]);
+
+        // Past the gap, the exchange is closed
+        process_chunk(
+            &mut streams,
+            chunk(5, LlmDirection::Read, b"  "),
+            &dropped,
+            None,
+        );
+        assert!(!streams[&key].processor.is_llm());
+        assert!(dropped.streams().is_empty());
+
+        // The stream resyncs at the next request
+        process_chunk(
+            &mut streams,
+            chunk(6, LlmDirection::Write, request),
+            &dropped,
+            None,
+        );
+        assert!(streams[&key].processor.is_llm());
+    }
+}
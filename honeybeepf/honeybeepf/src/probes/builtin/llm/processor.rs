@@ -1,41 +1,153 @@
-use std::time::Instant;
+use std::{
+    collections::VecDeque,
+    time::{Duration, Instant},
+};
 
-use log::{info, warn};
+use log::{debug, info, warn};
 
 use crate::probes::builtin::llm::{
-    http::{self, ProtocolParser},
-    types::LlmDirection,
+    estimator,
+    http::{
+        self, DeltaScanner, Progress, Protocol, ProtocolParser, RequestScanner, ResponseFraming,
+    },
+    types::{
+        LlmCompletion, LlmDirection, RequestInfo, ResponseStatus, UnmeteredExchange, UsageInfo,
+    },
 };
 
 // Buffer size constants
 const INITIAL_BUFFER_CAPACITY: usize = 8 * 1024; // 8KB initial allocation
-const MAX_REQUEST_BUFFER_SIZE: usize = 8 * 1024 * 1024; // 8MB max for request (images, large context)
+const MAX_REQUEST_HEAD_SIZE: usize = 64 * 1024; // 64KB max for request headers
 const MAX_RESPONSE_BUFFER_SIZE: usize = 16 * 1024 * 1024; // 16MB max for response (streaming)
+const MAX_RESPONSE_HEAD_SIZE: usize = 16 * 1024; // Give up on the status after 16KB
 const DETECTION_BUFFER_THRESHOLD: usize = 4096; // Give up detection after 4KB
+const MAX_AWAITING_RESPONSES: usize = 32; // Requests written ahead of their responses
+/// How long the kernel skips a rejected connection before it is classified again
+pub const VERDICT_TTL: Duration = Duration::from_secs(60);
 
-/// State definition: lifecycle of an LLM connection
-enum ProcessorState {
-    /// Initial state: detecting protocol and request
+/// Write side of a connection: the request being written
+enum RequestState {
+    /// Detecting protocol and request
     Detecting,
-    /// Buffering request body
-    ProcessingRequest {
-        start_time: Instant,
-        parser: Box<dyn ProtocolParser>,
-    },
-    /// Request finished, buffering response
-    ProcessingResponse {
-        start_time: Instant,
+    /// Request detected; its body is scanned for routing facts, without buffering it
+    Writing {
+        /// Kernel time of the write the request was detected in
+        start_time: Duration,
         parser: Box<dyn ProtocolParser>,
+        /// `None` while the request head is still being buffered
+        scanner: Option<Box<RequestScanner>>,
     },
-    /// Finished or Invalid
-    Finished,
+    /// Not HTTP: ignored for the rest of the connection
+    Rejected(&'static str),
+}
+
+/// A written request waiting for its response
+struct Exchange {
+    start_time: Duration,
+    parser: Box<dyn ProtocolParser>,
+    request: RequestInfo,
+    /// Tells when the response, buffered in `read_buf`, is complete
+    framing: ResponseFraming,
+    /// Generated text of the response, for when it carries no usage
+    deltas: DeltaScanner,
+    /// Whether the response head was parsed, or given up on
+    head_read: bool,
+}
+
+impl Exchange {
+    /// The response completed at kernel time `now`.
+    fn complete(self, mut usage: UsageInfo, now: Duration, pid: u32) -> LlmCompletion {
+        let latency = now.saturating_sub(self.start_time);
+        let generation = self.deltas.generation();
+        let request = self.request;
+        if usage.model.is_none() {
+            usage.model = request.model.clone();
+        }
+        let model_str = usage.model.as_deref().unwrap_or("unknown");
+        let provider_str = request.provider.as_deref().unwrap_or("unknown");
+
+        if usage.prompt_tokens == 0 && usage.completion_tokens == 0 {
+            info!(
+                "LLM FAILED/ERROR | PID: {} | Provider: {} | Model: {} | Latency: {:.2}s",
+                pid,
+                provider_str,
+                model_str,
+                latency.as_secs_f64()
+            );
+        } else {
+            let thoughts_str = usage
+                .thoughts_tokens
+                .map(|t| format!(", Thoughts: {}", t))
+                .unwrap_or_default();
+            let cache_str = match (usage.cache_read_tokens, usage.cache_write_tokens) {
+                (None | Some(0), None | Some(0)) => String::new(),
+                (read, write) => format!(
+                    ", Cache read: {}, Cache write: {}",
+                    read.unwrap_or(0),
+                    write.unwrap_or(0)
+                ),
+            };
+            let rate_str = generation
+                .map(|g| {
+                    format!(
+                        " | {:.1} tok/s",
+                        usage.completion_tokens as f64 / g.as_secs_f64()
+                    )
+                })
+                .unwrap_or_default();
+            info!(
+                "LLM SUCCESS | PID: {} | Provider: {} | Model: {} | Latency: {:.2}s | Tokens: {} (Prompt: {}, Compl: {}{}{}){}",
+                pid,
+                provider_str,
+                model_str,
+                latency.as_secs_f64(),
+                usage.prompt_tokens + usage.completion_tokens,
+                usage.prompt_tokens,
+                usage.completion_tokens,
+                thoughts_str,
+                cache_str,
+                rate_str
+            );
+        }
+
+        LlmCompletion {
+            request,
+            usage,
+            latency,
+            generation,
+        }
+    }
 }
 
 pub struct StreamProcessor {
-    state: ProcessorState,
+    request: RequestState,
+    /// Requests written and not yet answered, oldest first. Responses come back in request
+    /// order, so reads belong to the front one.
+    awaiting: VecDeque<Exchange>,
+    /// Writes until the request is detected and its head parsed; the body is only scanned
     write_buf: Vec<u8>,
+    /// Response to the front of `awaiting`
     read_buf: Vec<u8>,
+    /// Exchanges whose responses ended without usage, for the token estimator
+    unmetered: Vec<UnmeteredExchange>,
+    /// Response heads parsed since the last `take_responses`
+    responses: Vec<ResponseStatus>,
     last_activity: Instant,
+    /// Kernel timestamp of the last event, which all exchange timings are taken from:
+    /// workers handle events late, and in batches
+    now: Duration,
+    /// Sequence number of the last event seen on this connection
+    last_seq: Option<u64>,
+    /// Whether the TLS handshake was seen, so that the first write is the start of the
+    /// protocol
+    from_start: bool,
+    /// Protocol of the connection, settled by its first write
+    protocol: Option<Protocol>,
+    /// A rejection the kernel should be told about (see `take_verdict`)
+    verdict_pending: bool,
+    /// When the connection was rejected, to tell events captured before the kernel had
+    /// the verdict from those after it expired
+    rejected_at: Option<Instant>,
 }
 
 impl Default for StreamProcessor {
@@ -47,10 +159,19 @@ impl Default for StreamProcessor {
 impl StreamProcessor {
     pub fn new() -> Self {
         Self {
-            state: ProcessorState::Detecting,
+            request: RequestState::Detecting,
+            awaiting: VecDeque::new(),
             write_buf: Vec::with_capacity(INITIAL_BUFFER_CAPACITY),
             read_buf: Vec::with_capacity(INITIAL_BUFFER_CAPACITY),
+            unmetered: Vec::new(),
+            responses: Vec::new(),
             last_activity: Instant::now(),
+            now: Duration::ZERO,
+            last_seq: None,
+            from_start: false,
+            protocol: None,
+            verdict_pending: false,
+            rejected_at: None,
         }
     }
 
@@ -59,148 +180,836 @@ impl StreamProcessor {
     }
 
     pub fn is_llm(&self) -> bool {
-        !matches!(
-            self.state,
-            ProcessorState::Detecting | ProcessorState::Finished
-        )
+        matches!(self.request, RequestState::Writing { .. }) || !self.awaiting.is_empty()
+    }
+
+    /// Exchanges whose responses ended without usage since the last call: those with
+    /// generated text, and all of them while the tokenizer is loaded (see `estimator`).
+    pub fn take_unmetered(&mut self) -> Vec<UnmeteredExchange> {
+        std::mem::take(&mut self.unmetered)
+    }
+
+    /// Status and rate-limit headers of the responses whose head arrived since the last
+    /// call, successful or not.
+    pub fn take_responses(&mut self) -> Vec<ResponseStatus> {
+        std::mem::take(&mut self.responses)
+    }
+
+    /// The connection went idle: a response already started is over, whatever its
+    /// framing says (the client stopped reading, or the stream was cut).
+    pub fn abandon(&mut self) {
+        if !self.read_buf.is_empty() {
+            self.end_unmetered();
+        }
+    }
+
+    /// Events of the connection never reached the processor: the response being read is
+    /// over, cut short, and the stream resyncs at the next write.
+    pub fn truncate(&mut self) {
+        self.abandon();
+        if !matches!(self.request, RequestState::Rejected(_)) {
+            self.reset();
+        }
+    }
+
+    /// Protocol name of a rejected connection, once after the rejection.
+    pub fn take_verdict(&mut self) -> Option<&'static str> {
+        match self.request {
+            RequestState::Rejected(protocol) if self.verdict_pending => {
+                self.verdict_pending = false;
+                Some(protocol)
+            }
+            _ => None,
+        }
+    }
+
+    /// Track the kernel sequence number of the connection. Returns the number of lost
+    /// events on a gap, after discarding the partial requests and responses: the stream
+    /// then resyncs at the next write, like after a completed exchange.
+    pub fn observe_seq(&mut self, seq: u64) -> Option<u64> {
+        let lost = match self.last_seq {
+            // A lower number means the kernel counter restarted (connection evicted or reused)
+            Some(last) if seq > last + 1 => Some(seq - last - 1),
+            _ => None,
+        };
+        if self.last_seq.is_none_or(|last| seq <= last) {
+            // First event of the connection as far as this processor knows. Even seq 1 may
+            // be mid-stream (the kernel counter was evicted, or a restarted agent lost it),
+            // so only a handshake marks the start of the protocol.
+            self.from_start = false;
+            self.protocol = None;
+            self.reset();
+        }
+        self.last_seq = Some(seq);
+
+        if matches!(self.request, RequestState::Rejected(_)) {
+            return lost;
+        }
+        if lost.is_some() && self.protocol.is_none() {
+            // The lost events may have been the start of the protocol
+            self.from_start = false;
+        }
+        if lost.is_some() {
+            self.reset();
+        }
+        lost
     }
 
-    pub fn handle_event(&mut self, direction: LlmDirection, data: &[u8], pid: u32) {
+    /// A completed TLS handshake: the next write starts a protocol, which may differ from
+    /// what the connection (or a previous one at the same `SSL*` address) carried.
+    pub fn handshake(&mut self) {
+        self.from_start = true;
+        self.protocol = None;
+        self.reset();
+    }
+
+    /// Feed one SSL chunk, of which the kernel left out the last `missing` bytes, captured
+    /// at kernel time `timestamp`. Returns the exchanges whose responses were parsed.
+    pub fn handle_event(
+        &mut self,
+        direction: LlmDirection,
+        data: &[u8],
+        missing: usize,
+        timestamp: Duration,
+        pid: u32,
+    ) -> Vec<LlmCompletion> {
         self.last_activity = Instant::now();
+        self.now = self.now.max(timestamp);
 
-        // Early return if finished (except for new Write which triggers reset)
-        if matches!(self.state, ProcessorState::Finished) {
-            if direction == LlmDirection::Write {
-                self.reset();
-            } else {
-                return; // Ignore Read events after completion
+        if matches!(self.request, RequestState::Rejected(_)) {
+            if self
+                .rejected_at
+                .is_some_and(|at| at.elapsed() < VERDICT_TTL)
+            {
+                // Captured before the kernel had the verdict
+                return Vec::new();
             }
+            // The verdict expired: classify again, from the middle of the stream
+            self.from_start = false;
+            self.protocol = None;
+            self.reset();
+        }
+
+        // HTTP clients speak first; a connection that starts with a read is something else
+        if direction == LlmDirection::Read
+            && self.from_start
+            && self.protocol.is_none()
+            && self.write_buf.is_empty()
+            && self.awaiting.is_empty()
+            && matches!(self.request, RequestState::Detecting)
+        {
+            self.reject("server-first", pid);
+            return Vec::new();
         }
 
-        // 1. Buffer Management
         match direction {
             LlmDirection::Write => {
-                if self.write_buf.len() + data.len() > MAX_REQUEST_BUFFER_SIZE {
-                    warn!(
-                        "LLM request buffer exceeded {}MB limit (PID: {}), discarding stream",
-                        MAX_REQUEST_BUFFER_SIZE / (1024 * 1024),
-                        pid
-                    );
-                    self.reset();
-                    return;
-                }
-                self.write_buf.extend_from_slice(data);
+                self.write(data, missing, pid);
+                Vec::new()
             }
-            LlmDirection::Read => {
-                // Optimization: Don't buffer responses if we haven't detected a valid LLM request yet
-                if matches!(self.state, ProcessorState::Detecting) {
-                    return;
-                }
+            LlmDirection::Read => self.read(data, missing, pid),
+            _ => Vec::new(),
+        }
+    }
 
-                if self.read_buf.len() + data.len() > MAX_RESPONSE_BUFFER_SIZE {
-                    warn!(
-                        "LLM response buffer exceeded {}MB limit (PID: {}), discarding stream",
-                        MAX_RESPONSE_BUFFER_SIZE / (1024 * 1024),
-                        pid
-                    );
-                    self.reset();
-                    return;
-                }
-                self.read_buf.extend_from_slice(data);
+    fn write(&mut self, data: &[u8], missing: usize, pid: u32) {
+        if let RequestState::Writing {
+            scanner: Some(scanner),
+            ..
+        } = &mut self.request
+        {
+            let used = scanner.feed(data);
+            if used == data.len() {
+                scanner.skip(missing);
             }
-            _ => return,
-        }
-
-        // 2. State Machine Transition
-        // Take ownership of current state to enable transitions
-        let current_state = std::mem::replace(&mut self.state, ProcessorState::Finished);
-
-        self.state = match current_state {
-            // [State 1] Detecting
-            ProcessorState::Detecting => {
-                // Try H1
-                if let Some(path) = http::Http11Parser.detect_request(&self.write_buf) {
-                    info!("[LLM] Detected HTTP/1.1: {} (PID: {})", path, pid);
-                    ProcessorState::ProcessingRequest {
-                        start_time: Instant::now(),
-                        parser: Box::new(http::Http11Parser),
-                    }
-                }
-                // Try H2
-                else if let Some(path) = http::Http2Parser.detect_request(&self.write_buf) {
-                    info!("[LLM] Detected HTTP/2: {} (PID: {})", path, pid);
-                    ProcessorState::ProcessingRequest {
-                        start_time: Instant::now(),
-                        parser: Box::new(http::Http2Parser),
-                    }
-                } else {
-                    // Not detected yet
-                    if self.write_buf.len() > DETECTION_BUFFER_THRESHOLD {
-                        // Buffer too large and still not detected -> likely not LLM
-                        ProcessorState::Finished
-                    } else {
-                        ProcessorState::Detecting // Keep detecting
-                    }
+            if scanner.is_complete() {
+                self.finish_request();
+                if used < data.len() {
+                    // A pipelined request follows in the same write
+                    self.write(&data[used..], missing, pid);
                 }
             }
+            return;
+        }
 
-            // [State 2] Processing Request
-            ProcessorState::ProcessingRequest { start_time, parser } => {
-                if direction == LlmDirection::Read {
-                    // Write finished (implied by Read starting), transition to Response phase
-                    ProcessorState::ProcessingResponse { start_time, parser }
-                } else {
-                    // Still writing -> keep state
-                    ProcessorState::ProcessingRequest { start_time, parser }
-                }
+        self.write_buf.extend_from_slice(data);
+        if matches!(self.request, RequestState::Detecting) {
+            self.detect(pid);
+        }
+
+        // Parse the head of the detected request, then scan the part of the body already
+        // buffered. From then on writes are scanned, not buffered.
+        let RequestState::Writing {
+            parser,
+            scanner: scanner @ None,
+            ..
+        } = &mut self.request
+        else {
+            return;
+        };
+        let (info, body_offset) = match parser.request_head(&self.write_buf) {
+            Some(head) => head,
+            None if self.write_buf.len() > MAX_REQUEST_HEAD_SIZE => {
+                warn!(
+                    "LLM request head exceeds {}KB (PID: {}), not extracting request details",
+                    MAX_REQUEST_HEAD_SIZE / 1024,
+                    pid
+                );
+                (RequestInfo::default(), self.write_buf.len())
             }
+            None => return,
+        };
+        *scanner = Some(Box::new(parser.request_scanner(info)));
+        let body = self
+            .write_buf
+            .split_off(body_offset.min(self.write_buf.len()));
+        self.write_buf.clear();
+        self.write_buf.shrink_to(INITIAL_BUFFER_CAPACITY);
+        self.write(&body, missing, pid);
+    }
 
-            // [State 3] Processing Response
-            ProcessorState::ProcessingResponse { start_time, parser } => {
-                // Try parsing response
-                if let Some(usage) = parser.parse_response(&self.read_buf) {
-                    let latency = start_time.elapsed();
-                    let model_str = usage.model.as_deref().unwrap_or("unknown");
+    /// Look for an LLM request at the start of `write_buf`.
+    fn detect(&mut self, pid: u32) {
+        // Settle the protocol from the first bytes, so that only its parser runs. Without
+        // the start of the connection, a mismatch only means a write in the middle of a
+        // message, and both parsers are tried as before.
+        let protocol = self.protocol.or_else(|| http::classify(&self.write_buf));
+        if self.from_start && self.protocol.is_none() {
+            self.protocol = protocol;
+        }
+        let (try_h1, try_h2) = match protocol {
+            Some(Protocol::Http1) => (true, false),
+            Some(Protocol::Http2) => (false, true),
+            Some(Protocol::Other(name)) if self.from_start => {
+                self.reject(name, pid);
+                return;
+            }
+            Some(Protocol::Other(_)) => (true, true),
+            None => (false, false),
+        };
 
-                    if usage.prompt_tokens == 0 && usage.completion_tokens == 0 {
-                        info!(
-                            "LLM FAILED/ERROR | PID: {} | Model: {} | Latency: {:.2}s",
-                            pid,
-                            model_str,
-                            latency.as_secs_f64()
-                        );
-                    } else {
-                        let thoughts_str = usage
-                            .thoughts_tokens
-                            .map(|t| format!(", Thoughts: {}", t))
+        let parser: Box<dyn ProtocolParser> = if let Some(path) = try_h1
+            .then(|| http::Http11Parser.detect_request(&self.write_buf))
+            .flatten()
+        {
+            info!("[LLM] Detected HTTP/1.1: {} (PID: {})", path, pid);
+            Box::new(http::Http11Parser)
+        } else if let Some(path) = try_h2
+            .then(|| http::Http2Parser.detect_request(&self.write_buf))
+            .flatten()
+        {
+            info!("[LLM] Detected HTTP/2: {} (PID: {})", path, pid);
+            Box::new(http::Http2Parser)
+        } else {
+            if self.write_buf.len() > DETECTION_BUFFER_THRESHOLD {
+                // Buffer too large and still not detected -> likely not LLM, start over at
+                // the next write
+                self.write_buf.clear();
+            }
+            return;
+        };
+
+        // Clients do not send a new request before an unframed response is over
+        if self
+            .awaiting
+            .front()
+            .is_some_and(|exchange| exchange.framing.is_unframed())
+        {
+            debug!("[LLM] Response ended without usage (PID: {})", pid);
+            self.end_unmetered();
+        }
+        self.request = RequestState::Writing {
+            start_time: self.now,
+            parser,
+            scanner: None,
+        };
+    }
+
+    /// The request being written is over: queue it for its response.
+    fn finish_request(&mut self) {
+        let RequestState::Writing {
+            start_time,
+            parser,
+            scanner,
+        } = std::mem::replace(&mut self.request, RequestState::Detecting)
+        else {
+            return;
+        };
+        self.write_buf.clear();
+        if self.awaiting.len() >= MAX_AWAITING_RESPONSES {
+            debug!(
+                "[LLM] {} requests without responses, dropping the oldest",
+                self.awaiting.len()
+            );
+            self.pop_response();
+        }
+        let request = scanner.map(|scanner| scanner.finish()).unwrap_or_default();
+        let framing = parser.response_framing();
+        self.awaiting.push_back(Exchange {
+            start_time,
+            framing: if request.head_request {
+                framing.head_request()
+            } else {
+                framing
+            },
+            deltas: DeltaScanner::new(),
+            head_read: false,
+            request,
+            parser,
+        });
+    }
+
+    /// Walk one read through the responses it belongs to, and parse each response once its
+    /// framing says it is complete (on every read when it has no framing).
+    fn read(&mut self, mut data: &[u8], missing: usize, pid: u32) -> Vec<LlmCompletion> {
+        // Without a length, a request ends when the response starts
+        if self.awaiting.is_empty() {
+            self.finish_request();
+        }
+
+        let mut completions = Vec::new();
+        while let Some(exchange) = self.awaiting.front_mut() {
+            if self.read_buf.len() + data.len() > MAX_RESPONSE_BUFFER_SIZE {
+                warn!(
+                    "LLM response buffer exceeded {}MB limit (PID: {}), discarding response",
+                    MAX_RESPONSE_BUFFER_SIZE / (1024 * 1024),
+                    pid
+                );
+                self.pop_response();
+                break;
+            }
+
+            let mut body = Vec::new();
+            let progress = exchange.framing.feed_body(data, missing, &mut body);
+            let used = data.len() - exchange.framing.leftover();
+            self.read_buf.extend_from_slice(&data[..used]);
+            for part in body {
+                exchange.deltas.feed(part, self.now);
+            }
+            if missing > 0 && used == data.len() {
+                exchange.deltas.skip();
+            }
+            if !exchange.head_read {
+                if let Some(head) = exchange.parser.response_head(&self.read_buf) {
+                    exchange.head_read = true;
+                    let provider = exchange.request.provider.as_deref().unwrap_or("unknown");
+                    let kind = match head.status {
+                        429 => Some("RATE LIMITED"),
+                        500.. => Some("SERVER ERROR"),
+                        _ => None,
+                    };
+                    if let Some(kind) = kind {
+                        let retry_str = head
+                            .retry_after
+                            .map(|r| format!(" | Retry after: {:.1}s", r.as_secs_f64()))
                             .unwrap_or_default();
                         info!(
-                            "LLM SUCCESS | PID: {} | Model: {} | Latency: {:.2}s | Tokens: {} (Prompt: {}, Compl: {}{})",
-                            pid,
-                            model_str,
-                            latency.as_secs_f64(),
-                            usage.prompt_tokens + usage.completion_tokens,
-                            usage.prompt_tokens,
-                            usage.completion_tokens,
-                            thoughts_str
+                            "LLM {} | PID: {} | Provider: {} | Status: {}{}",
+                            kind, pid, provider, head.status, retry_str
                         );
                     }
-
-                    ProcessorState::Finished
-                } else {
-                    // Incomplete -> keep state
-                    ProcessorState::ProcessingResponse { start_time, parser }
+                    self.responses.push(ResponseStatus {
+                        provider: exchange.request.provider.clone(),
+                        api_key: exchange.request.api_key.clone(),
+                        head,
+                    });
+                } else if self.read_buf.len() > MAX_RESPONSE_HEAD_SIZE {
+                    exchange.head_read = true;
                 }
             }
+            let usage = match progress {
+                Progress::Pending => None,
+                Progress::Complete | Progress::StreamEnded | Progress::Unframed => {
+                    exchange.parser.parse_response(&self.read_buf)
+                }
+            };
+            match usage {
+                Some(usage) => {
+                    if let Some(exchange) = self.pop_response() {
+                        completions.push(exchange.complete(usage, self.now, pid));
+                    }
+                }
+                None if progress == Progress::Complete => {
+                    debug!("[LLM] Response carries no usage (PID: {})", pid);
+                    self.end_unmetered();
+                }
+                // Incomplete, or another HTTP/2 stream ended
+                None => break,
+            }
+            if used == data.len() {
+                break;
+            }
+            // A pipelined response follows in the same read
+            data = &data[used..];
+        }
+        completions
+    }
 
-            // [State 4] Finished
-            ProcessorState::Finished => ProcessorState::Finished,
+    /// Drop the front exchange and its response bytes.
+    fn pop_response(&mut self) -> Option<Exchange> {
+        self.read_buf.clear();
+        self.read_buf.shrink_to(INITIAL_BUFFER_CAPACITY);
+        self.awaiting.pop_front()
+    }
+
+    /// Drop the front exchange, whose response is over without usage, and leave it to the
+    /// token estimator.
+    fn end_unmetered(&mut self) {
+        let response = if estimator::enabled() {
+            std::mem::take(&mut self.read_buf)
+        } else {
+            Vec::new()
+        };
+        let Some(exchange) = self.pop_response() else {
+            return;
         };
+        if response.is_empty() && exchange.deltas.tokens() == 0 {
+            return;
+        }
+        self.unmetered.push(UnmeteredExchange {
+            latency: self.now.saturating_sub(exchange.start_time),
+            request: exchange.request,
+            response,
+            parser: exchange.parser,
+            deltas: exchange.deltas,
+        });
+    }
+
+    fn reject(&mut self, protocol: &'static str, pid: u32) {
+        debug!(
+            "[LLM] Not HTTP ({}), ignoring connection (PID: {})",
+            protocol, pid
+        );
+        self.write_buf = Vec::new();
+        self.read_buf = Vec::new();
+        self.awaiting.clear();
+        self.request = RequestState::Rejected(protocol);
+        self.verdict_pending = true;
+        self.rejected_at = Some(Instant::now());
     }
 
     fn reset(&mut self) {
-        self.state = ProcessorState::Detecting;
+        self.request = RequestState::Detecting;
+        self.awaiting.clear();
         self.write_buf.clear();
         self.read_buf.clear();
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const REQUEST: &[u8] = b"POST /v1/chat/completions HTTP/1.1\r\nHost: api.openai.com\r\n\r\n{}";
+
+    #[test]
+    fn test_seq_gap_discards_stream() {
+        let mut processor = StreamProcessor::new();
+        assert_eq!(processor.observe_seq(1), None);
+        processor.handle_event(LlmDirection::Write, REQUEST, 0, Duration::ZERO, 1);
+        assert!(processor.is_llm());
+
+        assert_eq!(processor.observe_seq(2), None);
+        assert_eq!(processor.observe_seq(5), Some(2));
+        assert!(!processor.is_llm());
+
+        // Reads of the broken exchange are ignored, the next write resyncs
+        processor.handle_event(
+            LlmDirection::Read,
+            b"HTTP/1.1 200 OK\r\n",
+            0,
+            Duration::ZERO,
+            1,
+        );
+        assert!(processor.read_buf.is_empty());
+        processor.handle_event(LlmDirection::Write, REQUEST, 0, Duration::ZERO, 1);
+        assert!(processor.is_llm());
+
+        // Counter restart is not a gap
+        assert_eq!(processor.observe_seq(1), None);
+    }
+
+    #[test]
+    fn test_sharded_ring_drain_keeps_connection_order() {
+        use std::collections::{HashMap, HashSet};
+
+        use honeybeepf_common::conn_shard;
+
+        const SHARDS: u32 = 4;
+        let conns: Vec<u64> = (0..6).map(|i| 0x5555_a000_0000 + i * 0x1_0840).collect();
+        // Events of all connections interleaved, as emitted on different CPUs
+        let emitted: Vec<(u64, u64)> = (1..=20)
+            .flat_map(|seq| conns.iter().map(move |&conn| (conn, seq)))
+            .collect();
+
+        // The consumer drains one shard after another
+        let drain = |shard_of: &dyn Fn(usize, u64) -> u32| -> Vec<(u64, u64)> {
+            (0..SHARDS)
+                .flat_map(|shard| {
+                    emitted
+                        .iter()
+                        .enumerate()
+                        .filter(move |&(i, &(conn, _))| shard_of(i, conn) == shard)
+                        .map(|(_, &event)| event)
+                })
+                .collect()
+        };
+        let gaps = |order: Vec<(u64, u64)>| -> usize {
+            let mut processors: HashMap<u64, StreamProcessor> = HashMap::new();
+            order
+                .into_iter()
+                .filter(|&(conn, seq)| {
+                    let processor = processors.entry(conn).or_default();
+                    processor.observe_seq(seq).is_some()
+                })
+                .count()
+        };
+
+        // Sharded by CPU, later chunks of a connection overtake earlier ones
+        assert!(gaps(drain(&|i, _| i as u32 % SHARDS)) > 0);
+        // Sharded by connection, each connection is seen in order
+        assert_eq!(gaps(drain(&|_, conn| conn_shard(7, conn, SHARDS))), 0);
+        // and the connections are still spread over the shards
+        let used: HashSet<u32> = conns.iter().map(|&c| conn_shard(7, c, SHARDS)).collect();
+        assert!(used.len() > 1);
+    }
+
+    #[test]
+    fn test_request_body_is_not_buffered() {
+        let mut processor = StreamProcessor::new();
+        let start = br#"{"messages":[{"content":""#;
+        let end = br#""}],"model":"gpt-4o","stream":false}"#;
+        let image = vec![b'A'; 4096];
+        let len = start.len() + 1024 * image.len() + end.len();
+        let head = format!(
+            "POST /v1/chat/completions HTTP/1.1\r\nHost: api.openai.com\r\nContent-Length: {}\r\n\r\n",
+            len
+        );
+        processor.handle_event(LlmDirection::Write, head.as_bytes(), 0, Duration::ZERO, 1);
+        processor.handle_event(LlmDirection::Write, start, 0, Duration::ZERO, 1);
+        for _ in 0..1024 {
+            processor.handle_event(LlmDirection::Write, &image, 0, Duration::ZERO, 1);
+        }
+        processor.handle_event(LlmDirection::Write, end, 0, Duration::ZERO, 1);
+        assert!(processor.write_buf.capacity() <= INITIAL_BUFFER_CAPACITY);
+
+        // Content-Length tells that the request is over before any read
+        let request = &processor
+            .awaiting
+            .front()
+            .expect("awaiting response")
+            .request;
+        assert_eq!(request.model.as_deref(), Some("gpt-4o"));
+        assert_eq!(request.stream, Some(false));
+        assert_eq!(request.content_length, Some(len as u64));
+        assert_eq!(request.body_bytes, len as u64);
+    }
+
+    #[test]
+    fn test_response_completes_by_framing() {
+        let body = br#"{"model":"gpt-4o","usage":{"prompt_tokens":5,"completion_tokens":7}}"#;
+        let (first, rest) = body.split_at(body.iter().position(|&b| b == b'}').unwrap() + 1);
+
+        // Reads that end in '}' before the declared length complete nothing
+        let mut processor = StreamProcessor::new();
+        processor.handle_event(LlmDirection::Write, REQUEST, 0, Duration::ZERO, 1);
+        let head = format!("HTTP/1.1 200 OK\r\nContent-Length: {}\r\n\r\n", body.len());
+        let mut response = head.into_bytes();
+        response.extend_from_slice(first);
+        assert!(
+            processor
+                .handle_event(LlmDirection::Read, &response, 0, Duration::ZERO, 1)
+                .is_empty()
+        );
+        let completion = processor
+            .handle_event(LlmDirection::Read, rest, 0, Duration::ZERO, 1)
+            .pop()
+            .expect("complete at Content-Length");
+        assert_eq!(completion.usage.prompt_tokens, 5);
+        assert_eq!(completion.usage.completion_tokens, 7);
+
+        // A whole chunked response in a single read, up to the terminal chunk
+        let mut processor = StreamProcessor::new();
+        processor.handle_event(LlmDirection::Write, REQUEST, 0, Duration::ZERO, 1);
+        let mut response = format!(
+            "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n{:x}\r\n",
+            body.len()
+        )
+        .into_bytes();
+        response.extend_from_slice(body);
+        assert!(
+            processor
+                .handle_event(LlmDirection::Read, &response, 0, Duration::ZERO, 1)
+                .is_empty()
+        );
+        let completion =
+            processor.handle_event(LlmDirection::Read, b"\r\n0\r\n\r\n", 0, Duration::ZERO, 1);
+        assert_eq!(completion[0].usage.model.as_deref(), Some("gpt-4o"));
+    }
+
+    #[test]
+    fn test_keep_alive_pairs_requests_in_order() {
+        let request = |model: &str| {
+            let body = format!(r#"{{"model":"{}","messages":[]}}"#, model);
+            format!(
+                "POST /v1/chat/completions HTTP/1.1\r\nHost: api.openai.com\r\nContent-Length: {}\r\n\r\n{}",
+                body.len(),
+                body
+            )
+        };
+        let response = |prompt_tokens: u64| {
+            let body = format!(
+                r#"{{"usage":{{"prompt_tokens":{},"completion_tokens":1}}}}"#,
+                prompt_tokens
+            );
+            format!(
+                "HTTP/1.1 200 OK\r\nContent-Length: {}\r\n\r\n{}",
+                body.len(),
+                body
+            )
+        };
+        let error = "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 2\r\n\r\n{}";
+
+        let mut processor = StreamProcessor::new();
+        let mut completions = Vec::new();
+        for i in 0..1000 {
+            if i % 100 == 7 {
+                // An error without usage does not hold up the connection
+                processor.handle_event(
+                    LlmDirection::Write,
+                    request("err").as_bytes(),
+                    0,
+                    Duration::ZERO,
+                    1,
+                );
+                completions.extend(processor.handle_event(
+                    LlmDirection::Read,
+                    error.as_bytes(),
+                    0,
+                    Duration::ZERO,
+                    1,
+                ));
+            }
+            // Two pipelined requests in one write, answered in one read
+            let writes = request(&format!("m{}", i)) + &request(&format!("n{}", i));
+            processor.handle_event(LlmDirection::Write, writes.as_bytes(), 0, Duration::ZERO, 1);
+            let reads = response(i) + &response(i + 1);
+            completions.extend(processor.handle_event(
+                LlmDirection::Read,
+                reads.as_bytes(),
+                0,
+                Duration::ZERO,
+                1,
+            ));
+        }
+
+        assert_eq!(completions.len(), 2000);
+        for (i, pair) in completions.chunks(2).enumerate() {
+            assert_eq!(pair[0].request.model, Some(format!("m{}", i)));
+            assert_eq!(pair[0].usage.prompt_tokens, i as u64);
+            assert_eq!(pair[1].request.model, Some(format!("n{}", i)));
+            assert_eq!(pair[1].usage.prompt_tokens, i as u64 + 1);
+        }
+        assert!(processor.awaiting.is_empty());
+        assert!(processor.write_buf.capacity() <= INITIAL_BUFFER_CAPACITY);
+        assert!(processor.read_buf.capacity() <= INITIAL_BUFFER_CAPACITY);
+
+        // A response without framing ends when the next request is written
+        processor.handle_event(
+            LlmDirection::Write,
+            request("a").as_bytes(),
+            0,
+            Duration::ZERO,
+            1,
+        );
+        processor.handle_event(
+            LlmDirection::Read,
+            b"HTTP/1.1 200 OK\r\n\r\n{\"x\":",
+            0,
+            Duration::ZERO,
+            1,
+        );
+        processor.handle_event(
+            LlmDirection::Write,
+            request("b").as_bytes(),
+            0,
+            Duration::ZERO,
+            1,
+        );
+        assert_eq!(processor.awaiting.len(), 1);
+        let completion = processor.handle_event(
+            LlmDirection::Read,
+            response(3).as_bytes(),
+            0,
+            Duration::ZERO,
+            1,
+        );
+        assert_eq!(completion[0].request.model.as_deref(), Some("b"));
+
+        // The response to a HEAD request ends with its head, whatever its Content-Length
+        processor.handle_event(
+            LlmDirection::Write,
+            b"HEAD /v1/chat/completions HTTP/1.1\r\nHost: api.openai.com\r\n\r\n",
+            0,
+            Duration::ZERO,
+            1,
+        );
+        processor.handle_event(
+            LlmDirection::Read,
+            b"HTTP/1.1 200 OK\r\nContent-Length: 500\r\n\r\n",
+            0,
+            Duration::ZERO,
+            1,
+        );
+        assert!(processor.awaiting.is_empty());
+        processor.handle_event(
+            LlmDirection::Write,
+            request("c").as_bytes(),
+            0,
+            Duration::ZERO,
+            1,
+        );
+        let completion = processor.handle_event(
+            LlmDirection::Read,
+            response(4).as_bytes(),
+            0,
+            Duration::ZERO,
+            1,
+        );
+        assert_eq!(completion[0].request.model.as_deref(), Some("c"));
+    }
+
+    #[test]
+    fn test_stream_without_usage_is_estimated_from_deltas() {
+        // Timings come from the kernel timestamps of the events
+        let at = Duration::from_millis;
+        let mut processor = StreamProcessor::new();
+        processor.handle_event(LlmDirection::Write, REQUEST, 0, at(1000), 1);
+        let head = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nTransfer-Encoding: chunked\r\n\r\n";
+        processor.handle_event(LlmDirection::Read, head.as_bytes(), 0, at(1200), 1);
+        for (i, delta) in ["Hello", " world", "!"].iter().enumerate() {
+            let event = format!(
+                "data: {{\"choices\":[{{\"delta\":{{\"content\":\"{}\"}}}}]}}\n\n",
+                delta
+            );
+            // Chunk sizes split an event: the scanner only sees the body
+            let (first, second) = event.split_at(20);
+            let chunk = format!(
+                "{:x}\r\n{}\r\n{:x}\r\n{}\r\n",
+                first.len(),
+                first,
+                second.len(),
+                second
+            );
+            let timestamp = at(1300 + 100 * i as u64);
+            processor.handle_event(LlmDirection::Read, chunk.as_bytes(), 0, timestamp, 1);
+        }
+        let end = "e\r\ndata: [DONE]\n\n\r\n0\r\n\r\n";
+        assert!(
+            processor
+                .handle_event(LlmDirection::Read, end.as_bytes(), 0, at(1600), 1)
+                .is_empty()
+        );
+
+        let unmetered = processor.take_unmetered();
+        assert_eq!(unmetered.len(), 1);
+        assert_eq!(unmetered[0].deltas.tokens(), 3);
+        assert_eq!(unmetered[0].deltas.generation(), Some(at(200)));
+        assert_eq!(unmetered[0].latency, at(600));
+        assert!(processor.awaiting.is_empty());
+        assert!(processor.take_unmetered().is_empty());
+    }
+
+    #[test]
+    fn test_rate_limited_response_is_reported() {
+        let mut processor = StreamProcessor::new();
+        let request = b"POST /v1/chat/completions HTTP/1.1\r\nHost: api.openai.com\r\nAuthorization: Bearer sk-test\r\nContent-Length: 2\r\n\r\n{}";
+        processor.handle_event(LlmDirection::Write, request, 0, Duration::ZERO, 1);
+        let body = br#"{"error":{"type":"rate_limit_exceeded"}}"#;
+        let head = format!(
+            "HTTP/1.1 429 Too Many Requests\r\nContent-Length: {}\r\nx-ratelimit-remaining-tokens: 0\r\nretry-after: 7\r\n\r\n",
+            body.len()
+        );
+        // The status is known from the head, before the body arrives
+        processor.handle_event(LlmDirection::Read, head.as_bytes(), 0, Duration::ZERO, 1);
+        let responses = processor.take_responses();
+        assert_eq!(responses.len(), 1);
+        assert_eq!(responses[0].provider.as_deref(), Some("openai"));
+        assert!(responses[0].api_key.is_some());
+        assert_eq!(responses[0].head.status, 429);
+        assert_eq!(responses[0].head.remaining_tokens, Some(0));
+
+        let completions = processor.handle_event(LlmDirection::Read, body, 0, Duration::ZERO, 1);
+        assert_eq!(completions[0].usage.prompt_tokens, 0);
+        assert!(processor.take_responses().is_empty());
+    }
+
+    #[test]
+    fn test_non_http_is_rejected() {
+        let postgres = [0, 0, 0, 41, 0, 3, 0, 0, b'u', b's', b'e', b'r'];
+
+        let mut processor = StreamProcessor::new();
+        processor.observe_seq(1);
+        processor.handshake();
+        processor.observe_seq(2);
+        processor.handle_event(LlmDirection::Write, &postgres, 0, Duration::ZERO, 1);
+        assert_eq!(processor.take_verdict(), Some("postgres"));
+        assert_eq!(processor.take_verdict(), None);
+        // Events captured before the kernel had the verdict are dropped
+        processor.observe_seq(3);
+        processor.handle_event(LlmDirection::Write, REQUEST, 0, Duration::ZERO, 1);
+        assert!(!processor.is_llm());
+        assert_eq!(processor.take_verdict(), None);
+        // A new TLS session is classified again
+        processor.observe_seq(4);
+        processor.handshake();
+        processor.observe_seq(5);
+        processor.handle_event(LlmDirection::Write, REQUEST, 0, Duration::ZERO, 1);
+        assert!(processor.is_llm());
+
+        // Servers never speak first in HTTP
+        let mut processor = StreamProcessor::new();
+        processor.observe_seq(1);
+        processor.handshake();
+        processor.observe_seq(2);
+        processor.handle_event(
+            LlmDirection::Read,
+            b"220 smtp.example.com ESMTP\r\n",
+            0,
+            Duration::ZERO,
+            1,
+        );
+        assert_eq!(processor.take_verdict(), Some("server-first"));
+        // Once the verdict expired, the connection is classified again mid-stream, and
+        // not rejected for good
+        processor.rejected_at = Instant::now().checked_sub(VERDICT_TTL);
+        processor.observe_seq(3);
+        processor.handle_event(LlmDirection::Read, b"250 OK\r\n", 0, Duration::ZERO, 1);
+        assert_eq!(processor.take_verdict(), None);
+        processor.handle_event(LlmDirection::Write, REQUEST, 0, Duration::ZERO, 1);
+        assert!(processor.is_llm());
+
+        // Joined mid-connection, the first write proves nothing
+        let mut processor = StreamProcessor::new();
+        processor.observe_seq(40);
+        processor.handle_event(LlmDirection::Write, &postgres, 0, Duration::ZERO, 1);
+        assert_eq!(processor.take_verdict(), None);
+        processor.handle_event(LlmDirection::Write, REQUEST, 0, Duration::ZERO, 1);
+        assert!(processor.is_llm());
+
+        // Neither does seq 1 without a handshake (evicted counter, restarted agent)
+        let mut processor = StreamProcessor::new();
+        processor.observe_seq(1);
+        processor.handle_event(
+            LlmDirection::Read,
+            b"HTTP/1.1 200 OK\r\n",
+            0,
+            Duration::ZERO,
+            1,
+        );
+        processor.handle_event(LlmDirection::Write, &postgres, 0, Duration::ZERO, 1);
+        assert_eq!(processor.take_verdict(), None);
+        processor.handle_event(LlmDirection::Write, REQUEST, 0, Duration::ZERO, 1);
+        assert!(processor.is_llm());
+    }
+}
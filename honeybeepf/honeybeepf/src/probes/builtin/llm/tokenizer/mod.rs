@@ -0,0 +1,315 @@
+//! Byte-pair encoding compatible with tiktoken, for estimating the token counts of exchanges
+//! whose responses carry no usage.
+//!
+//! Vocabularies are tiktoken's rank files (`cl100k_base.tiktoken`, `o200k_base.tiktoken`):
+//! one base64 token and its rank per line, the rank doubling as merge priority. A file is
+//! mapped rather than read, and decoded once into a rank table. Counting splits text into
+//! pieces (see `pretokenize`) and merges the bytes of each piece, lowest rank first.
+
+mod pretokenize;
+
+use std::{fs::File, os::fd::AsRawFd, path::Path};
+
+use anyhow::{Context, Result, bail};
+pub use pretokenize::pieces;
+use rustc_hash::FxHashMap;
+
+/// Pieces longer than this are merged in slices, as merging is quadratic in piece length
+/// (a base64 blob has no spaces to split at)
+const MAX_PIECE_BYTES: usize = 1024;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum Vocab {
+    Cl100k,
+    O200k,
+}
+
+impl Vocab {
+    pub const ALL: [Vocab; 2] = [Vocab::Cl100k, Vocab::O200k];
+
+    pub fn file_name(self) -> &'static str {
+        match self {
+            Vocab::Cl100k => "cl100k_base.tiktoken",
+            Vocab::O200k => "o200k_base.tiktoken",
+        }
+    }
+
+    /// Vocabulary of a model: o200k from the GPT-4o generation on, cl100k otherwise. Other
+    /// providers do not publish their tokenizers; cl100k stands in for them.
+    pub fn for_model(model: &str) -> Self {
+        const O200K_PREFIXES: [&str; 8] = [
+            "gpt-4o",
+            "gpt-4.1",
+            "gpt-4.5",
+            "gpt-5",
+            "chatgpt-4o",
+            "o1",
+            "o3",
+            "o4",
+        ];
+        let model = model.to_ascii_lowercase();
+        if O200K_PREFIXES
+            .iter()
+            .any(|prefix| model.starts_with(prefix))
+        {
+            Vocab::O200k
+        } else {
+            Vocab::Cl100k
+        }
+    }
+}
+
+pub struct Tokenizer {
+    vocab: Vocab,
+    ranks: FxHashMap<Vec<u8>, u32>,
+}
+
+impl Tokenizer {
+    pub fn load(vocab: Vocab, path: &Path) -> Result<Self> {
+        let file = Mmap::open(path).with_context(|| format!("Failed to map {}", path.display()))?;
+        Self::from_ranks(vocab, file.as_slice())
+            .with_context(|| format!("Failed to parse {}", path.display()))
+    }
+
+    /// Build from the contents of a rank file.
+    pub fn from_ranks(vocab: Vocab, data: &[u8]) -> Result<Self> {
+        let mut ranks = FxHashMap::default();
+        for (number, line) in data.split(|&b| b == b'\n').enumerate() {
+            if line.is_empty() {
+                continue;
+            }
+            let parsed = line.iter().position(|&b| b == b' ').and_then(|space| {
+                let token = decode_base64(&line[..space])?;
+                let rank = std::str::from_utf8(&line[space + 1..]).ok()?;
+                Some((token, rank.trim().parse().ok()?))
+            });
+            let Some((token, rank)) = parsed else {
+                bail!("Malformed line {}", number + 1);
+            };
+            ranks.insert(token, rank);
+        }
+        if ranks.is_empty() {
+            bail!("No tokens");
+        }
+        Ok(Self { vocab, ranks })
+    }
+
+    pub fn vocab(&self) -> Vocab {
+        self.vocab
+    }
+
+    /// Number of tokens of `text`.
+    pub fn count(&self, text: &str) -> usize {
+        pieces(text, self.vocab)
+            .map(|piece| {
+                piece
+                    .as_bytes()
+                    .chunks(MAX_PIECE_BYTES)
+                    .map(|slice| self.merge(slice).len() - 1)
+                    .sum::<usize>()
+            })
+            .sum()
+    }
+
+    /// Token ids of `text`. Bytes missing from the vocabulary encode as `u32::MAX`.
+    pub fn encode(&self, text: &str) -> Vec<u32> {
+        let mut tokens = Vec::new();
+        for piece in pieces(text, self.vocab) {
+            for slice in piece.as_bytes().chunks(MAX_PIECE_BYTES) {
+                let bounds = self.merge(slice);
+                tokens.extend(
+                    bounds
+                        .windows(2)
+                        .map(|pair| self.rank(&slice[pair[0]..pair[1]])),
+                );
+            }
+        }
+        tokens
+    }
+
+    fn rank(&self, bytes: &[u8]) -> u32 {
+        self.ranks.get(bytes).copied().unwrap_or(u32::MAX)
+    }
+
+    /// Token boundaries of `piece` after merging, starting at 0 and ending at its length.
+    fn merge(&self, piece: &[u8]) -> Vec<usize> {
+        if self.ranks.contains_key(piece) {
+            return vec![0, piece.len()];
+        }
+        // (start, rank of the pair starting here), as in tiktoken's byte_pair_merge
+        let mut parts: Vec<(usize, u32)> = (0..piece.len().saturating_sub(1))
+            .map(|i| (i, self.rank(&piece[i..i + 2])))
+            .collect();
+        parts.push((piece.len().saturating_sub(1), u32::MAX));
+        parts.push((piece.len(), u32::MAX));
+
+        let pair_rank = |parts: &[(usize, u32)], i: usize| {
+            if i + 3 < parts.len() {
+                self.rank(&piece[parts[i].0..parts[i + 3].0])
+            } else {
+                u32::MAX
+            }
+        };
+        loop {
+            let Some((i, _)) = parts[..parts.len() - 1]
+                .iter()
+                .enumerate()
+                .filter(|(_, (_, rank))| *rank != u32::MAX)
+                .min_by_key(|(_, (_, rank))| *rank)
+            else {
+                break;
+            };
+            if i > 0 {
+                parts[i - 1].1 = pair_rank(&parts, i - 1);
+            }
+            parts[i].1 = pair_rank(&parts, i);
+            parts.remove(i + 1);
+        }
+        parts.into_iter().map(|(start, _)| start).collect()
+    }
+}
+
+/// Decode standard base64 (with optional padding).
+fn decode_base64(text: &[u8]) -> Option<Vec<u8>> {
+    let value = |c: u8| -> Option<u32> {
+        Some(match c {
+            b'A'..=b'Z' => c - b'A',
+            b'a'..=b'z' => c - b'a' + 26,
+            b'0'..=b'9' => c - b'0' + 52,
+            b'+' => 62,
+            b'/' => 63,
+            _ => return None,
+        } as u32)
+    };
+    let text = text
+        .strip_suffix(b"==")
+        .or_else(|| text.strip_suffix(b"="))
+        .unwrap_or(text);
+    let mut out = Vec::with_capacity(text.len() * 3 / 4);
+    for group in text.chunks(4) {
+        let mut bits = 0u32;
+        for &c in group {
+            bits = bits << 6 | value(c)?;
+        }
+        bits <<= 6 * (4 - group.len() as u32);
+        let bytes = bits.to_be_bytes();
+        match group.len() {
+            4 => out.extend_from_slice(&bytes[1..4]),
+            3 => out.extend_from_slice(&bytes[1..3]),
+            2 => out.push(bytes[1]),
+            _ => return None,
+        }
+    }
+    Some(out)
+}
+
+/// Read-only mapping of a whole file
+struct Mmap {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+impl Mmap {
+    fn open(path: &Path) -> Result<Self> {
+        let file = File::open(path)?;
+        let len = file.metadata()?.len() as usize;
+        if len == 0 {
+            bail!("Empty file");
+        }
+        let ptr = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                libc::PROT_READ,
+                libc::MAP_PRIVATE,
+                file.as_raw_fd(),
+                0,
+            )
+        };
+        if ptr == libc::MAP_FAILED {
+            return Err(std::io::Error::last_os_error().into());
+        }
+        Ok(Self { ptr, len })
+    }
+
+    fn as_slice(&self) -> &[u8] {
+        unsafe { std::slice::from_raw_parts(self.ptr as *const u8, self.len) }
+    }
+}
+
+impl Drop for Mmap {
+    fn drop(&mut self) {
+        unsafe { libc::munmap(self.ptr, self.len) };
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn base64(bytes: &[u8]) -> String {
+        const ALPHABET: &[u8] = b"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        let mut out = String::new();
+        for group in bytes.chunks(3) {
+            let mut padded = [0u8; 3];
+            padded[..group.len()].copy_from_slice(group);
+            let bits = u32::from_be_bytes([0, padded[0], padded[1], padded[2]]);
+            for i in 0..4 {
+                if i <= group.len() {
+                    out.push(ALPHABET[(bits >> (18 - 6 * i) & 63) as usize] as char);
+                } else {
+                    out.push('=');
+                }
+            }
+        }
+        out
+    }
+
+    fn tokenizer(tokens: &[&[u8]]) -> Tokenizer {
+        // Every single byte, then the merges in priority order
+        let mut ranks: Vec<Vec<u8>> = (0..=255u8).map(|b| vec![b]).collect();
+        ranks.extend(tokens.iter().map(|token| token.to_vec()));
+        let file: String = ranks
+            .iter()
+            .enumerate()
+            .map(|(rank, token)| format!("{} {}\n", base64(token), rank))
+            .collect();
+        Tokenizer::from_ranks(Vocab::Cl100k, file.as_bytes()).unwrap()
+    }
+
+    #[test]
+    fn test_merge_by_rank() {
+        let tokenizer = tokenizer(&[b"ab", b" a", b" ab", b"abab", b"bc"]);
+        let ab = tokenizer.rank(b"ab");
+        // "ab" merges before "bc", so "abc" is "ab" + "c"
+        assert_eq!(tokenizer.encode("abc"), [ab, b'c' as u32]);
+        assert_eq!(tokenizer.encode("abab"), [tokenizer.rank(b"abab")]);
+        assert_eq!(tokenizer.encode("ababab"), [tokenizer.rank(b"abab"), ab]);
+        // Pieces are merged separately: "ab", " ab", " ab"
+        assert_eq!(tokenizer.count("ab ab ab"), 3);
+        assert_eq!(tokenizer.count(""), 0);
+        assert_eq!(tokenizer.count("é"), 2);
+    }
+
+    #[test]
+    fn test_rank_file() {
+        assert_eq!(decode_base64(b"IGhlbGxv").unwrap(), b" hello");
+        assert_eq!(decode_base64(b"YQ==").unwrap(), b"a");
+        assert_eq!(decode_base64(b"YWI=").unwrap(), b"ab");
+        assert!(Tokenizer::from_ranks(Vocab::Cl100k, b"YQ== 0\nnot-base64 1\n").is_err());
+
+        let path = std::env::temp_dir().join(format!("honeybeepf-ranks-{}", std::process::id()));
+        std::fs::write(&path, "YQ== 0\nYg== 1\nYWI= 2\n").unwrap();
+        let tokenizer = Tokenizer::load(Vocab::Cl100k, &path).unwrap();
+        std::fs::remove_file(&path).unwrap();
+        assert_eq!(tokenizer.encode("ab"), [2]);
+    }
+
+    #[test]
+    fn test_vocab_for_model() {
+        assert_eq!(Vocab::for_model("gpt-4o-mini"), Vocab::O200k);
+        assert_eq!(Vocab::for_model("o3-mini"), Vocab::O200k);
+        assert_eq!(Vocab::for_model("gpt-4-turbo"), Vocab::Cl100k);
+        assert_eq!(Vocab::for_model("claude-sonnet-4"), Vocab::Cl100k);
+    }
+}
@@ -0,0 +1,310 @@
+//! Pre-tokenization: the pieces of text that BPE merges within.
+//!
+//! A hand-written equivalent of the split patterns of tiktoken's `cl100k_base` and
+//! `o200k_base`, which need look-ahead a plain regex engine does not have. ASCII is
+//! classified by table, and runs of ASCII letters and spaces (most of English text, JSON
+//! and code) are skipped eight bytes at a time.
+
+use super::Vocab;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+enum Class {
+    Upper,
+    Lower,
+    /// Letters without case (CJK, ...), matched by both halves of o200k's word pattern
+    Caseless,
+    Number,
+    /// `\r` and `\n`
+    Newline,
+    /// Whitespace other than newlines
+    Space,
+    /// Anything else: punctuation, symbols
+    Other,
+}
+
+const ASCII_CLASSES: [Class; 128] = {
+    let mut classes = [Class::Other; 128];
+    let mut b = 0;
+    while b < 128 {
+        classes[b] = match b as u8 {
+            b'A'..=b'Z' => Class::Upper,
+            b'a'..=b'z' => Class::Lower,
+            b'0'..=b'9' => Class::Number,
+            b'\r' | b'\n' => Class::Newline,
+            b' ' | b'\t' | 0x0b | 0x0c => Class::Space,
+            _ => Class::Other,
+        };
+        b += 1;
+    }
+    classes
+};
+
+const LOW_BITS: u64 = 0x0101_0101_0101_0101;
+const HIGH_BITS: u64 = 0x8080_8080_8080_8080;
+
+/// Whether all eight bytes are ASCII letters
+fn all_ascii_letters(word: u64) -> bool {
+    // Folding to lower case maps the letters onto 0x61..=0x7a, and nothing else there
+    let folded = word | (0x20 * LOW_BITS);
+    let at_least_a = folded + (0x80 - b'a' as u64) * LOW_BITS;
+    let above_z = folded + (0x80 - b'z' as u64 - 1) * LOW_BITS;
+    word & HIGH_BITS == 0 && at_least_a & !above_z & HIGH_BITS == HIGH_BITS
+}
+
+fn word_at(bytes: &[u8], at: usize) -> Option<u64> {
+    let word = bytes.get(at..at + 8)?;
+    Some(u64::from_le_bytes(word.try_into().ok()?))
+}
+
+/// Pieces of `text` under the split pattern of `vocab`
+pub fn pieces(text: &str, vocab: Vocab) -> Pieces<'_> {
+    Pieces {
+        text,
+        pos: 0,
+        vocab,
+    }
+}
+
+pub struct Pieces<'a> {
+    text: &'a str,
+    pos: usize,
+    vocab: Vocab,
+}
+
+impl<'a> Iterator for Pieces<'a> {
+    type Item = &'a str;
+
+    fn next(&mut self) -> Option<&'a str> {
+        if self.pos >= self.text.len() {
+            return None;
+        }
+        let start = self.pos;
+        self.pos = Splitter {
+            text: self.text,
+            bytes: self.text.as_bytes(),
+        }
+        .piece_end(start, self.vocab);
+        Some(&self.text[start..self.pos])
+    }
+}
+
+struct Splitter<'a> {
+    text: &'a str,
+    bytes: &'a [u8],
+}
+
+impl Splitter<'_> {
+    /// Character at byte offset `at`: its class and length
+    fn at(&self, at: usize) -> Option<(char, Class, usize)> {
+        let b = *self.bytes.get(at)?;
+        if b < 0x80 {
+            return Some((b as char, ASCII_CLASSES[b as usize], 1));
+        }
+        let c = self.text[at..].chars().next()?;
+        let class = if c.is_uppercase() {
+            Class::Upper
+        } else if c.is_lowercase() {
+            Class::Lower
+        } else if c.is_alphabetic() {
+            Class::Caseless
+        } else if c.is_numeric() {
+            Class::Number
+        } else if c.is_whitespace() {
+            Class::Space
+        } else {
+            Class::Other
+        };
+        Some((c, class, c.len_utf8()))
+    }
+
+    fn class(&self, at: usize) -> Option<Class> {
+        self.at(at).map(|(_, class, _)| class)
+    }
+
+    /// End of the run of characters from `at` whose class passes `keep`
+    fn run(&self, mut at: usize, keep: impl Fn(Class) -> bool) -> usize {
+        while let Some((_, class, len)) = self.at(at) {
+            if !keep(class) {
+                break;
+            }
+            at += len;
+        }
+        at
+    }
+
+    fn letters_end(&self, mut at: usize) -> usize {
+        while let Some(word) = word_at(self.bytes, at) {
+            if !all_ascii_letters(word) {
+                break;
+            }
+            at += 8;
+        }
+        self.run(at, is_letter)
+    }
+
+    fn spaces_end(&self, mut at: usize) -> usize {
+        while word_at(self.bytes, at) == Some(u64::from_le_bytes([b' '; 8])) {
+            at += 8;
+        }
+        self.run(at, |class| matches!(class, Class::Space | Class::Newline))
+    }
+
+    /// Length of a contraction (`'s`, `'t`, `'re`, `'ve`, `'m`, `'ll`, `'d`) at `at`
+    fn contraction(&self, at: usize) -> Option<usize> {
+        if self.bytes.get(at) != Some(&b'\'') {
+            return None;
+        }
+        let lower = |i: usize| self.bytes.get(at + i).map(u8::to_ascii_lowercase);
+        match (lower(1)?, lower(2)) {
+            (b's' | b't' | b'm' | b'd', _) => Some(2),
+            (b'r', Some(b'e')) | (b'v', Some(b'e')) | (b'l', Some(b'l')) => Some(3),
+            _ => None,
+        }
+    }
+
+    fn piece_end(&self, start: usize, vocab: Vocab) -> usize {
+        let Some((c0, class0, len0)) = self.at(start) else {
+            return self.bytes.len();
+        };
+
+        // cl100k: (?i:'s|'t|'re|'ve|'m|'ll|'d)
+        if vocab == Vocab::Cl100k
+            && let Some(len) = self.contraction(start)
+        {
+            return start + len;
+        }
+
+        // [^\r\n\p{L}\p{N}]? followed by letters
+        let word_start = if is_letter(class0) {
+            Some(start)
+        } else if !matches!(class0, Class::Newline | Class::Number)
+            && self.class(start + len0).is_some_and(is_letter)
+        {
+            Some(start + len0)
+        } else {
+            None
+        };
+        if let Some(word_start) = word_start {
+            return match vocab {
+                // \p{L}+
+                Vocab::Cl100k => self.letters_end(word_start),
+                // [\p{Lu}...]*[\p{Ll}...]+ | [\p{Lu}...]+[\p{Ll}...]*, then a contraction
+                Vocab::O200k => {
+                    let upper_end =
+                        self.run(word_start, |c| matches!(c, Class::Upper | Class::Caseless));
+                    let end = self.run(upper_end, |c| matches!(c, Class::Lower | Class::Caseless));
+                    end + self.contraction(end).unwrap_or(0)
+                }
+            };
+        }
+
+        // \p{N}{1,3}
+        if class0 == Class::Number {
+            let mut end = start + len0;
+            for _ in 0..2 {
+                match self.at(end) {
+                    Some((_, Class::Number, len)) => end += len,
+                    _ => break,
+                }
+            }
+            return end;
+        }
+
+        // ` ?[^\s\p{L}\p{N}]+[\r\n]*` (o200k also takes trailing '/')
+        let symbols_start = if c0 == ' ' && self.class(start + 1) == Some(Class::Other) {
+            start + 1
+        } else {
+            start
+        };
+        if self.class(symbols_start) == Some(Class::Other) {
+            let end = self.run(symbols_start, |class| class == Class::Other);
+            let mut end = end;
+            while let Some(&b) = self.bytes.get(end) {
+                if b == b'\r' || b == b'\n' || (b == b'/' && vocab == Vocab::O200k) {
+                    end += 1;
+                } else {
+                    break;
+                }
+            }
+            return end;
+        }
+
+        let spaces_end = self.spaces_end(start);
+        // \s*[\r\n]+
+        if let Some(newline) = self.bytes[start..spaces_end]
+            .iter()
+            .rposition(|&b| b == b'\r' || b == b'\n')
+        {
+            return start + newline + 1;
+        }
+        // \s+(?!\S): all but the last space when a word follows, which takes that one
+        if spaces_end < self.bytes.len()
+            && let Some(last) = self.text[start..spaces_end].chars().next_back()
+            && spaces_end - last.len_utf8() > start
+        {
+            return spaces_end - last.len_utf8();
+        }
+        // \s+
+        spaces_end
+    }
+}
+
+fn is_letter(class: Class) -> bool {
+    matches!(class, Class::Upper | Class::Lower | Class::Caseless)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_cl100k_pieces() {
+        let split = |text| pieces(text, Vocab::Cl100k).collect::<Vec<_>>();
+        assert_eq!(
+            split("I'm 12345 ok!!\n\n  x"),
+            ["I", "'m", " ", "123", "45", " ok", "!!\n\n", " ", " x"]
+        );
+        assert_eq!(
+            split("  fn main() {\n    println!(\"héllo wörld\");\n}"),
+            [
+                " ", " fn", " main", "()", " {\n", "   ", " println", "!(\"", "héllo", " wörld",
+                "\");\n", "}"
+            ]
+        );
+        assert_eq!(
+            split("abcdefghijKLMNOPQR stuvwxyz0"),
+            ["abcdefghijKLMNOPQR", " stuvwxyz", "0"]
+        );
+        assert_eq!(split("tail  "), ["tail", "  "]);
+    }
+
+    #[test]
+    fn test_o200k_pieces() {
+        let split = |text| pieces(text, Vocab::O200k).collect::<Vec<_>>();
+        assert_eq!(
+            split("HelloWorld HTMLParser"),
+            ["Hello", "World", " HTMLParser"]
+        );
+        assert_eq!(
+            split("we'll see http://x"),
+            ["we'll", " see", " http", "://", "x"]
+        );
+    }
+
+    #[test]
+    fn test_ascii_letter_words() {
+        assert!(all_ascii_letters(u64::from_le_bytes(*b"AbcdXYZz")));
+        for bad in [
+            *b"Abcd XYZ",
+            *b"Abcd@XYZ",
+            *b"Abcd[XYZ",
+            *b"Abcd`XYZ",
+            *b"Abcd{XYZ",
+        ] {
+            assert!(!all_ascii_letters(u64::from_le_bytes(bad)));
+        }
+        assert!(!all_ascii_letters(u64::from_le_bytes([
+            b'a', b'b', 0xc3, 0xa9, b'c', b'd', b'e', b'f'
+        ])));
+    }
+}
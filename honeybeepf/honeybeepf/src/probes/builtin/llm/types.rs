@@ -1,13 +1,81 @@
+use std::time::Duration;
+
 pub use honeybeepf_common::LlmDirection;
 use serde::Deserialize;
 use serde_json::Value;
 
+use crate::probes::builtin::llm::http::{DeltaScanner, ProtocolParser};
+
 /// Parsed usage info from an LLM response
 pub struct UsageInfo {
     pub prompt_tokens: u64,
     pub completion_tokens: u64,
     pub thoughts_tokens: Option<u64>,
+    /// Prompt tokens read from the provider's prompt cache (part of `prompt_tokens`)
+    pub cache_read_tokens: Option<u64>,
+    /// Prompt tokens written to the provider's prompt cache (part of `prompt_tokens`)
+    pub cache_write_tokens: Option<u64>,
     pub model: Option<String>,
+    /// Counted by the local tokenizer, as the response carried no usage (see `estimator`)
+    pub estimated: bool,
+}
+
+/// Routing facts of a request, extracted as it streams past (see `http::scanner`)
+#[derive(Debug, Clone, Default)]
+pub struct RequestInfo {
+    /// Provider matched by host and path
+    pub provider: Option<String>,
+    /// Requested model, from the body or the path
+    pub model: Option<String>,
+    pub stream: Option<bool>,
+    pub content_length: Option<u64>,
+    /// A HEAD request, whose response has no body
+    pub head_request: bool,
+    /// Hash of the API key the request was sent with (see `http::api_key_hash`)
+    pub api_key: Option<String>,
+    /// Body bytes seen
+    pub body_bytes: u64,
+    /// Start of the body, for prompt text extraction
+    pub prompt_sample: Vec<u8>,
+}
+
+/// Status and rate-limit headers of a response, parsed as soon as its head arrives
+#[derive(Debug, Clone, Default, PartialEq)]
+pub struct ResponseHead {
+    pub status: u16,
+    /// Requests left in the current rate-limit window
+    pub remaining_requests: Option<u64>,
+    /// Tokens left in the current rate-limit window
+    pub remaining_tokens: Option<u64>,
+    pub retry_after: Option<Duration>,
+}
+
+/// A response head together with the request it answers
+pub struct ResponseStatus {
+    pub provider: Option<String>,
+    pub api_key: Option<String>,
+    pub head: ResponseHead,
+}
+
+/// A parsed request/response exchange
+pub struct LlmCompletion {
+    pub request: RequestInfo,
+    pub usage: UsageInfo,
+    /// From the first request chunk to the parsed response
+    pub latency: Duration,
+    /// From the first streamed delta to the last
+    pub generation: Option<Duration>,
+}
+
+/// An exchange whose response ended without usage, left for the token estimator
+pub struct UnmeteredExchange {
+    pub request: RequestInfo,
+    /// The response bytes received, when kept for the tokenizer
+    pub response: Vec<u8>,
+    pub latency: Duration,
+    pub parser: Box<dyn ProtocolParser>,
+    /// Generated text seen in the response
+    pub deltas: DeltaScanner,
 }
 
 /// Lightweight struct for SSE chunk detection (only checks if usage field exists)
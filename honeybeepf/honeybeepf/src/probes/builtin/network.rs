@@ -2,10 +2,13 @@ use std::net::Ipv4Addr;
 
 use anyhow::Result;
 use aya::Ebpf;
-use honeybeepf_common::ConnectionEvent;
-use log::info;
+use honeybeepf_common::{ConnectionEvent, RingId};
+use log::{info, trace};
 
-use crate::probes::{Probe, TracepointConfig, attach_tracepoint, spawn_ringbuf_handler};
+use crate::{
+    probes::{Probe, TracepointConfig, attach_tracepoint, spawn_ringbuf_handler},
+    recorder, sink,
+};
 
 pub struct NetworkLatencyProbe;
 
@@ -21,20 +24,27 @@ impl Probe for NetworkLatencyProbe {
             },
         )?;
 
-        spawn_ringbuf_handler(bpf, "NETWORK_EVENTS", |event: ConnectionEvent| {
-            let dest_ip = Ipv4Addr::from(u32::from_be(event.dest_addr));
-            let dest_port = u16::from_be(event.dest_port);
-
-            info!(
-                "PID {} connecting to {}:{} (cgroup_id={}, ts={})",
-                event.metadata.pid,
-                dest_ip,
-                dest_port,
-                event.metadata.cgroup_id,
-                event.metadata.timestamp
-            );
-        })?;
+        spawn_ringbuf_handler(bpf, "NETWORK_EVENTS", handle_event)?;
 
         Ok(())
     }
 }
+
+/// Handle one `NETWORK_EVENTS` record.
+pub fn handle_event(event: ConnectionEvent) {
+    sink::record(RingId::Network, event.metadata.timestamp, &event);
+    recorder::record(
+        RingId::Network,
+        event.metadata.timestamp,
+        event.metadata.cgroup_id,
+        &event,
+    );
+
+    let dest_ip = Ipv4Addr::from(u32::from_be(event.dest_addr));
+    let dest_port = u16::from_be(event.dest_port);
+
+    trace!(
+        "PID {} connecting to {}:{} (cgroup_id={}, ts={})",
+        event.metadata.pid, dest_ip, dest_port, event.metadata.cgroup_id, event.metadata.timestamp
+    );
+}
@@ -0,0 +1,817 @@
+//! Per-probe BPF object loading with load-time map sizing.
+//!
+//! Every builtin probe gets its own `Ebpf` instance. Aya creates all maps of an
+//! object at load time, so maps owned by other probes are shrunk to their minimum
+//! size, while the probe's own rings and tables are sized from settings and the
+//! node's CPU count. Probes that are disabled are never loaded at all.
+//!
+//! High-volume rings are declared as `MAX_RING_SHARDS` maps (`NAME`, `NAME_1`, ...).
+//! Only the first `ring_shards` of them are sized. Block I/O shards each cover a group
+//! of CPUs; SSL shards each carry a share of the connections, so that the chunks of one
+//! connection stay in order.
+//!
+//! After load, the wakeup policy of the probe's rings is written to `RING_WAKEUP`.
+//!
+//! State tables (in-flight SSL calls, connection sequence numbers, open GPU fds, drop
+//! counters) are declared pinned. With `MAPS__PIN_DIR` set they live in
+//! `<dir>/<probe>/v<MAP_ABI_VERSION>-<max_entries>`, so the next agent adopts them on an
+//! upgrade, and a change of layout or size moves to a fresh directory. Without it the
+//! object is loaded with the pinning of its maps cleared, so no bpffs mount is needed.
+//!
+//! `load_programs` runs the verifier on the probe's programs before attach, so that the
+//! engine can do it for every enabled probe in parallel at startup.
+
+use std::path::{Path, PathBuf};
+
+use anyhow::{Context, Result};
+use aya::{Ebpf, EbpfLoader, maps::Array, programs::Program};
+use aya_log::EbpfLogger;
+use honeybeepf_common::{MAP_ABI_VERSION, MAX_RING_SHARDS, RingId, RingWakeupConfig};
+use log::{info, warn};
+
+use crate::settings::{MapSettings, WakeupSettings};
+
+/// Default ring buffer budget per CPU for tracepoint event rings.
+const DEFAULT_RINGBUF_PER_CPU_KB: u32 = 64;
+/// Default ring buffer budget per CPU for the SSL capture ring (events are ~4KB each).
+const DEFAULT_SSL_RINGBUF_PER_CPU_KB: u32 = 512;
+/// With the default per-CPU budgets, a ring (all of its shards together) never grows past
+/// the fixed size it had before load-time sizing. More is opt-in, via `MAPS__*_PER_CPU_KB`.
+const DEFAULT_RINGBUF_MAX_TOTAL: u32 = 1024 * 1024;
+const DEFAULT_SSL_RINGBUF_MAX_TOTAL: u32 = 8 * 1024 * 1024;
+/// Default capacity of per-thread / per-fd tracking tables.
+const DEFAULT_MAX_ENTRIES: u32 = 10240;
+/// Exec notifications are tiny and rare, a fixed ring is enough.
+const EXEC_RINGBUF_SIZE: u32 = 64 * 1024;
+/// Legacy `bpf_map_def` of the `maps` section: type, key_size, value_size, max_entries,
+/// map_flags, id, pinning (all u32).
+const MAP_DEF_LEN: u64 = 28;
+const MAP_DEF_PINNING_OFFSET: u64 = 24;
+/// Upper bound for any single ring buffer.
+const MAX_RINGBUF_SIZE: u32 = 256 * 1024 * 1024;
+/// Without a configured watermark, wake the consumer once a quarter of a ring shard is pending.
+const DEFAULT_WAKEUP_RING_FRACTION: u32 = 4;
+/// Longest a producer defers a wakeup while events keep arriving.
+const DEFAULT_WAKEUP_MAX_DELAY_MS: u32 = 5;
+
+/// Builtin probes that are shipped as independently loaded objects.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum ProbeKind {
+    BlockIo,
+    NetworkLatency,
+    GpuUsage,
+    Llm,
+}
+
+impl ProbeKind {
+    pub const ALL: [ProbeKind; 4] = [
+        ProbeKind::BlockIo,
+        ProbeKind::NetworkLatency,
+        ProbeKind::GpuUsage,
+        ProbeKind::Llm,
+    ];
+
+    pub fn from_name(name: &str) -> Option<Self> {
+        Self::ALL.into_iter().find(|kind| kind.name() == name)
+    }
+
+    pub fn name(&self) -> &'static str {
+        match self {
+            ProbeKind::BlockIo => "block_io",
+            ProbeKind::NetworkLatency => "network_latency",
+            ProbeKind::GpuUsage => "gpu_usage",
+            ProbeKind::Llm => "llm",
+        }
+    }
+
+    /// Programs of the object that the probe attaches
+    pub fn programs(&self) -> &'static [&'static str] {
+        match self {
+            ProbeKind::BlockIo => &["honeybeepf_block_io_start", "honeybeepf_block_io_done"],
+            ProbeKind::NetworkLatency => &["honeybeepf"],
+            ProbeKind::GpuUsage => &[
+                "honeybeepf_gpu_open_enter",
+                "honeybeepf_gpu_open_exit",
+                "honeybeepf_gpu_close",
+            ],
+            ProbeKind::Llm => &[
+                "probe_ssl_rw_enter",
+                "probe_ssl_read_exit",
+                "probe_ssl_write_exit",
+                "probe_ssl_do_handshake_enter",
+                "probe_ssl_do_handshake_exit",
+                "probe_ssl_rw_ex_enter",
+                "probe_ssl_read_ex_exit",
+                "probe_ssl_write_ex_exit",
+                "probe_exec",
+            ],
+        }
+    }
+}
+
+#[derive(Clone, Copy)]
+enum MapKind {
+    /// Generic tracepoint event ring
+    EventRing,
+    /// Large SSL payload ring
+    SslRing,
+    /// Exec notification ring
+    ExecRing,
+    /// Hash map keyed by thread / fd
+    Table,
+}
+
+struct MapSpec {
+    name: &'static str,
+    owner: ProbeKind,
+    kind: MapKind,
+    /// Declared as `MAX_RING_SHARDS` per-CPU-group rings
+    sharded: bool,
+    /// Index of the ring in `RING_WAKEUP` (rings only)
+    ring: Option<RingId>,
+}
+
+/// All sizeable maps in the eBPF object and the probe that owns them.
+/// New probes must register their maps here, otherwise they keep their compile-time size.
+const MAP_SPECS: &[MapSpec] = &[
+    MapSpec {
+        name: "BLOCK_IO_EVENTS",
+        owner: ProbeKind::BlockIo,
+        kind: MapKind::EventRing,
+        sharded: true,
+        ring: Some(RingId::BlockIo),
+    },
+    MapSpec {
+        name: "NETWORK_EVENTS",
+        owner: ProbeKind::NetworkLatency,
+        kind: MapKind::EventRing,
+        sharded: false,
+        ring: Some(RingId::Network),
+    },
+    MapSpec {
+        name: "GPU_OPEN_EVENTS",
+        owner: ProbeKind::GpuUsage,
+        kind: MapKind::EventRing,
+        sharded: false,
+        ring: Some(RingId::GpuOpen),
+    },
+    MapSpec {
+        name: "GPU_CLOSE_EVENTS",
+        owner: ProbeKind::GpuUsage,
+        kind: MapKind::EventRing,
+        sharded: false,
+        ring: Some(RingId::GpuClose),
+    },
+    MapSpec {
+        name: "PENDING_GPU_OPENS",
+        owner: ProbeKind::GpuUsage,
+        kind: MapKind::Table,
+        sharded: false,
+        ring: None,
+    },
+    MapSpec {
+        name: "GPU_FD_MAP",
+        owner: ProbeKind::GpuUsage,
+        kind: MapKind::Table,
+        sharded: false,
+        ring: None,
+    },
+    MapSpec {
+        name: "SSL_EVENTS",
+        owner: ProbeKind::Llm,
+        kind: MapKind::SslRing,
+        sharded: true,
+        ring: Some(RingId::Ssl),
+    },
+    MapSpec {
+        name: "START_NS",
+        owner: ProbeKind::Llm,
+        kind: MapKind::Table,
+        sharded: false,
+        ring: None,
+    },
+    MapSpec {
+        name: "BUFS",
+        owner: ProbeKind::Llm,
+        kind: MapKind::Table,
+        sharded: false,
+        ring: None,
+    },
+    MapSpec {
+        name: "READBYTES_PTRS",
+        owner: ProbeKind::Llm,
+        kind: MapKind::Table,
+        sharded: false,
+        ring: None,
+    },
+    MapSpec {
+        name: "SSL_CONNS",
+        owner: ProbeKind::Llm,
+        kind: MapKind::Table,
+        sharded: false,
+        ring: None,
+    },
+    MapSpec {
+        name: "CONN_SEQ",
+        owner: ProbeKind::Llm,
+        kind: MapKind::Table,
+        sharded: false,
+        ring: None,
+    },
+    MapSpec {
+        name: "CONN_VERDICT",
+        owner: ProbeKind::Llm,
+        kind: MapKind::Table,
+        sharded: false,
+        ring: None,
+    },
+    MapSpec {
+        name: "EXEC_EVENTS",
+        owner: ProbeKind::Llm,
+        kind: MapKind::ExecRing,
+        sharded: false,
+        ring: Some(RingId::Exec),
+    },
+];
+
+/// Resolved map sizes for this node.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct MapLimits {
+    /// Size of unsharded event rings (cover every CPU)
+    pub event_ringbuf_size: u32,
+    /// Size of each active shard of a sharded event ring
+    pub event_shard_size: u32,
+    /// Size of each active shard of the SSL ring
+    pub ssl_shard_size: u32,
+    /// Number of active shards for sharded rings
+    pub ring_shards: u32,
+    pub max_entries: u32,
+    /// Smallest valid ring buffer (one page), used for maps of other probes
+    pub min_ringbuf_size: u32,
+}
+
+impl MapLimits {
+    pub fn new(settings: &MapSettings, nr_cpus: usize, page_size: u32) -> Self {
+        let nr_cpus = nr_cpus.max(1);
+        let (event_per_cpu, event_total) = match settings.ringbuf_per_cpu_kb {
+            Some(kb) => (kb, None),
+            None => (DEFAULT_RINGBUF_PER_CPU_KB, Some(DEFAULT_RINGBUF_MAX_TOTAL)),
+        };
+        let (ssl_per_cpu, ssl_total) = match settings.ssl_ringbuf_per_cpu_kb {
+            Some(kb) => (kb, None),
+            None => (
+                DEFAULT_SSL_RINGBUF_PER_CPU_KB,
+                Some(DEFAULT_SSL_RINGBUF_MAX_TOTAL),
+            ),
+        };
+        let ring_shards = settings
+            .ringbuf_shards
+            .unwrap_or(1)
+            .clamp(1, MAX_RING_SHARDS.min(nr_cpus as u32));
+        let cpus_per_shard = nr_cpus.div_ceil(ring_shards as usize);
+        let shard_size = |per_cpu_kb, total: Option<u32>, shards: u32| {
+            let cpus = if shards > 1 { cpus_per_shard } else { nr_cpus };
+            let size = ringbuf_size(per_cpu_kb, cpus, page_size);
+            match total {
+                Some(total) => size.min(ringbuf_share(total, shards, page_size)),
+                None => size,
+            }
+        };
+
+        Self {
+            event_ringbuf_size: shard_size(event_per_cpu, event_total, 1),
+            event_shard_size: shard_size(event_per_cpu, event_total, ring_shards),
+            ssl_shard_size: shard_size(ssl_per_cpu, ssl_total, ring_shards),
+            ring_shards,
+            max_entries: settings.max_entries.unwrap_or(DEFAULT_MAX_ENTRIES).max(1),
+            min_ringbuf_size: page_size,
+        }
+    }
+
+    /// Detect CPU count and page size of the running node.
+    pub fn detect(settings: &MapSettings) -> Self {
+        let nr_cpus = aya::util::nr_cpus().unwrap_or_else(|(msg, e)| {
+            warn!("Failed to read possible CPUs ({}: {}), assuming 1", msg, e);
+            1
+        });
+        let page_size = match unsafe { libc::sysconf(libc::_SC_PAGESIZE) } {
+            n if n > 0 => n as u32,
+            _ => 4096,
+        };
+        let limits = Self::new(settings, nr_cpus, page_size);
+        info!(
+            "Map sizing: {} CPUs, event ring {}KB, {} shard(s) of {}KB (SSL {}KB), max_entries {}",
+            nr_cpus,
+            limits.event_ringbuf_size / 1024,
+            limits.ring_shards,
+            limits.event_shard_size / 1024,
+            limits.ssl_shard_size / 1024,
+            limits.max_entries
+        );
+        limits
+    }
+
+    fn size_for(&self, spec: &MapSpec, probe: ProbeKind, shard: u32) -> u32 {
+        let active = spec.owner == probe && shard < self.ring_shards.max(1);
+        match spec.kind {
+            MapKind::EventRing if active && spec.sharded => self.event_shard_size,
+            MapKind::EventRing if active => self.event_ringbuf_size,
+            MapKind::SslRing if active => self.ssl_shard_size,
+            MapKind::ExecRing if active => EXEC_RINGBUF_SIZE.max(self.min_ringbuf_size),
+            MapKind::Table if active => self.max_entries,
+            MapKind::EventRing | MapKind::SslRing | MapKind::ExecRing => self.min_ringbuf_size,
+            MapKind::Table => 1,
+        }
+    }
+}
+
+/// Wakeup policy for a ring of `ring_size` bytes. The watermark is capped at half the
+/// ring so that the consumer is always woken well before producers start dropping.
+fn wakeup_config(
+    ring_size: u32,
+    watermark_kb: Option<u32>,
+    max_delay_ms: Option<u32>,
+) -> RingWakeupConfig {
+    let watermark = match watermark_kb {
+        Some(kb) => kb as u64 * 1024,
+        None => (ring_size / DEFAULT_WAKEUP_RING_FRACTION) as u64,
+    };
+    RingWakeupConfig {
+        watermark_bytes: watermark.min(ring_size as u64 / 2),
+        max_delay_ns: max_delay_ms.unwrap_or(DEFAULT_WAKEUP_MAX_DELAY_MS) as u64 * 1_000_000,
+    }
+}
+
+fn watermark_kb(settings: &WakeupSettings, probe: ProbeKind) -> Option<u32> {
+    match probe {
+        ProbeKind::BlockIo => settings.block_io_watermark_kb,
+        ProbeKind::NetworkLatency => settings.network_latency_watermark_kb,
+        ProbeKind::GpuUsage => settings.gpu_usage_watermark_kb,
+        ProbeKind::Llm => settings.llm_watermark_kb,
+    }
+}
+
+/// Write the wakeup policy of every ring owned by `probe` into its `RING_WAKEUP` map.
+pub fn configure_wakeup(
+    bpf: &mut Ebpf,
+    probe: ProbeKind,
+    limits: &MapLimits,
+    settings: &WakeupSettings,
+) -> Result<()> {
+    let mut wakeup: Array<_, RingWakeupConfig> = Array::try_from(
+        bpf.map_mut("RING_WAKEUP")
+            .context("Failed to get RING_WAKEUP map")?,
+    )?;
+    for spec in MAP_SPECS.iter().filter(|s| s.owner == probe) {
+        let Some(ring) = spec.ring else {
+            continue;
+        };
+        let config = wakeup_config(
+            limits.size_for(spec, probe, 0),
+            watermark_kb(settings, probe),
+            settings.max_delay_ms,
+        );
+        wakeup.set(ring as u32, config, 0)?;
+    }
+    Ok(())
+}
+
+/// Keep 1 in `keep_one_in` events of `ring` in the kernel (1 keeps everything).
+pub fn set_ring_sampling(bpf: &mut Ebpf, ring: RingId, keep_one_in: u32) -> Result<()> {
+    let mut sample: Array<_, u32> = Array::try_from(
+        bpf.map_mut("RING_SAMPLE")
+            .context("Failed to get RING_SAMPLE map")?,
+    )?;
+    sample.set(ring as u32, keep_one_in.max(1), 0)?;
+    Ok(())
+}
+
+/// Probe that produces the events of `ring`
+pub fn owner_of_ring(ring: RingId) -> Option<ProbeKind> {
+    Some(MAP_SPECS.iter().find(|s| s.ring == Some(ring))?.owner)
+}
+
+/// Probe whose object declares the map `name`
+pub fn owner_of_map(name: &str) -> Option<ProbeKind> {
+    Some(MAP_SPECS.iter().find(|s| s.name == name)?.owner)
+}
+
+/// `RingId` of the event ring map `name`, if it is one.
+pub fn ring_of_map(name: &str) -> Option<RingId> {
+    MAP_SPECS.iter().find(|s| s.name == name)?.ring
+}
+
+/// Name of the `shard`-th map of a sharded ring (`NAME`, `NAME_1`, `NAME_2`, ...).
+pub fn shard_map_name(base: &str, shard: u32) -> String {
+    if shard == 0 {
+        base.to_string()
+    } else {
+        format!("{}_{}", base, shard)
+    }
+}
+
+/// Ring buffer size must be a power of two and a multiple of the page size.
+fn ringbuf_size(per_cpu_kb: u32, nr_cpus: usize, page_size: u32) -> u32 {
+    let wanted = (per_cpu_kb as u64 * 1024).saturating_mul(nr_cpus.max(1) as u64);
+    let rounded = wanted.max(page_size as u64).next_power_of_two();
+    rounded.min(MAX_RINGBUF_SIZE as u64) as u32
+}
+
+/// Largest ring buffer size that keeps `shards` of them within `total` bytes.
+fn ringbuf_share(total: u32, shards: u32, page_size: u32) -> u32 {
+    let share = (total / shards.max(1)).max(page_size);
+    if share.is_power_of_two() {
+        share
+    } else {
+        share.next_power_of_two() / 2
+    }
+}
+
+/// Directory that holds the pinned tables of `probe` under `root`.
+pub fn pin_dir(root: &Path, probe: ProbeKind, limits: &MapLimits) -> PathBuf {
+    root.join(probe.name())
+        .join(format!("v{}-{}", MAP_ABI_VERSION, limits.max_entries))
+}
+
+/// Remove the pins of other layout versions. Agents still using them keep their maps.
+fn remove_stale_pins(current: &Path) {
+    let Some(Ok(entries)) = current.parent().map(std::fs::read_dir) else {
+        return;
+    };
+    for entry in entries.flatten() {
+        let path = entry.path();
+        if path != current {
+            match std::fs::remove_dir_all(&path) {
+                Ok(()) => info!("Removed stale pinned maps {}", path.display()),
+                Err(e) => warn!("Failed to remove stale pins {}: {}", path.display(), e),
+            }
+        }
+    }
+}
+
+/// Load the eBPF object of `probe` with its maps sized from `limits`. With `pin_root`, state
+/// tables pinned there by a previous agent are adopted instead of created.
+pub fn load_probe_object(
+    bytecode: &[u8],
+    probe: ProbeKind,
+    limits: &MapLimits,
+    pin_root: Option<&Path>,
+) -> Result<Ebpf> {
+    let sizes: Vec<(String, u32)> = MAP_SPECS
+        .iter()
+        .flat_map(|spec| {
+            let shards = if spec.sharded { MAX_RING_SHARDS } else { 1 };
+            (0..shards).map(move |shard| {
+                (
+                    shard_map_name(spec.name, shard),
+                    limits.size_for(spec, probe, shard),
+                )
+            })
+        })
+        .collect();
+
+    let mut loader = EbpfLoader::new();
+    for (name, size) in &sizes {
+        loader.set_max_entries(name, *size);
+    }
+    loader.set_global("RING_SHARDS", &limits.ring_shards, true);
+
+    let mut bpf = match pin_root {
+        Some(root) => {
+            let pin_path = pin_dir(root, probe, limits);
+            std::fs::create_dir_all(&pin_path).with_context(|| {
+                format!(
+                    "Failed to create pin directory {} (is bpffs mounted?)",
+                    pin_path.display()
+                )
+            })?;
+            let adopted = std::fs::read_dir(&pin_path).is_ok_and(|mut d| d.next().is_some());
+            loader.map_pin_path(&pin_path);
+            let bpf = loader
+                .load(bytecode)
+                .with_context(|| format!("Failed to load eBPF object for {}", probe.name()))?;
+            if adopted {
+                info!(
+                    "{}: adopted pinned maps from {}",
+                    probe.name(),
+                    pin_path.display()
+                );
+            }
+            remove_stale_pins(&pin_path);
+            bpf
+        }
+        None => {
+            let object = without_pinning(bytecode)?;
+            loader
+                .load(object.bytes())
+                .with_context(|| format!("Failed to load eBPF object for {}", probe.name()))?
+        }
+    };
+    if let Err(e) = EbpfLogger::init(&mut bpf) {
+        warn!(
+            "Failed to initialize eBPF logger for {}: {}",
+            probe.name(),
+            e
+        );
+    }
+    Ok(bpf)
+}
+
+/// Object bytes kept 8-byte aligned for the ELF parser, like `include_bytes_aligned!` does.
+struct AlignedObject {
+    words: Vec<u64>,
+    len: usize,
+}
+
+impl AlignedObject {
+    fn new(bytes: &[u8]) -> Self {
+        let mut object = Self {
+            words: vec![0; bytes.len().div_ceil(8)],
+            len: bytes.len(),
+        };
+        object.bytes_mut().copy_from_slice(bytes);
+        object
+    }
+
+    fn bytes(&self) -> &[u8] {
+        // SAFETY: `words` holds at least `len` initialized bytes
+        unsafe { std::slice::from_raw_parts(self.words.as_ptr().cast(), self.len) }
+    }
+
+    fn bytes_mut(&mut self) -> &mut [u8] {
+        // SAFETY: as above, and the borrow is exclusive
+        unsafe { std::slice::from_raw_parts_mut(self.words.as_mut_ptr().cast(), self.len) }
+    }
+}
+
+/// Copy of `bytecode` with the pinning of every map in its `maps` section cleared. Aya pins
+/// maps declared `pinned` at load time, which needs bpffs even when nothing should outlive
+/// the agent.
+fn without_pinning(bytecode: &[u8]) -> Result<AlignedObject> {
+    use object::{Object, ObjectSection, ObjectSymbol};
+
+    let mut object = AlignedObject::new(bytecode);
+    let pinning: Vec<usize> = {
+        let file = object::File::parse(object.bytes()).context("Failed to parse eBPF object")?;
+        let Some(maps) = file.section_by_name("maps") else {
+            return Ok(object);
+        };
+        let Some((start, size)) = maps.file_range() else {
+            return Ok(object);
+        };
+        file.symbols()
+            .filter(|symbol| {
+                symbol.section_index() == Some(maps.index()) && symbol.size() >= MAP_DEF_LEN
+            })
+            .filter_map(|symbol| {
+                let offset = symbol.address().checked_sub(maps.address())?;
+                (offset + MAP_DEF_LEN <= size)
+                    .then(|| (start + offset + MAP_DEF_PINNING_OFFSET) as usize)
+            })
+            .collect()
+    };
+    let bytes = object.bytes_mut();
+    for at in pinning {
+        bytes[at..at + 4].fill(0);
+    }
+    Ok(object)
+}
+
+/// Load the probe's programs into the kernel (verify them) without attaching. Returns how
+/// many were loaded. A program that fails is left unloaded, and attaching it reports the
+/// error as before.
+pub fn load_programs(bpf: &mut Ebpf, probe: ProbeKind) -> usize {
+    let mut loaded = 0;
+    for &name in probe.programs() {
+        let result = match bpf.program_mut(name) {
+            Some(Program::TracePoint(program)) if program.fd().is_err() => program.load(),
+            Some(Program::UProbe(program)) if program.fd().is_err() => program.load(),
+            _ => continue,
+        };
+        match result {
+            Ok(()) => loaded += 1,
+            Err(e) => warn!("{}: failed to load program {}: {}", probe.name(), name, e),
+        }
+    }
+    loaded
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn spec(name: &str) -> &'static MapSpec {
+        MAP_SPECS.iter().find(|s| s.name == name).unwrap()
+    }
+
+    #[test]
+    fn test_ringbuf_scales_with_cpus() {
+        let settings = MapSettings::default();
+        let small = MapLimits::new(&settings, 2, 4096);
+        let large = MapLimits::new(&settings, 128, 4096);
+
+        assert_eq!(small.event_ringbuf_size, 128 * 1024);
+        assert_eq!(small.ssl_shard_size, 1024 * 1024);
+        // Capped at the fixed sizes of old unless asked for
+        assert_eq!(large.event_ringbuf_size, 1024 * 1024);
+        assert_eq!(large.ssl_shard_size, 8 * 1024 * 1024);
+
+        let settings = MapSettings {
+            ringbuf_per_cpu_kb: Some(64),
+            ssl_ringbuf_per_cpu_kb: Some(512),
+            ..Default::default()
+        };
+        let large = MapLimits::new(&settings, 128, 4096);
+        assert_eq!(large.event_ringbuf_size, 8 * 1024 * 1024);
+        assert_eq!(large.ssl_shard_size, 64 * 1024 * 1024);
+    }
+
+    #[test]
+    fn test_ringbuf_size_bounds() {
+        assert_eq!(ringbuf_size(0, 4, 4096), 4096);
+        assert_eq!(ringbuf_size(3, 1, 4096), 4096);
+        assert_eq!(ringbuf_size(5, 1, 4096), 8192);
+        assert_eq!(ringbuf_size(u32::MAX, 1024, 4096), MAX_RINGBUF_SIZE);
+        assert_eq!(ringbuf_size(1, 1, 65536), 65536);
+    }
+
+    #[test]
+    fn test_foreign_maps_are_minimal() {
+        let limits = MapLimits::new(&MapSettings::default(), 16, 4096);
+        let ssl = spec("SSL_EVENTS");
+        let gpu_fds = spec("GPU_FD_MAP");
+
+        assert_eq!(limits.size_for(ssl, ProbeKind::BlockIo, 0), 4096);
+        assert_eq!(limits.size_for(ssl, ProbeKind::Llm, 0), 8 * 1024 * 1024);
+        assert_eq!(limits.size_for(gpu_fds, ProbeKind::Llm, 0), 1);
+        assert_eq!(limits.size_for(gpu_fds, ProbeKind::GpuUsage, 0), 10240);
+    }
+
+    #[test]
+    fn test_pin_dir_is_versioned() {
+        let limits = MapLimits::new(&MapSettings::default(), 4, 4096);
+        assert_eq!(
+            pin_dir(Path::new("/sys/fs/bpf/honeybeepf"), ProbeKind::Llm, &limits),
+            Path::new(&format!(
+                "/sys/fs/bpf/honeybeepf/llm/v{}-10240",
+                MAP_ABI_VERSION
+            ))
+        );
+    }
+
+    /// Relocatable BPF ELF with two pinned map definitions in its `maps` section
+    fn object_with_pinned_maps() -> Vec<u8> {
+        fn map_def(pinning: u32) -> Vec<u8> {
+            [2, 4, 8, 16, 0, 0, pinning]
+                .iter()
+                .flat_map(|v: &u32| v.to_le_bytes())
+                .collect()
+        }
+        fn symbol(name: u32, value: u64) -> Vec<u8> {
+            let mut sym = name.to_le_bytes().to_vec();
+            // STB_GLOBAL | STT_OBJECT, in section 1
+            sym.extend_from_slice(&[0x11, 0, 1, 0]);
+            sym.extend_from_slice(&value.to_le_bytes());
+            sym.extend_from_slice(&MAP_DEF_LEN.to_le_bytes());
+            sym
+        }
+        fn section(
+            name: u32,
+            kind: u32,
+            offset: usize,
+            size: usize,
+            link: u32,
+            info: u32,
+            entsize: u64,
+        ) -> Vec<u8> {
+            let mut shdr = name.to_le_bytes().to_vec();
+            shdr.extend_from_slice(&kind.to_le_bytes());
+            shdr.extend_from_slice(&[0; 16]); // flags, addr
+            shdr.extend_from_slice(&(offset as u64).to_le_bytes());
+            shdr.extend_from_slice(&(size as u64).to_le_bytes());
+            shdr.extend_from_slice(&link.to_le_bytes());
+            shdr.extend_from_slice(&info.to_le_bytes());
+            shdr.extend_from_slice(&8u64.to_le_bytes());
+            shdr.extend_from_slice(&entsize.to_le_bytes());
+            shdr
+        }
+
+        let maps = [map_def(1), map_def(1)].concat();
+        let strtab = b"\0RING\0TABLE\0".to_vec();
+        let shstrtab = b"\0maps\0.symtab\0.strtab\0.shstrtab\0".to_vec();
+        let symtab = [vec![0; 24], symbol(1, 0), symbol(6, MAP_DEF_LEN)].concat();
+
+        let mut data = vec![0u8; 64];
+        let mut place = |bytes: &[u8]| {
+            data.resize(data.len().next_multiple_of(8), 0);
+            data.extend_from_slice(bytes);
+            data.len() - bytes.len()
+        };
+        let maps_at = place(&maps);
+        let strtab_at = place(&strtab);
+        let shstrtab_at = place(&shstrtab);
+        let symtab_at = place(&symtab);
+        let headers = [
+            vec![0; 64],
+            section(1, 1, maps_at, maps.len(), 0, 0, 0),
+            section(6, 2, symtab_at, symtab.len(), 3, 1, 24),
+            section(14, 3, strtab_at, strtab.len(), 0, 0, 0),
+            section(22, 3, shstrtab_at, shstrtab.len(), 0, 0, 0),
+        ]
+        .concat();
+        let shoff = place(&headers);
+
+        let header = &mut data[..64];
+        header[..7].copy_from_slice(&[0x7f, b'E', b'L', b'F', 2, 1, 1]);
+        header[16..18].copy_from_slice(&1u16.to_le_bytes()); // ET_REL
+        header[18..20].copy_from_slice(&247u16.to_le_bytes()); // EM_BPF
+        header[20..24].copy_from_slice(&1u32.to_le_bytes());
+        header[40..48].copy_from_slice(&(shoff as u64).to_le_bytes());
+        header[52..54].copy_from_slice(&64u16.to_le_bytes());
+        header[58..60].copy_from_slice(&64u16.to_le_bytes());
+        header[60..62].copy_from_slice(&5u16.to_le_bytes());
+        header[62..64].copy_from_slice(&4u16.to_le_bytes());
+        data
+    }
+
+    #[test]
+    fn test_without_pinning() {
+        let bytecode = object_with_pinned_maps();
+        let maps_at = 64;
+        let pinning = |bytes: &[u8], map: usize| {
+            let at = maps_at + map * MAP_DEF_LEN as usize + MAP_DEF_PINNING_OFFSET as usize;
+            u32::from_le_bytes(bytes[at..at + 4].try_into().unwrap())
+        };
+        assert_eq!(pinning(&bytecode, 1), 1);
+
+        let object = without_pinning(&bytecode).unwrap();
+        let patched = object.bytes();
+        assert_eq!(patched.as_ptr() as usize % 8, 0);
+        assert_eq!((pinning(patched, 0), pinning(patched, 1)), (0, 0));
+        // Everything else is untouched
+        let at = maps_at + MAP_DEF_PINNING_OFFSET as usize;
+        assert_eq!(patched[..at], bytecode[..at]);
+        assert_eq!(patched[at + 4..at + 28], bytecode[at + 4..at + 28]);
+
+        assert!(without_pinning(b"not an object").is_err());
+    }
+
+    #[test]
+    fn test_sharded_rings() {
+        let settings = MapSettings {
+            ringbuf_shards: Some(4),
+            ..Default::default()
+        };
+        let limits = MapLimits::new(&settings, 128, 4096);
+        let ssl = spec("SSL_EVENTS");
+
+        assert_eq!(limits.ring_shards, 4);
+        // The default total is split between the shards
+        assert_eq!(limits.size_for(ssl, ProbeKind::Llm, 3), 2 * 1024 * 1024);
+        assert_eq!(limits.size_for(ssl, ProbeKind::Llm, 4), 4096);
+        let three = MapSettings {
+            ringbuf_shards: Some(3),
+            ..Default::default()
+        };
+        assert_eq!(
+            MapLimits::new(&three, 128, 4096).ssl_shard_size,
+            2 * 1024 * 1024
+        );
+        // 32 CPUs per shard * 512KB when asked for
+        let scaled = MapSettings {
+            ssl_ringbuf_per_cpu_kb: Some(512),
+            ..settings.clone()
+        };
+        let limits = MapLimits::new(&scaled, 128, 4096);
+        assert_eq!(limits.size_for(ssl, ProbeKind::Llm, 3), 16 * 1024 * 1024);
+        assert_eq!(shard_map_name("SSL_EVENTS", 0), "SSL_EVENTS");
+        assert_eq!(shard_map_name("SSL_EVENTS", 3), "SSL_EVENTS_3");
+
+        // Never more shards than CPUs
+        let tiny = MapLimits::new(&settings, 2, 4096);
+        assert_eq!(tiny.ring_shards, 2);
+    }
+
+    #[test]
+    fn test_wakeup_watermark() {
+        let default = wakeup_config(1024 * 1024, None, None);
+        assert_eq!(default.watermark_bytes, 256 * 1024);
+        assert_eq!(default.max_delay_ns, 5_000_000);
+
+        // Explicit watermark, capped at half the ring
+        assert_eq!(
+            wakeup_config(1024 * 1024, Some(64), None).watermark_bytes,
+            64 * 1024
+        );
+        assert_eq!(
+            wakeup_config(1024 * 1024, Some(4096), None).watermark_bytes,
+            512 * 1024
+        );
+
+        // Zero disables batching
+        assert_eq!(
+            wakeup_config(1024 * 1024, Some(0), Some(1)).watermark_bytes,
+            0
+        );
+    }
+}
@@ -1,16 +1,26 @@
 use std::{
+    collections::{HashMap, HashSet},
+    io,
+    os::fd::{AsFd, AsRawFd, FromRawFd, OwnedFd, RawFd},
     path::Path,
     sync::{
-        Arc,
-        atomic::{AtomicBool, Ordering},
+        Arc, Mutex, RwLock,
+        atomic::{AtomicBool, AtomicU64, Ordering},
     },
-    time::Duration,
+    time::{Duration, Instant},
 };
 
 use anyhow::{Context, Result};
-use aya::{Ebpf, maps::RingBuf, programs::TracePoint};
+use aya::{
+    Ebpf,
+    maps::{MapData, PerCpuArray, RingBuf},
+    programs::TracePoint,
+};
+use honeybeepf_common::{EventMetadata, MAX_RING_SHARDS, RING_COUNT, RingId};
 use log::{info, warn};
 
+use crate::{probes::loader::ProbeKind, sink, telemetry};
+
 static SHUTDOWN: once_cell::sync::Lazy<Arc<AtomicBool>> =
     once_cell::sync::Lazy::new(|| Arc::new(AtomicBool::new(false)));
 
@@ -22,8 +32,97 @@ pub fn request_shutdown() {
     SHUTDOWN.store(true, Ordering::Relaxed);
 }
 
+/// Consumer tasks of one attached builtin probe
+#[derive(Default)]
+struct ProbeTasks {
+    stop: Arc<AtomicBool>,
+    handles: Vec<tokio::task::JoinHandle<()>>,
+}
+
+static PROBE_TASKS: Mutex<Option<HashMap<ProbeKind, ProbeTasks>>> = Mutex::new(None);
+
+/// Stop flag shared by the consumers of `kind`; never set for maps without an owner.
+fn probe_stop_flag(kind: Option<ProbeKind>) -> Arc<AtomicBool> {
+    let Some(kind) = kind else {
+        return Arc::new(AtomicBool::new(false));
+    };
+    let mut tasks = PROBE_TASKS.lock().unwrap_or_else(|e| e.into_inner());
+    tasks
+        .get_or_insert_with(HashMap::new)
+        .entry(kind)
+        .or_default()
+        .stop
+        .clone()
+}
+
+fn register_probe_task(kind: Option<ProbeKind>, handle: tokio::task::JoinHandle<()>) {
+    if let Some(kind) = kind {
+        let mut tasks = PROBE_TASKS.lock().unwrap_or_else(|e| e.into_inner());
+        tasks
+            .get_or_insert_with(HashMap::new)
+            .entry(kind)
+            .or_default()
+            .handles
+            .push(handle);
+    }
+}
+
+/// Stop the ring consumers of `kind` and wait until they have released their maps.
+/// The probe's next attach starts with fresh consumers.
+pub async fn stop_probe_tasks(kind: ProbeKind) {
+    let tasks = PROBE_TASKS
+        .lock()
+        .unwrap_or_else(|e| e.into_inner())
+        .as_mut()
+        .and_then(|tasks| tasks.remove(&kind));
+    if let Some(tasks) = tasks {
+        tasks.stop.store(true, Ordering::Relaxed);
+        for handle in tasks.handles {
+            let _ = handle.await;
+        }
+    }
+}
+
+static CGROUP_FILTER_ON: AtomicBool = AtomicBool::new(false);
+static CGROUP_FILTER: RwLock<Option<HashSet<u64>>> = RwLock::new(None);
+
+/// Only hand events of these cgroups to the handlers (`None` passes everything).
+/// Exec notifications are never filtered, as they drive SSL library discovery.
+pub fn set_cgroup_filter(cgroups: Option<HashSet<u64>>) {
+    let on = cgroups.is_some();
+    *CGROUP_FILTER.write().unwrap_or_else(|e| e.into_inner()) = cgroups;
+    CGROUP_FILTER_ON.store(on, Ordering::Relaxed);
+}
+
+pub fn cgroup_filter() -> Option<Vec<u64>> {
+    let filter = CGROUP_FILTER.read().unwrap_or_else(|e| e.into_inner());
+    filter.as_ref().map(|cgroups| {
+        let mut cgroups: Vec<u64> = cgroups.iter().copied().collect();
+        cgroups.sort_unstable();
+        cgroups
+    })
+}
+
+#[inline]
+fn passes_cgroup_filter(ring: Option<RingId>, item: &[u8]) -> bool {
+    if !CGROUP_FILTER_ON.load(Ordering::Relaxed) || ring == Some(RingId::Exec) {
+        return true;
+    }
+    let Some(metadata) = capture::decode_event::<EventMetadata>(item) else {
+        return true;
+    };
+    CGROUP_FILTER
+        .read()
+        .unwrap_or_else(|e| e.into_inner())
+        .as_ref()
+        .is_none_or(|cgroups| cgroups.contains(&metadata.cgroup_id))
+}
+
 pub mod builtin;
+pub mod capture;
 pub mod custom;
+pub mod loader;
+pub mod test_run;
 
 pub trait Probe {
     fn attach(&self, bpf: &mut Ebpf) -> Result<()>;
@@ -36,6 +135,11 @@ pub struct TracepointConfig<'a> {
 }
 
 pub const POLL_INTERVAL_MS: u64 = 10;
+const DROP_REPORT_INTERVAL_SECS: u64 = 10;
+/// How often the drop monitor checks for shutdown or detach between reports
+const DROP_MONITOR_TICK_MS: u64 = 100;
+/// How often consumer wakeup counts are flushed to telemetry.
+const WAKEUP_REPORT_INTERVAL_SECS: u64 = 1;
 
 fn tracepoint_exists(category: &str, name: &str) -> bool {
     const TRACEFS_MOUNT_POINTS: [&str; 2] = ["/sys/kernel/tracing", "/sys/kernel/debug/tracing"];
@@ -58,40 +162,202 @@ pub fn attach_tracepoint(bpf: &mut Ebpf, config: TracepointConfig) -> Result<boo
         return Ok(false);
     }
 
-    info!("Loading program {}", config.program_name);
+    info!("Attaching program {}", config.program_name);
     let program: &mut TracePoint = bpf
         .program_mut(config.program_name)
         .with_context(|| format!("Failed to find {} program", config.program_name))?
         .try_into()?;
-    program.load()?;
+    // Usually loaded already, see `loader::load_programs`
+    if program.fd().is_err() {
+        program.load()?;
+    }
     program
         .attach(config.category, config.name)
         .with_context(|| format!("Failed to attach {}", config.name))?;
     Ok(true)
 }
 
+/// Drain a ring buffer (and all of its CPU shards, if any) on a blocking thread.
+/// The consumer sleeps in `epoll_wait` on every shard instead of polling.
+/// Raw records are also written to the active capture file, if any (see `capture`).
+/// The consumer runs until shutdown or until the owning probe is detached.
 pub fn spawn_ringbuf_handler<T, F>(bpf: &mut Ebpf, map_name: &str, handler: F) -> Result<()>
 where
     T: Copy + Send + 'static,
     F: Fn(T) + Send + 'static,
 {
-    let mut ring_buf = RingBuf::try_from(bpf.take_map(map_name).context("Failed to get map")?)?;
+    let mut rings = Vec::new();
+    for shard in 0..MAX_RING_SHARDS {
+        let name = loader::shard_map_name(map_name, shard);
+        let Some(map) = bpf.take_map(&name) else {
+            break;
+        };
+        rings.push(RingBuf::try_from(map)?);
+    }
+    if rings.is_empty() {
+        anyhow::bail!("Failed to get map {}", map_name);
+    }
+
+    let epoll = EpollSet::new(rings.iter().map(|r| r.as_fd().as_raw_fd()))
+        .with_context(|| format!("Failed to set up epoll for {}", map_name))?;
     let shutdown = shutdown_flag();
+    let owner = loader::owner_of_map(map_name);
+    let stop = probe_stop_flag(owner);
+    let ring_name = map_name.to_string();
+    let ring_id = loader::ring_of_map(map_name);
 
-    tokio::task::spawn_blocking(move || {
-        while !shutdown.load(Ordering::Relaxed) {
-            let mut has_work = false;
-            while let Some(item) = ring_buf.next() {
-                has_work = true;
-                if item.len() >= std::mem::size_of::<T>() {
-                    let event = unsafe { (item.as_ptr() as *const T).read_unaligned() };
-                    handler(event);
+    let handle = tokio::task::spawn_blocking(move || {
+        // Wakeups are batched in eBPF; count how often the consumer is actually woken
+        let mut wakeups = 0u64;
+        let mut last_report = Instant::now();
+        loop {
+            // Once stopped, one last pass takes what is already in the rings, so that a
+            // detach (or handoff) does not throw it away
+            let stopping = shutdown.load(Ordering::Relaxed) || stop.load(Ordering::Relaxed);
+            if !stopping {
+                match epoll.wait(POLL_INTERVAL_MS as i32) {
+                    Ok(0) => {}
+                    Ok(_) => wakeups += 1,
+                    Err(e) => {
+                        warn!("epoll_wait failed: {}", e);
+                        std::thread::sleep(Duration::from_millis(POLL_INTERVAL_MS));
+                    }
                 }
             }
-            if !has_work {
-                std::thread::sleep(Duration::from_millis(POLL_INTERVAL_MS));
+            if last_report.elapsed() >= Duration::from_secs(WAKEUP_REPORT_INTERVAL_SECS) {
+                telemetry::record_ringbuf_wakeups(&ring_name, wakeups);
+                wakeups = 0;
+                last_report = Instant::now();
+            }
+            for ring_buf in rings.iter_mut() {
+                while let Some(item) = ring_buf.next() {
+                    if !passes_cgroup_filter(ring_id, &item) {
+                        continue;
+                    }
+                    if let Some(ring) = ring_id {
+                        capture::record(ring, &item);
+                    }
+                    if let Some(event) = capture::decode_event::<T>(&item) {
+                        handler(event);
+                    }
+                }
+            }
+            sink::flush();
+            if stopping {
+                break;
+            }
+        }
+    });
+    register_probe_task(owner, handle);
+    Ok(())
+}
+
+/// Minimal epoll wrapper: one readiness set over all shards of a ring.
+struct EpollSet {
+    fd: OwnedFd,
+}
+
+impl EpollSet {
+    fn new(fds: impl Iterator<Item = RawFd>) -> io::Result<Self> {
+        let raw = unsafe { libc::epoll_create1(libc::EPOLL_CLOEXEC) };
+        if raw < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let set = Self {
+            fd: unsafe { OwnedFd::from_raw_fd(raw) },
+        };
+        for (index, fd) in fds.enumerate() {
+            let mut event = libc::epoll_event {
+                events: libc::EPOLLIN as u32,
+                u64: index as u64,
+            };
+            let ret =
+                unsafe { libc::epoll_ctl(set.fd.as_raw_fd(), libc::EPOLL_CTL_ADD, fd, &mut event) };
+            if ret < 0 {
+                return Err(io::Error::last_os_error());
+            }
+        }
+        Ok(set)
+    }
+
+    /// Block until any ring has data or the timeout expires. Returns the number of ready rings.
+    fn wait(&self, timeout_ms: i32) -> io::Result<usize> {
+        let mut events = [libc::epoll_event { events: 0, u64: 0 }; MAX_RING_SHARDS as usize];
+        let n = unsafe {
+            libc::epoll_wait(
+                self.fd.as_raw_fd(),
+                events.as_mut_ptr(),
+                events.len() as i32,
+                timeout_ms,
+            )
+        };
+        if n < 0 {
+            let err = io::Error::last_os_error();
+            if err.kind() == io::ErrorKind::Interrupted {
+                return Ok(0);
+            }
+            return Err(err);
+        }
+        Ok(n as usize)
+    }
+}
+
+/// Events lost on full rings since startup, by `RingId`
+static RING_DROPS: [AtomicU64; RING_COUNT as usize] =
+    [const { AtomicU64::new(0) }; RING_COUNT as usize];
+
+pub fn ring_drops_total(ring: RingId) -> u64 {
+    RING_DROPS[ring as usize].load(Ordering::Relaxed)
+}
+
+/// Periodically export per-ring drop counts (events lost because a ring was full).
+/// Runs until shutdown or until the owning probe is detached, like the ring consumers.
+pub fn spawn_drop_monitor(bpf: &mut Ebpf, probe_name: &'static str) -> Result<()> {
+    let drops: PerCpuArray<MapData, u64> = PerCpuArray::try_from(
+        bpf.take_map("RINGBUF_DROPS")
+            .context("Failed to get RINGBUF_DROPS map")?,
+    )?;
+    let shutdown = shutdown_flag();
+    let owner = ProbeKind::from_name(probe_name);
+    let stop = probe_stop_flag(owner);
+
+    let handle = tokio::task::spawn_blocking(move || {
+        // RINGBUF_DROPS may be adopted from a previous agent, which reported its totals
+        let mut last = RingId::ALL.map(|ring| {
+            drops
+                .get(&(ring as u32), 0)
+                .map(|values| values.iter().sum())
+                .unwrap_or(0)
+        });
+        let interval = Duration::from_secs(DROP_REPORT_INTERVAL_SECS);
+        let mut next_report = Instant::now() + interval;
+        // Checks the stop flag between reports, so a detach releases RINGBUF_DROPS promptly
+        while !shutdown.load(Ordering::Relaxed) && !stop.load(Ordering::Relaxed) {
+            std::thread::sleep(Duration::from_millis(DROP_MONITOR_TICK_MS));
+            if Instant::now() < next_report {
+                continue;
+            }
+            next_report += interval;
+            for ring in RingId::ALL {
+                let Ok(values) = drops.get(&(ring as u32), 0) else {
+                    continue;
+                };
+                let total: u64 = values.iter().sum();
+                let delta = total.saturating_sub(last[ring as usize]);
+                last[ring as usize] = total;
+                if delta > 0 {
+                    RING_DROPS[ring as usize].fetch_add(delta, Ordering::Relaxed);
+                    warn!(
+                        "{}: {} events dropped on full {} ring",
+                        probe_name,
+                        delta,
+                        ring.name()
+                    );
+                    telemetry::record_ringbuf_drops(ring.name(), delta);
+                }
             }
         }
     });
+    register_probe_task(owner, handle);
     Ok(())
 }
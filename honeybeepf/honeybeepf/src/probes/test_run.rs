@@ -0,0 +1,430 @@
+//! Kernel-side program microbenchmarks via `BPF_PROG_TEST_RUN`.
+//!
+//! Tracepoint programs cannot be test-run, so hot programs have `*_raw` raw tracepoint
+//! twins sharing their logic, whose test context is the tracepoint record itself.
+//! Time per run is taken from the kernel's BPF run-time statistics (`BPF_ENABLE_STATS`),
+//! which excludes the syscall overhead of driving the runs.
+
+use std::{
+    io,
+    os::fd::{AsFd, AsRawFd, FromRawFd, OwnedFd, RawFd},
+};
+
+use anyhow::{Context, Result, bail};
+use aya::{Ebpf, programs::RawTracePoint};
+
+const BPF_PROG_TEST_RUN: libc::c_long = 10;
+const BPF_OBJ_GET_INFO_BY_FD: libc::c_long = 15;
+const BPF_ENABLE_STATS: libc::c_long = 32;
+const BPF_STATS_RUN_TIME: u32 = 0;
+/// Size of one BPF instruction in `xlated_prog_len`
+const BPF_INSN_SIZE: u32 = 8;
+
+/// `bpf_attr.test`
+#[repr(C)]
+#[derive(Default)]
+struct TestRunAttr {
+    prog_fd: u32,
+    retval: u32,
+    data_size_in: u32,
+    data_size_out: u32,
+    data_in: u64,
+    data_out: u64,
+    repeat: u32,
+    duration: u32,
+    ctx_size_in: u32,
+    ctx_size_out: u32,
+    ctx_in: u64,
+    ctx_out: u64,
+    flags: u32,
+    cpu: u32,
+    batch_size: u32,
+    _pad: u32,
+}
+
+/// `bpf_attr.info`
+#[repr(C)]
+struct InfoAttr {
+    bpf_fd: u32,
+    info_len: u32,
+    info: u64,
+}
+
+/// `bpf_attr.enable_stats`
+#[repr(C)]
+struct EnableStatsAttr {
+    kind: u32,
+}
+
+/// `struct bpf_prog_info` up to `attach_btf_id`. Older kernels fill a prefix of it.
+#[repr(C)]
+#[derive(Default)]
+struct ProgInfo {
+    prog_type: u32,
+    id: u32,
+    tag: [u8; 8],
+    jited_prog_len: u32,
+    xlated_prog_len: u32,
+    jited_prog_insns: u64,
+    xlated_prog_insns: u64,
+    load_time: u64,
+    created_by_uid: u32,
+    nr_map_ids: u32,
+    map_ids: u64,
+    name: [u8; 16],
+    ifindex: u32,
+    gpl_compatible: u32,
+    netns_dev: u64,
+    netns_ino: u64,
+    nr_jited_ksyms: u32,
+    nr_jited_func_lens: u32,
+    jited_ksyms: u64,
+    jited_func_lens: u64,
+    btf_id: u32,
+    func_info_rec_size: u32,
+    func_info: u64,
+    nr_func_info: u32,
+    nr_line_info: u32,
+    line_info: u64,
+    jited_line_info: u64,
+    nr_jited_line_info: u32,
+    line_info_rec_size: u32,
+    jited_line_info_rec_size: u32,
+    nr_prog_tags: u32,
+    prog_tags: u64,
+    run_time_ns: u64,
+    run_cnt: u64,
+    recursion_misses: u64,
+    verified_insns: u32,
+    attach_btf_obj_id: u32,
+    attach_btf_id: u32,
+    /// Explicit tail padding: the kernel rejects non-zero bytes past its own struct
+    _pad: u32,
+}
+
+fn sys_bpf<T>(cmd: libc::c_long, attr: &mut T) -> io::Result<libc::c_long> {
+    let ret = unsafe {
+        libc::syscall(
+            libc::SYS_bpf,
+            cmd,
+            attr as *mut T,
+            std::mem::size_of::<T>() as u32,
+        )
+    };
+    if ret < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(ret)
+}
+
+fn prog_info(prog_fd: RawFd) -> io::Result<ProgInfo> {
+    let mut info = ProgInfo::default();
+    let mut attr = InfoAttr {
+        bpf_fd: prog_fd as u32,
+        info_len: std::mem::size_of::<ProgInfo>() as u32,
+        info: &mut info as *mut ProgInfo as u64,
+    };
+    sys_bpf(BPF_OBJ_GET_INFO_BY_FD, &mut attr)?;
+    Ok(info)
+}
+
+/// View a tracepoint record as a test context.
+pub fn as_ctx<T>(record: &T) -> &[u8] {
+    unsafe { std::slice::from_raw_parts(record as *const T as *const u8, std::mem::size_of::<T>()) }
+}
+
+/// Load the raw tracepoint program `name` without attaching it. The fd stays owned by `bpf`.
+pub fn load_raw_program(bpf: &mut Ebpf, name: &str) -> Result<RawFd> {
+    let program: &mut RawTracePoint = bpf
+        .program_mut(name)
+        .with_context(|| format!("Failed to find {} program", name))?
+        .try_into()?;
+    program.load()?;
+    Ok(program.fd()?.as_fd().as_raw_fd())
+}
+
+#[derive(Debug)]
+pub struct ProgStats {
+    pub runs: u64,
+    pub ns_per_run: f64,
+    /// Return value of the last run
+    pub retval: u32,
+    /// Instructions after verifier rewrites
+    pub xlated_insns: u32,
+    pub jited_bytes: u32,
+    /// Instructions processed by the verifier (0 before Linux 5.16)
+    pub verified_insns: u32,
+}
+
+/// Runs programs through `BPF_PROG_TEST_RUN`, with run-time stats enabled while it lives.
+pub struct TestRunner {
+    _stats: OwnedFd,
+}
+
+impl TestRunner {
+    pub fn new() -> Result<Self> {
+        let mut attr = EnableStatsAttr {
+            kind: BPF_STATS_RUN_TIME,
+        };
+        let fd = sys_bpf(BPF_ENABLE_STATS, &mut attr).context("Failed to enable BPF stats")?;
+        Ok(Self {
+            _stats: unsafe { OwnedFd::from_raw_fd(fd as RawFd) },
+        })
+    }
+
+    /// Run the program once on `ctx`. Raw tracepoint test runs do not support `repeat`.
+    pub fn run(&self, prog_fd: RawFd, ctx: &[u8]) -> Result<u32> {
+        let mut attr = TestRunAttr {
+            prog_fd: prog_fd as u32,
+            ctx_size_in: ctx.len() as u32,
+            ctx_in: ctx.as_ptr() as u64,
+            ..Default::default()
+        };
+        sys_bpf(BPF_PROG_TEST_RUN, &mut attr).context("BPF_PROG_TEST_RUN failed")?;
+        Ok(attr.retval)
+    }
+
+    /// Run the program `runs` times, calling `between` after every `batch` runs
+    /// (e.g. to drain rings the program writes to).
+    pub fn bench(
+        &self,
+        prog_fd: RawFd,
+        ctx: &[u8],
+        runs: u64,
+        batch: u64,
+        mut between: impl FnMut(),
+    ) -> Result<ProgStats> {
+        let before = prog_info(prog_fd)?;
+        let mut retval = 0;
+        for run in 0..runs {
+            retval = self.run(prog_fd, ctx)?;
+            if (run + 1) % batch.max(1) == 0 {
+                between();
+            }
+        }
+        let after = prog_info(prog_fd)?;
+
+        let counted = after.run_cnt.saturating_sub(before.run_cnt);
+        if counted == 0 {
+            bail!("Kernel did not account any runs; BPF stats unsupported?");
+        }
+        Ok(ProgStats {
+            runs: counted,
+            ns_per_run: after.run_time_ns.saturating_sub(before.run_time_ns) as f64
+                / counted as f64,
+            retval,
+            xlated_insns: after.xlated_prog_len / BPF_INSN_SIZE,
+            jited_bytes: after.jited_prog_len,
+            verified_insns: after.verified_insns,
+        })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use aya::maps::RingBuf;
+    use honeybeepf_common::MAX_RING_SHARDS;
+
+    use super::*;
+    use crate::{
+        probes::loader::{MapLimits, ProbeKind, load_probe_object, shard_map_name},
+        settings::MapSettings,
+    };
+
+    const RUNS: u64 = 100_000;
+    /// Rings are drained this often, so producers never hit the ring-full path
+    const DRAIN_BATCH: u64 = 1000;
+
+    #[repr(C)]
+    #[derive(Default)]
+    struct SyscallTraceHeader {
+        common_type: u16,
+        common_flags: u8,
+        common_preempt_count: u8,
+        common_pid: i32,
+        syscall_nr: i32,
+        _pad: i32,
+    }
+
+    #[repr(C)]
+    #[derive(Default)]
+    struct SysEnterOpenat {
+        header: SyscallTraceHeader,
+        dfd: i64,
+        filename: u64,
+        flags: i64,
+        mode: i64,
+    }
+
+    #[repr(C)]
+    #[derive(Default)]
+    struct SysEnterClose {
+        header: SyscallTraceHeader,
+        fd: i64,
+    }
+
+    #[repr(C)]
+    #[derive(Default)]
+    struct BlockIoTrace {
+        common_type: u16,
+        common_flags: u8,
+        common_preempt_count: u8,
+        common_pid: i32,
+        dev: u32,
+        sector: u64,
+        nr_sector: u32,
+        bytes: u32,
+        rwbs: [u8; 8],
+        comm: [u8; 16],
+        cmd: [u8; 4],
+    }
+
+    /// Budgets are ceilings meant to catch gross regressions (a log call or loop in a
+    /// hot path), not noise; tighten them as CI hardware numbers accumulate.
+    struct Case {
+        label: &'static str,
+        probe: ProbeKind,
+        program: &'static str,
+        ctx: Vec<u8>,
+        rings: &'static [&'static str],
+        expected_retval: u32,
+        max_insns: u32,
+        max_ns: f64,
+    }
+
+    fn openat(filename: &[u8]) -> Vec<u8> {
+        // Heap copy: the program reads it with a non-faulting user read, so it must be resident
+        let filename: &'static [u8] = Box::leak(filename.to_vec().into_boxed_slice());
+        as_ctx(&SysEnterOpenat {
+            dfd: libc::AT_FDCWD as i64,
+            filename: filename.as_ptr() as u64,
+            flags: libc::O_RDWR as i64,
+            ..Default::default()
+        })
+        .to_vec()
+    }
+
+    fn cases() -> Vec<Case> {
+        let mut block_io = BlockIoTrace {
+            dev: (8 << 20) | 1,
+            sector: 2048,
+            nr_sector: 8,
+            bytes: 4096,
+            ..Default::default()
+        };
+        block_io.rwbs[..2].copy_from_slice(b"WS");
+        block_io.comm[..4].copy_from_slice(b"test");
+
+        vec![
+            Case {
+                label: "gpu_open_enter (non-GPU path)",
+                probe: ProbeKind::GpuUsage,
+                program: "honeybeepf_gpu_open_enter_raw",
+                ctx: openat(b"/usr/lib/x86_64-linux-gnu/libc.so.6\0"),
+                rings: &[],
+                expected_retval: 2, // EmitGpuStatus::NotGpuDevice
+                max_insns: 4096,
+                max_ns: 1_000.0,
+            },
+            Case {
+                label: "gpu_open_enter (GPU path)",
+                probe: ProbeKind::GpuUsage,
+                program: "honeybeepf_gpu_open_enter_raw",
+                ctx: openat(b"/dev/nvidia0\0"),
+                rings: &[],
+                expected_retval: 0,
+                max_insns: 4096,
+                max_ns: 2_000.0,
+            },
+            Case {
+                label: "gpu_close (non-GPU fd)",
+                probe: ProbeKind::GpuUsage,
+                program: "honeybeepf_gpu_close_raw",
+                ctx: as_ctx(&SysEnterClose {
+                    fd: 3,
+                    ..Default::default()
+                })
+                .to_vec(),
+                rings: &[],
+                expected_retval: 0,
+                max_insns: 2048,
+                max_ns: 1_000.0,
+            },
+            Case {
+                label: "block_io_start",
+                probe: ProbeKind::BlockIo,
+                program: "honeybeepf_block_io_start_raw",
+                ctx: as_ctx(&block_io).to_vec(),
+                rings: &["BLOCK_IO_EVENTS"],
+                expected_retval: 0,
+                max_insns: 8192,
+                max_ns: 5_000.0,
+            },
+        ]
+    }
+
+    fn take_rings(bpf: &mut Ebpf, bases: &[&str]) -> Vec<RingBuf<aya::maps::MapData>> {
+        bases
+            .iter()
+            .flat_map(|base| (0..MAX_RING_SHARDS).map(move |shard| shard_map_name(base, shard)))
+            .filter_map(|name| bpf.take_map(&name))
+            .filter_map(|map| RingBuf::try_from(map).ok())
+            .collect()
+    }
+
+    /// Runs as part of `cargo test` (the cargo runner is `sudo -E`); skipped without root.
+    #[tokio::test]
+    async fn test_prog_run_budgets() {
+        if unsafe { libc::geteuid() } != 0 {
+            eprintln!("Skipping BPF program benchmarks: requires root");
+            return;
+        }
+        crate::bump_memlock_rlimit().unwrap();
+
+        let bytecode = aya::include_bytes_aligned!(concat!(env!("OUT_DIR"), "/honeybeepf"));
+        let limits = MapLimits::detect(&MapSettings::default());
+        let runner = TestRunner::new().unwrap();
+
+        println!(
+            "{:<32} {:>10} {:>8} {:>10} {:>10}",
+            "program", "ns/run", "xlated", "verified", "jited (B)"
+        );
+        let mut failures = Vec::new();
+        for case in cases() {
+            let mut bpf = load_probe_object(bytecode, case.probe, &limits, None).unwrap();
+            let fd = load_raw_program(&mut bpf, case.program).unwrap();
+            let mut rings = take_rings(&mut bpf, case.rings);
+
+            let stats = runner
+                .bench(fd, &case.ctx, RUNS, DRAIN_BATCH, || {
+                    for ring in rings.iter_mut() {
+                        while ring.next().is_some() {}
+                    }
+                })
+                .unwrap();
+            println!(
+                "{:<32} {:>10.1} {:>8} {:>10} {:>10}",
+                case.label,
+                stats.ns_per_run,
+                stats.xlated_insns,
+                stats.verified_insns,
+                stats.jited_bytes
+            );
+
+            assert_eq!(stats.retval, case.expected_retval, "{}", case.label);
+            if stats.xlated_insns > case.max_insns {
+                failures.push(format!(
+                    "{}: {} instructions > budget {}",
+                    case.label, stats.xlated_insns, case.max_insns
+                ));
+            }
+            if stats.ns_per_run > case.max_ns {
+                failures.push(format!(
+                    "{}: {:.1} ns/run > budget {:.1}",
+                    case.label, stats.ns_per_run, case.max_ns
+                ));
+            }
+        }
+        assert!(failures.is_empty(), "{}", failures.join("\n"));
+    }
+}
@@ -0,0 +1,460 @@
+//! Per-cgroup flight recorder.
+//!
+//! Probe handlers append every event to a fixed-size in-memory buffer of the event's cgroup.
+//! Nothing is exported until a trigger fires: an LLM request of that cgroup slower than
+//! `RECORDER__LLM_LATENCY_MS`, SIGUSR1 (all cgroups) or an explicit command. A dump thread
+//! then writes the buffer as a capture file (see `probes::capture`), so the events leading
+//! up to the trigger can be inspected with `honeybeepf replay`.
+//!
+//! Each buffer is two halves of `buffer_kb / 2`: once the current half is full it replaces
+//! the previous one, so between half and all of the buffer is always recent history and
+//! appending is a copy into preallocated memory. SSL records are stored without the unused
+//! tail of their payload buffer and expanded back to full events when dumped. Buffers live
+//! in a fixed number of locked shards; at most `max_cgroups` of them exist, and a new cgroup
+//! takes over the buffer of the least recently active one in its shard.
+
+use std::{
+    collections::HashMap,
+    fs::File,
+    io::{BufWriter, Write},
+    mem::offset_of,
+    path::{Path, PathBuf},
+    sync::{
+        Mutex,
+        atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering},
+        mpsc::{Receiver, SyncSender, sync_channel},
+    },
+    thread::JoinHandle,
+    time::{Duration, Instant},
+};
+
+use anyhow::{Context, Result};
+use chrono::Utc;
+use honeybeepf_common::{LlmEvent, MAX_SSL_BUF_SIZE, RingId};
+use log::{info, warn};
+
+use crate::{
+    probes::capture::{self, decode_event},
+    settings::RecorderSettings,
+    telemetry,
+};
+
+const SHARDS: usize = 16;
+const DEFAULT_BUFFER_KB: usize = 256;
+const DEFAULT_MAX_CGROUPS: usize = 64;
+const DEFAULT_COOLDOWN_SECS: u64 = 60;
+/// Pending dump requests; further triggers are ignored while the dump thread is busy
+const DUMP_QUEUE_CAPACITY: usize = 16;
+/// Smallest buffer half, so that one full SSL record always fits
+const MIN_HALF_BYTES: usize = 8 * 1024;
+
+/// What caused a dump
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Trigger {
+    /// An LLM request of this cgroup exceeded the latency threshold
+    LlmLatency(u64),
+    /// SIGUSR1: every cgroup
+    Signal,
+    /// Explicit request for one cgroup, or all of them
+    Command(Option<u64>),
+}
+
+impl Trigger {
+    pub fn reason(&self) -> &'static str {
+        match self {
+            Trigger::LlmLatency(_) => "llm_latency",
+            Trigger::Signal => "signal",
+            Trigger::Command(_) => "command",
+        }
+    }
+
+    fn cgroup(&self) -> Option<u64> {
+        match self {
+            Trigger::LlmLatency(cgroup) => Some(*cgroup),
+            Trigger::Signal => None,
+            Trigger::Command(cgroup) => *cgroup,
+        }
+    }
+}
+
+struct CgroupBuffer {
+    current: Vec<u8>,
+    previous: Vec<u8>,
+    /// Timestamp of the latest event, for eviction
+    last_ns: u64,
+}
+
+impl CgroupBuffer {
+    fn new(half: usize) -> Self {
+        Self {
+            current: Vec::with_capacity(half),
+            previous: Vec::with_capacity(half),
+            last_ns: 0,
+        }
+    }
+
+    /// The half to append `len` encoded bytes to, retiring the older half if needed.
+    fn reserve(&mut self, half: usize, len: usize) -> &mut Vec<u8> {
+        if !self.current.is_empty() && self.current.len() + len > half {
+            std::mem::swap(&mut self.current, &mut self.previous);
+            self.current.clear();
+        }
+        &mut self.current
+    }
+
+    fn clear(&mut self) {
+        self.current.clear();
+        self.previous.clear();
+    }
+}
+
+type Shard = Mutex<Option<HashMap<u64, CgroupBuffer>>>;
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static HALF_BYTES: AtomicUsize = AtomicUsize::new(0);
+static BUFFERS_PER_SHARD: AtomicUsize = AtomicUsize::new(0);
+/// 0 disables the latency trigger
+static LLM_LATENCY_NS: AtomicU64 = AtomicU64::new(0);
+static BUFFERS: [Shard; SHARDS] = [const { Mutex::new(None) }; SHARDS];
+static DUMPS: Mutex<Option<SyncSender<Trigger>>> = Mutex::new(None);
+static DUMPER: Mutex<Option<JoinHandle<()>>> = Mutex::new(None);
+
+/// Start the flight recorder. Does nothing unless `RECORDER__DIR` is set.
+pub fn init(settings: &RecorderSettings) -> Result<()> {
+    let Some(dir) = settings.dir.as_ref() else {
+        return Ok(());
+    };
+    let dir = PathBuf::from(dir);
+    std::fs::create_dir_all(&dir)
+        .with_context(|| format!("Failed to create recorder directory {}", dir.display()))?;
+
+    let buffer_kb = settings.buffer_kb.unwrap_or(DEFAULT_BUFFER_KB);
+    let half = (buffer_kb * 1024 / 2).max(MIN_HALF_BYTES);
+    let max_cgroups = settings.max_cgroups.unwrap_or(DEFAULT_MAX_CGROUPS).max(1);
+    let per_shard = max_cgroups.div_ceil(SHARDS);
+    let cooldown = Duration::from_secs(settings.cooldown_secs.unwrap_or(DEFAULT_COOLDOWN_SECS));
+
+    let mut dumps = DUMPS.lock().unwrap_or_else(|e| e.into_inner());
+    if dumps.is_some() {
+        anyhow::bail!("Flight recorder already running");
+    }
+    let (tx, rx) = sync_channel(DUMP_QUEUE_CAPACITY);
+    let writer_dir = dir.clone();
+    let handle = std::thread::Builder::new()
+        .name("hbpf-recorder".into())
+        .spawn(move || run_dumper(rx, writer_dir, cooldown))
+        .context("Failed to spawn flight recorder thread")?;
+    *DUMPER.lock().unwrap_or_else(|e| e.into_inner()) = Some(handle);
+    *dumps = Some(tx);
+
+    HALF_BYTES.store(half, Ordering::Relaxed);
+    BUFFERS_PER_SHARD.store(per_shard, Ordering::Relaxed);
+    LLM_LATENCY_NS.store(
+        settings
+            .llm_latency_ms
+            .unwrap_or(0)
+            .saturating_mul(1_000_000),
+        Ordering::Relaxed,
+    );
+    ENABLED.store(true, Ordering::Release);
+    info!(
+        "Flight recorder keeping {} KB for up to {} cgroups, dumps to {}",
+        half * 2 / 1024,
+        per_shard * SHARDS,
+        dir.display()
+    );
+    Ok(())
+}
+
+pub fn enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Stop recording, finish queued dumps and release the buffers.
+pub fn shutdown() {
+    ENABLED.store(false, Ordering::Relaxed);
+    DUMPS.lock().unwrap_or_else(|e| e.into_inner()).take();
+    if let Some(handle) = DUMPER.lock().unwrap_or_else(|e| e.into_inner()).take() {
+        let _ = handle.join();
+    }
+    for shard in &BUFFERS {
+        shard.lock().unwrap_or_else(|e| e.into_inner()).take();
+    }
+}
+
+/// Append a decoded event to its cgroup's buffer.
+#[inline]
+pub fn record<T: Copy>(ring: RingId, timestamp_ns: u64, cgroup_id: u64, event: &T) {
+    if !ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    let data = unsafe {
+        std::slice::from_raw_parts(event as *const T as *const u8, std::mem::size_of::<T>())
+    };
+    append(ring, timestamp_ns, cgroup_id, &[data]);
+}
+
+/// Append an SSL event, keeping only the filled part of its payload buffer.
+pub fn record_ssl(event: &LlmEvent) {
+    if !ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    let (head, payload, tail) = ssl_parts(event);
+    append(
+        RingId::Ssl,
+        event.metadata.timestamp,
+        event.metadata.cgroup_id,
+        &[head, tail, payload],
+    );
+}
+
+/// Trigger a dump of `cgroup_id` if an LLM request took longer than the threshold.
+pub fn observe_llm(cgroup_id: u64, latency: Duration) {
+    if !ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    let threshold = LLM_LATENCY_NS.load(Ordering::Relaxed);
+    if threshold > 0 && latency.as_nanos() >= threshold as u128 {
+        trigger(Trigger::LlmLatency(cgroup_id));
+    }
+}
+
+/// Queue a dump. Returns false if the recorder is off or too many dumps are pending.
+pub fn trigger(trigger: Trigger) -> bool {
+    let dumps = DUMPS.lock().unwrap_or_else(|e| e.into_inner());
+    dumps
+        .as_ref()
+        .is_some_and(|tx| tx.try_send(trigger).is_ok())
+}
+
+fn shard(cgroup_id: u64) -> &'static Shard {
+    &BUFFERS[cgroup_id as usize % SHARDS]
+}
+
+fn append(ring: RingId, timestamp_ns: u64, cgroup_id: u64, parts: &[&[u8]]) {
+    let half = HALF_BYTES.load(Ordering::Relaxed);
+    let len = capture::encoded_len(parts.iter().map(|part| part.len()).sum());
+
+    let mut shard = shard(cgroup_id).lock().unwrap_or_else(|e| e.into_inner());
+    let buffers = shard.get_or_insert_with(HashMap::new);
+    let buffer = match buffers.get_mut(&cgroup_id) {
+        Some(buffer) => buffer,
+        None => {
+            let buffer = if buffers.len() >= BUFFERS_PER_SHARD.load(Ordering::Relaxed) {
+                // Reuse the allocation of the least recently active cgroup
+                let oldest = buffers
+                    .iter()
+                    .min_by_key(|(_, buffer)| buffer.last_ns)
+                    .map(|(&cgroup, _)| cgroup);
+                let mut buffer = oldest
+                    .and_then(|cgroup| buffers.remove(&cgroup))
+                    .unwrap_or_else(|| CgroupBuffer::new(half));
+                buffer.clear();
+                buffer
+            } else {
+                CgroupBuffer::new(half)
+            };
+            buffers.entry(cgroup_id).or_insert(buffer)
+        }
+    };
+    buffer.last_ns = timestamp_ns;
+    capture::encode_record_parts(buffer.reserve(half, len), ring, timestamp_ns, parts);
+}
+
+const SSL_BUF_START: usize = offset_of!(LlmEvent, buf);
+const SSL_BUF_END: usize = SSL_BUF_START + MAX_SSL_BUF_SIZE;
+
+/// Fields before the payload buffer, the filled part of the payload, fields after it
+fn ssl_parts(event: &LlmEvent) -> (&[u8], &[u8], &[u8]) {
+    let bytes = unsafe {
+        std::slice::from_raw_parts(
+            event as *const LlmEvent as *const u8,
+            std::mem::size_of::<LlmEvent>(),
+        )
+    };
+    let len = if event.buf_filled == 0 {
+        0
+    } else {
+        (event.len as usize).min(MAX_SSL_BUF_SIZE)
+    };
+    (
+        &bytes[..SSL_BUF_START],
+        &event.buf[..len],
+        &bytes[SSL_BUF_END..],
+    )
+}
+
+/// Rebuild a full `LlmEvent` from a record written by `record_ssl`.
+fn expand_ssl(data: &[u8]) -> Option<LlmEvent> {
+    let tail_len = std::mem::size_of::<LlmEvent>() - SSL_BUF_END;
+    let fixed = SSL_BUF_START + tail_len;
+    if data.len() < fixed || data.len() - fixed > MAX_SSL_BUF_SIZE {
+        return None;
+    }
+    let mut bytes = vec![0u8; std::mem::size_of::<LlmEvent>()];
+    bytes[..SSL_BUF_START].copy_from_slice(&data[..SSL_BUF_START]);
+    bytes[SSL_BUF_END..].copy_from_slice(&data[SSL_BUF_START..fixed]);
+    let payload = &data[fixed..];
+    bytes[SSL_BUF_START..SSL_BUF_START + payload.len()].copy_from_slice(payload);
+    decode_event(&bytes)
+}
+
+/// Copy out a cgroup's records, oldest first, with SSL records expanded to full events.
+fn snapshot(cgroup_id: u64, out: &mut Vec<u8>) -> u64 {
+    let shard = shard(cgroup_id).lock().unwrap_or_else(|e| e.into_inner());
+    let Some(buffer) = shard.as_ref().and_then(|buffers| buffers.get(&cgroup_id)) else {
+        return 0;
+    };
+    let mut events = 0;
+    for half in [&buffer.previous, &buffer.current] {
+        for record in capture::decode_records(half) {
+            match record.ring {
+                RingId::Ssl => {
+                    let Some(event) = expand_ssl(record.data) else {
+                        continue;
+                    };
+                    let data = unsafe {
+                        std::slice::from_raw_parts(
+                            &event as *const LlmEvent as *const u8,
+                            std::mem::size_of::<LlmEvent>(),
+                        )
+                    };
+                    capture::encode_record(out, record.ring, record.timestamp_ns, data);
+                }
+                ring => capture::encode_record(out, ring, record.timestamp_ns, record.data),
+            }
+            events += 1;
+        }
+    }
+    events
+}
+
+fn cgroups() -> Vec<u64> {
+    BUFFERS
+        .iter()
+        .flat_map(|shard| {
+            let shard = shard.lock().unwrap_or_else(|e| e.into_inner());
+            shard
+                .as_ref()
+                .map(|buffers| buffers.keys().copied().collect::<Vec<_>>())
+                .unwrap_or_default()
+        })
+        .collect()
+}
+
+fn write_dump(path: &Path, records: &[u8]) -> std::io::Result<()> {
+    let mut out = BufWriter::new(File::create(path)?);
+    capture::write_file_header(&mut out)?;
+    out.write_all(records)?;
+    out.flush()
+}
+
+fn run_dumper(rx: Receiver<Trigger>, dir: PathBuf, cooldown: Duration) {
+    let mut last_dump: HashMap<u64, Instant> = HashMap::new();
+    let mut records = Vec::new();
+
+    for trigger in rx {
+        let targets = match trigger.cgroup() {
+            Some(cgroup) => vec![cgroup],
+            None => cgroups(),
+        };
+        let stamp = Utc::now().format("%Y%m%dT%H%M%S");
+        for cgroup in targets {
+            // Only automatic triggers are rate limited
+            if let Trigger::LlmLatency(_) = trigger
+                && last_dump
+                    .get(&cgroup)
+                    .is_some_and(|at| at.elapsed() < cooldown)
+            {
+                continue;
+            }
+            records.clear();
+            let events = snapshot(cgroup, &mut records);
+            if events == 0 {
+                continue;
+            }
+            let path = dir.join(format!("{}-{}-cg{}.hbcap", stamp, trigger.reason(), cgroup));
+            match write_dump(&path, &records) {
+                Ok(()) => {
+                    info!(
+                        "Flight recorder: {} events of cgroup {} written to {} ({})",
+                        events,
+                        cgroup,
+                        path.display(),
+                        trigger.reason()
+                    );
+                    telemetry::record_recorder_dump(trigger.reason());
+                    last_dump.insert(cgroup, Instant::now());
+                }
+                Err(e) => warn!("Flight recorder cannot write {}: {}", path.display(), e),
+            }
+        }
+        last_dump.retain(|_, at| at.elapsed() < cooldown);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use honeybeepf_common::BlockIoEvent;
+
+    use super::*;
+
+    #[test]
+    fn test_buffer_keeps_recent_events() {
+        HALF_BYTES.store(MIN_HALF_BYTES, Ordering::Relaxed);
+        BUFFERS_PER_SHARD.store(1, Ordering::Relaxed);
+        let cgroup = 3;
+
+        let mut block: BlockIoEvent = unsafe { std::mem::zeroed() };
+        block.metadata.cgroup_id = cgroup;
+        let block_len = capture::encoded_len(std::mem::size_of::<BlockIoEvent>());
+        let total = 4 * MIN_HALF_BYTES / block_len;
+        for i in 0..total as u64 {
+            block.sector = i;
+            append(
+                RingId::BlockIo,
+                i,
+                cgroup,
+                &[unsafe {
+                    std::slice::from_raw_parts(
+                        &block as *const _ as *const u8,
+                        std::mem::size_of::<BlockIoEvent>(),
+                    )
+                }],
+            );
+        }
+
+        let mut ssl = LlmEvent::default();
+        ssl.metadata.cgroup_id = cgroup;
+        ssl.metadata.timestamp = total as u64;
+        ssl.conn_id = 0xdead;
+        ssl.seq = 9;
+        ssl.len = 5;
+        ssl.buf_filled = 1;
+        ssl.buf[..5].copy_from_slice(b"hello");
+        let (head, payload, tail) = ssl_parts(&ssl);
+        append(RingId::Ssl, total as u64, cgroup, &[head, tail, payload]);
+
+        let mut out = Vec::new();
+        let events = snapshot(cgroup, &mut out) as usize;
+        let records: Vec<_> = capture::decode_records(&out).collect();
+        assert_eq!(records.len(), events);
+        // Oldest events were dropped, at least a half's worth is kept, in order
+        assert!(events < total && events >= MIN_HALF_BYTES / block_len);
+        assert!(
+            records
+                .windows(2)
+                .all(|w| w[0].timestamp_ns < w[1].timestamp_ns)
+        );
+
+        let last = records.last().unwrap();
+        assert_eq!(last.ring, RingId::Ssl);
+        let restored: LlmEvent = decode_event(last.data).unwrap();
+        assert_eq!((restored.conn_id, restored.seq), (0xdead, 9));
+        assert_eq!(&restored.buf[..6], b"hello\0");
+
+        // A second cgroup in the same shard takes over the buffer
+        append(RingId::BlockIo, 0, cgroup + SHARDS as u64, &[&[0u8; 8]]);
+        assert_eq!(snapshot(cgroup, &mut Vec::new()), 0);
+    }
+}
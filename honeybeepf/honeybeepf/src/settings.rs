@@ -13,12 +13,140 @@ pub struct BuiltinProbes {
     pub interval: Option<u32>,
 }
 
+/// Load-time sizing of BPF maps (e.g. MAPS__SSL_RINGBUF_PER_CPU_KB=256).
+/// Ring buffers scale with the node's CPU count. With the default per-CPU budgets they stay
+/// within their fixed sizes of old (1MB, SSL 8MB); setting a budget lifts that cap.
+#[derive(Debug, Deserialize, Clone, Default)]
+#[allow(unused)]
+pub struct MapSettings {
+    pub ringbuf_per_cpu_kb: Option<u32>,
+    pub ssl_ringbuf_per_cpu_kb: Option<u32>,
+    pub max_entries: Option<u32>,
+    /// Split SSL and block I/O rings into per-CPU-group shards (1 = single shared ring)
+    pub ringbuf_shards: Option<u32>,
+    /// bpffs directory where state tables are pinned, so they survive agent upgrades
+    pub pin_dir: Option<String>,
+}
+
+/// Consumer wakeup batching per probe (e.g. WAKEUP__LLM_WATERMARK_KB=512).
+/// Producers wake userspace only once this much data is pending in a ring or
+/// `max_delay_ms` has passed since the last wakeup. A watermark of 0 wakes on every event.
+#[derive(Debug, Deserialize, Clone, Default)]
+#[allow(unused)]
+pub struct WakeupSettings {
+    pub block_io_watermark_kb: Option<u32>,
+    pub network_latency_watermark_kb: Option<u32>,
+    pub gpu_usage_watermark_kb: Option<u32>,
+    pub llm_watermark_kb: Option<u32>,
+    pub max_delay_ms: Option<u32>,
+}
+
+/// SSL payload parsing pipeline (e.g. LLM__WORKERS=4).
+#[derive(Debug, Deserialize, Clone, Default)]
+#[allow(unused)]
+pub struct LlmSettings {
+    /// Parser threads; streams are sharded across them by connection
+    pub workers: Option<usize>,
+    /// Bounded queue length per worker, in SSL events
+    pub queue_capacity: Option<usize>,
+    /// File where SSL library discovery is cached for fast restarts
+    pub discovery_cache: Option<String>,
+    /// Directory of tiktoken vocabularies (`cl100k_base.tiktoken`, `o200k_base.tiktoken`)
+    /// for estimating the tokens of responses without usage
+    pub tokenizer_dir: Option<String>,
+}
+
+/// Structured per-event output (e.g. SINK__PATH=/var/log/honeybeepf/events.jsonl).
+/// Disabled unless `path` or `socket` is set.
+#[derive(Debug, Deserialize, Clone, Default)]
+#[allow(unused)]
+pub struct SinkSettings {
+    /// `json` (JSON lines, default) or `binary` (capture file format, replayable)
+    pub format: Option<String>,
+    /// Output file
+    pub path: Option<String>,
+    /// Unix stream socket to connect to instead of a file
+    pub socket: Option<String>,
+    /// Keep 1 in N events of each probe
+    pub sample_rate: Option<u32>,
+    /// Event batches buffered for the writer thread before batches are dropped
+    pub queue_capacity: Option<usize>,
+}
+
+/// Local Parquet store (e.g. STORE__DIR=/var/lib/honeybeepf/store).
+/// Disabled unless `dir` is set; needs a build with the `store` feature.
+#[derive(Debug, Deserialize, Clone, Default)]
+#[allow(unused)]
+pub struct StoreSettings {
+    pub dir: Option<String>,
+    /// Start a new file once the current one reaches this size (files also roll hourly)
+    pub rotate_mb: Option<u64>,
+    /// Delete the oldest files beyond this total size (0 = keep everything)
+    pub retention_mb: Option<u64>,
+    /// Rows per Arrow batch and Parquet row group
+    pub batch_rows: Option<usize>,
+    /// Rows queued for the I/O thread before new rows are dropped
+    pub queue_capacity: Option<usize>,
+    pub block_io_interval_secs: Option<u64>,
+}
+
+/// Per-cgroup flight recorder (e.g. RECORDER__DIR=/var/lib/honeybeepf/recordings).
+/// Disabled unless `dir` is set.
+#[derive(Debug, Deserialize, Clone, Default)]
+#[allow(unused)]
+pub struct RecorderSettings {
+    pub dir: Option<String>,
+    /// Recent events kept per cgroup
+    pub buffer_kb: Option<usize>,
+    /// Cgroups with a buffer; the least recently active one is evicted beyond this
+    pub max_cgroups: Option<usize>,
+    /// Dump a cgroup's buffer when one of its LLM requests takes longer (unset = off)
+    pub llm_latency_ms: Option<u64>,
+    /// Minimum time between two dumps of the same cgroup
+    pub cooldown_secs: Option<u64>,
+}
+
+/// Local control socket (e.g. CONTROL__SOCKET=/run/honeybeepf/control.sock)
+#[derive(Debug, Deserialize, Clone, Default)]
+#[allow(unused)]
+pub struct ControlSettings {
+    pub socket: Option<String>,
+}
+
+/// Agent CPU budget governor (e.g. GOVERNOR__CPU_MILLICORES=500). On by default whenever a
+/// budget is known: `cpu_millicores`, or else the CPU limit of the agent's cgroup.
+#[derive(Debug, Deserialize, Clone, Default)]
+#[allow(unused)]
+pub struct GovernorSettings {
+    pub enabled: Option<bool>,
+    pub cpu_millicores: Option<u64>,
+    pub interval_secs: Option<u64>,
+    /// Highest keep-1-in-N rate the governor may set
+    pub max_sample_rate: Option<u32>,
+}
+
 #[derive(Debug, Deserialize, Clone)]
 #[allow(unused)]
 pub struct Settings {
     pub otel_exporter_otlp_endpoint: Option<String>,
     pub otel_exporter_otlp_protocol: Option<String>,
     pub builtin_probes: BuiltinProbes,
+    #[serde(default)]
+    pub maps: MapSettings,
+    #[serde(default)]
+    pub wakeup: WakeupSettings,
+    #[serde(default)]
+    pub llm: LlmSettings,
+    #[serde(default)]
+    pub sink: SinkSettings,
+    #[serde(default)]
+    pub store: StoreSettings,
+    #[serde(default)]
+    pub recorder: RecorderSettings,
+    #[serde(default)]
+    pub control: ControlSettings,
+    #[serde(default)]
+    pub governor: GovernorSettings,
     pub custom_probe_config: Option<String>,
 }
 
@@ -94,6 +222,14 @@ mod tests {
                 llm: None,             // Should default to false
                 interval: None,        // Should default to constant
             },
+            maps: MapSettings::default(),
+            wakeup: WakeupSettings::default(),
+            llm: LlmSettings::default(),
+            sink: SinkSettings::default(),
+            store: StoreSettings::default(),
+            recorder: RecorderSettings::default(),
+            control: ControlSettings::default(),
+            governor: GovernorSettings::default(),
             custom_probe_config: None,
         };
 
@@ -0,0 +1,510 @@
+//! Structured event sink.
+//!
+//! Builtin probe handlers hand their decoded events to `record`, which appends the raw struct
+//! to a per-thread batch. Ring buffer consumers call `flush` after each drain pass, so one
+//! batch covers everything a wakeup delivered. Batches travel over a bounded channel to a
+//! single writer thread that formats and writes them with buffered I/O, so the consumers never
+//! format strings or block on the output. When the writer falls behind, whole batches are
+//! dropped and counted instead of stalling the rings.
+//!
+//! Output is JSON lines or the binary capture format (see `probes::capture`), so a binary
+//! sink file can be fed back through `honeybeepf replay`.
+
+use std::{
+    cell::RefCell,
+    io::{self, BufWriter, Write},
+    os::unix::net::UnixStream,
+    path::PathBuf,
+    sync::{
+        Mutex,
+        atomic::{AtomicBool, AtomicU32, AtomicU64, Ordering},
+        mpsc::{Receiver, RecvTimeoutError, SyncSender, TrySendError, sync_channel},
+    },
+    thread::JoinHandle,
+    time::{Duration, Instant},
+};
+
+use anyhow::{Context, Result, bail};
+use honeybeepf_common::{
+    BlockIoEvent, BlockIoEventType, ConnectionEvent, EventMetadata, GpuCloseEvent, GpuOpenEvent,
+    RING_COUNT, RingId,
+};
+use log::{info, warn};
+
+use crate::{
+    probes::capture::{self, CaptureRecord, decode_event},
+    settings::SinkSettings,
+    telemetry,
+};
+
+/// A batch is handed to the writer once it holds this many bytes
+const BATCH_BYTES: usize = 64 * 1024;
+const DEFAULT_QUEUE_CAPACITY: usize = 64;
+const WRITE_BUFFER_SIZE: usize = 256 * 1024;
+const POOL_BUFFERS: usize = 16;
+/// Buffered output is flushed when no batch arrived for this long
+const FLUSH_INTERVAL: Duration = Duration::from_millis(200);
+const RECONNECT_INTERVAL: Duration = Duration::from_secs(1);
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum SinkFormat {
+    Json,
+    Binary,
+}
+
+impl SinkFormat {
+    fn parse(value: &str) -> Result<Self> {
+        match value.to_ascii_lowercase().as_str() {
+            "json" | "jsonl" => Ok(Self::Json),
+            "binary" => Ok(Self::Binary),
+            other => bail!("Unknown sink format '{}' (expected json or binary)", other),
+        }
+    }
+}
+
+#[derive(Debug, Clone)]
+enum Target {
+    File(PathBuf),
+    Socket(PathBuf),
+}
+
+impl Target {
+    /// Open the output. Files are appended to unless `truncate` is set.
+    fn open(&self, truncate: bool) -> io::Result<Box<dyn Write + Send>> {
+        Ok(match self {
+            Target::File(path) => Box::new(
+                std::fs::OpenOptions::new()
+                    .create(true)
+                    .write(true)
+                    .truncate(truncate)
+                    .append(!truncate)
+                    .open(path)?,
+            ),
+            Target::Socket(path) => Box::new(UnixStream::connect(path)?),
+        })
+    }
+}
+
+impl std::fmt::Display for Target {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            Target::File(path) => write!(f, "{}", path.display()),
+            Target::Socket(path) => write!(f, "unix:{}", path.display()),
+        }
+    }
+}
+
+#[derive(Default)]
+struct Batch {
+    buf: Vec<u8>,
+    events: u64,
+}
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static SAMPLE_RATE: AtomicU32 = AtomicU32::new(1);
+static SEEN: [AtomicU64; RING_COUNT as usize] = [const { AtomicU64::new(0) }; RING_COUNT as usize];
+/// Locked once per batch, not per event
+static SENDER: Mutex<Option<SyncSender<Batch>>> = Mutex::new(None);
+static WRITER: Mutex<Option<JoinHandle<()>>> = Mutex::new(None);
+/// Batch buffers handed back by the writer
+static POOL: Mutex<Vec<Vec<u8>>> = Mutex::new(Vec::new());
+
+thread_local! {
+    static BATCH: RefCell<Batch> = RefCell::new(Batch::default());
+}
+
+/// Start the sink described by `settings`. Does nothing if neither a path nor a socket is set.
+pub fn init(settings: &SinkSettings) -> Result<()> {
+    let target = match (&settings.path, &settings.socket) {
+        (Some(_), Some(_)) => bail!("Set only one of SINK__PATH and SINK__SOCKET"),
+        (Some(path), None) => Target::File(path.into()),
+        (None, Some(path)) => Target::Socket(path.into()),
+        (None, None) => return Ok(()),
+    };
+    let format = SinkFormat::parse(settings.format.as_deref().unwrap_or("json"))?;
+    let sample_rate = settings.sample_rate.unwrap_or(1).max(1);
+    let capacity = settings
+        .queue_capacity
+        .unwrap_or(DEFAULT_QUEUE_CAPACITY)
+        .max(1);
+
+    let mut sender = SENDER.lock().unwrap_or_else(|e| e.into_inner());
+    if sender.is_some() {
+        bail!("Event sink already running");
+    }
+    let (tx, rx) = sync_channel(capacity);
+    let writer_target = target.clone();
+    let handle = std::thread::Builder::new()
+        .name("hbpf-sink".into())
+        .spawn(move || run_writer(rx, writer_target, format))
+        .context("Failed to spawn sink writer thread")?;
+    *WRITER.lock().unwrap_or_else(|e| e.into_inner()) = Some(handle);
+    *sender = Some(tx);
+
+    SAMPLE_RATE.store(sample_rate, Ordering::Relaxed);
+    ENABLED.store(true, Ordering::Relaxed);
+    info!(
+        "Event sink writing {:?} to {} (1 in {} events)",
+        format, target, sample_rate
+    );
+    Ok(())
+}
+
+pub fn enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+/// Keep 1 in `rate` events per ring from now on.
+pub fn set_sample_rate(rate: u32) {
+    SAMPLE_RATE.store(rate.max(1), Ordering::Relaxed);
+}
+
+pub fn sample_rate() -> u32 {
+    SAMPLE_RATE.load(Ordering::Relaxed)
+}
+
+/// Queue one decoded event, stamped with its eBPF timestamp (`CLOCK_MONOTONIC`).
+/// Cheap when the sink is disabled or the event is sampled out.
+#[inline]
+pub fn record<T: Copy>(ring: RingId, timestamp_ns: u64, event: &T) {
+    if !ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    let rate = SAMPLE_RATE.load(Ordering::Relaxed) as u64;
+    if rate > 1 && SEEN[ring as usize].fetch_add(1, Ordering::Relaxed) % rate != 0 {
+        return;
+    }
+
+    let data = unsafe {
+        std::slice::from_raw_parts(event as *const T as *const u8, std::mem::size_of::<T>())
+    };
+    BATCH.with_borrow_mut(|batch| {
+        if batch.buf.capacity() == 0 {
+            batch.buf = take_buffer();
+        }
+        capture::encode_record(&mut batch.buf, ring, timestamp_ns, data);
+        batch.events += 1;
+        if batch.buf.len() >= BATCH_BYTES {
+            send(batch);
+        }
+    });
+}
+
+/// Hand this thread's pending events to the writer.
+pub fn flush() {
+    if !ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    BATCH.with_borrow_mut(|batch| {
+        if batch.events > 0 {
+            send(batch);
+        }
+    });
+}
+
+fn take_buffer() -> Vec<u8> {
+    POOL.lock()
+        .unwrap_or_else(|e| e.into_inner())
+        .pop()
+        .unwrap_or_else(|| Vec::with_capacity(BATCH_BYTES + 4096))
+}
+
+fn recycle_buffer(mut buf: Vec<u8>) {
+    buf.clear();
+    let mut pool = POOL.lock().unwrap_or_else(|e| e.into_inner());
+    if pool.len() < POOL_BUFFERS {
+        pool.push(buf);
+    }
+}
+
+fn send(batch: &mut Batch) {
+    let sender = SENDER.lock().unwrap_or_else(|e| e.into_inner());
+    let Some(tx) = sender.as_ref() else {
+        batch.buf.clear();
+        batch.events = 0;
+        return;
+    };
+    match tx.try_send(std::mem::take(batch)) {
+        Ok(()) => {}
+        Err(TrySendError::Full(mut rejected)) | Err(TrySendError::Disconnected(mut rejected)) => {
+            telemetry::record_sink_drops(rejected.events);
+            // Keep the allocation for the next batch
+            rejected.buf.clear();
+            rejected.events = 0;
+            *batch = rejected;
+        }
+    }
+}
+
+/// Flush the calling thread's batch, then stop the writer once it has written everything queued.
+pub fn shutdown() {
+    flush();
+    ENABLED.store(false, Ordering::Relaxed);
+    // The writer sees the disconnect only after receiving every queued batch
+    SENDER.lock().unwrap_or_else(|e| e.into_inner()).take();
+    if let Some(handle) = WRITER.lock().unwrap_or_else(|e| e.into_inner()).take() {
+        let _ = handle.join();
+    }
+}
+
+struct Output {
+    target: Target,
+    format: SinkFormat,
+    out: Option<BufWriter<Box<dyn Write + Send>>>,
+    opened: bool,
+    retry_at: Instant,
+}
+
+impl Output {
+    /// Connect (or reconnect) to the target, at most once per `RECONNECT_INTERVAL`.
+    fn ensure_open(&mut self) -> Option<&mut BufWriter<Box<dyn Write + Send>>> {
+        if self.out.is_none() && Instant::now() >= self.retry_at {
+            // A binary stream needs the capture header up front: start binary files afresh
+            // and send it on every socket connection. Reopened files continue where they were.
+            let binary = self.format == SinkFormat::Binary;
+            let fresh = binary && (!self.opened || matches!(self.target, Target::Socket(_)));
+            let opened = self.target.open(binary && !self.opened).and_then(|w| {
+                let mut out = BufWriter::with_capacity(WRITE_BUFFER_SIZE, w);
+                if fresh {
+                    capture::write_file_header(&mut out)?;
+                }
+                Ok(out)
+            });
+            match opened {
+                Ok(out) => {
+                    self.out = Some(out);
+                    self.opened = true;
+                }
+                Err(e) => {
+                    warn!("Event sink cannot open {}: {}", self.target, e);
+                    self.retry_at = Instant::now() + RECONNECT_INTERVAL;
+                }
+            }
+        }
+        self.out.as_mut()
+    }
+
+    fn write(&mut self, bytes: &[u8], events: u64) {
+        let Some(out) = self.ensure_open() else {
+            telemetry::record_sink_drops(events);
+            return;
+        };
+        match out.write_all(bytes) {
+            Ok(()) => telemetry::record_sink_events(events),
+            Err(e) => {
+                warn!("Event sink write to {} failed: {}", self.target, e);
+                self.out = None;
+                self.retry_at = Instant::now() + RECONNECT_INTERVAL;
+                telemetry::record_sink_drops(events);
+            }
+        }
+    }
+
+    fn flush(&mut self) {
+        if let Some(out) = self.out.as_mut()
+            && let Err(e) = out.flush()
+        {
+            warn!("Event sink flush to {} failed: {}", self.target, e);
+            self.out = None;
+            self.retry_at = Instant::now() + RECONNECT_INTERVAL;
+        }
+    }
+}
+
+fn run_writer(rx: Receiver<Batch>, target: Target, format: SinkFormat) {
+    let mut output = Output {
+        target,
+        format,
+        out: None,
+        opened: false,
+        retry_at: Instant::now(),
+    };
+    let mut lines = Vec::with_capacity(BATCH_BYTES * 2);
+
+    loop {
+        let batch = match rx.recv_timeout(FLUSH_INTERVAL) {
+            Ok(batch) => batch,
+            Err(RecvTimeoutError::Disconnected) => break,
+            Err(RecvTimeoutError::Timeout) => {
+                output.flush();
+                continue;
+            }
+        };
+        match format {
+            SinkFormat::Binary => output.write(&batch.buf, batch.events),
+            SinkFormat::Json => {
+                lines.clear();
+                for record in capture::decode_records(&batch.buf) {
+                    write_json(&mut lines, &record);
+                }
+                output.write(&lines, batch.events);
+            }
+        }
+        recycle_buffer(batch.buf);
+    }
+    output.flush();
+}
+
+/// Format one record as a JSON line. Records of rings without a JSON form are skipped.
+fn write_json(out: &mut Vec<u8>, record: &CaptureRecord) {
+    match record.ring {
+        RingId::BlockIo => {
+            let Some(e) = decode_event::<BlockIoEvent>(record.data) else {
+                return;
+            };
+            let event_type = match BlockIoEventType::from(e.event_type) {
+                BlockIoEventType::Start => "start",
+                BlockIoEventType::Done => "done",
+                BlockIoEventType::Unknown => "unknown",
+            };
+            json_prefix(out, "block_io", &e.metadata);
+            out.extend_from_slice(b",\"type\":\"");
+            out.extend_from_slice(event_type.as_bytes());
+            out.extend_from_slice(b"\",\"dev\":\"");
+            push_int(out, (e.dev >> 20) as i64);
+            out.push(b':');
+            push_int(out, (e.dev & 0xFFFFF) as i64);
+            out.push(b'"');
+            json_int(out, "sector", e.sector as i64);
+            json_int(out, "nr_sector", e.nr_sector as i64);
+            json_int(out, "bytes", e.bytes as i64);
+            json_str(out, "rwbs", &e.rwbs);
+            json_str(out, "comm", &e.comm);
+        }
+        RingId::Network => {
+            let Some(e) = decode_event::<ConnectionEvent>(record.data) else {
+                return;
+            };
+            json_prefix(out, "network", &e.metadata);
+            let _ = write!(
+                out,
+                ",\"dest\":\"{}\"",
+                std::net::Ipv4Addr::from(u32::from_be(e.dest_addr))
+            );
+            json_int(out, "port", u16::from_be(e.dest_port) as i64);
+        }
+        RingId::GpuOpen => {
+            let Some(e) = decode_event::<GpuOpenEvent>(record.data) else {
+                return;
+            };
+            json_prefix(out, "gpu_open", &e.metadata);
+            json_int(out, "gpu_index", e.gpu_index as i64);
+            json_int(out, "fd", e.fd as i64);
+            json_int(out, "flags", e.flags as i64);
+            json_str(out, "comm", &e.comm);
+            json_str(out, "file", &e.filename);
+        }
+        RingId::GpuClose => {
+            let Some(e) = decode_event::<GpuCloseEvent>(record.data) else {
+                return;
+            };
+            json_prefix(out, "gpu_close", &e.metadata);
+            json_int(out, "gpu_index", e.gpu_index as i64);
+            json_int(out, "fd", e.fd as i64);
+            json_str(out, "comm", &e.comm);
+        }
+        RingId::Ssl | RingId::Exec => return,
+    }
+    out.extend_from_slice(b"}\n");
+}
+
+// Fields are appended by hand: `write!` with format arguments costs several times more
+// than the event decoding itself.
+
+fn json_prefix(out: &mut Vec<u8>, probe: &str, metadata: &EventMetadata) {
+    out.extend_from_slice(b"{\"probe\":\"");
+    out.extend_from_slice(probe.as_bytes());
+    out.push(b'"');
+    json_int(out, "ts", metadata.timestamp as i64);
+    json_int(out, "pid", metadata.pid as i64);
+    // cgroup ids are inode numbers, well below i64::MAX
+    json_int(out, "cgroup_id", metadata.cgroup_id as i64);
+}
+
+fn json_key(out: &mut Vec<u8>, key: &str) {
+    out.extend_from_slice(b",\"");
+    out.extend_from_slice(key.as_bytes());
+    out.extend_from_slice(b"\":");
+}
+
+fn json_int(out: &mut Vec<u8>, key: &str, value: i64) {
+    json_key(out, key);
+    push_int(out, value);
+}
+
+fn push_int(out: &mut Vec<u8>, value: i64) {
+    if value < 0 {
+        out.push(b'-');
+    }
+    let mut n = value.unsigned_abs();
+    let mut digits = [0u8; 20];
+    let mut pos = digits.len();
+    loop {
+        pos -= 1;
+        digits[pos] = b'0' + (n % 10) as u8;
+        n /= 10;
+        if n == 0 {
+            break;
+        }
+    }
+    out.extend_from_slice(&digits[pos..]);
+}
+
+/// Append a NUL-terminated kernel string field, JSON-escaped.
+fn json_str(out: &mut Vec<u8>, key: &str, raw: &[u8]) {
+    let end = raw.iter().position(|&b| b == 0).unwrap_or(raw.len());
+    let value = &raw[..end];
+    json_key(out, key);
+    if value
+        .iter()
+        .all(|&b| b.is_ascii() && !b.is_ascii_control() && b != b'"' && b != b'\\')
+    {
+        out.push(b'"');
+        out.extend_from_slice(value);
+        out.push(b'"');
+    } else {
+        let _ = serde_json::to_writer(&mut *out, String::from_utf8_lossy(value).as_ref());
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_json_lines() {
+        let mut event: BlockIoEvent = unsafe { std::mem::zeroed() };
+        event.metadata.pid = 42;
+        event.metadata.timestamp = 7;
+        event.dev = (8 << 20) | 1;
+        event.bytes = 4096;
+        event.rwbs[..2].copy_from_slice(b"WS");
+        event.comm[..6].copy_from_slice(b"d\"d\\x\n");
+        event.event_type = BlockIoEventType::Done as u8;
+        let data = unsafe {
+            std::slice::from_raw_parts(
+                &event as *const _ as *const u8,
+                std::mem::size_of::<BlockIoEvent>(),
+            )
+        };
+
+        let mut encoded = Vec::new();
+        capture::encode_record(&mut encoded, RingId::BlockIo, 1, data);
+        capture::encode_record(&mut encoded, RingId::Exec, 2, &[0; 4]);
+        let mut lines = Vec::new();
+        for record in capture::decode_records(&encoded) {
+            write_json(&mut lines, &record);
+        }
+
+        let text = String::from_utf8(lines).unwrap();
+        assert_eq!(text.lines().count(), 1);
+        let value: serde_json::Value = serde_json::from_str(text.trim_end()).unwrap();
+        assert_eq!(value["probe"], "block_io");
+        assert_eq!(value["pid"], 42);
+        assert_eq!(value["type"], "done");
+        assert_eq!(value["dev"], "8:1");
+        assert_eq!(value["bytes"], 4096);
+        assert_eq!(value["rwbs"], "WS");
+        assert_eq!(value["comm"], "d\"d\\x\n");
+    }
+}
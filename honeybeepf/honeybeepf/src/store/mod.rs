@@ -0,0 +1,329 @@
+//! Local columnar event store, for deployments without a collector.
+//!
+//! Three tables are kept under `STORE__DIR`, one subdirectory each:
+//! - `llm_requests`: one row per parsed LLM exchange (model, tokens, latency)
+//! - `gpu_holds`: one row per GPU device fd, from open to close
+//! - `block_io`: per-cgroup, per-device operation and byte totals per interval
+//!
+//! Probe handlers only build rows (or bump block I/O totals) and hand them to a bounded
+//! queue. A dedicated I/O thread batches rows into row groups and writes hourly Parquet
+//! files (see `parquet`) with size-based rotation and a total size cap.
+//!
+//! `honeybeepf summarize` reads the files back (see `summary`).
+
+use std::{
+    collections::HashMap,
+    sync::{
+        Mutex,
+        atomic::{AtomicBool, Ordering},
+        mpsc::{SyncSender, TrySendError},
+    },
+    time::{Duration, SystemTime},
+};
+
+use anyhow::Result;
+use honeybeepf_common::{BlockIoEvent, BlockIoEventType, GpuCloseEvent, GpuOpenEvent};
+
+use crate::{probes::builtin::llm::types::LlmCompletion, settings::StoreSettings};
+
+mod parquet;
+pub mod summary;
+mod writer;
+
+const DEFAULT_ROTATE_MB: u64 = 64;
+const DEFAULT_RETENTION_MB: u64 = 1024;
+const DEFAULT_BATCH_ROWS: usize = 8192;
+const DEFAULT_QUEUE_CAPACITY: usize = 16384;
+const DEFAULT_BLOCK_IO_INTERVAL_SECS: u64 = 60;
+/// Distinct (cgroup, device, op) keys per block I/O interval; further keys are merged
+/// into cgroup 0 so a cgroup storm cannot grow the table without bound.
+const MAX_BLOCK_IO_KEYS: usize = 16384;
+/// GPU fds tracked between open and close
+const MAX_OPEN_GPU_FDS: usize = 65536;
+
+pub const LLM_REQUESTS: &str = "llm_requests";
+pub const GPU_HOLDS: &str = "gpu_holds";
+pub const BLOCK_IO: &str = "block_io";
+
+pub struct LlmRequestRow {
+    /// Completion time
+    pub time: SystemTime,
+    pub pid: u32,
+    pub cgroup_id: u64,
+    pub model: String,
+    pub prompt_tokens: u64,
+    pub completion_tokens: u64,
+    pub thoughts_tokens: Option<u64>,
+    pub cache_read_tokens: Option<u64>,
+    pub cache_write_tokens: Option<u64>,
+    pub latency: Duration,
+    /// Tokens counted locally, as the response carried no usage
+    pub estimated: bool,
+}
+
+pub struct GpuHoldRow {
+    /// Close time
+    pub time: SystemTime,
+    pub pid: u32,
+    pub cgroup_id: u64,
+    pub gpu_index: i32,
+    pub comm: String,
+    pub held: Duration,
+}
+
+pub struct BlockIoRow {
+    /// Start of the aggregation interval
+    pub time: SystemTime,
+    pub interval: Duration,
+    pub cgroup_id: u64,
+    /// major:minor
+    pub device: String,
+    /// First `rwbs` flag: R, W, D (discard) or F (flush)
+    pub op: String,
+    pub ops: u64,
+    pub bytes: u64,
+}
+
+pub enum StoreRecord {
+    LlmRequest(LlmRequestRow),
+    GpuHold(GpuHoldRow),
+}
+
+/// Resolved `StoreSettings`
+#[derive(Debug, Clone)]
+pub struct StoreConfig {
+    pub dir: std::path::PathBuf,
+    pub rotate_bytes: u64,
+    pub retention_bytes: u64,
+    pub batch_rows: usize,
+    pub block_io_interval: Duration,
+}
+
+impl StoreConfig {
+    pub fn from_settings(settings: &StoreSettings) -> Option<Self> {
+        let dir = settings.dir.as_ref()?;
+        Some(Self {
+            dir: dir.into(),
+            rotate_bytes: settings.rotate_mb.unwrap_or(DEFAULT_ROTATE_MB).max(1) * 1024 * 1024,
+            retention_bytes: settings.retention_mb.unwrap_or(DEFAULT_RETENTION_MB) * 1024 * 1024,
+            batch_rows: settings.batch_rows.unwrap_or(DEFAULT_BATCH_ROWS).max(1),
+            block_io_interval: Duration::from_secs(
+                settings
+                    .block_io_interval_secs
+                    .unwrap_or(DEFAULT_BLOCK_IO_INTERVAL_SECS)
+                    .max(1),
+            ),
+        })
+    }
+}
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static SENDER: Mutex<Option<SyncSender<StoreRecord>>> = Mutex::new(None);
+
+/// Start the store I/O thread. Does nothing unless `STORE__DIR` is set.
+pub fn init(settings: &StoreSettings) -> Result<()> {
+    let Some(config) = StoreConfig::from_settings(settings) else {
+        return Ok(());
+    };
+    let capacity = settings
+        .queue_capacity
+        .unwrap_or(DEFAULT_QUEUE_CAPACITY)
+        .max(1);
+    let tx = writer::spawn(config, capacity)?;
+    *SENDER.lock().unwrap_or_else(|e| e.into_inner()) = Some(tx);
+    ENABLED.store(true, Ordering::Relaxed);
+    Ok(())
+}
+
+/// Close the current files (writing their footers) and stop the I/O thread.
+pub fn shutdown() {
+    ENABLED.store(false, Ordering::Relaxed);
+    let tx = SENDER.lock().unwrap_or_else(|e| e.into_inner()).take();
+    if tx.is_some() {
+        drop(tx);
+        writer::join();
+    }
+}
+
+fn send(record: StoreRecord) {
+    let sender = SENDER.lock().unwrap_or_else(|e| e.into_inner());
+    if let Some(tx) = sender.as_ref()
+        && let Err(TrySendError::Full(_)) = tx.try_send(record)
+    {
+        crate::telemetry::record_store_drops(1);
+    }
+}
+
+pub fn record_llm(pid: u32, cgroup_id: u64, completion: &LlmCompletion) {
+    if !ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    let usage = &completion.usage;
+    send(StoreRecord::LlmRequest(LlmRequestRow {
+        time: SystemTime::now(),
+        pid,
+        cgroup_id,
+        model: usage.model.clone().unwrap_or_else(|| "unknown".to_string()),
+        prompt_tokens: usage.prompt_tokens,
+        completion_tokens: usage.completion_tokens,
+        thoughts_tokens: usage.thoughts_tokens,
+        cache_read_tokens: usage.cache_read_tokens,
+        cache_write_tokens: usage.cache_write_tokens,
+        latency: completion.latency,
+        estimated: usage.estimated,
+    }));
+}
+
+struct OpenGpuFd {
+    opened_ns: u64,
+    cgroup_id: u64,
+    gpu_index: i32,
+    comm: [u8; 16],
+}
+
+static OPEN_GPU_FDS: Mutex<Option<HashMap<(u32, i32), OpenGpuFd>>> = Mutex::new(None);
+
+pub fn record_gpu_open(event: &GpuOpenEvent) {
+    if !ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    let mut open = OPEN_GPU_FDS.lock().unwrap_or_else(|e| e.into_inner());
+    let open = open.get_or_insert_with(HashMap::new);
+    if open.len() >= MAX_OPEN_GPU_FDS {
+        // Closes were lost (e.g. process killed); start over rather than grow
+        open.clear();
+    }
+    open.insert(
+        (event.metadata.pid, event.fd),
+        OpenGpuFd {
+            opened_ns: event.metadata.timestamp,
+            cgroup_id: event.metadata.cgroup_id,
+            gpu_index: event.gpu_index,
+            comm: event.comm,
+        },
+    );
+}
+
+pub fn record_gpu_close(event: &GpuCloseEvent) {
+    if !ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    let opened = OPEN_GPU_FDS
+        .lock()
+        .unwrap_or_else(|e| e.into_inner())
+        .as_mut()
+        .and_then(|open| open.remove(&(event.metadata.pid, event.fd)));
+    let Some(opened) = opened else {
+        return;
+    };
+    let end = opened.comm.iter().position(|&b| b == 0).unwrap_or(16);
+    send(StoreRecord::GpuHold(GpuHoldRow {
+        time: SystemTime::now(),
+        pid: event.metadata.pid,
+        cgroup_id: opened.cgroup_id,
+        gpu_index: opened.gpu_index,
+        comm: String::from_utf8_lossy(&opened.comm[..end]).into_owned(),
+        held: Duration::from_nanos(event.metadata.timestamp.saturating_sub(opened.opened_ns)),
+    }));
+}
+
+#[derive(Clone, Copy, PartialEq, Eq, Hash)]
+struct BlockIoKey {
+    cgroup_id: u64,
+    dev: u32,
+    op: u8,
+}
+
+#[derive(Default)]
+struct BlockIoTotals {
+    ops: u64,
+    bytes: u64,
+}
+
+static BLOCK_IO_TOTALS: Mutex<Option<HashMap<BlockIoKey, BlockIoTotals>>> = Mutex::new(None);
+
+/// Count an issued request. Completions carry no reliable task context, so only starts count.
+/// `weight` is the number of requests this event stands for while the ring is sampled.
+pub fn record_block_io(event: &BlockIoEvent, weight: u64) {
+    if !ENABLED.load(Ordering::Relaxed)
+        || BlockIoEventType::from(event.event_type) != BlockIoEventType::Start
+    {
+        return;
+    }
+    let mut key = BlockIoKey {
+        cgroup_id: event.metadata.cgroup_id,
+        dev: event.dev,
+        op: match event.rwbs[0] {
+            op @ (b'R' | b'W' | b'D' | b'F') => op,
+            _ => b'?',
+        },
+    };
+    let mut totals = BLOCK_IO_TOTALS.lock().unwrap_or_else(|e| e.into_inner());
+    let totals = totals.get_or_insert_with(HashMap::new);
+    if totals.len() >= MAX_BLOCK_IO_KEYS && !totals.contains_key(&key) {
+        key.cgroup_id = 0;
+    }
+    let entry = totals.entry(key).or_default();
+    entry.ops += weight;
+    entry.bytes += event.bytes as u64 * weight;
+}
+
+/// Take the block I/O totals accumulated since the last call, as rows for `interval`.
+fn drain_block_io(start: SystemTime, interval: Duration) -> Vec<BlockIoRow> {
+    let totals = BLOCK_IO_TOTALS
+        .lock()
+        .unwrap_or_else(|e| e.into_inner())
+        .take()
+        .unwrap_or_default();
+    totals
+        .into_iter()
+        .map(|(key, totals)| BlockIoRow {
+            time: start,
+            interval,
+            cgroup_id: key.cgroup_id,
+            device: format!("{}:{}", key.dev >> 20, key.dev & 0xFFFFF),
+            op: (key.op as char).to_string(),
+            ops: totals.ops,
+            bytes: totals.bytes,
+        })
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_block_io_totals() {
+        ENABLED.store(true, Ordering::Relaxed);
+        let mut event: BlockIoEvent = unsafe { std::mem::zeroed() };
+        event.metadata.cgroup_id = 7;
+        event.dev = (8 << 20) | 16;
+        event.bytes = 4096;
+        event.rwbs[0] = b'W';
+        event.event_type = BlockIoEventType::Start as u8;
+        record_block_io(&event, 1);
+        record_block_io(&event, 1);
+        event.rwbs[0] = b'R';
+        // Sampled 1 in 4
+        record_block_io(&event, 4);
+        // Completions are not counted
+        event.event_type = BlockIoEventType::Done as u8;
+        record_block_io(&event, 1);
+        ENABLED.store(false, Ordering::Relaxed);
+
+        let mut rows = drain_block_io(SystemTime::UNIX_EPOCH, Duration::from_secs(60));
+        rows.sort_by(|a, b| a.op.cmp(&b.op));
+        assert_eq!(rows.len(), 2);
+        assert_eq!(
+            (rows[0].op.as_str(), rows[0].ops, rows[0].bytes),
+            ("R", 4, 16384)
+        );
+        assert_eq!(
+            (rows[1].op.as_str(), rows[1].ops, rows[1].bytes),
+            ("W", 2, 8192)
+        );
+        assert_eq!(rows[1].device, "8:16");
+        assert!(drain_block_io(SystemTime::UNIX_EPOCH, Duration::from_secs(60)).is_empty());
+    }
+}
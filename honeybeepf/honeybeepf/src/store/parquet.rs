@@ -0,0 +1,1073 @@
+//! Minimal Parquet codec for the store's flat tables.
+//!
+//! Writes flat schemas of required and optional primitive columns: one uncompressed data
+//! page (v1, PLAIN values, RLE definition levels) per column chunk, and the thrift
+//! compact footer. The reader covers the same subset, which is what `summarize` needs to
+//! read the store back; files from other writers fail with an error when they use
+//! nesting, dictionaries, compression or v2 pages.
+//!
+//! The `parquet` and `arrow` crates would bring arrow's array stack, its codecs and thrift
+//! into an agent that runs on every node, for a handful of flat tables. The subset written
+//! here is the one every reader must support, and `test_standard_reader` checks the files
+//! with pyarrow where it is installed.
+
+use std::{io::Write, path::Path};
+
+use anyhow::{Context, Result, anyhow, bail, ensure};
+
+const MAGIC: &[u8; 4] = b"PAR1";
+const CREATED_BY: &str = concat!("honeybeepf version ", env!("CARGO_PKG_VERSION"));
+
+// Physical types
+const BOOLEAN: i64 = 0;
+const INT32: i64 = 1;
+const INT64: i64 = 2;
+const DOUBLE: i64 = 5;
+const BYTE_ARRAY: i64 = 6;
+// Field repetition
+const REQUIRED: i64 = 0;
+const OPTIONAL: i64 = 1;
+// Converted types, for readers that predate logical types
+const UTF8: i64 = 0;
+const TIMESTAMP_MICROS: i64 = 10;
+const UINT_32: i64 = 13;
+const UINT_64: i64 = 14;
+// Pages, encodings and codecs
+const DATA_PAGE: i64 = 0;
+const INDEX_PAGE: i64 = 1;
+const PLAIN: i64 = 0;
+const RLE: i64 = 3;
+const UNCOMPRESSED: i64 = 0;
+
+// Thrift compact protocol type codes
+const STOP: u8 = 0;
+const TRUE: u8 = 1;
+const FALSE: u8 = 2;
+const BYTE: u8 = 3;
+const I16: u8 = 4;
+const I32: u8 = 5;
+const I64: u8 = 6;
+const F64: u8 = 7;
+const BINARY: u8 = 8;
+const LIST: u8 = 9;
+const SET: u8 = 10;
+const MAP: u8 = 11;
+const STRUCT: u8 = 12;
+/// Nesting limit when decoding a footer, against corrupt or hostile files
+const MAX_DEPTH: usize = 32;
+
+/// Column types, each stored as one of the physical types
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Kind {
+    Boolean,
+    Int32,
+    /// Stored as INT32
+    UInt32,
+    /// Stored as INT64
+    UInt64,
+    Float64,
+    Utf8,
+    /// Microseconds since the epoch, UTC; stored as INT64
+    TimestampMicros,
+}
+
+impl Kind {
+    fn physical(self) -> i64 {
+        match self {
+            Kind::Boolean => BOOLEAN,
+            Kind::Int32 | Kind::UInt32 => INT32,
+            Kind::UInt64 | Kind::TimestampMicros => INT64,
+            Kind::Float64 => DOUBLE,
+            Kind::Utf8 => BYTE_ARRAY,
+        }
+    }
+
+    fn converted(self) -> Option<i64> {
+        match self {
+            Kind::UInt32 => Some(UINT_32),
+            Kind::UInt64 => Some(UINT_64),
+            Kind::Utf8 => Some(UTF8),
+            Kind::TimestampMicros => Some(TIMESTAMP_MICROS),
+            Kind::Boolean | Kind::Int32 | Kind::Float64 => None,
+        }
+    }
+
+    /// The `LogicalType` union (SchemaElement field 10)
+    fn logical(self, t: &mut Compact) {
+        match self {
+            Kind::Utf8 => {
+                t.begin_struct(10);
+                t.empty_struct(1); // STRING
+                t.end_struct();
+            }
+            Kind::TimestampMicros => {
+                t.begin_struct(10);
+                t.begin_struct(8); // TIMESTAMP
+                t.bool(1, true); // isAdjustedToUTC
+                t.begin_struct(2);
+                t.empty_struct(2); // MICROS
+                t.end_struct();
+                t.end_struct();
+                t.end_struct();
+            }
+            Kind::UInt32 | Kind::UInt64 => {
+                t.begin_struct(10);
+                t.begin_struct(10); // INTEGER
+                t.byte(1, if self == Kind::UInt32 { 32 } else { 64 });
+                t.bool(2, false);
+                t.end_struct();
+                t.end_struct();
+            }
+            Kind::Boolean | Kind::Int32 | Kind::Float64 => {}
+        }
+    }
+}
+
+pub struct Field {
+    pub name: &'static str,
+    pub kind: Kind,
+    pub nullable: bool,
+}
+
+impl Field {
+    pub const fn new(name: &'static str, kind: Kind, nullable: bool) -> Self {
+        Self {
+            name,
+            kind,
+            nullable,
+        }
+    }
+}
+
+/// Values of one column chunk, by physical type. `None` is a null.
+#[derive(Debug, Clone, PartialEq)]
+pub enum Column {
+    Boolean(Vec<Option<bool>>),
+    Int32(Vec<Option<i32>>),
+    Int64(Vec<Option<i64>>),
+    Double(Vec<Option<f64>>),
+    ByteArray(Vec<Option<Vec<u8>>>),
+}
+
+impl Column {
+    fn empty(physical: i64) -> Result<Self> {
+        Ok(match physical {
+            BOOLEAN => Column::Boolean(Vec::new()),
+            INT32 => Column::Int32(Vec::new()),
+            INT64 => Column::Int64(Vec::new()),
+            DOUBLE => Column::Double(Vec::new()),
+            BYTE_ARRAY => Column::ByteArray(Vec::new()),
+            other => bail!("Unsupported physical type {}", other),
+        })
+    }
+
+    fn len(&self) -> usize {
+        match self {
+            Column::Boolean(v) => v.len(),
+            Column::Int32(v) => v.len(),
+            Column::Int64(v) => v.len(),
+            Column::Double(v) => v.len(),
+            Column::ByteArray(v) => v.len(),
+        }
+    }
+
+    pub fn as_int64(&self) -> Option<&[Option<i64>]> {
+        match self {
+            Column::Int64(v) => Some(v),
+            _ => None,
+        }
+    }
+
+    pub fn as_double(&self) -> Option<&[Option<f64>]> {
+        match self {
+            Column::Double(v) => Some(v),
+            _ => None,
+        }
+    }
+
+    pub fn as_byte_array(&self) -> Option<&[Option<Vec<u8>>]> {
+        match self {
+            Column::ByteArray(v) => Some(v),
+            _ => None,
+        }
+    }
+
+    fn physical(&self) -> i64 {
+        match self {
+            Column::Boolean(_) => BOOLEAN,
+            Column::Int32(_) => INT32,
+            Column::Int64(_) => INT64,
+            Column::Double(_) => DOUBLE,
+            Column::ByteArray(_) => BYTE_ARRAY,
+        }
+    }
+
+    fn defined(&self) -> Vec<bool> {
+        match self {
+            Column::Boolean(v) => v.iter().map(Option::is_some).collect(),
+            Column::Int32(v) => v.iter().map(Option::is_some).collect(),
+            Column::Int64(v) => v.iter().map(Option::is_some).collect(),
+            Column::Double(v) => v.iter().map(Option::is_some).collect(),
+            Column::ByteArray(v) => v.iter().map(Option::is_some).collect(),
+        }
+    }
+
+    /// PLAIN encoding of the non-null values
+    fn encode_plain(&self, out: &mut Vec<u8>) {
+        match self {
+            Column::Boolean(v) => {
+                let bits: Vec<bool> = v.iter().flatten().copied().collect();
+                out.extend(bits.chunks(8).map(|byte| {
+                    byte.iter()
+                        .enumerate()
+                        .fold(0u8, |acc, (i, &bit)| acc | (bit as u8) << i)
+                }));
+            }
+            Column::Int32(v) => v
+                .iter()
+                .flatten()
+                .for_each(|x| out.extend_from_slice(&x.to_le_bytes())),
+            Column::Int64(v) => v
+                .iter()
+                .flatten()
+                .for_each(|x| out.extend_from_slice(&x.to_le_bytes())),
+            Column::Double(v) => v
+                .iter()
+                .flatten()
+                .for_each(|x| out.extend_from_slice(&x.to_le_bytes())),
+            Column::ByteArray(v) => {
+                for x in v.iter().flatten() {
+                    out.extend_from_slice(&(x.len() as u32).to_le_bytes());
+                    out.extend_from_slice(x);
+                }
+            }
+        }
+    }
+
+    /// Append PLAIN-encoded values for a page, with nulls where `defined` is false
+    fn decode_plain(&mut self, d: &mut Decoder<'_>, defined: &[bool]) -> Result<()> {
+        match self {
+            Column::Boolean(v) => {
+                let count = defined.iter().filter(|&&def| def).count();
+                let bits = d.take(count.div_ceil(8))?;
+                let mut i = 0;
+                for &def in defined {
+                    v.push(def.then(|| {
+                        let bit = bits[i / 8] >> (i % 8) & 1 != 0;
+                        i += 1;
+                        bit
+                    }));
+                }
+            }
+            Column::Int32(v) => {
+                for &def in defined {
+                    v.push(if def {
+                        Some(i32::from_le_bytes(d.array()?))
+                    } else {
+                        None
+                    });
+                }
+            }
+            Column::Int64(v) => {
+                for &def in defined {
+                    v.push(if def {
+                        Some(i64::from_le_bytes(d.array()?))
+                    } else {
+                        None
+                    });
+                }
+            }
+            Column::Double(v) => {
+                for &def in defined {
+                    v.push(if def {
+                        Some(f64::from_le_bytes(d.array()?))
+                    } else {
+                        None
+                    });
+                }
+            }
+            Column::ByteArray(v) => {
+                for &def in defined {
+                    v.push(if def {
+                        let len = u32::from_le_bytes(d.array()?) as usize;
+                        Some(d.take(len)?.to_vec())
+                    } else {
+                        None
+                    });
+                }
+            }
+        }
+        Ok(())
+    }
+}
+
+struct ChunkMeta {
+    offset: u64,
+    size: u64,
+}
+
+/// Writes row groups to `out` as they come and the footer on `close`.
+pub struct FileWriter<W: Write> {
+    out: W,
+    fields: &'static [Field],
+    written: u64,
+    /// Rows and column chunks of each row group written
+    row_groups: Vec<(usize, Vec<ChunkMeta>)>,
+}
+
+impl<W: Write> FileWriter<W> {
+    pub fn new(mut out: W, fields: &'static [Field]) -> Result<Self> {
+        out.write_all(MAGIC)?;
+        Ok(Self {
+            out,
+            fields,
+            written: MAGIC.len() as u64,
+            row_groups: Vec::new(),
+        })
+    }
+
+    pub fn bytes_written(&self) -> u64 {
+        self.written
+    }
+
+    /// Write one row group, with a column for each field, in schema order.
+    pub fn write_row_group(&mut self, columns: &[Column]) -> Result<()> {
+        ensure!(
+            columns.len() == self.fields.len(),
+            "{} columns for {} fields",
+            columns.len(),
+            self.fields.len()
+        );
+        let rows = columns.first().map_or(0, Column::len);
+        // Encode every page first, so that bad input leaves the file as it was
+        let pages = self
+            .fields
+            .iter()
+            .zip(columns)
+            .map(|(field, column)| {
+                ensure!(
+                    column.len() == rows,
+                    "Column {} has {} values for {} rows",
+                    field.name,
+                    column.len(),
+                    rows
+                );
+                data_page(field, column)
+            })
+            .collect::<Result<Vec<_>>>()?;
+        let mut chunks = Vec::with_capacity(pages.len());
+        for page in pages {
+            self.out.write_all(&page)?;
+            chunks.push(ChunkMeta {
+                offset: self.written,
+                size: page.len() as u64,
+            });
+            self.written += page.len() as u64;
+        }
+        self.row_groups.push((rows, chunks));
+        Ok(())
+    }
+
+    pub fn flush(&mut self) -> Result<()> {
+        Ok(self.out.flush()?)
+    }
+
+    /// Write the footer and return the flushed output.
+    pub fn close(mut self) -> Result<W> {
+        let footer = self.footer();
+        self.out.write_all(&footer)?;
+        self.out.write_all(&(footer.len() as u32).to_le_bytes())?;
+        self.out.write_all(MAGIC)?;
+        self.out.flush()?;
+        Ok(self.out)
+    }
+
+    /// FileMetaData
+    fn footer(&self) -> Vec<u8> {
+        let mut t = Compact::new();
+        t.i32(1, 1); // version
+        t.begin_list(2, STRUCT, self.fields.len() + 1);
+        t.begin_element();
+        t.binary(4, b"schema");
+        t.i32(5, self.fields.len() as i32); // num_children
+        t.end_struct();
+        for field in self.fields {
+            t.begin_element();
+            t.i32(1, field.kind.physical() as i32);
+            t.i32(3, if field.nullable { OPTIONAL } else { REQUIRED } as i32);
+            t.binary(4, field.name.as_bytes());
+            if let Some(converted) = field.kind.converted() {
+                t.i32(6, converted as i32);
+            }
+            field.kind.logical(&mut t);
+            t.end_struct();
+        }
+        t.i64(
+            3,
+            self.row_groups.iter().map(|(rows, _)| *rows as i64).sum(),
+        );
+
+        t.begin_list(4, STRUCT, self.row_groups.len());
+        for (rows, chunks) in &self.row_groups {
+            t.begin_element();
+            t.begin_list(1, STRUCT, chunks.len());
+            for (field, chunk) in self.fields.iter().zip(chunks) {
+                t.begin_element();
+                t.i64(2, chunk.offset as i64); // file_offset
+                t.begin_struct(3); // ColumnMetaData
+                t.i32(1, field.kind.physical() as i32);
+                t.begin_list(2, I32, 2);
+                t.element_i32(PLAIN as i32);
+                t.element_i32(RLE as i32);
+                t.begin_list(3, BINARY, 1);
+                t.element_binary(field.name.as_bytes());
+                t.i32(4, UNCOMPRESSED as i32);
+                t.i64(5, *rows as i64);
+                t.i64(6, chunk.size as i64);
+                t.i64(7, chunk.size as i64);
+                t.i64(9, chunk.offset as i64); // data_page_offset
+                t.end_struct();
+                t.end_struct();
+            }
+            t.i64(2, chunks.iter().map(|c| c.size as i64).sum()); // total_byte_size
+            t.i64(3, *rows as i64);
+            t.end_struct();
+        }
+        t.binary(6, CREATED_BY.as_bytes());
+        t.finish()
+    }
+}
+
+/// A column chunk as a single data page: header, definition levels, values.
+fn data_page(field: &Field, column: &Column) -> Result<Vec<u8>> {
+    ensure!(
+        column.physical() == field.kind.physical(),
+        "Column {} does not match its {:?} field",
+        field.name,
+        field.kind
+    );
+    let defined = column.defined();
+    let mut body = Vec::new();
+    if field.nullable {
+        let levels = encode_levels(&defined);
+        body.extend_from_slice(&(levels.len() as u32).to_le_bytes());
+        body.extend_from_slice(&levels);
+    } else {
+        ensure!(
+            defined.iter().all(|&def| def),
+            "Null in required column {}",
+            field.name
+        );
+    }
+    column.encode_plain(&mut body);
+    let size = i32::try_from(body.len()).context("Page too large")?;
+
+    let mut t = Compact::new();
+    t.i32(1, DATA_PAGE as i32);
+    t.i32(2, size); // uncompressed
+    t.i32(3, size); // compressed
+    t.begin_struct(5);
+    t.i32(1, column.len() as i32);
+    t.i32(2, PLAIN as i32);
+    t.i32(3, RLE as i32); // definition levels
+    t.i32(4, RLE as i32); // repetition levels (none, flat schema)
+    t.end_struct();
+    let mut page = t.finish();
+    page.extend_from_slice(&body);
+    Ok(page)
+}
+
+/// Definition levels of bit width 1 in the RLE/bit-packing hybrid, as RLE runs only
+fn encode_levels(defined: &[bool]) -> Vec<u8> {
+    let mut out = Vec::new();
+    let mut rest = defined;
+    while let Some(&first) = rest.first() {
+        let run = rest.iter().take_while(|&&def| def == first).count();
+        varint(&mut out, (run as u64) << 1);
+        out.push(first as u8);
+        rest = &rest[run..];
+    }
+    out
+}
+
+fn decode_levels(bytes: &[u8], count: usize) -> Result<Vec<bool>> {
+    let mut d = Decoder::new(bytes);
+    let mut levels = Vec::with_capacity(count);
+    while levels.len() < count {
+        let header = d.varint()?;
+        let len = (header >> 1) as usize;
+        if header & 1 == 0 {
+            let level = d.byte()? != 0;
+            levels.extend(std::iter::repeat_n(level, len.min(count - levels.len())));
+        } else {
+            // `len` groups of 8 levels, one byte each at bit width 1
+            for &byte in d.take(len)? {
+                for bit in 0..8 {
+                    if levels.len() < count {
+                        levels.push(byte >> bit & 1 != 0);
+                    }
+                }
+            }
+        }
+    }
+    Ok(levels)
+}
+
+fn varint(out: &mut Vec<u8>, mut value: u64) {
+    while value >= 0x80 {
+        out.push(value as u8 | 0x80);
+        value >>= 7;
+    }
+    out.push(value as u8);
+}
+
+fn zigzag(value: i64) -> u64 {
+    ((value << 1) ^ (value >> 63)) as u64
+}
+
+/// Thrift compact protocol encoder
+struct Compact {
+    buf: Vec<u8>,
+    /// Last field id of each open struct, for the delta-encoded field headers
+    last: Vec<i16>,
+}
+
+impl Compact {
+    fn new() -> Self {
+        Self {
+            buf: Vec::new(),
+            last: vec![0],
+        }
+    }
+
+    fn header(&mut self, id: i16, kind: u8) {
+        let last = self.last.last_mut().expect("inside a struct");
+        let delta = id - *last;
+        if (1..=15).contains(&delta) {
+            self.buf.push((delta as u8) << 4 | kind);
+        } else {
+            self.buf.push(kind);
+            varint(&mut self.buf, zigzag(id as i64));
+        }
+        *last = id;
+    }
+
+    fn bool(&mut self, id: i16, value: bool) {
+        self.header(id, if value { TRUE } else { FALSE });
+    }
+
+    fn byte(&mut self, id: i16, value: i8) {
+        self.header(id, BYTE);
+        self.buf.push(value as u8);
+    }
+
+    fn i32(&mut self, id: i16, value: i32) {
+        self.header(id, I32);
+        varint(&mut self.buf, zigzag(value as i64));
+    }
+
+    fn i64(&mut self, id: i16, value: i64) {
+        self.header(id, I64);
+        varint(&mut self.buf, zigzag(value));
+    }
+
+    fn binary(&mut self, id: i16, value: &[u8]) {
+        self.header(id, BINARY);
+        self.element_binary(value);
+    }
+
+    fn begin_struct(&mut self, id: i16) {
+        self.header(id, STRUCT);
+        self.last.push(0);
+    }
+
+    fn end_struct(&mut self) {
+        self.buf.push(STOP);
+        self.last.pop();
+    }
+
+    fn empty_struct(&mut self, id: i16) {
+        self.begin_struct(id);
+        self.end_struct();
+    }
+
+    fn begin_list(&mut self, id: i16, kind: u8, len: usize) {
+        self.header(id, LIST);
+        if len < 15 {
+            self.buf.push((len as u8) << 4 | kind);
+        } else {
+            self.buf.push(0xf0 | kind);
+            varint(&mut self.buf, len as u64);
+        }
+    }
+
+    /// A struct element of a list, closed with `end_struct`
+    fn begin_element(&mut self) {
+        self.last.push(0);
+    }
+
+    fn element_i32(&mut self, value: i32) {
+        varint(&mut self.buf, zigzag(value as i64));
+    }
+
+    fn element_binary(&mut self, value: &[u8]) {
+        varint(&mut self.buf, value.len() as u64);
+        self.buf.extend_from_slice(value);
+    }
+
+    fn finish(mut self) -> Vec<u8> {
+        self.buf.push(STOP);
+        self.buf
+    }
+}
+
+/// A decoded thrift compact value. Booleans are read as integers, maps are flattened to
+/// their keys and values in turn.
+enum Value<'a> {
+    Int(i64),
+    /// Doubles, which the footer fields read here never are
+    Skipped,
+    Binary(&'a [u8]),
+    List(Vec<Value<'a>>),
+    Struct(Vec<(i16, Value<'a>)>),
+}
+
+impl<'a> Value<'a> {
+    fn field(&self, id: i16) -> Option<&Value<'a>> {
+        match self {
+            Value::Struct(fields) => fields.iter().find(|(i, _)| *i == id).map(|(_, v)| v),
+            _ => None,
+        }
+    }
+
+    fn int(&self, id: i16) -> Result<i64> {
+        match self.field(id) {
+            Some(Value::Int(v)) => Ok(*v),
+            _ => Err(anyhow!("Missing integer field {}", id)),
+        }
+    }
+
+    fn binary(&self, id: i16) -> Result<&'a [u8]> {
+        match self.field(id) {
+            Some(Value::Binary(v)) => Ok(v),
+            _ => Err(anyhow!("Missing binary field {}", id)),
+        }
+    }
+
+    fn list(&self, id: i16) -> Result<&[Value<'a>]> {
+        match self.field(id) {
+            Some(Value::List(v)) => Ok(v),
+            _ => Err(anyhow!("Missing list field {}", id)),
+        }
+    }
+}
+
+struct Decoder<'a> {
+    buf: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Decoder<'a> {
+    fn new(buf: &'a [u8]) -> Self {
+        Self { buf, pos: 0 }
+    }
+
+    fn remaining(&self) -> usize {
+        self.buf.len() - self.pos
+    }
+
+    fn take(&mut self, len: usize) -> Result<&'a [u8]> {
+        ensure!(len <= self.remaining(), "Truncated Parquet data");
+        let bytes = &self.buf[self.pos..self.pos + len];
+        self.pos += len;
+        Ok(bytes)
+    }
+
+    fn array<const N: usize>(&mut self) -> Result<[u8; N]> {
+        Ok(self.take(N)?.try_into().expect("N bytes"))
+    }
+
+    fn byte(&mut self) -> Result<u8> {
+        Ok(self.take(1)?[0])
+    }
+
+    fn varint(&mut self) -> Result<u64> {
+        let mut value = 0u64;
+        for shift in (0..64).step_by(7) {
+            let byte = self.byte()?;
+            value |= ((byte & 0x7f) as u64) << shift;
+            if byte & 0x80 == 0 {
+                return Ok(value);
+            }
+        }
+        bail!("Varint too long")
+    }
+
+    fn zigzag(&mut self) -> Result<i64> {
+        let value = self.varint()?;
+        Ok((value >> 1) as i64 ^ -((value & 1) as i64))
+    }
+
+    fn value(&mut self, kind: u8, depth: usize) -> Result<Value<'a>> {
+        ensure!(depth < MAX_DEPTH, "Parquet metadata nested too deep");
+        Ok(match kind {
+            TRUE => Value::Int(1),
+            FALSE => Value::Int(0),
+            BYTE => Value::Int(self.byte()? as i8 as i64),
+            I16 | I32 | I64 => Value::Int(self.zigzag()?),
+            F64 => {
+                self.take(8)?;
+                Value::Skipped
+            }
+            BINARY => {
+                let len = self.varint()? as usize;
+                Value::Binary(self.take(len)?)
+            }
+            LIST | SET => {
+                let header = self.byte()?;
+                let len = match header >> 4 {
+                    15 => self.varint()? as usize,
+                    len => len as usize,
+                };
+                let kind = header & 0xf;
+                let elements = (0..len)
+                    .map(|_| match kind {
+                        // Booleans in collections take a byte each
+                        TRUE | FALSE => Ok(Value::Int((self.byte()? == TRUE) as i64)),
+                        kind => self.value(kind, depth + 1),
+                    })
+                    .collect::<Result<_>>()?;
+                Value::List(elements)
+            }
+            MAP => {
+                let len = self.varint()? as usize;
+                let mut entries = Vec::new();
+                if len > 0 {
+                    let kinds = self.byte()?;
+                    for _ in 0..len {
+                        entries.push(self.value(kinds >> 4, depth + 1)?);
+                        entries.push(self.value(kinds & 0xf, depth + 1)?);
+                    }
+                }
+                Value::List(entries)
+            }
+            STRUCT => self.structure(depth + 1)?,
+            kind => bail!("Bad thrift type {}", kind),
+        })
+    }
+
+    fn structure(&mut self, depth: usize) -> Result<Value<'a>> {
+        let mut fields = Vec::new();
+        let mut last = 0i16;
+        loop {
+            let header = self.byte()?;
+            if header == STOP {
+                return Ok(Value::Struct(fields));
+            }
+            let id = match header >> 4 {
+                0 => self.zigzag()? as i16,
+                delta => last.wrapping_add(delta as i16),
+            };
+            last = id;
+            fields.push((id, self.value(header & 0xf, depth)?));
+        }
+    }
+}
+
+/// A row group read back, with its columns by name
+pub struct RowGroup {
+    pub rows: usize,
+    columns: Vec<(String, Column)>,
+}
+
+impl RowGroup {
+    pub fn column(&self, name: &str) -> Option<&Column> {
+        self.columns
+            .iter()
+            .find(|(column, _)| column == name)
+            .map(|(_, values)| values)
+    }
+}
+
+struct Leaf {
+    name: String,
+    physical: i64,
+    optional: bool,
+}
+
+pub fn read_file(path: &Path) -> Result<Vec<RowGroup>> {
+    let bytes = std::fs::read(path)?;
+    read(&bytes)
+}
+
+pub fn read(bytes: &[u8]) -> Result<Vec<RowGroup>> {
+    ensure!(
+        bytes.len() >= 12 && bytes.starts_with(MAGIC) && bytes.ends_with(MAGIC),
+        "Not a Parquet file"
+    );
+    let end = bytes.len() - 8;
+    let footer_len = u32::from_le_bytes(bytes[end..end + 4].try_into().expect("4 bytes")) as usize;
+    let start = end
+        .checked_sub(footer_len)
+        .filter(|&start| start >= MAGIC.len())
+        .context("Bad footer length")?;
+    let meta = Decoder::new(&bytes[start..end]).structure(0)?;
+
+    let leaves = meta
+        .list(2)?
+        .iter()
+        .skip(1)
+        .map(|element| {
+            ensure!(
+                element.field(5).is_none(),
+                "Nested columns are not supported"
+            );
+            Ok(Leaf {
+                name: String::from_utf8_lossy(element.binary(4)?).into_owned(),
+                physical: element.int(1)?,
+                optional: element.int(3)? != REQUIRED,
+            })
+        })
+        .collect::<Result<Vec<_>>>()?;
+
+    meta.list(4)?
+        .iter()
+        .map(|group| {
+            let chunks = group.list(1)?;
+            ensure!(
+                chunks.len() == leaves.len(),
+                "Row group has {} columns for {} fields",
+                chunks.len(),
+                leaves.len()
+            );
+            let rows = group.int(3)? as usize;
+            let columns = leaves
+                .iter()
+                .zip(chunks)
+                .map(|(leaf, chunk)| {
+                    let meta = chunk.field(3).context("Column chunk without metadata")?;
+                    let column = read_chunk(bytes, leaf, meta)
+                        .with_context(|| format!("Column {}", leaf.name))?;
+                    // Flat schema: one value (or null) per row
+                    ensure!(
+                        column.len() == rows,
+                        "Column {} has {} values for {} rows",
+                        leaf.name,
+                        column.len(),
+                        rows
+                    );
+                    Ok((leaf.name.clone(), column))
+                })
+                .collect::<Result<_>>()?;
+            Ok(RowGroup { rows, columns })
+        })
+        .collect()
+}
+
+fn read_chunk(file: &[u8], leaf: &Leaf, meta: &Value<'_>) -> Result<Column> {
+    ensure!(
+        meta.int(4)? == UNCOMPRESSED,
+        "Compressed columns are not supported"
+    );
+    ensure!(
+        meta.field(11).is_none(),
+        "Dictionary encoding is not supported"
+    );
+    let start = meta.int(9)? as usize;
+    let len = meta.int(7)? as usize;
+    let chunk = start
+        .checked_add(len)
+        .and_then(|end| file.get(start..end))
+        .context("Column chunk out of bounds")?;
+
+    let mut column = Column::empty(leaf.physical)?;
+    let mut d = Decoder::new(chunk);
+    while d.remaining() > 0 {
+        let header = d.structure(0)?;
+        let body = d.take(header.int(3)? as usize)?;
+        match header.int(1)? {
+            DATA_PAGE => {
+                let page = header.field(5).context("Data page without header")?;
+                ensure!(page.int(2)? == PLAIN, "Only PLAIN encoding is supported");
+                let count = page.int(1)? as usize;
+                let mut body = Decoder::new(body);
+                let defined = if leaf.optional {
+                    let len = u32::from_le_bytes(body.array()?) as usize;
+                    decode_levels(body.take(len)?, count)?
+                } else {
+                    vec![true; count]
+                };
+                column.decode_plain(&mut body, &defined)?;
+            }
+            INDEX_PAGE => {}
+            other => bail!("Unsupported page type {}", other),
+        }
+    }
+    ensure!(
+        column.len() as i64 == meta.int(5)?,
+        "Expected {} values, read {}",
+        meta.int(5)?,
+        column.len()
+    );
+    Ok(column)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const FIELDS: &[Field] = &[
+        Field::new("time", Kind::TimestampMicros, false),
+        Field::new("pid", Kind::UInt32, false),
+        Field::new("model", Kind::Utf8, false),
+        Field::new("thoughts", Kind::UInt64, true),
+        Field::new("latency_ms", Kind::Float64, false),
+        Field::new("estimated", Kind::Boolean, true),
+    ];
+
+    fn row_group(rows: usize) -> Vec<Column> {
+        let rows = 0..rows as i64;
+        vec![
+            Column::Int64(
+                rows.clone()
+                    .map(|i| Some(1_700_000_000_000_000 + i))
+                    .collect(),
+            ),
+            Column::Int32(rows.clone().map(|i| Some(i as i32)).collect()),
+            Column::ByteArray(
+                rows.clone()
+                    .map(|i| Some(format!("model-{}", i % 3).into_bytes()))
+                    .collect(),
+            ),
+            Column::Int64(rows.clone().map(|i| (i % 4 != 0).then_some(i)).collect()),
+            Column::Double(rows.clone().map(|i| Some(i as f64 / 2.0)).collect()),
+            Column::Boolean(rows.map(|i| (i % 5 != 0).then_some(i % 2 == 0)).collect()),
+        ]
+    }
+
+    #[test]
+    fn test_roundtrip() {
+        let mut writer = FileWriter::new(Vec::new(), FIELDS).unwrap();
+        let groups = [row_group(20), row_group(1), row_group(0)];
+        for group in &groups {
+            writer.write_row_group(group).unwrap();
+        }
+        let bytes = writer.close().unwrap();
+
+        let read = read(&bytes).unwrap();
+        assert_eq!(read.len(), groups.len());
+        for (read, written) in read.iter().zip(&groups) {
+            assert_eq!(read.rows, written[0].len());
+            for (field, column) in FIELDS.iter().zip(written) {
+                assert_eq!(read.column(field.name), Some(column));
+            }
+        }
+        assert_eq!(
+            read[0].column("thoughts").unwrap().as_int64().unwrap()[4],
+            None
+        );
+        assert!(read[0].column("missing").is_none());
+    }
+
+    /// Reads the file with pyarrow and prints its schema and columns as JSON
+    const PYARROW_DUMP: &str = r#"
+import json, sys
+import pyarrow as pa, pyarrow.parquet as pq
+file = pq.ParquetFile(sys.argv[1])
+table = file.read()
+columns = {}
+for field, column in zip(table.schema, table.columns):
+    if pa.types.is_timestamp(field.type):
+        column = column.cast(pa.int64())
+    columns[field.name] = column.to_pylist()
+print(json.dumps({
+    "row_groups": file.num_row_groups,
+    "types": [str(field.type) for field in table.schema],
+    "columns": columns,
+}))
+"#;
+
+    #[test]
+    fn test_standard_reader() {
+        let has_pyarrow = std::process::Command::new("python3")
+            .args(["-c", "import pyarrow"])
+            .output()
+            .is_ok_and(|output| output.status.success());
+        if !has_pyarrow {
+            eprintln!("pyarrow not installed, skipping");
+            return;
+        }
+
+        let path = std::env::temp_dir().join(format!("honeybeepf-parquet-{}", std::process::id()));
+        let mut writer = FileWriter::new(std::fs::File::create(&path).unwrap(), FIELDS).unwrap();
+        writer.write_row_group(&row_group(20)).unwrap();
+        writer.write_row_group(&row_group(7)).unwrap();
+        writer.close().unwrap();
+        let output = std::process::Command::new("python3")
+            .args(["-c", PYARROW_DUMP])
+            .arg(&path)
+            .output()
+            .unwrap();
+        std::fs::remove_file(&path).unwrap();
+        assert!(
+            output.status.success(),
+            "{}",
+            String::from_utf8_lossy(&output.stderr)
+        );
+
+        let dump: serde_json::Value = serde_json::from_slice(&output.stdout).unwrap();
+        assert_eq!(dump["row_groups"], 2);
+        assert_eq!(
+            dump["types"],
+            serde_json::json!([
+                "timestamp[us, tz=UTC]",
+                "uint32",
+                "string",
+                "uint64",
+                "double",
+                "bool"
+            ])
+        );
+        let columns = &dump["columns"];
+        let expected = [row_group(20), row_group(7)];
+        for (field, index) in FIELDS.iter().zip(0..) {
+            let values: Vec<serde_json::Value> = expected
+                .iter()
+                .flat_map(|group| match &group[index] {
+                    Column::Boolean(v) => v.iter().map(|x| serde_json::json!(x)).collect(),
+                    Column::Int32(v) => v.iter().map(|x| serde_json::json!(x)).collect(),
+                    Column::Int64(v) => v.iter().map(|x| serde_json::json!(x)).collect(),
+                    Column::Double(v) => v.iter().map(|x| serde_json::json!(x)).collect(),
+                    Column::ByteArray(v) => v
+                        .iter()
+                        .map(|x| serde_json::json!(x.as_deref().map(String::from_utf8_lossy)))
+                        .collect::<Vec<_>>(),
+                })
+                .collect();
+            assert_eq!(
+                columns[field.name],
+                serde_json::Value::Array(values),
+                "{}",
+                field.name
+            );
+        }
+    }
+
+    #[test]
+    fn test_rejects_bad_input() {
+        let mut writer = FileWriter::new(Vec::new(), FIELDS).unwrap();
+        let mut group = row_group(3);
+        group[1] = Column::Int32(vec![Some(1), None, Some(3)]);
+        assert!(writer.write_row_group(&group).is_err());
+        group[1] = Column::Int64(vec![Some(1); 3]);
+        assert!(writer.write_row_group(&group).is_err());
+
+        writer.write_row_group(&row_group(3)).unwrap();
+        let bytes = writer.close().unwrap();
+        assert!(read(&bytes[..bytes.len() - 1]).is_err());
+        let mut truncated = bytes.clone();
+        let len = truncated.len();
+        truncated[len - 8..len - 4].copy_from_slice(&(len as u32).to_le_bytes());
+        assert!(read(&truncated).is_err());
+    }
+}
@@ -0,0 +1,287 @@
+//! `honeybeepf summarize`: token, GPU and block I/O totals from the local store files.
+
+use std::{collections::BTreeMap, fmt, path::Path};
+
+use anyhow::{Context, Result};
+
+use super::{
+    BLOCK_IO, GPU_HOLDS, LLM_REQUESTS,
+    parquet::{self, RowGroup},
+    writer::list_files,
+};
+
+#[derive(Debug, Default, Clone, PartialEq)]
+pub struct ModelSummary {
+    pub requests: u64,
+    /// Exchanges without any token usage (error responses)
+    pub failed: u64,
+    pub prompt_tokens: u64,
+    pub completion_tokens: u64,
+    pub thoughts_tokens: u64,
+    pub cache_read_tokens: u64,
+    /// Prompt tokens of the requests whose provider reports cache reads
+    pub cacheable_prompt_tokens: u64,
+    pub latency_ms: f64,
+}
+
+#[derive(Debug, Default, Clone, PartialEq)]
+pub struct CgroupSummary {
+    pub requests: u64,
+    pub prompt_tokens: u64,
+    pub completion_tokens: u64,
+    pub gpu_held_ms: f64,
+    pub block_io_ops: u64,
+    pub block_io_bytes: u64,
+}
+
+#[derive(Debug, Default)]
+pub struct Summary {
+    pub files: usize,
+    pub models: BTreeMap<String, ModelSummary>,
+    pub cgroups: BTreeMap<u64, CgroupSummary>,
+}
+
+fn int64s<'a>(group: &'a RowGroup, name: &str) -> Result<&'a [Option<i64>]> {
+    group
+        .column(name)
+        .and_then(|c| c.as_int64())
+        .with_context(|| format!("Missing or mistyped column {}", name))
+}
+
+fn doubles<'a>(group: &'a RowGroup, name: &str) -> Result<&'a [Option<f64>]> {
+    group
+        .column(name)
+        .and_then(|c| c.as_double())
+        .with_context(|| format!("Missing or mistyped column {}", name))
+}
+
+fn strings<'a>(group: &'a RowGroup, name: &str) -> Result<&'a [Option<Vec<u8>>]> {
+    group
+        .column(name)
+        .and_then(|c| c.as_byte_array())
+        .with_context(|| format!("Missing or mistyped column {}", name))
+}
+
+/// Unsigned value of a UINT_64 column (nulls count as 0)
+fn unsigned(values: &[Option<i64>], i: usize) -> u64 {
+    values[i].unwrap_or(0) as u64
+}
+
+/// Read every complete file of a table, oldest first.
+fn for_each_row_group(
+    dir: &Path,
+    table: &str,
+    files: &mut usize,
+    mut f: impl FnMut(&RowGroup) -> Result<()>,
+) -> Result<()> {
+    let mut paths = list_files(&dir.join(table));
+    paths.sort_by(|a, b| a.1.cmp(&b.1));
+    for (path, _, _) in paths {
+        let groups = parquet::read_file(&path)
+            .with_context(|| format!("Failed to read {}", path.display()))?;
+        for group in &groups {
+            f(group).with_context(|| format!("Bad data in {}", path.display()))?;
+        }
+        *files += 1;
+    }
+    Ok(())
+}
+
+pub fn summarize(dir: &Path) -> Result<Summary> {
+    let mut summary = Summary::default();
+    let Summary {
+        files,
+        models,
+        cgroups,
+    } = &mut summary;
+
+    for_each_row_group(dir, LLM_REQUESTS, files, |group| {
+        let cgroup = int64s(group, "cgroup_id")?;
+        let model = strings(group, "model")?;
+        let prompt = int64s(group, "prompt_tokens")?;
+        let completion = int64s(group, "completion_tokens")?;
+        let thoughts = int64s(group, "thoughts_tokens")?;
+        // Absent from files written before prompt cache accounting
+        let cache_read = int64s(group, "cache_read_tokens").ok();
+        let latency = doubles(group, "latency_ms")?;
+        for i in 0..group.rows {
+            let model = String::from_utf8_lossy(model[i].as_deref().unwrap_or_default());
+            let m = models.entry(model.into_owned()).or_default();
+            let (prompt, completion) = (unsigned(prompt, i), unsigned(completion, i));
+            m.requests += 1;
+            m.failed += (prompt == 0 && completion == 0) as u64;
+            m.prompt_tokens += prompt;
+            m.completion_tokens += completion;
+            m.thoughts_tokens += unsigned(thoughts, i);
+            if let Some(cache_read) = cache_read.and_then(|c| c[i]) {
+                m.cache_read_tokens += cache_read as u64;
+                m.cacheable_prompt_tokens += prompt;
+            }
+            m.latency_ms += latency[i].unwrap_or(0.0);
+
+            let c = cgroups.entry(unsigned(cgroup, i)).or_default();
+            c.requests += 1;
+            c.prompt_tokens += prompt;
+            c.completion_tokens += completion;
+        }
+        Ok(())
+    })?;
+
+    for_each_row_group(dir, GPU_HOLDS, files, |group| {
+        let cgroup = int64s(group, "cgroup_id")?;
+        let held = doubles(group, "held_ms")?;
+        for (i, held) in held.iter().enumerate() {
+            cgroups.entry(unsigned(cgroup, i)).or_default().gpu_held_ms += held.unwrap_or(0.0);
+        }
+        Ok(())
+    })?;
+
+    for_each_row_group(dir, BLOCK_IO, files, |group| {
+        let cgroup = int64s(group, "cgroup_id")?;
+        let ops = int64s(group, "ops")?;
+        let bytes = int64s(group, "bytes")?;
+        for i in 0..group.rows {
+            let c = cgroups.entry(unsigned(cgroup, i)).or_default();
+            c.block_io_ops += unsigned(ops, i);
+            c.block_io_bytes += unsigned(bytes, i);
+        }
+        Ok(())
+    })?;
+
+    Ok(summary)
+}
+
+impl fmt::Display for Summary {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        writeln!(f, "{} file(s)", self.files)?;
+
+        writeln!(f, "\nLLM requests by model")?;
+        writeln!(
+            f,
+            "{:<32} {:>9} {:>7} {:>13} {:>13} {:>11} {:>10} {:>12}",
+            "model",
+            "requests",
+            "failed",
+            "prompt_tok",
+            "compl_tok",
+            "thoughts",
+            "cache_hit",
+            "avg_lat_ms"
+        )?;
+        for (model, m) in &self.models {
+            let cache_hit = if m.cacheable_prompt_tokens > 0 {
+                format!(
+                    "{:.1}%",
+                    100.0 * m.cache_read_tokens as f64 / m.cacheable_prompt_tokens as f64
+                )
+            } else {
+                "-".to_string()
+            };
+            writeln!(
+                f,
+                "{:<32} {:>9} {:>7} {:>13} {:>13} {:>11} {:>10} {:>12.1}",
+                model,
+                m.requests,
+                m.failed,
+                m.prompt_tokens,
+                m.completion_tokens,
+                m.thoughts_tokens,
+                cache_hit,
+                m.latency_ms / m.requests.max(1) as f64
+            )?;
+        }
+
+        writeln!(f, "\nBy cgroup")?;
+        writeln!(
+            f,
+            "{:<20} {:>9} {:>13} {:>13} {:>12} {:>12} {:>12}",
+            "cgroup_id", "requests", "prompt_tok", "compl_tok", "gpu_held_s", "io_ops", "io_mb"
+        )?;
+        for (cgroup, c) in &self.cgroups {
+            writeln!(
+                f,
+                "{:<20} {:>9} {:>13} {:>13} {:>12.1} {:>12} {:>12.1}",
+                cgroup,
+                c.requests,
+                c.prompt_tokens,
+                c.completion_tokens,
+                c.gpu_held_ms / 1e3,
+                c.block_io_ops,
+                c.block_io_bytes as f64 / (1024.0 * 1024.0)
+            )?;
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::time::{Duration, SystemTime};
+
+    use super::{
+        super::{GpuHoldRow, LlmRequestRow, StoreConfig, StoreRecord, writer},
+        *,
+    };
+
+    fn llm_row(cgroup_id: u64, model: &str, prompt: u64, completion: u64) -> StoreRecord {
+        StoreRecord::LlmRequest(LlmRequestRow {
+            time: SystemTime::now(),
+            pid: 1,
+            cgroup_id,
+            model: model.to_string(),
+            prompt_tokens: prompt,
+            completion_tokens: completion,
+            thoughts_tokens: None,
+            cache_read_tokens: None,
+            cache_write_tokens: None,
+            latency: Duration::from_millis(200),
+            estimated: false,
+        })
+    }
+
+    #[test]
+    fn test_store_roundtrip() {
+        let dir = std::env::temp_dir().join(format!("honeybeepf-store-{}", std::process::id()));
+        let config = StoreConfig {
+            dir: dir.clone(),
+            rotate_bytes: 64 * 1024 * 1024,
+            retention_bytes: 0,
+            // Two row groups for three rows
+            batch_rows: 2,
+            block_io_interval: Duration::from_secs(60),
+        };
+
+        let tx = writer::spawn(config, 16).unwrap();
+        tx.send(llm_row(7, "gpt-4o", 100, 20)).unwrap();
+        let mut cached = llm_row(7, "gpt-4o", 50, 0);
+        if let StoreRecord::LlmRequest(row) = &mut cached {
+            row.cache_read_tokens = Some(40);
+        }
+        tx.send(cached).unwrap();
+        tx.send(llm_row(9, "claude", 0, 0)).unwrap();
+        tx.send(StoreRecord::GpuHold(GpuHoldRow {
+            time: SystemTime::now(),
+            pid: 2,
+            cgroup_id: 9,
+            gpu_index: 0,
+            comm: "python".to_string(),
+            held: Duration::from_secs(3),
+        }))
+        .unwrap();
+        drop(tx);
+        writer::join();
+
+        let summary = summarize(&dir).unwrap();
+        assert_eq!(summary.models["gpt-4o"].requests, 2);
+        assert_eq!(summary.models["gpt-4o"].prompt_tokens, 150);
+        assert_eq!(summary.models["gpt-4o"].cache_read_tokens, 40);
+        assert_eq!(summary.models["gpt-4o"].cacheable_prompt_tokens, 50);
+        assert_eq!(summary.models["claude"].failed, 1);
+        assert_eq!(summary.cgroups[&7].completion_tokens, 20);
+        assert_eq!(summary.cgroups[&9].gpu_held_ms, 3000.0);
+        // No in-progress files are left behind
+        assert_eq!(summary.files, 2);
+
+        std::fs::remove_dir_all(&dir).unwrap();
+    }
+}
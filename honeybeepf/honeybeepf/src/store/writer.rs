@@ -0,0 +1,380 @@
+//! Store I/O thread: row batching, hourly Parquet files, rotation and retention.
+//!
+//! Files are written as `<table>/<start time>-<n>.parquet.tmp` and renamed once their footer
+//! is written, so readers only ever see complete files. Every batch is flushed as its own
+//! row group, which bounds the writer's memory to `batch_rows` rows per table.
+
+use std::{
+    fs::File,
+    io::BufWriter,
+    path::{Path, PathBuf},
+    sync::{
+        Mutex,
+        atomic::{AtomicU32, Ordering},
+        mpsc::{Receiver, RecvTimeoutError, SyncSender, sync_channel},
+    },
+    thread::JoinHandle,
+    time::{Duration, Instant, SystemTime},
+};
+
+use anyhow::{Context, Result};
+use chrono::{DateTime, Utc};
+use log::{info, warn};
+
+use super::{
+    BLOCK_IO, BlockIoRow, GPU_HOLDS, GpuHoldRow, LLM_REQUESTS, LlmRequestRow, StoreConfig,
+    StoreRecord, drain_block_io,
+    parquet::{Column, Field, FileWriter, Kind},
+};
+
+/// Pending rows are written at least this often, even below `batch_rows`
+const FLUSH_INTERVAL: Duration = Duration::from_secs(60);
+const RECV_TIMEOUT: Duration = Duration::from_secs(1);
+
+static HANDLE: Mutex<Option<JoinHandle<()>>> = Mutex::new(None);
+static FILE_SEQ: AtomicU32 = AtomicU32::new(0);
+
+pub(super) fn spawn(config: StoreConfig, capacity: usize) -> Result<SyncSender<StoreRecord>> {
+    for table in [LLM_REQUESTS, GPU_HOLDS, BLOCK_IO] {
+        let dir = config.dir.join(table);
+        std::fs::create_dir_all(&dir)
+            .with_context(|| format!("Failed to create store directory {}", dir.display()))?;
+    }
+    info!(
+        "Local store writing Parquet files to {} (rotate at {}MB, keep {}MB)",
+        config.dir.display(),
+        config.rotate_bytes / (1024 * 1024),
+        config.retention_bytes / (1024 * 1024)
+    );
+
+    let (tx, rx) = sync_channel(capacity);
+    let handle = std::thread::Builder::new()
+        .name("hbpf-store".into())
+        .spawn(move || run(rx, config))
+        .context("Failed to spawn store thread")?;
+    *HANDLE.lock().unwrap_or_else(|e| e.into_inner()) = Some(handle);
+    Ok(tx)
+}
+
+/// Wait for the I/O thread to close its files. The sender must be dropped first.
+pub(super) fn join() {
+    if let Some(handle) = HANDLE.lock().unwrap_or_else(|e| e.into_inner()).take() {
+        let _ = handle.join();
+    }
+}
+
+fn micros(time: SystemTime) -> i64 {
+    time.duration_since(SystemTime::UNIX_EPOCH)
+        .map(|d| d.as_micros() as i64)
+        .unwrap_or(0)
+}
+
+/// Values of a column without nulls
+fn required<T>(values: impl Iterator<Item = T>) -> Vec<Option<T>> {
+    values.map(Some).collect()
+}
+
+fn strings<'a>(values: impl Iterator<Item = &'a str>) -> Column {
+    Column::ByteArray(required(values.map(|s| s.as_bytes().to_vec())))
+}
+
+/// A row type with its Parquet schema. Unsigned values are stored in the signed physical
+/// type of the same width, as the schema's unsigned logical types specify.
+trait Row: Sized {
+    const FIELDS: &'static [Field];
+    fn columns(rows: &[Self]) -> Vec<Column>;
+}
+
+impl Row for LlmRequestRow {
+    const FIELDS: &'static [Field] = &[
+        Field::new("time", Kind::TimestampMicros, false),
+        Field::new("pid", Kind::UInt32, false),
+        Field::new("cgroup_id", Kind::UInt64, false),
+        Field::new("model", Kind::Utf8, false),
+        Field::new("prompt_tokens", Kind::UInt64, false),
+        Field::new("completion_tokens", Kind::UInt64, false),
+        Field::new("thoughts_tokens", Kind::UInt64, true),
+        Field::new("cache_read_tokens", Kind::UInt64, true),
+        Field::new("cache_write_tokens", Kind::UInt64, true),
+        Field::new("latency_ms", Kind::Float64, false),
+        Field::new("estimated", Kind::Boolean, false),
+    ];
+
+    fn columns(rows: &[Self]) -> Vec<Column> {
+        vec![
+            Column::Int64(required(rows.iter().map(|r| micros(r.time)))),
+            Column::Int32(required(rows.iter().map(|r| r.pid as i32))),
+            Column::Int64(required(rows.iter().map(|r| r.cgroup_id as i64))),
+            strings(rows.iter().map(|r| r.model.as_str())),
+            Column::Int64(required(rows.iter().map(|r| r.prompt_tokens as i64))),
+            Column::Int64(required(rows.iter().map(|r| r.completion_tokens as i64))),
+            Column::Int64(
+                rows.iter()
+                    .map(|r| r.thoughts_tokens.map(|t| t as i64))
+                    .collect(),
+            ),
+            Column::Int64(
+                rows.iter()
+                    .map(|r| r.cache_read_tokens.map(|t| t as i64))
+                    .collect(),
+            ),
+            Column::Int64(
+                rows.iter()
+                    .map(|r| r.cache_write_tokens.map(|t| t as i64))
+                    .collect(),
+            ),
+            Column::Double(required(rows.iter().map(|r| r.latency.as_secs_f64() * 1e3))),
+            Column::Boolean(required(rows.iter().map(|r| r.estimated))),
+        ]
+    }
+}
+
+impl Row for GpuHoldRow {
+    const FIELDS: &'static [Field] = &[
+        Field::new("time", Kind::TimestampMicros, false),
+        Field::new("pid", Kind::UInt32, false),
+        Field::new("cgroup_id", Kind::UInt64, false),
+        Field::new("gpu_index", Kind::Int32, false),
+        Field::new("comm", Kind::Utf8, false),
+        Field::new("held_ms", Kind::Float64, false),
+    ];
+
+    fn columns(rows: &[Self]) -> Vec<Column> {
+        vec![
+            Column::Int64(required(rows.iter().map(|r| micros(r.time)))),
+            Column::Int32(required(rows.iter().map(|r| r.pid as i32))),
+            Column::Int64(required(rows.iter().map(|r| r.cgroup_id as i64))),
+            Column::Int32(required(rows.iter().map(|r| r.gpu_index))),
+            strings(rows.iter().map(|r| r.comm.as_str())),
+            Column::Double(required(rows.iter().map(|r| r.held.as_secs_f64() * 1e3))),
+        ]
+    }
+}
+
+impl Row for BlockIoRow {
+    const FIELDS: &'static [Field] = &[
+        Field::new("time", Kind::TimestampMicros, false),
+        Field::new("interval_secs", Kind::UInt32, false),
+        Field::new("cgroup_id", Kind::UInt64, false),
+        Field::new("device", Kind::Utf8, false),
+        Field::new("op", Kind::Utf8, false),
+        Field::new("ops", Kind::UInt64, false),
+        Field::new("bytes", Kind::UInt64, false),
+    ];
+
+    fn columns(rows: &[Self]) -> Vec<Column> {
+        vec![
+            Column::Int64(required(rows.iter().map(|r| micros(r.time)))),
+            Column::Int32(required(rows.iter().map(|r| r.interval.as_secs() as i32))),
+            Column::Int64(required(rows.iter().map(|r| r.cgroup_id as i64))),
+            strings(rows.iter().map(|r| r.device.as_str())),
+            strings(rows.iter().map(|r| r.op.as_str())),
+            Column::Int64(required(rows.iter().map(|r| r.ops as i64))),
+            Column::Int64(required(rows.iter().map(|r| r.bytes as i64))),
+        ]
+    }
+}
+
+struct OpenFile {
+    writer: FileWriter<BufWriter<File>>,
+    tmp_path: PathBuf,
+    path: PathBuf,
+    /// Hours since the epoch, UTC
+    hour: i64,
+}
+
+/// Pending rows and the open file of one table.
+struct Table<R: Row> {
+    name: &'static str,
+    rows: Vec<R>,
+    file: Option<OpenFile>,
+}
+
+impl<R: Row> Table<R> {
+    fn new(name: &'static str) -> Self {
+        Self {
+            name,
+            rows: Vec::new(),
+            file: None,
+        }
+    }
+
+    /// Queue a row. Returns true if a file was closed.
+    fn push(&mut self, row: R, config: &StoreConfig) -> bool {
+        self.rows.push(row);
+        self.rows.len() >= config.batch_rows && self.write(config)
+    }
+
+    /// Write pending rows as one row group. Returns true if a file was closed.
+    fn write(&mut self, config: &StoreConfig) -> bool {
+        if self.rows.is_empty() {
+            return false;
+        }
+        let rows = std::mem::take(&mut self.rows);
+        match self.try_write(&rows, config) {
+            Ok(closed) => closed,
+            Err(e) => {
+                warn!("Store: dropping {} {} rows: {:#}", rows.len(), self.name, e);
+                crate::telemetry::record_store_drops(rows.len() as u64);
+                // Abandon the file, a broken writer cannot be finished
+                self.file = None;
+                false
+            }
+        }
+    }
+
+    fn try_write(&mut self, rows: &[R], config: &StoreConfig) -> Result<bool> {
+        let now = Utc::now();
+        let mut closed = self.close_if_stale(now.timestamp() / 3600)?;
+        if self.file.is_none() {
+            self.file = Some(self.create(config, now)?);
+        }
+        let file = self.file.as_mut().expect("file was just opened");
+
+        file.writer.write_row_group(&R::columns(rows))?;
+        file.writer.flush()?;
+        if file.writer.bytes_written() >= config.rotate_bytes {
+            closed |= self.close()?;
+        }
+        Ok(closed)
+    }
+
+    fn create(&self, config: &StoreConfig, now: DateTime<Utc>) -> Result<OpenFile> {
+        let name = format!(
+            "{}-{}.parquet",
+            now.format("%Y%m%dT%H%M%S"),
+            FILE_SEQ.fetch_add(1, Ordering::Relaxed)
+        );
+        let path = config.dir.join(self.name).join(name);
+        let tmp_path = path.with_extension("parquet.tmp");
+        let file = File::create(&tmp_path)
+            .with_context(|| format!("Failed to create {}", tmp_path.display()))?;
+        Ok(OpenFile {
+            writer: FileWriter::new(BufWriter::new(file), R::FIELDS)?,
+            tmp_path,
+            path,
+            hour: now.timestamp() / 3600,
+        })
+    }
+
+    /// Close the file if it was started in an earlier hour.
+    fn close_if_stale(&mut self, hour: i64) -> Result<bool> {
+        if self.file.as_ref().is_some_and(|file| file.hour != hour) {
+            self.close()
+        } else {
+            Ok(false)
+        }
+    }
+
+    /// Write the footer and publish the file under its final name.
+    fn close(&mut self) -> Result<bool> {
+        let Some(file) = self.file.take() else {
+            return Ok(false);
+        };
+        file.writer.close()?;
+        std::fs::rename(&file.tmp_path, &file.path)
+            .with_context(|| format!("Failed to rename {}", file.tmp_path.display()))?;
+        Ok(true)
+    }
+
+    fn rotate_hourly(&mut self) -> bool {
+        let hour = Utc::now().timestamp() / 3600;
+        self.close_if_stale(hour).unwrap_or_else(|e| {
+            warn!("Store: failed to close {} file: {:#}", self.name, e);
+            false
+        })
+    }
+
+    fn finish(&mut self, config: &StoreConfig) {
+        self.write(config);
+        if let Err(e) = self.close() {
+            warn!("Store: failed to close {} file: {:#}", self.name, e);
+        }
+    }
+}
+
+/// Delete the oldest complete files until the store fits in `retention_bytes` (0 = no cap).
+fn enforce_retention(config: &StoreConfig) {
+    if config.retention_bytes == 0 {
+        return;
+    }
+    let mut files = Vec::new();
+    for table in [LLM_REQUESTS, GPU_HOLDS, BLOCK_IO] {
+        files.extend(list_files(&config.dir.join(table)));
+    }
+    let mut total: u64 = files.iter().map(|(_, _, size)| size).sum();
+    // Names start with the creation time, so name order is age order across tables
+    files.sort_by(|a, b| a.1.cmp(&b.1));
+    for (path, _, size) in files {
+        if total <= config.retention_bytes {
+            break;
+        }
+        match std::fs::remove_file(&path) {
+            Ok(()) => total -= size,
+            Err(e) => warn!("Store: failed to remove {}: {}", path.display(), e),
+        }
+    }
+}
+
+/// Complete Parquet files of a table directory: (path, file name, size)
+pub(super) fn list_files(dir: &Path) -> Vec<(PathBuf, String, u64)> {
+    let Ok(entries) = std::fs::read_dir(dir) else {
+        return Vec::new();
+    };
+    entries
+        .flatten()
+        .filter_map(|entry| {
+            let name = entry.file_name().into_string().ok()?;
+            if !name.ends_with(".parquet") {
+                return None;
+            }
+            let size = entry.metadata().ok()?.len();
+            Some((entry.path(), name, size))
+        })
+        .collect()
+}
+
+fn run(rx: Receiver<StoreRecord>, config: StoreConfig) {
+    let mut llm = Table::<LlmRequestRow>::new(LLM_REQUESTS);
+    let mut gpu = Table::<GpuHoldRow>::new(GPU_HOLDS);
+    let mut block_io = Table::<BlockIoRow>::new(BLOCK_IO);
+    let mut window_start = SystemTime::now();
+    let mut window = Instant::now();
+    let mut last_flush = Instant::now();
+
+    loop {
+        let closed = match rx.recv_timeout(RECV_TIMEOUT) {
+            Ok(StoreRecord::LlmRequest(row)) => llm.push(row, &config),
+            Ok(StoreRecord::GpuHold(row)) => gpu.push(row, &config),
+            Err(RecvTimeoutError::Timeout) => false,
+            Err(RecvTimeoutError::Disconnected) => break,
+        };
+        let mut closed = closed;
+
+        if window.elapsed() >= config.block_io_interval {
+            for row in drain_block_io(window_start, config.block_io_interval) {
+                closed |= block_io.push(row, &config);
+            }
+            window_start = SystemTime::now();
+            window = Instant::now();
+        }
+        if last_flush.elapsed() >= FLUSH_INTERVAL {
+            closed |= llm.write(&config) | gpu.write(&config) | block_io.write(&config);
+            closed |= llm.rotate_hourly() | gpu.rotate_hourly() | block_io.rotate_hourly();
+            last_flush = Instant::now();
+        }
+        if closed {
+            enforce_retention(&config);
+        }
+    }
+
+    // Partial block I/O window
+    for row in drain_block_io(window_start, window.elapsed()) {
+        block_io.push(row, &config);
+    }
+    llm.finish(&config);
+    gpu.finish(&config);
+    block_io.finish(&config);
+    enforce_retention(&config);
+    info!("Local store closed");
+}
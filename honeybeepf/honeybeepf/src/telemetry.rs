@@ -15,9 +15,12 @@ use opentelemetry_otlp::WithExportConfig;
 use opentelemetry_sdk::Resource;
 use opentelemetry_sdk::metrics::{PeriodicReader, SdkMeterProvider};
 use std::collections::HashMap;
-use std::sync::{OnceLock, RwLock};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, OnceLock, RwLock};
 use std::time::Duration;
 
+use crate::probes::builtin::llm::types::{ResponseStatus, UsageInfo};
+
 /// Metric export interval in seconds
 const METRIC_EXPORT_INTERVAL_SECS: u64 = 30;
 
@@ -34,6 +37,34 @@ fn active_probes_map() -> &'static RwLock<HashMap<String, u64>> {
     ACTIVE_PROBES.get_or_init(|| RwLock::new(HashMap::new()))
 }
 
+/// Prompt tokens and prompt cache reads of each model since the last export (for the
+/// cache hit ratio ObservableGauge callback)
+static LLM_PROMPT_CACHE: OnceLock<Mutex<HashMap<String, (u64, u64)>>> = OnceLock::new();
+/// Models tracked for the cache hit ratio between two exports
+const MAX_PROMPT_CACHE_MODELS: usize = 256;
+
+fn llm_prompt_cache() -> &'static Mutex<HashMap<String, (u64, u64)>> {
+    LLM_PROMPT_CACHE.get_or_init(|| Mutex::new(HashMap::new()))
+}
+
+/// Lowest rate-limit quota left reported for each (provider, API key hash, limit) since
+/// the last export (for the ObservableGauge callback)
+static LLM_RATE_LIMITS: OnceLock<Mutex<HashMap<(String, String, &'static str), u64>>> =
+    OnceLock::new();
+/// Series tracked for the remaining quota between two exports
+const MAX_RATE_LIMIT_SERIES: usize = 256;
+
+fn llm_rate_limits() -> &'static Mutex<HashMap<(String, String, &'static str), u64>> {
+    LLM_RATE_LIMITS.get_or_init(|| Mutex::new(HashMap::new()))
+}
+
+/// Queue depth of each LLM parser worker (for ObservableGauge callback)
+static LLM_QUEUE_DEPTHS: OnceLock<RwLock<Vec<Arc<AtomicUsize>>>> = OnceLock::new();
+
+fn llm_queue_depths() -> &'static RwLock<Vec<Arc<AtomicUsize>>> {
+    LLM_QUEUE_DEPTHS.get_or_init(|| RwLock::new(Vec::new()))
+}
+
 /// honeybeepf metrics collection
 ///
 /// Note: Do NOT add _total suffix to Counter names (Prometheus adds it automatically)
@@ -43,6 +74,24 @@ pub struct HoneyBeeMetrics {
     pub block_io_latency_ns: Histogram<u64>,
     pub network_latency_ns: Histogram<u64>,
     pub gpu_open_events: Counter<u64>,
+    pub ringbuf_drops: Counter<u64>,
+    pub ringbuf_wakeups: Counter<u64>,
+    pub llm_stream_gaps: Counter<u64>,
+    pub llm_lost_events: Counter<u64>,
+    pub llm_queue_drops: Counter<u64>,
+    pub sink_events: Counter<u64>,
+    pub sink_drops: Counter<u64>,
+    pub store_drops: Counter<u64>,
+    pub recorder_dumps: Counter<u64>,
+    pub handoff_gap_ms: Histogram<u64>,
+    pub startup_phase_ms: Histogram<u64>,
+    pub llm_streams_rejected: Counter<u64>,
+    pub llm_usage_estimated: Counter<u64>,
+    pub llm_estimate_drops: Counter<u64>,
+    pub llm_output_tokens_per_sec: Histogram<u64>,
+    pub llm_tokens: Counter<u64>,
+    pub llm_error_responses: Counter<u64>,
+    pub llm_retry_after_ms: Histogram<u64>,
     // Note: active_probes is registered as ObservableGauge in init_metrics()
 }
 
@@ -76,6 +125,108 @@ impl HoneyBeeMetrics {
                 .with_description("Number of GPU device open events")
                 .with_unit("events")
                 .build(),
+            ringbuf_drops: meter
+                .u64_counter("ringbuf_drops")
+                .with_description("Events dropped in eBPF because the ring buffer was full")
+                .with_unit("events")
+                .build(),
+            ringbuf_wakeups: meter
+                .u64_counter("ringbuf_wakeups")
+                .with_description("Times a ring buffer consumer was woken with data pending")
+                .with_unit("wakeups")
+                .build(),
+            llm_stream_gaps: meter
+                .u64_counter("llm_stream_gaps")
+                .with_description("SSL streams discarded because of a sequence gap")
+                .with_unit("streams")
+                .build(),
+            llm_lost_events: meter
+                .u64_counter("llm_lost_events")
+                .with_description("SSL events missing from sequence gaps")
+                .with_unit("events")
+                .build(),
+            llm_queue_drops: meter
+                .u64_counter("llm_queue_drops")
+                .with_description("SSL events dropped because a parser worker queue was full")
+                .with_unit("events")
+                .build(),
+            sink_events: meter
+                .u64_counter("sink_events")
+                .with_description("Events written by the event sink")
+                .with_unit("events")
+                .build(),
+            sink_drops: meter
+                .u64_counter("sink_drops")
+                .with_description(
+                    "Events dropped by the event sink (queue full or output unavailable)",
+                )
+                .with_unit("events")
+                .build(),
+            store_drops: meter
+                .u64_counter("store_drops")
+                .with_description("Rows dropped by the local store (queue full or write error)")
+                .with_unit("rows")
+                .build(),
+            recorder_dumps: meter
+                .u64_counter("recorder_dumps")
+                .with_description("Flight recorder buffers written to disk, by trigger")
+                .with_unit("dumps")
+                .build(),
+            handoff_gap_ms: meter
+                .u64_histogram("handoff_gap_ms")
+                .with_description(
+                    "Time probes were detached while taking over from the previous agent",
+                )
+                .with_unit("ms")
+                .build(),
+            startup_phase_ms: meter
+                .u64_histogram("startup_phase_ms")
+                .with_description("Duration of each agent startup phase, up to readiness")
+                .with_unit("ms")
+                .build(),
+            llm_streams_rejected: meter
+                .u64_counter("llm_streams_rejected")
+                .with_description(
+                    "TLS connections classified as not HTTP and excluded from capture, by protocol",
+                )
+                .with_unit("connections")
+                .build(),
+            llm_usage_estimated: meter
+                .u64_counter("llm_usage_estimated")
+                .with_description("LLM exchanges without usage whose tokens were counted locally")
+                .with_unit("exchanges")
+                .build(),
+            llm_estimate_drops: meter
+                .u64_counter("llm_estimate_drops")
+                .with_description(
+                    "LLM exchanges without usage not estimated because the tokenizer queue was full",
+                )
+                .with_unit("exchanges")
+                .build(),
+            llm_output_tokens_per_sec: meter
+                .u64_histogram("llm_output_tokens_per_sec")
+                .with_description(
+                    "Generation speed of streamed LLM responses, from the first delta to the last",
+                )
+                .with_unit("tokens/s")
+                .build(),
+            llm_tokens: meter
+                .u64_counter("llm_tokens")
+                .with_description(
+                    "LLM tokens by type: prompt (cached or not), completion, thoughts, cache_read, cache_write",
+                )
+                .with_unit("tokens")
+                .build(),
+            llm_error_responses: meter
+                .u64_counter("llm_error_responses")
+                .with_description("LLM responses with status 429 (rate limited) or 5xx")
+                .with_unit("responses")
+                .build(),
+            llm_retry_after_ms: meter
+                .u64_histogram("llm_retry_after_ms")
+                .with_description("Wait asked for by the retry-after header of LLM responses")
+                .with_unit("ms")
+                .build(),
         }
     }
 }
@@ -153,6 +304,82 @@ pub fn init_metrics() -> Result<()> {
         })
         .build();
 
+    let _llm_queue_depth_gauge = meter
+        .u64_observable_gauge("llm_worker_queue_depth")
+        .with_description("SSL events waiting in each LLM parser worker queue")
+        .with_unit("events")
+        .with_callback(|observer| {
+            if let Ok(depths) = llm_queue_depths().read() {
+                for (worker, depth) in depths.iter().enumerate() {
+                    observer.observe(
+                        depth.load(Ordering::Relaxed) as u64,
+                        &[KeyValue::new("worker", worker as i64)],
+                    );
+                }
+            }
+        })
+        .build();
+
+    let _llm_prompt_cache_gauge = meter
+        .f64_observable_gauge("llm_prompt_cache_hit_ratio")
+        .with_description(
+            "Share of prompt tokens read from the provider's prompt cache since the last export",
+        )
+        .with_callback(|observer| {
+            let window =
+                std::mem::take(&mut *llm_prompt_cache().lock().unwrap_or_else(|e| e.into_inner()));
+            for (model, (prompt, cache_read)) in window {
+                if prompt > 0 {
+                    observer.observe(
+                        cache_read as f64 / prompt as f64,
+                        &[KeyValue::new("model", model)],
+                    );
+                }
+            }
+        })
+        .build();
+
+    let _llm_rate_limit_gauge = meter
+        .u64_observable_gauge("llm_ratelimit_remaining")
+        .with_description(
+            "Lowest LLM rate-limit quota left reported by the provider since the last export",
+        )
+        .with_callback(|observer| {
+            let window =
+                std::mem::take(&mut *llm_rate_limits().lock().unwrap_or_else(|e| e.into_inner()));
+            for ((provider, api_key, limit), remaining) in window {
+                observer.observe(
+                    remaining,
+                    &[
+                        KeyValue::new("provider", provider),
+                        KeyValue::new("api_key", api_key),
+                        KeyValue::new("limit", limit),
+                    ],
+                );
+            }
+        })
+        .build();
+
+    let _ring_sample_rate_gauge = meter
+        .u64_observable_gauge("ring_sample_rate")
+        .with_description("CPU governor sampling of each ring: 1 in N events kept")
+        .with_callback(|observer| {
+            for ring in crate::governor::SAMPLED_RINGS {
+                observer.observe(
+                    crate::governor::sample_rate(ring) as u64,
+                    &[KeyValue::new("ring", ring.name())],
+                );
+            }
+        })
+        .build();
+
+    let _agent_cpu_gauge = meter
+        .u64_observable_gauge("agent_cpu_millicores")
+        .with_description("CPU used by the agent, as measured by the governor")
+        .with_unit("millicores")
+        .with_callback(|observer| observer.observe(crate::governor::cpu_millicores(), &[]))
+        .build();
+
     let _ = METRICS.set(HoneyBeeMetrics::new(&meter));
 
     info!("OpenTelemetry metrics initialized successfully");
@@ -163,15 +390,22 @@ pub fn metrics() -> Option<&'static HoneyBeeMetrics> {
     METRICS.get()
 }
 
-pub fn record_block_io_event(event_type: &str, bytes: u64, latency_ns: Option<u64>, device: &str) {
+/// `weight` is the number of events this one stands for while the ring is sampled.
+pub fn record_block_io_event(
+    event_type: &str,
+    bytes: u64,
+    latency_ns: Option<u64>,
+    device: &str,
+    weight: u64,
+) {
     if let Some(m) = metrics() {
         let attrs = [
             KeyValue::new("event_type", event_type.to_string()),
             KeyValue::new("device", device.to_string()),
         ];
 
-        m.block_io_events.add(1, &attrs);
-        m.block_io_bytes.add(bytes, &attrs);
+        m.block_io_events.add(weight, &attrs);
+        m.block_io_bytes.add(bytes * weight, &attrs);
 
         if let Some(lat) = latency_ns {
             m.block_io_latency_ns.record(lat, &attrs);
@@ -193,6 +427,183 @@ pub fn record_gpu_open_event(device_path: &str) {
     }
 }
 
+pub fn record_ringbuf_drops(ring: &str, count: u64) {
+    if let Some(m) = metrics() {
+        let attrs = [KeyValue::new("ring", ring.to_string())];
+        m.ringbuf_drops.add(count, &attrs);
+    }
+}
+
+pub fn record_ringbuf_wakeups(ring: &str, count: u64) {
+    if let Some(m) = metrics() {
+        let attrs = [KeyValue::new("ring", ring.to_string())];
+        m.ringbuf_wakeups.add(count, &attrs);
+    }
+}
+
+pub fn record_llm_stream_gap(lost_events: u64) {
+    if let Some(m) = metrics() {
+        m.llm_stream_gaps.add(1, &[]);
+        m.llm_lost_events.add(lost_events, &[]);
+    }
+}
+
+pub fn record_llm_queue_drop() {
+    if let Some(m) = metrics() {
+        m.llm_queue_drops.add(1, &[]);
+    }
+}
+
+pub fn record_llm_stream_rejected(protocol: &str) {
+    if let Some(m) = metrics() {
+        let attrs = [KeyValue::new("protocol", protocol.to_string())];
+        m.llm_streams_rejected.add(1, &attrs);
+    }
+}
+
+pub fn record_llm_usage_estimated() {
+    if let Some(m) = metrics() {
+        m.llm_usage_estimated.add(1, &[]);
+    }
+}
+
+pub fn record_llm_output_rate(provider: &str, estimated: bool, tokens_per_sec: f64) {
+    if let Some(m) = metrics() {
+        let attrs = [
+            KeyValue::new("provider", provider.to_string()),
+            KeyValue::new("estimated", estimated),
+        ];
+        m.llm_output_tokens_per_sec
+            .record(tokens_per_sec.round() as u64, &attrs);
+    }
+}
+
+pub fn record_llm_usage(provider: &str, usage: &UsageInfo) {
+    let Some(m) = metrics() else {
+        return;
+    };
+    let model = usage.model.as_deref().unwrap_or("unknown");
+    let counts = [
+        ("prompt", Some(usage.prompt_tokens)),
+        ("completion", Some(usage.completion_tokens)),
+        ("thoughts", usage.thoughts_tokens),
+        ("cache_read", usage.cache_read_tokens),
+        ("cache_write", usage.cache_write_tokens),
+    ];
+    for (kind, count) in counts {
+        if let Some(count) = count.filter(|&count| count > 0) {
+            let attrs = [
+                KeyValue::new("provider", provider.to_string()),
+                KeyValue::new("model", model.to_string()),
+                KeyValue::new("type", kind),
+                KeyValue::new("estimated", usage.estimated),
+            ];
+            m.llm_tokens.add(count, &attrs);
+        }
+    }
+
+    // Only providers that report cache reads have a hit ratio
+    if let Some(cache_read) = usage.cache_read_tokens {
+        let mut window = llm_prompt_cache().lock().unwrap_or_else(|e| e.into_inner());
+        if window.len() < MAX_PROMPT_CACHE_MODELS || window.contains_key(model) {
+            let totals = window.entry(model.to_string()).or_default();
+            totals.0 += usage.prompt_tokens;
+            totals.1 += cache_read;
+        }
+    }
+}
+
+pub fn record_llm_response(response: &ResponseStatus) {
+    let Some(m) = metrics() else {
+        return;
+    };
+    let provider = response.provider.as_deref().unwrap_or("unknown");
+    let api_key = response.api_key.as_deref().unwrap_or("unknown");
+    let head = &response.head;
+    let attrs = [
+        KeyValue::new("provider", provider.to_string()),
+        KeyValue::new("api_key", api_key.to_string()),
+    ];
+    if head.status == 429 || head.status >= 500 {
+        let mut status_attrs = attrs.to_vec();
+        status_attrs.push(KeyValue::new("status", head.status as i64));
+        m.llm_error_responses.add(1, &status_attrs);
+    }
+    if let Some(retry_after) = head.retry_after {
+        m.llm_retry_after_ms
+            .record(retry_after.as_millis() as u64, &attrs);
+    }
+
+    let remaining = [
+        ("requests", head.remaining_requests),
+        ("tokens", head.remaining_tokens),
+    ];
+    let mut window = llm_rate_limits().lock().unwrap_or_else(|e| e.into_inner());
+    for (limit, value) in remaining {
+        let Some(value) = value else {
+            continue;
+        };
+        let key = (provider.to_string(), api_key.to_string(), limit);
+        if let Some(lowest) = window.get_mut(&key) {
+            *lowest = (*lowest).min(value);
+        } else if window.len() < MAX_RATE_LIMIT_SERIES {
+            window.insert(key, value);
+        }
+    }
+}
+
+pub fn record_llm_estimate_drop() {
+    if let Some(m) = metrics() {
+        m.llm_estimate_drops.add(1, &[]);
+    }
+}
+
+pub fn record_sink_events(count: u64) {
+    if let Some(m) = metrics() {
+        m.sink_events.add(count, &[]);
+    }
+}
+
+pub fn record_sink_drops(count: u64) {
+    if let Some(m) = metrics() {
+        m.sink_drops.add(count, &[]);
+    }
+}
+
+pub fn record_store_drops(count: u64) {
+    if let Some(m) = metrics() {
+        m.store_drops.add(count, &[]);
+    }
+}
+
+pub fn record_recorder_dump(reason: &str) {
+    if let Some(m) = metrics() {
+        let attrs = [KeyValue::new("reason", reason.to_string())];
+        m.recorder_dumps.add(1, &attrs);
+    }
+}
+
+pub fn record_handoff_gap(gap: Duration) {
+    if let Some(m) = metrics() {
+        m.handoff_gap_ms.record(gap.as_millis() as u64, &[]);
+    }
+}
+
+pub fn record_startup_phase(phase: &str, duration: Duration) {
+    if let Some(m) = metrics() {
+        let attrs = [KeyValue::new("phase", phase.to_string())];
+        m.startup_phase_ms
+            .record(duration.as_millis() as u64, &attrs);
+    }
+}
+
+/// Expose the queue depth counters of the LLM parser workers as a gauge
+pub fn register_llm_queue_depths(depths: Vec<Arc<AtomicUsize>>) {
+    if let Ok(mut registered) = llm_queue_depths().write() {
+        *registered = depths;
+    }
+}
+
 /// Record active probe count
 /// Updates the global active probes map for ObservableGauge callback
 pub fn record_active_probe(probe_name: &str, count: u64) {
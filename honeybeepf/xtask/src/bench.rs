@@ -0,0 +1,716 @@
+//! `cargo xtask bench`: end-to-end probe overhead on local workloads.
+//!
+//! Every workload runs first without the agent, then with the agent attached but the
+//! workload filtered out before any parsing, then with full capture. Latency is what the
+//! workload itself observes; CPU time is read from `/proc` for the workload (which also
+//! pays for uprobes and tracepoints) and for the agent process.
+
+use std::{
+    fs::{self, File, OpenOptions},
+    io::{BufRead, BufReader, Read, Write},
+    net::{SocketAddr, TcpListener, TcpStream},
+    os::unix::fs::{FileExt, symlink},
+    path::{Path, PathBuf},
+    process::{Child, Command, Stdio},
+    sync::{Arc, mpsc},
+    thread,
+    time::{Duration, Instant},
+};
+
+use anyhow::{Context, Result, bail};
+use clap::{Args, ValueEnum};
+use openssl::{
+    asn1::Asn1Time,
+    ec::{EcGroup, EcKey},
+    hash::MessageDigest,
+    nid::Nid,
+    pkey::{PKey, Private},
+    ssl::{SslAcceptor, SslConnector, SslMethod, SslVerifyMode},
+    x509::{X509, X509NameBuilder},
+};
+
+const AGENT_START_TIMEOUT_SECS: u64 = 60;
+const AGENT_STOP_TIMEOUT_SECS: u64 = 10;
+/// Logged by the agent once all probes are attached
+const AGENT_READY_MARKER: &str = "active. Press Ctrl-C";
+/// USER_HZ, the unit of utime/stime in /proc/<pid>/stat
+const CLOCK_TICKS_PER_SEC: u64 = 100;
+/// Fake GPU nodes are created from this index up, far above real device counts
+const FAKE_GPU_FIRST_INDEX: u32 = 64;
+const LLM_HOST: &str = "api.openai.com";
+const LLM_PATH: &str = "/v1/chat/completions";
+/// Host and path matching no LLM provider: the agent drops these after header parsing
+const OTHER_HOST: &str = "bench.local";
+const OTHER_PATH: &str = "/v1/data";
+
+#[derive(Args)]
+pub struct BenchArgs {
+    /// Workload to run
+    #[arg(long, value_enum, default_value = "all")]
+    workload: Workload,
+
+    /// Operations per run (requests, synced writes or open/close pairs)
+    #[arg(long, default_value = "20000")]
+    ops: usize,
+
+    /// Target operations per second over all connections (0 = as fast as possible)
+    #[arg(long, default_value = "0")]
+    rate: u64,
+
+    /// Concurrent TLS connections
+    #[arg(long, default_value = "4")]
+    connections: usize,
+
+    /// TLS request body size in bytes
+    #[arg(long, default_value = "1024")]
+    request_size: usize,
+
+    /// TLS response body size in bytes
+    #[arg(long, default_value = "4096")]
+    response_size: usize,
+
+    /// Block I/O write size in bytes
+    #[arg(long, default_value = "4096")]
+    block_size: usize,
+
+    /// Block I/O test file size in MiB
+    #[arg(long, default_value = "64")]
+    file_size_mb: u64,
+
+    /// Directory for the block I/O test file; must be on a real block device (not tmpfs)
+    #[arg(long)]
+    dir: Option<PathBuf>,
+
+    /// Agent binary (default: target/release/honeybeepf)
+    #[arg(long)]
+    agent: Option<PathBuf>,
+}
+
+#[derive(Clone, Copy, PartialEq, Eq, ValueEnum)]
+enum Workload {
+    Tls,
+    BlockIo,
+    Gpu,
+    All,
+}
+
+impl Workload {
+    fn name(&self) -> &'static str {
+        match self {
+            Workload::Tls => "tls",
+            Workload::BlockIo => "block_io",
+            Workload::Gpu => "gpu",
+            Workload::All => "all",
+        }
+    }
+
+    /// `BUILTIN_PROBES__*` switch of the probe observing this workload
+    fn probe(&self) -> &'static str {
+        match self {
+            Workload::Tls => "LLM",
+            Workload::BlockIo => "BLOCK_IO",
+            Workload::Gpu | Workload::All => "GPU_USAGE",
+        }
+    }
+
+    /// Block I/O has no filter in the kernel path, so it has no filtered run.
+    fn modes(&self) -> &'static [Mode] {
+        match self {
+            Workload::BlockIo => &[Mode::Off, Mode::Full],
+            _ => &[Mode::Off, Mode::Filtered, Mode::Full],
+        }
+    }
+}
+
+#[derive(Clone, Copy, PartialEq, Eq)]
+enum Mode {
+    /// No agent running
+    Off,
+    /// Probe attached, but the workload is rejected before parsing
+    Filtered,
+    /// Probe attached and every operation fully captured
+    Full,
+}
+
+impl Mode {
+    fn name(&self) -> &'static str {
+        match self {
+            Mode::Off => "off",
+            Mode::Filtered => "filtered",
+            Mode::Full => "full",
+        }
+    }
+}
+
+struct RunResult {
+    workload: Workload,
+    mode: Mode,
+    /// Sorted per-operation latencies in nanoseconds
+    latencies: Vec<u64>,
+    wall: Duration,
+    workload_cpu: Duration,
+    agent_cpu: Option<Duration>,
+}
+
+impl RunResult {
+    fn percentile_us(&self, p: usize) -> f64 {
+        if self.latencies.is_empty() {
+            return 0.0;
+        }
+        self.latencies[(self.latencies.len() - 1) * p / 100] as f64 / 1000.0
+    }
+}
+
+pub fn bench(args: BenchArgs) -> Result<()> {
+    let workloads = match args.workload {
+        Workload::All => vec![Workload::Tls, Workload::BlockIo, Workload::Gpu],
+        w => vec![w],
+    };
+
+    let root = is_root();
+    let agent = args
+        .agent
+        .clone()
+        .unwrap_or_else(|| super::project_root().join("target/release/honeybeepf"));
+    if root && !agent.exists() {
+        bail!(
+            "Agent binary not found at {}. Run `cargo xtask build --release` first.",
+            agent.display()
+        );
+    }
+    if !root {
+        println!("⚠️  Not running as root: measuring without the agent only");
+    }
+
+    let mut results = Vec::new();
+    for workload in workloads {
+        if workload == Workload::Gpu && !root {
+            println!("⚠️  Skipping gpu: fake device nodes in /dev need root");
+            continue;
+        }
+
+        let mut running: Option<Agent> = None;
+        for &mode in workload.modes() {
+            if mode != Mode::Off && !root {
+                break;
+            }
+            if mode != Mode::Off && running.is_none() {
+                println!("🐝 Starting agent for {}...", workload.name());
+                running = Some(Agent::start(&agent, workload.probe())?);
+            }
+
+            println!("⏱️  {} / {}", workload.name(), mode.name());
+            let agent_before = running.as_ref().map(Agent::cpu_time).transpose()?;
+            let cpu_before = process_cpu_time("/proc/self/stat")?;
+            let start = Instant::now();
+
+            let latencies = match workload {
+                Workload::Tls => run_tls(&args, mode)?,
+                Workload::BlockIo => run_block_io(&args)?,
+                _ => run_gpu(&args, mode)?,
+            };
+
+            let wall = start.elapsed();
+            let workload_cpu = process_cpu_time("/proc/self/stat")?.saturating_sub(cpu_before);
+            let agent_cpu = match (running.as_ref(), agent_before) {
+                (Some(agent), Some(before)) => Some(agent.cpu_time()?.saturating_sub(before)),
+                _ => None,
+            };
+            results.push(RunResult {
+                workload,
+                mode,
+                latencies: sorted(latencies),
+                wall,
+                workload_cpu,
+                agent_cpu,
+            });
+        }
+    }
+
+    print_table(&results);
+    Ok(())
+}
+
+fn sorted(mut latencies: Vec<u64>) -> Vec<u64> {
+    latencies.sort_unstable();
+    latencies
+}
+
+fn print_table(results: &[RunResult]) {
+    println!();
+    println!(
+        "{:<9} {:<9} {:>8} {:>10} {:>10} {:>9} {:>10} {:>12} {:>10}",
+        "workload",
+        "mode",
+        "ops",
+        "p50 (us)",
+        "p99 (us)",
+        "p99 Δ",
+        "ops/s",
+        "cpu/op (us)",
+        "agent cpu"
+    );
+    for result in results {
+        let baseline = results
+            .iter()
+            .find(|r| r.workload == result.workload && r.mode == Mode::Off);
+        let p99 = result.percentile_us(99);
+        let delta = match baseline {
+            Some(b) if result.mode != Mode::Off && b.percentile_us(99) > 0.0 => {
+                format!("{:+.1}%", (p99 / b.percentile_us(99) - 1.0) * 100.0)
+            }
+            _ => "-".to_string(),
+        };
+        let ops = result.latencies.len().max(1);
+        let agent_cpu = result
+            .agent_cpu
+            .map(|cpu| {
+                format!(
+                    "{:.1}%",
+                    cpu.as_secs_f64() / result.wall.as_secs_f64() * 100.0
+                )
+            })
+            .unwrap_or_else(|| "-".to_string());
+        println!(
+            "{:<9} {:<9} {:>8} {:>10.1} {:>10.1} {:>9} {:>10.0} {:>12.1} {:>10}",
+            result.workload.name(),
+            result.mode.name(),
+            result.latencies.len(),
+            result.percentile_us(50),
+            p99,
+            delta,
+            result.latencies.len() as f64 / result.wall.as_secs_f64(),
+            result.workload_cpu.as_secs_f64() * 1e6 / ops as f64,
+            agent_cpu
+        );
+    }
+}
+
+fn is_root() -> bool {
+    fs::read_to_string("/proc/self/status")
+        .ok()
+        .and_then(|status| {
+            status
+                .lines()
+                .find(|l| l.starts_with("Uid:"))
+                .and_then(|l| l.split_whitespace().nth(2).map(|euid| euid == "0"))
+        })
+        .unwrap_or(false)
+}
+
+/// utime + stime of a process from its `/proc/<pid>/stat`.
+fn process_cpu_time(stat_path: &str) -> Result<Duration> {
+    let stat =
+        fs::read_to_string(stat_path).with_context(|| format!("Failed to read {}", stat_path))?;
+    // Fields after the parenthesized comm, starting at field 3 (state)
+    let fields: Vec<&str> = stat
+        .rsplit_once(')')
+        .context("Malformed stat")?
+        .1
+        .split_whitespace()
+        .collect();
+    let ticks: u64 = fields
+        .get(11..13)
+        .context("Malformed stat")?
+        .iter()
+        .map(|f| f.parse::<u64>().unwrap_or(0))
+        .sum();
+    Ok(Duration::from_millis(ticks * 1000 / CLOCK_TICKS_PER_SEC))
+}
+
+/// Paces operations to a fixed rate; a zero rate never waits.
+struct Pacer {
+    start: Instant,
+    interval: Option<Duration>,
+    next: u32,
+}
+
+impl Pacer {
+    fn new(rate_per_worker: f64) -> Self {
+        Self {
+            start: Instant::now(),
+            interval: (rate_per_worker > 0.0)
+                .then(|| Duration::from_secs_f64(1.0 / rate_per_worker)),
+            next: 0,
+        }
+    }
+
+    fn wait(&mut self) {
+        if let Some(interval) = self.interval {
+            let due = self.start + interval * self.next;
+            if let Some(wait) = due.checked_duration_since(Instant::now()) {
+                thread::sleep(wait);
+            }
+            self.next += 1;
+        }
+    }
+}
+
+/// Discard warmup operations (connection setup, lazy initialization in the agent).
+fn warmup_ops(ops: usize) -> usize {
+    (ops / 10).min(1000)
+}
+
+/// A running agent with only `probe` enabled. Stopped with SIGINT on drop.
+struct Agent {
+    child: Child,
+}
+
+impl Agent {
+    fn start(binary: &Path, probe: &str) -> Result<Self> {
+        let mut cmd = Command::new(binary);
+        cmd.arg("--verbose")
+            .env_remove("RUST_LOG")
+            .env_remove("OTEL_EXPORTER_OTLP_ENDPOINT")
+            .stdout(Stdio::piped())
+            .stderr(Stdio::null());
+        for name in ["BLOCK_IO", "NETWORK_LATENCY", "GPU_USAGE", "LLM"] {
+            cmd.env(
+                format!("BUILTIN_PROBES__{}", name),
+                (name == probe).to_string(),
+            );
+        }
+        let mut child = cmd
+            .spawn()
+            .with_context(|| format!("Failed to start {}", binary.display()))?;
+
+        // Keep draining the log so the agent never blocks on a full pipe
+        let stdout = child.stdout.take().context("Agent stdout not captured")?;
+        let (ready_tx, ready_rx) = mpsc::channel();
+        thread::spawn(move || {
+            for line in BufReader::new(stdout).lines() {
+                let Ok(line) = line else { break };
+                if line.contains(AGENT_READY_MARKER) {
+                    let _ = ready_tx.send(());
+                }
+            }
+        });
+
+        let agent = Self { child };
+        ready_rx
+            .recv_timeout(Duration::from_secs(AGENT_START_TIMEOUT_SECS))
+            .context("Agent did not finish attaching probes")?;
+        Ok(agent)
+    }
+
+    fn cpu_time(&self) -> Result<Duration> {
+        process_cpu_time(&format!("/proc/{}/stat", self.child.id()))
+    }
+}
+
+impl Drop for Agent {
+    fn drop(&mut self) {
+        let _ = Command::new("kill")
+            .args(["-INT", &self.child.id().to_string()])
+            .status();
+        let deadline = Instant::now() + Duration::from_secs(AGENT_STOP_TIMEOUT_SECS);
+        while Instant::now() < deadline {
+            if let Ok(Some(_)) = self.child.try_wait() {
+                return;
+            }
+            thread::sleep(Duration::from_millis(50));
+        }
+        let _ = self.child.kill();
+        let _ = self.child.wait();
+    }
+}
+
+// --- TLS workload ---
+
+/// Loopback HTTPS keep-alive traffic through the system OpenSSL, so the agent's
+/// uprobes fire on both the client and the server side.
+fn run_tls(args: &BenchArgs, mode: Mode) -> Result<Vec<u64>> {
+    let connections = args.connections.max(1);
+    let addr = spawn_tls_server(connections, args.response_size)?;
+
+    let (host, path) = match mode {
+        Mode::Filtered => (OTHER_HOST, OTHER_PATH),
+        _ => (LLM_HOST, LLM_PATH),
+    };
+    let request = Arc::new(http_request(host, path, args.request_size));
+    let per_connection = args.ops.div_ceil(connections);
+    let rate = args.rate as f64 / connections as f64;
+
+    let mut connector = SslConnector::builder(SslMethod::tls())?;
+    connector.set_verify(SslVerifyMode::NONE);
+    let connector = connector.build();
+
+    let clients: Vec<_> = (0..connections)
+        .map(|_| {
+            let connector = connector.clone();
+            let request = request.clone();
+            thread::spawn(move || -> Result<Vec<u64>> {
+                let tcp = TcpStream::connect(addr)?;
+                tcp.set_nodelay(true)?;
+                let mut tls = connector.connect("localhost", tcp)?;
+                let warmup = warmup_ops(per_connection);
+                let mut latencies = Vec::with_capacity(per_connection + warmup);
+                let mut buf = Vec::new();
+                let mut pacer = Pacer::new(rate);
+                for _ in 0..per_connection + warmup {
+                    pacer.wait();
+                    let start = Instant::now();
+                    tls.write_all(&request)?;
+                    if !read_http_message(&mut tls, &mut buf)? {
+                        bail!("Server closed the connection");
+                    }
+                    latencies.push(start.elapsed().as_nanos() as u64);
+                }
+                let _ = tls.shutdown();
+                latencies.drain(..warmup);
+                Ok(latencies)
+            })
+        })
+        .collect();
+
+    let mut latencies = Vec::with_capacity(args.ops);
+    for client in clients {
+        latencies.extend(
+            client
+                .join()
+                .map_err(|_| anyhow::anyhow!("TLS client panicked"))??,
+        );
+    }
+    Ok(latencies)
+}
+
+/// Serve `connections` keep-alive connections, each on its own thread, then stop accepting.
+fn spawn_tls_server(connections: usize, response_size: usize) -> Result<SocketAddr> {
+    let (key, cert) = self_signed_cert()?;
+    let mut acceptor = SslAcceptor::mozilla_intermediate_v5(SslMethod::tls())?;
+    acceptor.set_private_key(&key)?;
+    acceptor.set_certificate(&cert)?;
+    let acceptor = acceptor.build();
+
+    let listener = TcpListener::bind("127.0.0.1:0")?;
+    let addr = listener.local_addr()?;
+    let response = Arc::new(http_response(response_size));
+
+    thread::spawn(move || {
+        for stream in listener.incoming().take(connections) {
+            let Ok(stream) = stream else { continue };
+            let acceptor = acceptor.clone();
+            let response = response.clone();
+            thread::spawn(move || {
+                let _ = stream.set_nodelay(true);
+                let Ok(mut tls) = acceptor.accept(stream) else {
+                    return;
+                };
+                let mut buf = Vec::new();
+                while let Ok(true) = read_http_message(&mut tls, &mut buf) {
+                    if tls.write_all(&response).is_err() {
+                        return;
+                    }
+                }
+            });
+        }
+    });
+    Ok(addr)
+}
+
+fn self_signed_cert() -> Result<(PKey<Private>, X509)> {
+    let group = EcGroup::from_curve_name(Nid::X9_62_PRIME256V1)?;
+    let key = PKey::from_ec_key(EcKey::generate(&group)?)?;
+
+    let mut name = X509NameBuilder::new()?;
+    name.append_entry_by_text("CN", "localhost")?;
+    let name = name.build();
+
+    let mut cert = X509::builder()?;
+    cert.set_version(2)?;
+    cert.set_subject_name(&name)?;
+    cert.set_issuer_name(&name)?;
+    cert.set_pubkey(&key)?;
+    cert.set_not_before(Asn1Time::days_from_now(0)?.as_ref())?;
+    cert.set_not_after(Asn1Time::days_from_now(1)?.as_ref())?;
+    cert.sign(&key, MessageDigest::sha256())?;
+    Ok((key, cert.build()))
+}
+
+/// Chat completion request padded to a `body_size` byte body.
+fn http_request(host: &str, path: &str, body_size: usize) -> Vec<u8> {
+    let body = padded_json(
+        r#"{"model":"gpt-4o-mini","messages":[{"role":"user","content":""#,
+        r#""}]}"#,
+        body_size,
+    );
+    let mut request = format!(
+        "POST {} HTTP/1.1\r\nHost: {}\r\nContent-Type: application/json\r\nContent-Length: {}\r\n\r\n",
+        path,
+        host,
+        body.len()
+    )
+    .into_bytes();
+    request.extend_from_slice(body.as_bytes());
+    request
+}
+
+/// Chat completion response with usage, padded to a `body_size` byte body.
+fn http_response(body_size: usize) -> Vec<u8> {
+    let body = padded_json(
+        r#"{"id":"chatcmpl-bench","object":"chat.completion","model":"gpt-4o-mini","choices":[{"index":0,"message":{"role":"assistant","content":""#,
+        r#""},"finish_reason":"stop"}],"usage":{"prompt_tokens":256,"completion_tokens":1024,"total_tokens":1280}}"#,
+        body_size,
+    );
+    let mut response = format!(
+        "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: {}\r\n\r\n",
+        body.len()
+    )
+    .into_bytes();
+    response.extend_from_slice(body.as_bytes());
+    response
+}
+
+fn padded_json(prefix: &str, suffix: &str, size: usize) -> String {
+    let pad = size.saturating_sub(prefix.len() + suffix.len());
+    format!("{}{}{}", prefix, "a".repeat(pad), suffix)
+}
+
+/// Read one Content-Length framed HTTP/1.1 message into `buf`. Returns false on EOF
+/// before the first byte.
+fn read_http_message(stream: &mut impl Read, buf: &mut Vec<u8>) -> Result<bool> {
+    buf.clear();
+    let mut chunk = [0u8; 16 * 1024];
+    loop {
+        if let Some(end) = buf.windows(4).position(|w| w == b"\r\n\r\n") {
+            let total = end + 4 + content_length(&buf[..end]);
+            while buf.len() < total {
+                let n = stream.read(&mut chunk)?;
+                if n == 0 {
+                    bail!("Connection closed mid-message");
+                }
+                buf.extend_from_slice(&chunk[..n]);
+            }
+            return Ok(true);
+        }
+        let n = stream.read(&mut chunk)?;
+        if n == 0 {
+            if buf.is_empty() {
+                return Ok(false);
+            }
+            bail!("Connection closed mid-headers");
+        }
+        buf.extend_from_slice(&chunk[..n]);
+    }
+}
+
+fn content_length(headers: &[u8]) -> usize {
+    String::from_utf8_lossy(headers)
+        .lines()
+        .find_map(|line| {
+            let (name, value) = line.split_once(':')?;
+            name.eq_ignore_ascii_case("content-length")
+                .then(|| value.trim().parse().ok())?
+        })
+        .unwrap_or(0)
+}
+
+// --- Block I/O workload ---
+
+/// fio-style random synced writes: `pwrite` of one block at a random aligned offset
+/// followed by `fdatasync`, so every operation reaches the block layer.
+fn run_block_io(args: &BenchArgs) -> Result<Vec<u64>> {
+    let dir = args
+        .dir
+        .clone()
+        .unwrap_or_else(|| super::project_root().join("target/bench"));
+    fs::create_dir_all(&dir)?;
+    let path = dir.join("block_io.dat");
+    let block_size = args.block_size.max(512);
+    let blocks = (args.file_size_mb * 1024 * 1024 / block_size as u64).max(1);
+
+    let file = OpenOptions::new()
+        .create(true)
+        .truncate(true)
+        .read(true)
+        .write(true)
+        .open(&path)
+        .with_context(|| format!("Failed to create {}", path.display()))?;
+    preallocate(&file, blocks, block_size)?;
+
+    let buf = vec![0xa5u8; block_size];
+    let mut rng = 0x2545_f491_4f6c_dd1du64;
+    let warmup = warmup_ops(args.ops);
+    let mut latencies = Vec::with_capacity(args.ops + warmup);
+    let mut pacer = Pacer::new(args.rate as f64);
+    for _ in 0..args.ops + warmup {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        let offset = (rng % blocks) * block_size as u64;
+        pacer.wait();
+        let start = Instant::now();
+        file.write_at(&buf, offset)?;
+        file.sync_data()?;
+        latencies.push(start.elapsed().as_nanos() as u64);
+    }
+
+    drop(file);
+    let _ = fs::remove_file(&path);
+    latencies.drain(..warmup);
+    Ok(latencies)
+}
+
+/// Write the whole file once so measured writes overwrite allocated blocks.
+fn preallocate(file: &File, blocks: u64, block_size: usize) -> Result<()> {
+    let zeros = vec![0u8; block_size * 256];
+    let mut remaining = blocks * block_size as u64;
+    let mut writer = file;
+    while remaining > 0 {
+        let n = remaining.min(zeros.len() as u64) as usize;
+        writer.write_all(&zeros[..n])?;
+        remaining -= n as u64;
+    }
+    file.sync_all()?;
+    Ok(())
+}
+
+// --- GPU workload ---
+
+/// A `/dev/nvidiaN` symlink to `/dev/null`: opening it looks like a GPU open to the
+/// probe, which matches on the path, while needing no driver.
+struct FakeGpuNode {
+    path: PathBuf,
+}
+
+impl FakeGpuNode {
+    fn create() -> Result<Self> {
+        for index in FAKE_GPU_FIRST_INDEX..FAKE_GPU_FIRST_INDEX + 64 {
+            let path = PathBuf::from(format!("/dev/nvidia{}", index));
+            if path.symlink_metadata().is_err() {
+                symlink("/dev/null", &path)
+                    .with_context(|| format!("Failed to create {}", path.display()))?;
+                return Ok(Self { path });
+            }
+        }
+        bail!("No free /dev/nvidiaN index for a fake GPU node")
+    }
+}
+
+impl Drop for FakeGpuNode {
+    fn drop(&mut self) {
+        let _ = fs::remove_file(&self.path);
+    }
+}
+
+/// open/close loop on a fake GPU node; the filtered run opens `/dev/null`, which the
+/// openat tracepoint sees and rejects by path.
+fn run_gpu(args: &BenchArgs, mode: Mode) -> Result<Vec<u64>> {
+    let node = FakeGpuNode::create()?;
+    let path = match mode {
+        Mode::Filtered => Path::new("/dev/null"),
+        _ => node.path.as_path(),
+    };
+
+    let warmup = warmup_ops(args.ops);
+    let mut latencies = Vec::with_capacity(args.ops + warmup);
+    let mut pacer = Pacer::new(args.rate as f64);
+    for _ in 0..args.ops + warmup {
+        pacer.wait();
+        let start = Instant::now();
+        drop(File::open(path)?);
+        latencies.push(start.elapsed().as_nanos() as u64);
+    }
+    latencies.drain(..warmup);
+    Ok(latencies)
+}
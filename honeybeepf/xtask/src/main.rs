@@ -7,6 +7,8 @@ use std::{
 use anyhow::{Context, Result, bail};
 use clap::{Parser, Subcommand};
 
+mod bench;
+
 #[derive(Parser)]
 #[command(name = "xtask")]
 #[command(about = "Build and deploy honeybeepf")]
@@ -72,6 +74,9 @@ enum Commands {
         #[arg(long, default_value = "dist")]
         output: String,
     },
+
+    /// Measure probe overhead on local TLS, block I/O and GPU workloads (run as root)
+    Bench(bench::BenchArgs),
 }
 
 fn main() -> Result<()> {
@@ -96,6 +101,9 @@ fn main() -> Result<()> {
         Commands::Package { target, output } => {
             package(target.as_deref(), &output)?;
         }
+        Commands::Bench(args) => {
+            bench::bench(args)?;
+        }
     }
 
     Ok(())